@@ -5,10 +5,11 @@
 //--------------------------------------------------------------------------------------
 Texture2D DiffuseSpecularMap : register(t0);
 
-Texture2D ShadowMap[15]      : register(t10);
+Texture2D ShadowAtlas        : register(t10);
 
 SamplerState TexSampler      : register(s0);
 SamplerState PointClamp      : register(s1);
+SamplerComparisonState ShadowSampler : register(s2);
 
 //--------------------------------------------------------------------------------------
 // Shader code
@@ -21,7 +22,7 @@ float4 main(LightingPixelShaderInput input) : SV_Target
 	// Calculate lighting
 	float3 diffuseLight;
 	float3 specularLight;
-	CalculateLighting(ShadowMap, input.worldPosition, input.worldNormal, PointClamp, diffuseLight, specularLight, ShadowMap);
+	CalculateLighting(ShadowAtlas, input.worldPosition, input.worldNormal, input.lightProjections, PointClamp, ShadowSampler, diffuseLight, specularLight, ShadowAtlas);
 
 	////////////////////
 	// Combine lighting and textures
@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------------
+// Render command stream
+//--------------------------------------------------------------------------------------
+
+#include "CommandStream.h"
+
+#include <cstring>
+
+
+//--------------------------------------------------------------------------------------
+// Writing commands
+//--------------------------------------------------------------------------------------
+
+// Reserve space for a command with the given amount of extra data, returns pointer to the command structure
+void* CommandStream::AddCommand(RenderCommand type, size_t commandSize, size_t extraSize /*= 0*/)
+{
+    // Round up to a multiple of 8 bytes so the next command's pointers are aligned
+    size_t size = (sizeof(CommandHeader) + commandSize + extraSize + 7) & ~size_t(7);
+
+    size_t offset = mData.size();
+    mData.resize(offset + size);
+    ++mNumCommands;
+
+    auto header = reinterpret_cast<CommandHeader*>(mData.data() + offset);
+    header->type = static_cast<uint32_t>(type);
+    header->size = static_cast<uint32_t>(size);
+    return header + 1;
+}
+
+
+void CommandStream::SetPipeline(const PipelineState* pipeline)
+{
+    auto command = static_cast<PipelineCommand*>(AddCommand(RenderCommand::SetPipeline, sizeof(PipelineCommand)));
+    command->pipeline = pipeline;
+}
+
+void CommandStream::SetRenderTargets(ID3D11RenderTargetView* renderTarget, ID3D11DepthStencilView* depthStencil)
+{
+    auto command = static_cast<RenderTargetsCommand*>(AddCommand(RenderCommand::SetRenderTargets, sizeof(RenderTargetsCommand)));
+    command->renderTarget = renderTarget;
+    command->depthStencil = depthStencil;
+}
+
+void CommandStream::SetViewport(float width, float height, float left, float top)
+{
+    auto command = static_cast<ViewportCommand*>(AddCommand(RenderCommand::SetViewport, sizeof(ViewportCommand)));
+    command->width  = width;
+    command->height = height;
+    command->left   = left;
+    command->top    = top;
+}
+
+void CommandStream::ClearRenderTarget(ID3D11RenderTargetView* renderTarget, const float colour[4])
+{
+    auto command = static_cast<ClearRenderTargetCommand*>(AddCommand(RenderCommand::ClearRenderTarget, sizeof(ClearRenderTargetCommand)));
+    command->renderTarget = renderTarget;
+    std::memcpy(command->colour, colour, sizeof(command->colour));
+}
+
+void CommandStream::ClearDepth(ID3D11DepthStencilView* depthStencil, float depth /*= 1.0f*/)
+{
+    auto command = static_cast<ClearDepthCommand*>(AddCommand(RenderCommand::ClearDepth, sizeof(ClearDepthCommand)));
+    command->depthStencil = depthStencil;
+    command->depth        = depth;
+}
+
+void CommandStream::BindTextures(uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* textures)
+{
+    size_t listSize = count * sizeof(ID3D11ShaderResourceView*);
+    auto command = static_cast<TexturesCommand*>(AddCommand(RenderCommand::BindTextures, sizeof(TexturesCommand), listSize));
+    command->slot  = slot;
+    command->count = count;
+    std::memcpy(command + 1, textures, listSize);
+}
+
+void CommandStream::BindSampler(uint32_t slot, ID3D11SamplerState* sampler)
+{
+    auto command = static_cast<SamplerCommand*>(AddCommand(RenderCommand::BindSampler, sizeof(SamplerCommand)));
+    command->slot    = slot;
+    command->sampler = sampler;
+}
+
+void CommandStream::BindConstantBuffer(uint32_t slot, ID3D11Buffer* buffer)
+{
+    auto command = static_cast<ConstantBufferCommand*>(AddCommand(RenderCommand::BindConstantBuffer, sizeof(ConstantBufferCommand)));
+    command->slot   = slot;
+    command->buffer = buffer;
+}
+
+void CommandStream::UpdateConstants(ID3D11Buffer* buffer, const void* data, uint32_t size)
+{
+    auto command = static_cast<UpdateConstantsCommand*>(AddCommand(RenderCommand::UpdateConstants, sizeof(UpdateConstantsCommand), size));
+    command->buffer = buffer;
+    command->size   = size;
+    std::memcpy(command + 1, data, size);
+}
+
+void CommandStream::SetGeometry(const GeometryCommand& geometry)
+{
+    auto command = static_cast<GeometryCommand*>(AddCommand(RenderCommand::SetGeometry, sizeof(GeometryCommand)));
+    *command = geometry;
+}
+
+void CommandStream::DrawIndexed(uint32_t indexCount, uint32_t startIndex /*= 0*/, int32_t baseVertex /*= 0*/)
+{
+    auto command = static_cast<DrawCommand*>(AddCommand(RenderCommand::DrawIndexed, sizeof(DrawCommand)));
+    command->indexCount = indexCount;
+    command->startIndex = startIndex;
+    command->baseVertex = baseVertex;
+}
+
+void CommandStream::DrawGenerated(uint32_t vertexCount)
+{
+    auto command = static_cast<DrawGeneratedCommand*>(AddCommand(RenderCommand::DrawGenerated, sizeof(DrawGeneratedCommand)));
+    command->vertexCount = vertexCount;
+}
+
+void CommandStream::CopyTexture(ID3D11Resource* destination, ID3D11Resource* source)
+{
+    auto command = static_cast<CopyTextureCommand*>(AddCommand(RenderCommand::CopyTexture, sizeof(CopyTextureCommand)));
+    command->destination = destination;
+    command->source      = source;
+}
+
+void CommandStream::Timestamp(ID3D11Query* query)
+{
+    auto command = static_cast<TimestampCommand*>(AddCommand(RenderCommand::Timestamp, sizeof(TimestampCommand)));
+    command->query = query;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Reading commands
+//--------------------------------------------------------------------------------------
+
+// Move to the next command, returns false at the end of the stream
+bool CommandStream::Reader::Next()
+{
+    if (mNextOffset >= mStream.mData.size())  return false;
+
+    mHeader = reinterpret_cast<const CommandHeader*>(mStream.mData.data() + mNextOffset);
+    mNextOffset += mHeader->size;
+    return true;
+}
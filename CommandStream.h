@@ -0,0 +1,265 @@
+//--------------------------------------------------------------------------------------
+// Render command stream
+//--------------------------------------------------------------------------------------
+// Scene code describes what it wants drawn as a compact list of commands rather than calling
+// Direct3D directly. A backend then consumes the stream: D3D11Backend sends it to the GPU and
+// NullBackend replays it without a GPU to count and check the commands. This allows the CPU
+// side of a frame to be run and profiled on a machine without Direct3D.
+//
+// This file doesn't include any Direct3D headers. GPU objects are only referred to by pointer,
+// the null backend never looks inside them.
+
+#ifndef _COMMAND_STREAM_H_INCLUDED_
+#define _COMMAND_STREAM_H_INCLUDED_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// GPU object types referred to in commands (declared in d3d11.h)
+struct ID3D11SamplerState;
+struct ID3D11ShaderResourceView;
+struct ID3D11RenderTargetView;
+struct ID3D11DepthStencilView;
+struct ID3D11InputLayout;
+struct ID3D11Buffer;
+struct ID3D11Resource;
+struct ID3D11Query;
+
+class PipelineState; // PipelineState.h
+
+
+//--------------------------------------------------------------------------------------
+// Commands
+//--------------------------------------------------------------------------------------
+
+enum class RenderCommand : uint32_t
+{
+    SetPipeline,
+    SetRenderTargets,
+    SetViewport,
+    ClearRenderTarget,
+    ClearDepth,
+    BindTextures,
+    BindSampler,
+    BindConstantBuffer,
+    UpdateConstants,
+    SetGeometry,
+    DrawIndexed,
+    DrawGenerated,
+    CopyTexture,
+    Timestamp,
+
+    NumCommands
+};
+
+// Shaders, fixed-function states and texture sampler used by following draws
+struct PipelineCommand
+{
+    const PipelineState* pipeline;
+};
+
+// Render target can be nullptr to only render depth
+struct RenderTargetsCommand
+{
+    ID3D11RenderTargetView* renderTarget;
+    ID3D11DepthStencilView* depthStencil;
+};
+
+// Viewport covers the full 0->1 depth range. The top-left is only moved from 0,0 to render into part of a texture (e.g. a shadow atlas)
+struct ViewportCommand
+{
+    float width;
+    float height;
+    float left;
+    float top;
+};
+
+struct ClearRenderTargetCommand
+{
+    ID3D11RenderTargetView* renderTarget;
+    float                   colour[4];
+};
+
+struct ClearDepthCommand
+{
+    ID3D11DepthStencilView* depthStencil;
+    float                   depth;
+};
+
+// Pixel shader textures, followed in the stream by "count" shader resource view pointers
+struct TexturesCommand
+{
+    uint32_t slot;
+    uint32_t count;
+};
+
+// Pixel shader sampler
+struct SamplerCommand
+{
+    uint32_t            slot;
+    ID3D11SamplerState* sampler;
+};
+
+// Constant buffers are bound to both the vertex and pixel shader
+struct ConstantBufferCommand
+{
+    uint32_t      slot;
+    ID3D11Buffer* buffer;
+};
+
+// Replace the whole content of a dynamic constant buffer, followed in the stream by "size" bytes of data
+struct UpdateConstantsCommand
+{
+    ID3D11Buffer* buffer;
+    uint32_t      size;
+};
+
+// Vertex and index buffers (triangle lists only)
+struct GeometryCommand
+{
+    ID3D11InputLayout* vertexLayout;
+    ID3D11Buffer*      vertexBuffer;
+    uint32_t           vertexSize;
+    ID3D11Buffer*      indexBuffer;
+    uint32_t           indexSize;  // 2 or 4 bytes
+};
+
+struct DrawCommand
+{
+    uint32_t indexCount;
+    uint32_t startIndex;
+    int32_t  baseVertex;
+};
+
+// Draw without any geometry, the vertex shader generates positions from SV_VertexID (e.g. a full screen triangle)
+struct DrawGeneratedCommand
+{
+    uint32_t vertexCount;
+};
+
+// Copy the whole of one texture to another of the same size and format
+struct CopyTextureCommand
+{
+    ID3D11Resource* destination;
+    ID3D11Resource* source;
+};
+
+// Write the GPU's clock to a timestamp query when the GPU reaches this point (see GpuTimer.h)
+struct TimestampCommand
+{
+    ID3D11Query* query;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Command stream
+//--------------------------------------------------------------------------------------
+
+// Start of each command in the stream
+struct CommandHeader
+{
+    uint32_t type; // RenderCommand
+    uint32_t size; // Total size of the command in bytes including this header and any padding
+};
+
+// Commands are packed one after another into a block of bytes: an 8 byte header giving the command type
+// and size, then the command structure, then any extra data (texture list, constant buffer content).
+// Each command is padded to 8 bytes so the structures can be read in place.
+class CommandStream
+{
+public:
+    // Remove all commands but keep the memory for reuse
+    void Clear()  { mData.clear(); mNumCommands = 0; }
+
+    //-------------------------------------
+    // Writing commands
+    //-------------------------------------
+
+    void SetPipeline(const PipelineState* pipeline);
+    void SetRenderTargets(ID3D11RenderTargetView* renderTarget, ID3D11DepthStencilView* depthStencil);
+    void SetViewport(float width, float height, float left = 0.0f, float top = 0.0f);
+    void ClearRenderTarget(ID3D11RenderTargetView* renderTarget, const float colour[4]);
+    void ClearDepth(ID3D11DepthStencilView* depthStencil, float depth = 1.0f);
+    void BindTextures(uint32_t slot, uint32_t count, ID3D11ShaderResourceView* const* textures);
+    void BindTexture(uint32_t slot, ID3D11ShaderResourceView* texture)  { BindTextures(slot, 1, &texture); }
+    void BindSampler(uint32_t slot, ID3D11SamplerState* sampler);
+    void BindConstantBuffer(uint32_t slot, ID3D11Buffer* buffer);
+    void UpdateConstants(ID3D11Buffer* buffer, const void* data, uint32_t size);
+    void SetGeometry(const GeometryCommand& geometry);
+    void DrawIndexed(uint32_t indexCount, uint32_t startIndex = 0, int32_t baseVertex = 0);
+    void DrawGenerated(uint32_t vertexCount);
+    void CopyTexture(ID3D11Resource* destination, ID3D11Resource* source);
+    void Timestamp(ID3D11Query* query);
+
+    // Copy a C++ constant buffer structure into the stream
+    template <class T>
+    void UpdateConstants(ID3D11Buffer* buffer, const T& data)
+    {
+        UpdateConstants(buffer, &data, static_cast<uint32_t>(sizeof(T)));
+    }
+
+
+    //-------------------------------------
+    // Reading commands
+    //-------------------------------------
+
+    // Steps through the commands in a stream in order, e.g.
+    //     CommandStream::Reader reader(stream);
+    //     while (reader.Next())  if (reader.Type() == RenderCommand::DrawIndexed) ... reader.Get<DrawCommand>() ...
+    class Reader
+    {
+    public:
+        Reader(const CommandStream& stream) : mStream(stream) {}
+
+        // Move to the next command, returns false at the end of the stream
+        bool Next();
+
+        RenderCommand Type()  { return static_cast<RenderCommand>(mHeader->type); }
+
+        // The command structure, T must match Type()
+        template <class T>
+        const T& Get()  { return *reinterpret_cast<const T*>(mHeader + 1); }
+
+        // Extra data after the command structure (texture list or constant buffer content)
+        template <class T>
+        const void* Extra()  { return reinterpret_cast<const uint8_t*>(mHeader + 1) + sizeof(T); }
+
+    private:
+        const CommandStream& mStream;
+        const CommandHeader* mHeader = nullptr;
+        size_t               mNextOffset = 0;
+    };
+
+
+    //-------------------------------------
+    // Data access
+    //-------------------------------------
+
+    size_t NumCommands()  const { return mNumCommands; }
+    size_t SizeInBytes()  const { return mData.size(); }
+
+private:
+    // Reserve space for a command with the given amount of extra data, returns pointer to the command structure
+    void* AddCommand(RenderCommand type, size_t commandSize, size_t extraSize = 0);
+
+    std::vector<uint8_t> mData;
+    size_t               mNumCommands = 0;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Backend interface
+//--------------------------------------------------------------------------------------
+// Something that consumes command streams, e.g. sends them to the GPU
+class RenderBackend
+{
+public:
+    virtual ~RenderBackend() {}
+
+    // Process all commands in the stream in order
+    virtual void Execute(const CommandStream& commands) = 0;
+};
+
+
+#endif //_COMMAND_STREAM_H_INCLUDED_
@@ -7,6 +7,7 @@
 #include <windows.h>
 #include <d3d11.h>
 #include <string>
+#include <cstdint>
 
 #include "CVector3.h"
 #include "CMatrix4x4.h"
@@ -47,23 +48,43 @@ extern std::string gLastError;
 struct SpotlightBuffer
 {
     CVector3   position; // 3 floats: x, y z
-    float    isSpot;       
+    float    padding1;
     CVector3   colour;
     float    padding2;
     CVector3   facing;           // Spotlight facing direction (normal)
     float    cosHalfAngle;     // cos(Spot light cone angle / 2). Precalculate in C++ the spotlight angle in this form to save doing in the shader
-    CMatrix4x4 viewMatrix;       // For shadow mapping we treat lights like cameras so we need camera matrices for them (prepared on the C++ side)
-    CMatrix4x4 projectionMatrix; // --"--
+    float    shadowAtlasRect[4]; // Light's region of the shadow atlas (see ShadowAtlas.h) in texture coordinates: left, top, width, height
+    CMatrix4x4 viewProjectionMatrix; // For shadow mapping we treat lights like cameras, view and projection matrices combined here rather than in the shaders
 };
 
+// Directional light, like the sun, with cascaded shadow maps (see ShadowCascades.h)
+struct DirectionalLightBuffer
+{
+    CVector3   direction;                // Direction the light travels (normal)
+    float      numCascades;              // Zero if there is no directional light
+    CVector3   colour;
+    float      padding;
+    CMatrix4x4 cascadeViewProjection[4]; // Camera-like matrices for each cascade, view and projection combined
+    float      cascadeRects[4][4];       // Each cascade's region of the shadow atlas, like SpotlightBuffer::shadowAtlasRect
+};
+
+// Point lights are sent in a structured buffer rather than the per-frame constants, so there can be any number of them
+// The shaders only use the lights in each pixel's cluster (see LightClusters.h)
 struct PointlightBuffer
 {
     CVector3   position; // 3 floats: x, y z
-    float    padding;        // Pad above variable to float4 (HLSL requirement - copied in the the C++ version of this structure)
-    CVector3   colour;
+    float    radius;         // Influence radius, the light has no effect on anything further away (see Light.h)
+    CVector3   colour;           // Intensity of the light, its colour scaled for inverse-square falloff
     float    padding2;
 };
 
+// Sphere containing something, e.g. a mesh or the area a light can reach
+struct BoundingSphere
+{
+    CVector3 centre;
+    float    radius;
+};
+
 //--------------------------------------------------------------------------------------
 // Constant Buffers
 //--------------------------------------------------------------------------------------
@@ -80,14 +101,19 @@ struct PerFrameConstants
     CMatrix4x4 viewProjectionMatrix; // The above two matrices multiplied together to combine their effects
 
     float spotlightNumber;
-    CVector3 padding;
+    float shadowAtlasTexelSize; // 1 / width of the shadow atlas, for shadow filtering
+    float padding[2];
 
     SpotlightBuffer spotlights[15];
 
-    float pointlightNumber;
-    CVector3 padding2;
+    DirectionalLightBuffer directionalLight;
 
-    PointlightBuffer pointlights[25];
+    // Clustered point lights (see LightClusters.h)
+    CVector3 clusterTiles;      // Number of tiles across and down the screen, and number of depth slices
+    float    clusterDepthScale; // Depth slice = log(view depth) * scale + bias
+    float    clusterDepthBias;
+    float    useObjectLights;   // 1 to use each model's own light list (see ObjectLights.h) instead of the clusters
+    float    padding2[2];
 
     CVector3   ambientColour;
     float      specularPower;
@@ -111,6 +137,17 @@ struct PerModelConstants
     CMatrix4x4 worldMatrix;
     CVector3   objectColour; // Allows each light model to be tinted to match the light colour they cast
     float      padding6;
+
+    // Most influential point lights for this model, used when the per-frame useObjectLights is set (see ObjectLights.h)
+    float      numObjectLights;
+    CVector3   padding7;
+    uint32_t   objectLights[8];  // Indexes into the point light buffer. Seen as uint4[2] by the shaders
+
+    // Decoding the vertices of compressed meshes (see MeshOptimiser.h). Model space position = position * scale + offset
+    CVector3   positionScale;
+    float      octahedralNormals; // Non-zero if normals and tangents are packed with the octahedral mapping
+    CVector3   positionOffset;
+    float      padding8;
 };
 extern PerModelConstants gPerModelConstants;      // This variable holds the CPU-side constant buffer described above
 extern ID3D11Buffer*     gPerModelConstantBuffer; // This variable controls the GPU-side constant buffer related to the above structure
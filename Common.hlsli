@@ -17,6 +17,11 @@ struct BasicVertex
 };
 
 
+// The most important spotlights (the per-frame constants list them first) have their shadow map positions calculated in the
+// vertex shader and interpolated, rather than in the pixel shader for every pixel. Projecting is linear in the world position
+// so the interpolated result is exact. Limited by the number of values that can be passed between the shaders
+#define NUM_VERTEX_SHADOW_LIGHTS 4
+
 // This structure describes what data the lighting pixel shader receives from the vertex shader.
 // The projected position is a required output from all vertex shaders - where the vertex is on the screen
 // The world position and normal at the vertex are sent to the pixel shader for the lighting equations.
@@ -33,6 +38,8 @@ struct LightingPixelShaderInput
                                             // its position and normal in the world - required for lighting equations
     
     float2 uv : uv; // UVs are texture coordinates. The artist specifies for every vertex which point on the texture is "pinned" to that vertex.
+
+    float4 lightProjections[NUM_VERTEX_SHADOW_LIGHTS] : lightProjection; // Position as seen from the first spotlights, see above
 };
 
 struct TangentVertex
@@ -54,6 +61,8 @@ struct NormalMappingPixelShaderInput
     float3 modelTangent  : modelTangent;  // --"--
 
     float2 uv : uv; // UVs are texture coordinates. The artist specifies for every vertex which point on the texture is "pinned" to that vertex.
+
+    float4 lightProjections[NUM_VERTEX_SHADOW_LIGHTS] : lightProjection; // Position as seen from the first spotlights, see above
 };
 
 // This structure is similar to the one above but for the light models, which aren't themselves lit
@@ -66,20 +75,31 @@ struct SimplePixelShaderInput
 struct Spotlight
 {
     float3   position; // 3 floats: x, y z
-    float    isSpot;
+    float    padding1;
     float3   colour;
     float    padding2;
     float3   facing;           // Spotlight facing direction (normal)
     float    cosHalfAngle;     // cos(Spot light cone angle / 2). Precalculate in C++ the spotlight angle in this form to save doing in the shader
-    float4x4 viewMatrix;       // For shadow mapping we treat lights like cameras so we need camera matrices for them (prepared on the C++ side)
-    float4x4 projectionMatrix; // --"--
+    float4   shadowAtlasRect;  // Light's region of the shadow atlas in texture coordinates: left, top, width, height
+    float4x4 viewProjectionMatrix; // For shadow mapping we treat lights like cameras, view and projection matrices combined on the C++ side
+};
+
+// Directional light, like the sun, with cascaded shadow maps
+struct DirectionalLight
+{
+    float3   direction;                // Direction the light travels (normal)
+    float    numCascades;              // Zero if there is no directional light
+    float3   colour;
+    float    padding;
+    float4x4 cascadeViewProjection[4]; // Camera-like matrices for each cascade, view and projection combined
+    float4   cascadeRects[4];          // Each cascade's region of the shadow atlas: left, top, width, height
 };
 
 struct Pointlight
 {
     float3   position; // 3 floats: x, y z
-    float    padding;        // Pad above variable to float4 (HLSL requirement - copied in the the C++ version of this structure)
-    float3   colour;
+    float    radius;         // Influence radius, the light has no effect on anything further away
+    float3   colour;           // Intensity of the light, its colour scaled for inverse-square falloff
     float    padding2;
 };
 
@@ -100,13 +120,17 @@ cbuffer PerFrameConstants : register(b0) // The b0 gives this constant buffer th
     float4x4 gViewProjectionMatrix; // The above two matrices multiplied together to combine their effects
 
     float gSpotlightNumber;
-    float3 pad;
+    float  gShadowAtlasTexelSize; // 1 / width of the shadow atlas, for shadow filtering
+    float2 pad;
     Spotlight gSpotlights[15];
 
+    DirectionalLight gDirectionalLight;
 
-    float gPointlightNumber;
-    float3 pad2;
-    Pointlight gPointlights[25];
+    float3 gClusterTiles;      // Number of tiles across and down the screen, and number of depth slices
+    float  gClusterDepthScale; // Depth slice = log(view depth) * scale + bias
+    float  gClusterDepthBias;
+    float  gUseObjectLights;   // 1 to use each model's own light list instead of the clusters
+    float2 pad2;
 
     float3   gAmbientColour;
     float    gSpecularPower;
@@ -131,51 +155,196 @@ cbuffer PerModelConstants : register(b1) // The b1 gives this constant buffer th
 
     float3   gObjectColour;
     float    padding6;  // See notes on padding in structure above
+
+    float    gNumObjectLights;  // Most influential point lights for this model, used when gUseObjectLights is set
+    float3   padding7;
+    uint4    gObjectLights[2];  // Indexes into gPointlights, 4 in each element
+
+    // Decoding the vertices of compressed meshes, see ModelPosition and ModelNormal below
+    float3   gPositionScale;
+    float    gOctahedralNormals;
+    float3   gPositionOffset;
+    float    padding8;
 } 
 
-float ShadowMapSample(Texture2D map, SamplerState PointClamp, float2 uv, float compare)
-{   float2 offset;
+
+// Model space position of a vertex. Compressed meshes store positions scaled to their bounding box, other meshes have a
+// scale of 1 and offset of 0
+float3 ModelPosition(float3 position)
+{
+    return position * gPositionScale + gPositionOffset;
+}
+
+// Model space normal or tangent of a vertex. Compressed meshes fold them onto an octahedron and store just x and y
+float3 ModelNormal(float3 normal)
+{
+    if (gOctahedralNormals == 0)  return normal;
+
+    float3 unfolded = float3(normal.xy, 1 - abs(normal.x) - abs(normal.y));
+    if (unfolded.z < 0)  unfolded.xy = (1 - abs(unfolded.yx)) * (unfolded.xy >= 0 ? 1 : -1);
+    return normalize(unfolded);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Point lights
+//--------------------------------------------------------------------------------------
+// The view frustum is split into a grid of clusters and the C++ code lists the point lights touching each one
+// (see LightClusters.h). Each pixel only loops over the lights in its own cluster. Alternatively each model can
+// be given a short list of its most influential lights in the per-model constants (see ObjectLights.h)
+
+StructuredBuffer<Pointlight> gPointlights      : register(t60); // Every point light in the scene
+StructuredBuffer<uint2>      gLightClusters    : register(t61); // For each cluster the offset and count of its lights in the list below
+StructuredBuffer<uint>       gClusterLightList : register(t62); // Indexes into gPointlights
+
+// Find the offset and count of the lights in the cluster containing the given world position
+uint2 GetLightCluster(float3 worldPosition)
+{
+    // Screen position (0 to 1, top row of tiles first) and view depth select the cluster, same as the C++ code
+    float4 viewPosition = mul(gViewMatrix, float4(worldPosition, 1.0f));
+    float4 projection   = mul(gProjectionMatrix, viewPosition);
+    float2 screen = float2(projection.x, -projection.y) / projection.w * 0.5f + 0.5f;
+
+    int3 cluster;
+    cluster.xy = int2(floor(screen * gClusterTiles.xy));
+    cluster.z  = int(floor(log(viewPosition.z) * gClusterDepthScale + gClusterDepthBias));
+    cluster = clamp(cluster, int3(0, 0, 0), int3(gClusterTiles) - 1);
+
+    return gLightClusters[cluster.x + (cluster.y + cluster.z * int(gClusterTiles.y)) * int(gClusterTiles.x)];
+}
+
+
+// Point light falloff with distance - inverse square, like real lights, smoothly brought down to zero at the light's
+// influence radius so there is no visible edge where the light stops. Also stops the light blowing up very close to it
+float PointlightAttenuation(float distance, float radius)
+{
+    float ratio = distance / radius;
+    float window = saturate(1.0f - ratio * ratio * ratio * ratio);
+    return window * window / max(distance * distance, 0.01f);
+}
+
+
+// Add the light from one point light to the diffuse and specular light at a pixel
+void AddPointlight(Pointlight light, float3 worldPosition, float3 worldNormal, float3 cameraDirection,
+                   inout float3 diffuseLight, inout float3 specularLight)
+{
+    float lightDist = length(light.position - worldPosition);
+    if (lightDist < light.radius)
+    {
+        float3 lightDirection = (light.position - worldPosition) / lightDist;
+        diffuseLight += light.colour * max(dot(worldNormal, lightDirection), 0) * PointlightAttenuation(lightDist, light.radius);
+        float3 halfway = normalize(lightDirection + cameraDirection);
+        specularLight += diffuseLight * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
+    }
+}
+
+
+// Position of a vertex as seen from each of the first spotlights (projected but not divided by w), for the lighting pixel shaders
+void CalculateLightProjections(float4 worldPosition, out float4 lightProjections[NUM_VERTEX_SHADOW_LIGHTS])
+{
+    [unroll] for (int i = 0; i < NUM_VERTEX_SHADOW_LIGHTS; i++)
+    {
+        lightProjections[i] = (i < gSpotlightNumber) ? mul(gSpotlights[i].viewProjectionMatrix, worldPosition) : float4(0, 0, 0, 1);
+    }
+}
+
+
+// All the lights' shadow maps share one texture, the shadow atlas (see ShadowAtlas.h). Each light has a square region given
+// by its shadowAtlasRect (left, top, width, height). Convert texture coordinates for a light's own shadow map to the atlas
+float2 ShadowAtlasUV(float4 rect, float2 uv)
+{
+    return rect.xy + saturate(uv) * rect.zw;
+}
+
+// Filter taps are kept inside the light's region so they don't pick up the neighbouring lights' shadow maps. Kept half a
+// texel in from the edge since filtered samples also read the neighbouring texels
+float2 ClampToShadowAtlasRect(float4 rect, float2 uv)
+{
+    float halfTexel = 0.5f * gShadowAtlasTexelSize;
+    return clamp(uv, rect.xy + halfTexel, rect.xy + rect.zw - halfTexel);
+}
+
+
+// Shadow filtering quality, chosen when the shaders are compiled: 0 = 1 tap, 1 = 4 taps, 2 = 8 taps, 3 = 16 taps
+// Each tap is a hardware comparison of the four nearest shadow map texels, blended bilinearly, so even one tap gives
+// smooth edges a texel wide. More taps spread over a wider area give softer edges
+#ifndef SHADOW_FILTER_QUALITY
+#define SHADOW_FILTER_QUALITY 2
+#endif
+
+#if   SHADOW_FILTER_QUALITY <= 0
+#define SHADOW_FILTER_TAPS 1
+#elif SHADOW_FILTER_QUALITY == 1
+#define SHADOW_FILTER_TAPS 4
+#elif SHADOW_FILTER_QUALITY == 2
+#define SHADOW_FILTER_TAPS 8
+#else
+#define SHADOW_FILTER_TAPS 16
+#endif
+
+// Radius of the filter in shadow map texels
+static const float SHADOW_FILTER_RADIUS = 1.5f;
+
+// Tap positions spread evenly but irregularly over a unit disc (Poisson disc), so the edges don't show a regular pattern.
+// The lower qualities use the first few, which are still spread over the whole disc
+static const float2 SHADOW_FILTER_TAP_OFFSETS[16] =
+{
+    float2(-0.94201624f, -0.39906216f), float2( 0.94558609f, -0.76890725f), float2(-0.09418410f, -0.92938870f), float2( 0.34495938f,  0.29387760f),
+    float2(-0.91588581f,  0.45771432f), float2(-0.81544232f, -0.87912464f), float2(-0.38277543f,  0.27676845f), float2( 0.97484398f,  0.75648379f),
+    float2( 0.44323325f, -0.97511554f), float2( 0.53742981f, -0.47373420f), float2(-0.26496911f, -0.41893023f), float2( 0.79197514f,  0.19090188f),
+    float2(-0.24188840f,  0.99706507f), float2(-0.81409955f,  0.91437590f), float2( 0.19984126f,  0.78641367f), float2( 0.14383161f, -0.14100790f)
+};
+
+// Fraction of the filter area that is lit (0 = fully in shadow). compare is the pixel's depth from the light
+float ShadowMapSample(Texture2D map, SamplerComparisonState ShadowSampler, float4 rect, float2 uv, float compare)
+{
+#if SHADOW_FILTER_TAPS == 1
+    return map.SampleCmpLevelZero(ShadowSampler, ClampToShadowAtlasRect(rect, uv), compare);
+#else
+    float radius = SHADOW_FILTER_RADIUS * gShadowAtlasTexelSize;
     float strength = 0;
-    [unroll(5)] for (int j = -2; j < 3; j++)
+    [unroll] for (int i = 0; i < SHADOW_FILTER_TAPS; i++)
     {
-        [unroll(9)] for (int k = -3; k < 4; k++)
-        {
-            offset.x = j * 0.00006f;
-            offset.y = k * 0.00004f;
-            if (compare < map.Sample(PointClamp, uv + offset).r)
-            {
-                strength += 0.0222222222f;
-            }
-        }
+        float2 tapUV = ClampToShadowAtlasRect(rect, uv + SHADOW_FILTER_TAP_OFFSETS[i] * radius);
+        strength += map.SampleCmpLevelZero(ShadowSampler, tapUV, compare);
     }
-    return strength;
+    return strength / SHADOW_FILTER_TAPS;
+#endif
 }
 
-float3 ColourMapSample(Texture2D map, SamplerState PointClamp, float2 uv)
+// Average colour of the transparent objects between the light and the pixel, over the same area as the shadow filter
+float3 ColourMapSample(Texture2D map, SamplerState PointClamp, float4 rect, float2 uv)
 {
-    float2 offset;
+    float radius = SHADOW_FILTER_RADIUS * gShadowAtlasTexelSize;
     float3 colour = 0;
-    [unroll(5)] for (int j = -2; j < 3; j++)
+    [unroll] for (int i = 0; i < SHADOW_FILTER_TAPS; i++)
     {
-        [unroll(9)] for (int k = -3; k < 4; k++)
-        {
-            offset.x = j * 0.00006f;
-            offset.y = k * 0.00004f;
-            colour += 0.0222222222f * map.Sample(PointClamp, uv + offset);
-        }
+        float2 tapUV = ClampToShadowAtlasRect(rect, uv + SHADOW_FILTER_TAP_OFFSETS[i] * radius);
+        colour += map.Sample(PointClamp, tapUV).rgb;
     }
-    return colour;
+    return colour / SHADOW_FILTER_TAPS;
 }
 
-void CalculateLighting(Texture2D ShadowMap[15], float3 worldPosition, float3 worldNormal, SamplerState PointClamp, out float3 diffuseLight, out float3 specularLight,
-    Texture2D ColourMap[15], bool transparentShadows = false)
+// Settings for the variants of the lighting pixel shaders (see ShaderPermutations.h). The project builds each shader with
+// the defaults, which handle everything: the most spotlights the constants hold and shadows tinted by transparent objects
+#ifndef MAX_SHADER_SPOTLIGHTS
+#define MAX_SHADER_SPOTLIGHTS 15
+#endif
+#ifndef COLOUR_SHADOWS
+#define COLOUR_SHADOWS 1
+#endif
+
+// lightProjections are the interpolated outputs of CalculateLightProjections
+void CalculateLighting(Texture2D ShadowAtlas, float3 worldPosition, float3 worldNormal, float4 lightProjections[NUM_VERTEX_SHADOW_LIGHTS],
+    SamplerState PointClamp, SamplerComparisonState ShadowSampler, out float3 diffuseLight, out float3 specularLight,
+    Texture2D ColourAtlas, bool transparentShadows = false)
 {
     diffuseLight = gAmbientColour;
     specularLight = 0;
 
     float3 cameraDirection = normalize(gCameraPosition - worldPosition);
 
-    [unroll(15)] for (int i = 0; i < gSpotlightNumber; i++)
+    [unroll(MAX_SHADER_SPOTLIGHTS)] for (int i = 0; i < min(int(gSpotlightNumber), MAX_SHADER_SPOTLIGHTS); i++)
     {
         // Direction from pixel to light
         float3 lightDirection = normalize(gSpotlights[i].position - worldPosition);
@@ -185,26 +354,29 @@ void CalculateLighting(Texture2D ShadowMap[15], float3 worldPosition, float3 wor
         {
             // Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
             // pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-            // These are the same as the view / projection matrix multiplies in a vertex shader (can improve performance by putting these lines in vertex shader)
-            float4 lightViewPosition = mul(gSpotlights[i].viewMatrix, float4(worldPosition, 1.0f));
-            float4 lightProjection = mul(gSpotlights[i].projectionMatrix, lightViewPosition);
+            // The vertex shader has already done this for the first few lights. The loop is unrolled so this choice is made at compile time
+            float4 lightProjection;
+            if (i < NUM_VERTEX_SHADOW_LIGHTS)  lightProjection = lightProjections[min(i, NUM_VERTEX_SHADOW_LIGHTS - 1)];
+            else                               lightProjection = mul(gSpotlights[i].viewProjectionMatrix, float4(worldPosition, 1.0f));
 
             // Sample the shadow map to determine how strong the shadow on this pixel is
             float2 shadowMapUV = (0.5f * lightProjection.xy / lightProjection.w) + float2(0.5f, 0.5f);
             shadowMapUV.y = 1.0f - shadowMapUV.y;
+            float4 atlasRect = gSpotlights[i].shadowAtlasRect;
+            shadowMapUV = ShadowAtlasUV(atlasRect, shadowMapUV);
 
             float depthFromLight = lightProjection.z / lightProjection.w;
 
-            float strength = ShadowMapSample(ShadowMap[i], PointClamp, shadowMapUV, depthFromLight);
+            // A light that didn't fit in the atlas has no shadows
+            float strength = 1;
+            if (atlasRect.z > 0)  strength = ShadowMapSample(ShadowAtlas, ShadowSampler, atlasRect, shadowMapUV, depthFromLight);
 
             if (strength > 0)
             {
-                float3 lightDist; 
-                if (gSpotlights[i].isSpot == 0) lightDist = 150; // Set value for fake directional light
-                else lightDist = length(gSpotlights[i].position - worldPosition);
+                float lightDist = length(gSpotlights[i].position - worldPosition);
 
                 float3 shadow = 1;
-                if (transparentShadows) shadow = ColourMapSample(ColourMap[i], PointClamp, shadowMapUV);
+                if (COLOUR_SHADOWS && transparentShadows && atlasRect.z > 0) shadow = ColourMapSample(ColourAtlas, PointClamp, atlasRect, shadowMapUV);
 
                 diffuseLight += (gSpotlights[i].colour * max(dot(worldNormal, lightDirection), 0) / lightDist) * shadow * strength;
 
@@ -212,23 +384,64 @@ void CalculateLighting(Texture2D ShadowMap[15], float3 worldPosition, float3 wor
                 specularLight += diffuseLight * pow(max(dot(worldNormal, halfway), 0), gSpecularPower) * shadow * strength;
             }
         }
-        else if (gSpotlights[i].isSpot == 0) // If not an actual spotlight light up the remaining area
+    }
+
+    // Directional light - lights everything from the same direction with no falloff
+    if (gDirectionalLight.numCascades > 0)
+    {
+        float3 lightDirection = -gDirectionalLight.direction;
+
+        // Use the first (most detailed) cascade that covers the pixel. Cascades are fitted to the main camera's view, but this
+        // choice also works when rendering from other cameras such as the portal's
+        int cascade = 0;
+        float4 lightProjection = 0;
+        for (; cascade < int(gDirectionalLight.numCascades); cascade++)
         {
-            diffuseLight += (gSpotlights[i].colour * max(dot(worldNormal, lightDirection), 0) / 250);
+            // Orthographic projection so no divide by w is needed
+            lightProjection = mul(gDirectionalLight.cascadeViewProjection[cascade], float4(worldPosition, 1.0f));
+            if (all(abs(lightProjection.xy) < 1.0f) && lightProjection.z > 0.0f && lightProjection.z < 1.0f)  break;
+        }
+
+        // Pixels outside every cascade (beyond the shadow distance), or in a cascade that didn't fit in the atlas, have no shadows
+        float  strength = 1;
+        float3 shadow = 1;
+        if (cascade < int(gDirectionalLight.numCascades) && gDirectionalLight.cascadeRects[cascade].z > 0)
+        {
+            float2 shadowMapUV = 0.5f * lightProjection.xy + float2(0.5f, 0.5f);
+            shadowMapUV.y = 1.0f - shadowMapUV.y;
+            float4 atlasRect = gDirectionalLight.cascadeRects[cascade];
+            shadowMapUV = ShadowAtlasUV(atlasRect, shadowMapUV);
+
+            strength = ShadowMapSample(ShadowAtlas, ShadowSampler, atlasRect, shadowMapUV, lightProjection.z);
+            if (COLOUR_SHADOWS && transparentShadows)  shadow = ColourMapSample(ColourAtlas, PointClamp, atlasRect, shadowMapUV);
+        }
+
+        if (strength > 0)
+        {
+            diffuseLight += gDirectionalLight.colour * max(dot(worldNormal, lightDirection), 0) * shadow * strength;
 
             float3 halfway = normalize(lightDirection + cameraDirection);
-            specularLight += diffuseLight * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
+            specularLight += diffuseLight * pow(max(dot(worldNormal, halfway), 0), gSpecularPower) * shadow * strength;
         }
     }
 
-    [unroll(25)] for (int i = 0; i < gPointlightNumber; i++)
+    // Point lights - either the few chosen for this model, or all the ones in this pixel's cluster
+    if (gUseObjectLights != 0)
     {
-        float3 lightDirection = normalize(gPointlights[i].position - worldPosition);
-
-        float3 lightDist = length(gPointlights[i].position - worldPosition);
-        diffuseLight += gPointlights[i].colour * max(dot(worldNormal, lightDirection), 0) / lightDist;
-        float3 halfway = normalize(lightDirection + cameraDirection);
-        specularLight += diffuseLight * pow(max(dot(worldNormal, halfway), 0), gSpecularPower);
+        for (uint j = 0; j < uint(gNumObjectLights); j++)
+        {
+            Pointlight light = gPointlights[gObjectLights[j / 4][j % 4]];
+            AddPointlight(light, worldPosition, worldNormal, cameraDirection, diffuseLight, specularLight);
+        }
+    }
+    else
+    {
+        uint2 cluster = GetLightCluster(worldPosition);
+        for (uint j = 0; j < cluster.y; j++)
+        {
+            Pointlight light = gPointlights[gClusterLightList[cluster.x + j]];
+            AddPointlight(light, worldPosition, worldNormal, cameraDirection, diffuseLight, specularLight);
+        }
     }
 }
 
@@ -0,0 +1,216 @@
+//--------------------------------------------------------------------------------------
+// Direct3D 11 command stream backend
+//--------------------------------------------------------------------------------------
+
+#include "D3D11Backend.h"
+
+#include <cstring>
+
+
+// Forget the state tracking, use if the context has been changed or cleared outside this backend
+void D3D11Backend::Reset()
+{
+    mPipeline = PipelineDesc();
+    mGeometry = {};
+    std::memset(mTextures,        0, sizeof(mTextures));
+    std::memset(mSamplers,        0, sizeof(mSamplers));
+    std::memset(mConstantBuffers, 0, sizeof(mConstantBuffers));
+}
+
+
+void D3D11Backend::Execute(const CommandStream& commands)
+{
+    CommandStream::Reader reader(commands);
+    while (reader.Next())
+    {
+        switch (reader.Type())
+        {
+        case RenderCommand::SetPipeline:
+        {
+            // Only send the parts of the pipeline that have changed
+            auto& pipeline = reader.Get<PipelineCommand>().pipeline->desc;
+            if (pipeline.vertexShader != mPipeline.vertexShader)
+            {
+                mContext->VSSetShader(pipeline.vertexShader, nullptr, 0);
+            }
+            if (pipeline.pixelShader != mPipeline.pixelShader)
+            {
+                mContext->PSSetShader(pipeline.pixelShader, nullptr, 0);
+            }
+            if (pipeline.blendState != mPipeline.blendState)
+            {
+                mContext->OMSetBlendState(pipeline.blendState, nullptr, 0xffffff);
+            }
+            if (pipeline.depthStencilState != mPipeline.depthStencilState)
+            {
+                mContext->OMSetDepthStencilState(pipeline.depthStencilState, 0);
+            }
+            if (pipeline.rasterizerState != mPipeline.rasterizerState)
+            {
+                mContext->RSSetState(pipeline.rasterizerState);
+            }
+            if (pipeline.sampler != mSamplers[0])
+            {
+                mContext->PSSetSamplers(0, 1, &pipeline.sampler);
+                mSamplers[0] = pipeline.sampler;
+            }
+            mPipeline = pipeline;
+            break;
+        }
+
+        case RenderCommand::SetRenderTargets:
+        {
+            auto& targets = reader.Get<RenderTargetsCommand>();
+            if (targets.renderTarget != nullptr)
+            {
+                mContext->OMSetRenderTargets(1, &targets.renderTarget, targets.depthStencil);
+            }
+            else
+            {
+                mContext->OMSetRenderTargets(0, nullptr, targets.depthStencil);
+            }
+            break;
+        }
+
+        case RenderCommand::SetViewport:
+        {
+            auto& viewport = reader.Get<ViewportCommand>();
+            D3D11_VIEWPORT vp;
+            vp.Width  = viewport.width;
+            vp.Height = viewport.height;
+            vp.MinDepth = 0.0f;
+            vp.MaxDepth = 1.0f;
+            vp.TopLeftX = viewport.left;
+            vp.TopLeftY = viewport.top;
+            mContext->RSSetViewports(1, &vp);
+            break;
+        }
+
+        case RenderCommand::ClearRenderTarget:
+        {
+            auto& clear = reader.Get<ClearRenderTargetCommand>();
+            mContext->ClearRenderTargetView(clear.renderTarget, clear.colour);
+            break;
+        }
+
+        case RenderCommand::ClearDepth:
+        {
+            auto& clear = reader.Get<ClearDepthCommand>();
+            mContext->ClearDepthStencilView(clear.depthStencil, D3D11_CLEAR_DEPTH, clear.depth, 0);
+            break;
+        }
+
+        case RenderCommand::BindTextures:
+        {
+            // Skip the bind if every texture in the range is already in place
+            auto& textures = reader.Get<TexturesCommand>();
+            auto  views    = static_cast<ID3D11ShaderResourceView* const*>(reader.Extra<TexturesCommand>());
+            if (std::memcmp(&mTextures[textures.slot], views, textures.count * sizeof(*views)) != 0)
+            {
+                mContext->PSSetShaderResources(textures.slot, textures.count, views);
+                std::memcpy(&mTextures[textures.slot], views, textures.count * sizeof(*views));
+            }
+            break;
+        }
+
+        case RenderCommand::BindSampler:
+        {
+            auto& sampler = reader.Get<SamplerCommand>();
+            if (sampler.sampler != mSamplers[sampler.slot])
+            {
+                mContext->PSSetSamplers(sampler.slot, 1, &sampler.sampler);
+                mSamplers[sampler.slot] = sampler.sampler;
+            }
+            break;
+        }
+
+        case RenderCommand::BindConstantBuffer:
+        {
+            auto& constants = reader.Get<ConstantBufferCommand>();
+            if (constants.buffer != mConstantBuffers[constants.slot])
+            {
+                mContext->VSSetConstantBuffers(constants.slot, 1, &constants.buffer);
+                mContext->PSSetConstantBuffers(constants.slot, 1, &constants.buffer);
+                mConstantBuffers[constants.slot] = constants.buffer;
+            }
+            break;
+        }
+
+        case RenderCommand::UpdateConstants:
+        {
+            // Same as UpdateConstantBuffer in GraphicsHelpers.h but the data comes from the stream
+            auto& update = reader.Get<UpdateConstantsCommand>();
+            D3D11_MAPPED_SUBRESOURCE cb;
+            mContext->Map(update.buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
+            std::memcpy(cb.pData, reader.Extra<UpdateConstantsCommand>(), update.size);
+            mContext->Unmap(update.buffer, 0);
+            break;
+        }
+
+        case RenderCommand::SetGeometry:
+        {
+            auto& geometry = reader.Get<GeometryCommand>();
+            if (geometry.vertexLayout != mGeometry.vertexLayout)
+            {
+                mContext->IASetInputLayout(geometry.vertexLayout);
+            }
+            if (geometry.vertexBuffer != mGeometry.vertexBuffer || geometry.vertexSize != mGeometry.vertexSize)
+            {
+                UINT offset = 0;
+                mContext->IASetVertexBuffers(0, 1, &geometry.vertexBuffer, &geometry.vertexSize, &offset);
+            }
+            if (geometry.indexBuffer != mGeometry.indexBuffer || geometry.indexSize != mGeometry.indexSize)
+            {
+                DXGI_FORMAT format = (geometry.indexSize == 2) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+                mContext->IASetIndexBuffer(geometry.indexBuffer, format, 0);
+            }
+
+            // The context starts with an undefined topology, set it the first time any geometry is used
+            if (mGeometry.vertexBuffer == nullptr)
+            {
+                mContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+            }
+            mGeometry = geometry;
+            break;
+        }
+
+        case RenderCommand::DrawIndexed:
+        {
+            auto& draw = reader.Get<DrawCommand>();
+            mContext->DrawIndexed(draw.indexCount, draw.startIndex, draw.baseVertex);
+            break;
+        }
+
+        case RenderCommand::DrawGenerated:
+        {
+            // No input layout so the vertex shader doesn't read any vertex data. Any geometry stays bound for later draws
+            if (mGeometry.vertexLayout != nullptr)
+            {
+                mContext->IASetInputLayout(nullptr);
+                mGeometry.vertexLayout = nullptr;
+            }
+            if (mGeometry.vertexBuffer == nullptr)
+            {
+                mContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+            }
+            mContext->Draw(reader.Get<DrawGeneratedCommand>().vertexCount, 0);
+            break;
+        }
+
+        case RenderCommand::CopyTexture:
+        {
+            auto& copy = reader.Get<CopyTextureCommand>();
+            mContext->CopyResource(copy.destination, copy.source);
+            break;
+        }
+
+        case RenderCommand::Timestamp:
+            // Timestamp queries only have an end
+            mContext->End(reader.Get<TimestampCommand>().query);
+            break;
+
+        default:
+            break;
+        }
+    }
+}
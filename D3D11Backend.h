@@ -0,0 +1,43 @@
+//--------------------------------------------------------------------------------------
+// Direct3D 11 command stream backend
+//--------------------------------------------------------------------------------------
+// Replays a command stream onto a D3D11 device context (immediate or deferred). Keeps track of
+// the state already set on the context and skips commands that wouldn't change anything, so
+// scene code can simply set everything each draw needs without worrying about the cost. Pipeline
+// states are bound by comparing them with the current state and only setting what differs.
+
+#ifndef _D3D11_BACKEND_H_INCLUDED_
+#define _D3D11_BACKEND_H_INCLUDED_
+
+#include "CommandStream.h"
+#include "PipelineState.h"
+#include "Common.h"
+
+class D3D11Backend : public RenderBackend
+{
+public:
+    // The context should be in default state (e.g. a new deferred context or just after ClearState)
+    D3D11Backend(ID3D11DeviceContext* context) : mContext(context) {}
+
+    void Execute(const CommandStream& commands) override;
+
+    // Forget the state tracking, use if the context has been changed or cleared outside this backend
+    void Reset();
+
+private:
+    static const unsigned int MAX_TEXTURE_SLOTS  = D3D11_COMMONSHADER_INPUT_RESOURCE_SLOT_COUNT;
+    static const unsigned int MAX_SAMPLER_SLOTS  = D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT;
+    static const unsigned int MAX_CONSTANT_SLOTS = D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT;
+
+    ID3D11DeviceContext* mContext;
+
+    // State currently set on the context, nullptr matches the default state
+    PipelineDesc              mPipeline;
+    GeometryCommand           mGeometry = {};
+    ID3D11ShaderResourceView* mTextures[MAX_TEXTURE_SLOTS] = {};
+    ID3D11SamplerState*       mSamplers[MAX_SAMPLER_SLOTS] = {};
+    ID3D11Buffer*             mConstantBuffers[MAX_CONSTANT_SLOTS] = {};
+};
+
+
+#endif //_D3D11_BACKEND_H_INCLUDED_
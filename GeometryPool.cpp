@@ -0,0 +1,386 @@
+//--------------------------------------------------------------------------------------
+// Geometry pool - all meshes' vertices and indices in a few shared GPU buffers
+//--------------------------------------------------------------------------------------
+
+#include "GeometryPool.h"
+#include "Shader.h" // Needed for helper function CreateSignatureForVertexLayout
+
+#include <algorithm>
+#include <stdexcept>
+
+
+//--------------------------------------------------------------------------------------
+// Buffer helpers
+//--------------------------------------------------------------------------------------
+
+static ID3D11Buffer* CreatePoolBuffer(UINT bindFlags, uint32_t bytes)
+{
+    D3D11_BUFFER_DESC bufferDesc;
+    bufferDesc.BindFlags = bindFlags;
+    bufferDesc.Usage = D3D11_USAGE_DEFAULT; // Written with UpdateSubresource and copies, never mapped
+    bufferDesc.ByteWidth = bytes;
+    bufferDesc.CPUAccessFlags = 0;
+    bufferDesc.MiscFlags = 0;
+    bufferDesc.StructureByteStride = 0;
+
+    ID3D11Buffer* buffer = nullptr;
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &buffer)))  throw std::runtime_error("Failure creating geometry pool buffer");
+    return buffer;
+}
+
+// Copy bytes from one buffer to another (the two must not be the same buffer)
+static void CopyBufferRange(ID3D11Buffer* destination, uint32_t destinationOffset, ID3D11Buffer* source, uint32_t sourceOffset, uint32_t bytes)
+{
+    if (bytes == 0)  return;
+    D3D11_BOX box = { sourceOffset, 0, 0, sourceOffset + bytes, 1, 1 };
+    gD3DContext->CopySubresourceRegion(destination, 0, destinationOffset, 0, 0, source, 0, &box);
+}
+
+static void UploadBufferRange(ID3D11Buffer* buffer, uint32_t offset, const void* data, uint32_t bytes)
+{
+    if (bytes == 0)  return;
+    D3D11_BOX box = { offset, 0, 0, offset + bytes, 1, 1 };
+    gD3DContext->UpdateSubresource(buffer, 0, &box, data, 0, 0);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Geometry pool
+//--------------------------------------------------------------------------------------
+
+// Buffers start at these sizes in bytes and grow as needed. They are created when the first mesh is added
+GeometryPool::GeometryPool(uint32_t initialVertexBytes /*= 8MB*/, uint32_t initialIndexBytes /*= 4MB*/)
+    : mInitialVertexBytes(initialVertexBytes), mInitialIndexBytes(initialIndexBytes)
+{
+}
+
+GeometryPool::~GeometryPool()
+{
+    Release();
+}
+
+
+// Copy a mesh's vertices and indices into the pool, returns the id of its slice
+// Will throw a std::runtime_error exception on failure. The name is only used in error messages
+uint32_t GeometryPool::Add(const CookedMesh& mesh, const std::string& name)
+{
+    uint32_t id = Reserve(mesh, name);
+    Upload(id, mesh, 0, UploadBytes(mesh));
+    return id;
+}
+
+
+// Make room for a mesh without copying its data, returns the id of its slice. The slice must be filled with Upload before
+// it is drawn. Will throw a std::runtime_error exception on failure
+uint32_t GeometryPool::Reserve(const CookedMesh& mesh, const std::string& name)
+{
+    if (mesh.numVertices == 0 || mesh.numIndices == 0 || (mesh.indexSize != 2 && mesh.indexSize != 4))
+    {
+        throw std::runtime_error("No geometry to draw in " + name);
+    }
+
+    GeometrySlice slice;
+    slice.format      = FindFormat(mesh, name);
+    slice.numVertices = mesh.numVertices;
+    slice.indexSize   = mesh.indexSize;
+    slice.indexWords  = (mesh.numIndices * mesh.indexSize + 3) / 4;
+
+    Format& format = mFormats[slice.format];
+    if (!format.allocator.Allocate(slice.numVertices, slice.firstVertex))
+    {
+        Grow(format.vertexBuffer, format.allocator, format.vertexSize, D3D11_BIND_VERTEX_BUFFER, mInitialVertexBytes, slice.numVertices);
+        format.allocator.Allocate(slice.numVertices, slice.firstVertex);
+    }
+    if (!mIndexAllocator.Allocate(slice.indexWords, slice.indexOffset))
+    {
+        Grow(mIndexBuffer, mIndexAllocator, 4, D3D11_BIND_INDEX_BUFFER, mInitialIndexBytes, slice.indexWords);
+        mIndexAllocator.Allocate(slice.indexWords, slice.indexOffset);
+    }
+
+    uint32_t id;
+    if (!mFreeSlices.empty())
+    {
+        id = mFreeSlices.back();
+        mFreeSlices.pop_back();
+        mSlices[id] = slice;
+    }
+    else
+    {
+        id = static_cast<uint32_t>(mSlices.size());
+        mSlices.push_back(slice);
+    }
+    return id;
+}
+
+
+// Copy part of a reserved mesh's data into its slice, the vertices then the indices. Carries on after the bytes already
+// copied and copies no more than maxBytes. Returns the bytes copied
+uint32_t GeometryPool::Upload(uint32_t id, const CookedMesh& mesh, uint32_t bytesCopied, uint32_t maxBytes)
+{
+    // The slice's position is looked up each time as the buffers may have grown or been packed since the last part
+    const GeometrySlice& slice  = mSlices[id];
+    const Format&        format = mFormats[slice.format];
+    uint32_t vertexBytes = mesh.numVertices * format.vertexSize;
+    uint32_t indexBytes  = mesh.numIndices * mesh.indexSize;
+
+    uint32_t copied = 0;
+    if (bytesCopied < vertexBytes)
+    {
+        uint32_t bytes = vertexBytes - bytesCopied;
+        if (bytes > maxBytes)  bytes = maxBytes;
+        UploadBufferRange(format.vertexBuffer, slice.firstVertex * format.vertexSize + bytesCopied,
+                          static_cast<const uint8_t*>(mesh.vertices) + bytesCopied, bytes);
+        copied += bytes;
+        bytesCopied += bytes;
+    }
+    if (bytesCopied >= vertexBytes && copied < maxBytes)
+    {
+        uint32_t indexStart = bytesCopied - vertexBytes;
+        uint32_t bytes = indexBytes - indexStart;
+        if (bytes > maxBytes - copied)  bytes = maxBytes - copied;
+        UploadBufferRange(mIndexBuffer, slice.indexOffset * 4 + indexStart, static_cast<const uint8_t*>(mesh.indices) + indexStart, bytes);
+        copied += bytes;
+    }
+    return copied;
+}
+
+
+// Free a slice for other meshes
+void GeometryPool::Remove(uint32_t id)
+{
+    if (id >= mSlices.size())  return; // The pool has already been released
+    GeometrySlice& slice = mSlices[id];
+    if (slice.numVertices == 0)  return;
+
+    mFormats[slice.format].allocator.Free(slice.firstVertex, slice.numVertices);
+    mIndexAllocator.Free(slice.indexOffset, slice.indexWords);
+    slice.numVertices = 0;
+    mFreeSlices.push_back(id);
+}
+
+
+// Buffers and layout to draw a slice with, and the index and vertex to add to the start index and base vertex of its draws
+GeometryCommand GeometryPool::Geometry(uint32_t id) const
+{
+    const GeometrySlice& slice  = mSlices[id];
+    const Format&        format = mFormats[slice.format];
+
+    GeometryCommand geometry;
+    geometry.vertexLayout = format.vertexLayout;
+    geometry.vertexBuffer = format.vertexBuffer;
+    geometry.vertexSize   = format.vertexSize;
+    geometry.indexBuffer  = mIndexBuffer;
+    geometry.indexSize    = slice.indexSize;
+    return geometry;
+}
+
+uint32_t GeometryPool::StartIndex(uint32_t id) const
+{
+    return mSlices[id].indexOffset * 4 / mSlices[id].indexSize;
+}
+
+int32_t GeometryPool::BaseVertex(uint32_t id) const
+{
+    return static_cast<int32_t>(mSlices[id].firstVertex);
+}
+
+
+// Pack the slices in each buffer together, leaving all the free space at the end. Only call between frames
+void GeometryPool::Defragment()
+{
+    // Slices in use, sorted by position in a buffer
+    std::vector<uint32_t> ids;
+    for (uint32_t id = 0; id < mSlices.size(); ++id)
+    {
+        if (mSlices[id].numVertices > 0)  ids.push_back(id);
+    }
+
+    // The buffers can't be copied within themselves as the old and new ranges may overlap, so the slices are copied into a new
+    // buffer of the same size. Nothing to do if the slices are already packed together
+    std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) { return mSlices[a].firstVertex < mSlices[b].firstVertex; });
+    for (uint32_t f = 0; f < mFormats.size(); ++f)
+    {
+        Format& format = mFormats[f];
+        uint32_t packed = 0;
+        bool moved = false;
+        for (uint32_t id : ids)
+        {
+            if (mSlices[id].format != f)  continue;
+            if (mSlices[id].firstVertex != packed)  moved = true;
+            packed += mSlices[id].numVertices;
+        }
+        if (!moved)  continue;
+
+        ID3D11Buffer* newBuffer = CreatePoolBuffer(D3D11_BIND_VERTEX_BUFFER, format.allocator.Size() * format.vertexSize);
+        packed = 0;
+        for (uint32_t id : ids)
+        {
+            GeometrySlice& slice = mSlices[id];
+            if (slice.format != f)  continue;
+            CopyBufferRange(newBuffer, packed * format.vertexSize, format.vertexBuffer, slice.firstVertex * format.vertexSize,
+                            slice.numVertices * format.vertexSize);
+            slice.firstVertex = packed;
+            packed += slice.numVertices;
+        }
+        format.vertexBuffer->Release();
+        format.vertexBuffer = newBuffer;
+        format.allocator.Reset(format.allocator.Size(), packed);
+    }
+
+    if (mIndexBuffer == nullptr)  return;
+    std::sort(ids.begin(), ids.end(), [&](uint32_t a, uint32_t b) { return mSlices[a].indexOffset < mSlices[b].indexOffset; });
+    uint32_t packed = 0;
+    bool moved = false;
+    for (uint32_t id : ids)
+    {
+        if (mSlices[id].indexOffset != packed)  moved = true;
+        packed += mSlices[id].indexWords;
+    }
+    if (!moved)  return;
+
+    ID3D11Buffer* newBuffer = CreatePoolBuffer(D3D11_BIND_INDEX_BUFFER, mIndexAllocator.Size() * 4);
+    packed = 0;
+    for (uint32_t id : ids)
+    {
+        GeometrySlice& slice = mSlices[id];
+        CopyBufferRange(newBuffer, packed * 4, mIndexBuffer, slice.indexOffset * 4, slice.indexWords * 4);
+        slice.indexOffset = packed;
+        packed += slice.indexWords;
+    }
+    mIndexBuffer->Release();
+    mIndexBuffer = newBuffer;
+    mIndexAllocator.Reset(mIndexAllocator.Size(), packed);
+}
+
+
+// Release the GPU buffers and layouts, all slices must have been removed
+void GeometryPool::Release()
+{
+    for (auto& format : mFormats)
+    {
+        if (format.vertexBuffer)  format.vertexBuffer->Release();
+        if (format.vertexLayout)  format.vertexLayout->Release();
+    }
+    mFormats.clear();
+    if (mIndexBuffer)  mIndexBuffer->Release();
+    mIndexBuffer = nullptr;
+    mIndexAllocator.Reset(0, 0);
+    mSlices.clear();
+    mFreeSlices.clear();
+}
+
+
+// Fraction of the buffers' space in use
+float GeometryPool::Occupancy() const
+{
+    uint64_t used = static_cast<uint64_t>(mIndexAllocator.Used()) * 4;
+    for (auto& format : mFormats)  used += static_cast<uint64_t>(format.allocator.Used()) * format.vertexSize;
+    uint64_t capacity = CapacityBytes();
+    return capacity > 0 ? static_cast<float>(used) / capacity : 0.0f;
+}
+
+// Total size of the buffers in bytes
+uint64_t GeometryPool::CapacityBytes() const
+{
+    uint64_t capacity = static_cast<uint64_t>(mIndexAllocator.Size()) * 4;
+    for (auto& format : mFormats)  capacity += static_cast<uint64_t>(format.allocator.Size()) * format.vertexSize;
+    return capacity;
+}
+
+// Number of gaps between slices, not counting the free space at the end of each buffer
+uint32_t GeometryPool::NumFreeRanges() const
+{
+    uint32_t gaps = 0;
+    auto countGaps = [&](const RangeAllocator& allocator)
+    {
+        uint32_t ranges = allocator.NumFreeRanges();
+        if (ranges > 0)  gaps += ranges - 1; // Buffers grow when full so there is almost always free space at the end
+    };
+    countGaps(mIndexAllocator);
+    for (auto& format : mFormats)  countGaps(format.allocator);
+    return gaps;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Private helpers
+//--------------------------------------------------------------------------------------
+
+// Index of the vertex buffer for a mesh's vertex format, creating it the first time the format is seen
+uint32_t GeometryPool::FindFormat(const CookedMesh& mesh, const std::string& name)
+{
+    for (uint32_t f = 0; f < mFormats.size(); ++f)
+    {
+        const Format& format = mFormats[f];
+        if (format.vertexSize != mesh.vertexSize || format.numElements != mesh.numElements)  continue;
+        bool same = true;
+        for (uint32_t i = 0; i < mesh.numElements; ++i)
+        {
+            const VertexElement& a = format.elements[i];
+            const VertexElement& b = mesh.elements[i];
+            if (a.semantic != b.semantic || a.format != b.format || a.components != b.components || a.offset != b.offset)  same = false;
+        }
+        if (same)  return f;
+    }
+
+    // Create a "vertex layout" to describe to DirectX what is data in each vertex of this format
+    // The semantic names must match those used in the vertex shaders
+    // Formats for 1 to 4 components of each vertex format (see MeshCache.h)
+    const DXGI_FORMAT formats[][4] =
+    {
+        { DXGI_FORMAT_R32_FLOAT, DXGI_FORMAT_R32G32_FLOAT,  DXGI_FORMAT_R32G32B32_FLOAT, DXGI_FORMAT_R32G32B32A32_FLOAT },
+        { DXGI_FORMAT_R16_SNORM, DXGI_FORMAT_R16G16_SNORM,  DXGI_FORMAT_UNKNOWN,         DXGI_FORMAT_R16G16B16A16_SNORM },
+        { DXGI_FORMAT_UNKNOWN,   DXGI_FORMAT_R16G16_SNORM,  DXGI_FORMAT_UNKNOWN,         DXGI_FORMAT_UNKNOWN },
+        { DXGI_FORMAT_R16_FLOAT, DXGI_FORMAT_R16G16_FLOAT,  DXGI_FORMAT_UNKNOWN,         DXGI_FORMAT_R16G16B16A16_FLOAT },
+    };
+    const char* semanticNames[] = { "Position", "Normal", "Tangent", "UV" };
+    if (mesh.numElements > MAX_VERTEX_ELEMENTS)  throw std::runtime_error("Unsupported vertex data in " + name);
+    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
+    for (uint32_t i = 0; i < mesh.numElements; ++i)
+    {
+        const VertexElement& element = mesh.elements[i];
+        uint32_t format = static_cast<uint32_t>(element.format);
+        if (element.components < 1 || element.components > 4 || format > static_cast<uint32_t>(VertexFormat::Half) ||
+            formats[format][element.components - 1] == DXGI_FORMAT_UNKNOWN)
+        {
+            throw std::runtime_error("Unsupported vertex data in " + name);
+        }
+        vertexElements.push_back( { semanticNames[static_cast<uint32_t>(element.semantic)], 0, formats[format][element.components - 1], 0,
+                                    element.offset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
+    }
+
+    Format format;
+    format.numElements = mesh.numElements;
+    for (uint32_t i = 0; i < mesh.numElements; ++i)  format.elements[i] = mesh.elements[i];
+    format.vertexSize = mesh.vertexSize;
+
+    auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
+    HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
+                                               shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
+                                               &format.vertexLayout);
+    if (shaderSignature)  shaderSignature->Release();
+    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + name);
+
+    mFormats.push_back(std::move(format));
+    return static_cast<uint32_t>(mFormats.size() - 1);
+}
+
+
+// Make a buffer larger so it has at least the given number of free units in one range, keeping its contents
+void GeometryPool::Grow(ID3D11Buffer*& buffer, RangeAllocator& allocator, uint32_t unitSize, UINT bindFlags, uint32_t initialBytes,
+                        uint32_t neededUnits)
+{
+    // Double the size, or more if that isn't enough. The new space joins any free range at the end of the old buffer
+    uint32_t oldUnits = allocator.Size();
+    uint32_t newUnits = (oldUnits > 0) ? oldUnits * 2 : initialBytes / unitSize;
+    if (newUnits < oldUnits + neededUnits)  newUnits = oldUnits + neededUnits;
+
+    ID3D11Buffer* newBuffer = CreatePoolBuffer(bindFlags, newUnits * unitSize);
+    if (buffer != nullptr)
+    {
+        CopyBufferRange(newBuffer, 0, buffer, 0, oldUnits * unitSize);
+        buffer->Release();
+    }
+    buffer = newBuffer;
+    allocator.Grow(newUnits);
+}
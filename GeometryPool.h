@@ -0,0 +1,114 @@
+//--------------------------------------------------------------------------------------
+// Geometry pool - all meshes' vertices and indices in a few shared GPU buffers
+//--------------------------------------------------------------------------------------
+// When every mesh owns its own vertex buffer, index buffer and vertex layout, each draw of a
+// different mesh has to rebind all three. The pool keeps one vertex buffer (and layout) for each
+// vertex format and one index buffer for all meshes, and gives each mesh a range of them. Draws
+// add the range's first index and vertex to their start index and base vertex, so meshes with the
+// same format are drawn one after another with no input assembler changes (the backend skips
+// geometry that is already bound). Only the index size (16 or 32-bit) can still change between
+// meshes.
+//
+// Ranges come from a best fit allocator (see RangeAllocator.h). Buffers double in size when they
+// are full, and Defragment packs the ranges together again after many meshes have been freed.
+// Buffers are only replaced or changed between frames, when no recorded commands refer to them.
+
+#ifndef _GEOMETRY_POOL_H_INCLUDED_
+#define _GEOMETRY_POOL_H_INCLUDED_
+
+#include "Common.h"
+#include "CommandStream.h"
+#include "MeshCache.h"
+#include "RangeAllocator.h"
+
+#include <string>
+#include <vector>
+
+// A mesh's part of the pool
+struct GeometrySlice
+{
+    uint32_t format;      // Which vertex buffer
+    uint32_t firstVertex;
+    uint32_t numVertices; // Zero if the slice is not in use
+    uint32_t indexOffset; // Position in the index buffer in 4 byte units, so it suits both index sizes
+    uint32_t indexWords;
+    uint32_t indexSize;   // 2 or 4 bytes
+};
+
+class GeometryPool
+{
+public:
+    // Buffers start at these sizes in bytes and grow as needed. They are created when the first mesh is added
+    GeometryPool(uint32_t initialVertexBytes = 8 * 1024 * 1024, uint32_t initialIndexBytes = 4 * 1024 * 1024);
+    ~GeometryPool();
+
+    // Copy a mesh's vertices and indices into the pool, returns the id of its slice
+    // Will throw a std::runtime_error exception on failure. The name is only used in error messages
+    uint32_t Add(const CookedMesh& mesh, const std::string& name);
+
+    // Make room for a mesh without copying its data, returns the id of its slice. The slice must be filled with Upload before
+    // it is drawn. Will throw a std::runtime_error exception on failure
+    uint32_t Reserve(const CookedMesh& mesh, const std::string& name);
+
+    // Copy part of a reserved mesh's data into its slice, the vertices then the indices, so large meshes can be copied over
+    // several frames. Carries on after the bytes already copied and copies no more than maxBytes. Returns the bytes copied,
+    // the slice is complete when the total reaches UploadBytes
+    uint32_t Upload(uint32_t id, const CookedMesh& mesh, uint32_t bytesCopied, uint32_t maxBytes);
+    static uint32_t UploadBytes(const CookedMesh& mesh)  { return mesh.numVertices * mesh.vertexSize + mesh.numIndices * mesh.indexSize; }
+
+    // Free a slice for other meshes
+    void Remove(uint32_t id);
+
+    // Buffers and layout to draw a slice with, and the index and vertex to add to the start index and base vertex of its draws
+    GeometryCommand Geometry(uint32_t id) const;
+    uint32_t StartIndex(uint32_t id) const;
+    int32_t  BaseVertex(uint32_t id) const;
+
+    // Pack the slices in each buffer together, leaving all the free space at the end. Only call between frames
+    void Defragment();
+
+    // Release the GPU buffers and layouts, all slices must have been removed
+    void Release();
+
+
+    // Fraction of the buffers' space in use, the total size of the buffers in bytes and the number of gaps between slices
+    float    Occupancy() const;
+    uint64_t CapacityBytes() const;
+    uint32_t NumFreeRanges() const;
+
+    // Number of vertex buffers (one per vertex format)
+    uint32_t NumFormats() const  { return static_cast<uint32_t>(mFormats.size()); }
+
+private:
+    // Vertex buffer and layout for one vertex format, capacity is in vertices
+    struct Format
+    {
+        uint32_t           numElements;
+        VertexElement      elements[MAX_VERTEX_ELEMENTS];
+        uint32_t           vertexSize;
+        ID3D11InputLayout* vertexLayout = nullptr;
+        ID3D11Buffer*      vertexBuffer = nullptr;
+        RangeAllocator     allocator;
+    };
+
+    uint32_t FindFormat(const CookedMesh& mesh, const std::string& name);
+
+    // Make a buffer larger so it has at least the given number of free units in one range, keeping its contents
+    void Grow(ID3D11Buffer*& buffer, RangeAllocator& allocator, uint32_t unitSize, UINT bindFlags, uint32_t initialBytes,
+              uint32_t neededUnits);
+
+    uint32_t mInitialVertexBytes;
+    uint32_t mInitialIndexBytes;
+
+    std::vector<Format> mFormats;
+
+    // Index buffer allocated in 4 byte units
+    ID3D11Buffer*  mIndexBuffer = nullptr;
+    RangeAllocator mIndexAllocator;
+
+    std::vector<GeometrySlice> mSlices;
+    std::vector<uint32_t>      mFreeSlices;
+};
+
+
+#endif //_GEOMETRY_POOL_H_INCLUDED_
@@ -0,0 +1,101 @@
+//--------------------------------------------------------------------------------------
+// GPU timer - how long parts of a frame take on the GPU
+//--------------------------------------------------------------------------------------
+
+#include "GpuTimer.h"
+
+#include <stdexcept>
+
+
+// Create queries for the given number of timestamps each frame
+// Will throw a std::runtime_error exception on failure (since constructors can't return errors)
+GpuTimer::GpuTimer(uint32_t numTimestamps)
+{
+    D3D11_QUERY_DESC disjointDesc  = { D3D11_QUERY_TIMESTAMP_DISJOINT, 0 };
+    D3D11_QUERY_DESC timestampDesc = { D3D11_QUERY_TIMESTAMP, 0 };
+    for (auto& frame : mFrames)
+    {
+        frame.timestamps.resize(numTimestamps, nullptr);
+        bool created = SUCCEEDED(gD3DDevice->CreateQuery(&disjointDesc, &frame.disjoint));
+        for (auto& timestamp : frame.timestamps)
+        {
+            created = created && SUCCEEDED(gD3DDevice->CreateQuery(&timestampDesc, &timestamp));
+        }
+        if (!created)
+        {
+            Release(); // The destructor isn't called when a constructor throws
+            throw std::runtime_error("Error creating GPU timer queries");
+        }
+    }
+    mResults.resize(numTimestamps, 0);
+}
+
+GpuTimer::~GpuTimer()
+{
+    Release();
+}
+
+void GpuTimer::Release()
+{
+    for (auto& frame : mFrames)
+    {
+        if (frame.disjoint)  frame.disjoint->Release();
+        frame.disjoint = nullptr;
+        for (auto& timestamp : frame.timestamps)
+        {
+            if (timestamp)  timestamp->Release();
+            timestamp = nullptr;
+        }
+    }
+}
+
+
+// Call on the main thread before the frame's first pass is added
+void GpuTimer::BeginFrame()
+{
+    ++mFrameNumber;
+    Frame& frame = mFrames[mFrameNumber % NUM_FRAMES];
+    frame.frameNumber = mFrameNumber;
+    gD3DContext->Begin(frame.disjoint);
+}
+
+
+// Call on the main thread after the frame's passes are submitted. Picks up the results of the oldest frame still waiting
+// if the GPU has finished it, they are dropped if not as its queries are needed for the next frame
+void GpuTimer::EndFrame()
+{
+    gD3DContext->End(mFrames[mFrameNumber % NUM_FRAMES].disjoint);
+
+    Frame& oldest = mFrames[(mFrameNumber + 1) % NUM_FRAMES];
+    if (oldest.frameNumber == 0)  return;
+    oldest.frameNumber = 0;
+
+    // DONOTFLUSH - only check, don't make the GPU start on work queued since
+    D3D11_QUERY_DATA_TIMESTAMP_DISJOINT disjoint;
+    if (gD3DContext->GetData(oldest.disjoint, &disjoint, sizeof(disjoint), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)  return;
+    if (disjoint.Disjoint)  return; // The clock changed speed during the frame (e.g. power saving), the times are wrong
+
+    std::vector<uint64_t> results(mResults.size());
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        if (gD3DContext->GetData(oldest.timestamps[i], &results[i], sizeof(uint64_t), D3D11_ASYNC_GETDATA_DONOTFLUSH) != S_OK)  return;
+    }
+    mResults.swap(results);
+    mFrequency = disjoint.Frequency;
+    mResultsFrame = mFrameNumber + 1 - NUM_FRAMES;
+}
+
+
+// Add a command to write the given timestamp. Every timestamp must be written once each frame
+void GpuTimer::Timestamp(CommandStream& commands, uint32_t timestamp)
+{
+    commands.Timestamp(mFrames[mFrameNumber % NUM_FRAMES].timestamps[timestamp]);
+}
+
+
+// Seconds between two timestamps in the latest frame with results, zero until the first results arrive
+float GpuTimer::Interval(uint32_t from, uint32_t to)
+{
+    if (mFrequency == 0)  return 0;
+    return static_cast<float>(static_cast<double>(mResults[to] - mResults[from]) / mFrequency);
+}
@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// GPU timer - how long parts of a frame take on the GPU
+//--------------------------------------------------------------------------------------
+// The CPU only records commands, the GPU runs them later, so the CPU's clock can't time GPU
+// work. Instead timestamp commands are added to the passes and the GPU writes its own clock to a
+// query when it reaches each one. The results arrive a few frames later, so each frame has its
+// own set of queries from a small ring and the oldest set is read back without waiting.
+
+#ifndef _GPU_TIMER_H_INCLUDED_
+#define _GPU_TIMER_H_INCLUDED_
+
+#include "Common.h"
+#include "CommandStream.h"
+
+#include <vector>
+#include <cstdint>
+
+class GpuTimer
+{
+public:
+    // Create queries for the given number of timestamps each frame
+    // Will throw a std::runtime_error exception on failure (since constructors can't return errors)
+    GpuTimer(uint32_t numTimestamps);
+    ~GpuTimer();
+
+    // Prevent copying, the timer owns its DirectX objects
+    GpuTimer(const GpuTimer&) = delete;
+    GpuTimer& operator=(const GpuTimer&) = delete;
+
+    // Call on the main thread before the frame's first pass is added and after its passes are submitted. EndFrame picks
+    // up the results of the oldest frame still waiting if the GPU has finished it
+    void BeginFrame();
+    void EndFrame();
+
+    // Add a command to write the given timestamp (0 to numTimestamps - 1). Every timestamp must be written once each frame
+    // Can be called from several threads at once
+    void Timestamp(CommandStream& commands, uint32_t timestamp);
+
+    // Seconds between two timestamps in the latest frame with results, zero until the first results arrive
+    float Interval(uint32_t from, uint32_t to);
+
+    // Number of the current frame, counting from 1 at the first BeginFrame
+    uint64_t FrameNumber()  { return mFrameNumber; }
+
+    // Number of the frame the latest results are from, counting from 1, to tell when there are new results
+    uint64_t ResultsFrame()  { return mResultsFrame; }
+
+private:
+    // Frames in the ring, the GPU is rarely more than this many frames behind
+    static const uint32_t NUM_FRAMES = 4;
+
+    void Release();
+
+    struct Frame
+    {
+        ID3D11Query*              disjoint = nullptr; // Gives the clock frequency and whether the clock was steady
+        std::vector<ID3D11Query*> timestamps;
+        uint64_t                  frameNumber = 0;    // Zero if nothing is waiting for results
+    };
+
+    Frame                 mFrames[NUM_FRAMES];
+    uint64_t              mFrameNumber = 0;
+    std::vector<uint64_t> mResults;
+    uint64_t              mFrequency = 0;
+    uint64_t              mResultsFrame = 0;
+};
+
+
+#endif //_GPU_TIMER_H_INCLUDED_
@@ -1,6 +1,8 @@
 #include "Light.h"
+#include "Camera.h"
+#include "MeshClusters.h"
 
-const FLOAT gWhite[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+#include <cstring>
 
 void Light::SetStrength(float newStrength)
 {
@@ -8,68 +10,92 @@ void Light::SetStrength(float newStrength)
     model->SetScale(pow(strength, 0.7f));
 }
 
-void Light::MakeFlicker()
+// Set the colour and strength first, they are what the animation starts from
+void Light::MakeFlicker(LightAnimation& lightAnimation)
 {
-    flicker = true;
-    strengthMax = strength;
-    currentStrength = strength;
+    if (animation < 0)  animation = static_cast<int>(lightAnimation.AddLight(colour, strength));
+    lightAnimation.MakeFlicker(animation, flickerTime);
 }
 
-void Light::MakeRainbow()
+void Light::MakeRainbow(LightAnimation& lightAnimation)
 {
-    colourChange = true;
+    if (animation < 0)  animation = static_cast<int>(lightAnimation.AddLight(colour, strength));
+    lightAnimation.MakeRainbow(animation, colourSpeed);
 }
 
-void Light::Update(float frameTime)
+// Copy the colour and strength from the animation if they changed in its last update
+void Light::Update(const LightAnimation& lightAnimation)
 {
-    // Flickering
-    if (flicker)
-    {
-        if (flickerDown)
-        {
-            currentStrength -= frameTime * strengthMax / flickerTime;
-            if (currentStrength < 0)
-            {
-                currentStrength = 0;
-                flickerDown = false;
-            }
-        }
-        else
-        {
-            currentStrength += frameTime * strengthMax / flickerTime;
-            if (currentStrength > strengthMax)
-            {
-                currentStrength = strengthMax;
-                flickerDown = true;
-            }
-        }
-
-        SetStrength(currentStrength);
-    }
+    if (animation < 0 || !lightAnimation.Changed(animation))  return;
 
-    if (colourChange)
-    {
-        colourProgress += colourSpeed * frameTime;
-        if (colourProgress > 1)
-        {
-            colourProgress -= 1.0f;
-            currentColour = nextColour;
-            nextColour++;
-            if (nextColour > lastColour) nextColour = 0;
-        }
-        colour = colourProgress * colours[nextColour] + (1 - colourProgress) * colours[currentColour];
-    }
+    colour = lightAnimation.Colour(animation);
+    if (lightAnimation.Strength(animation) != strength)  SetStrength(lightAnimation.Strength(animation)); // Also scales the model
 }
 
 void Spotlight::SetBuffer()
 {
     buffer.colour = colour * strength;
-    buffer.isSpot = isSpot;
-    buffer.position = model->Position();
-    buffer.facing = GetFacing();    // Additional lighting information for spotlights
+
+    // The rest only changes when the light moves or its cone changes
+    CMatrix4x4 worldMatrix = model->WorldMatrix();
+    if (mBufferValid && gSpotlightConeAngle == mBufferConeAngle &&
+        std::memcmp(&worldMatrix, &mBufferWorldMatrix, sizeof(CMatrix4x4)) == 0)
+    {
+        return;
+    }
+    mBufferValid       = true;
+    mBufferWorldMatrix = worldMatrix;
+    mBufferConeAngle   = gSpotlightConeAngle;
+
+    buffer.position = worldMatrix.GetPosition();
+    buffer.facing = Normalise(worldMatrix.GetZAxis());   // Additional lighting information for spotlights
     buffer.cosHalfAngle = cos(ToRadians(gSpotlightConeAngle / 2)); // --"--
-    buffer.viewMatrix = CalculateLightViewMatrix();         // Calculate camera-like matrices for...
-    buffer.projectionMatrix = CalculateLightProjectionMatrix();   //...lights to support shadow mapping
+    mViewMatrix       = InverseAffine(worldMatrix); // Camera-like matrices for shadow mapping
+    mProjectionMatrix = CalculateLightProjectionMatrix();
+    buffer.viewProjectionMatrix = mViewMatrix * mProjectionMatrix;
+}
+
+// Set the light's region of a shadow atlas of the given size, also stored in the buffer for the shaders
+void Spotlight::SetShadowRect(const AtlasRect& rect, uint32_t atlasSize)
+{
+    shadowRect = rect;
+    buffer.shadowAtlasRect[0] = static_cast<float>(rect.x)    / atlasSize;
+    buffer.shadowAtlasRect[1] = static_cast<float>(rect.y)    / atlasSize;
+    buffer.shadowAtlasRect[2] = static_cast<float>(rect.size) / atlasSize;
+    buffer.shadowAtlasRect[3] = static_cast<float>(rect.size) / atlasSize;
+}
+
+// Rough measure of how much of the screen the light's shadows cover, from 0 to 1. Used to choose its shadow map resolution
+// Compares the width of the light's cone at the end of its shadow range with the width of the camera's view at that distance
+float Spotlight::ShadowImportance(const CVector3& cameraPosition, float cameraFOV)
+{
+    float distance = Length(model->Position() - cameraPosition);
+    if (distance < SPOTLIGHT_SHADOW_RANGE)  distance = SPOTLIGHT_SHADOW_RANGE;
+
+    float importance = SPOTLIGHT_SHADOW_RANGE * tan(ToRadians(gSpotlightConeAngle / 2)) / (distance * tan(cameraFOV / 2));
+    if (importance > 1.0f)  importance = 1.0f;
+    return importance;
+}
+
+// Whether the light may light anything in a camera's view (see MakeClusterView), false if it is off or its cone is wholly
+// outside one of the view's planes. The cone has no end since the light has no range
+bool Spotlight::LightsView(const ClusterView& view)
+{
+    if (buffer.colour.x <= 0 && buffer.colour.y <= 0 && buffer.colour.z <= 0)  return false;
+
+    float sinHalfAngle = sqrt(1 - buffer.cosHalfAngle * buffer.cosHalfAngle);
+    for (auto& plane : view.planes)
+    {
+        CVector3 normal = { plane[0], plane[1], plane[2] };
+        if (Dot(normal, buffer.position) + plane[3] >= 0)  continue;
+
+        // The apex is outside the plane, the cone crosses it if its direction nearest the plane's normal points inside
+        float cosAngle = Dot(normal, buffer.facing);
+        if (cosAngle >= buffer.cosHalfAngle)  continue;
+        float nearest = cosAngle * buffer.cosHalfAngle + sqrt(1 - cosAngle * cosAngle) * sinHalfAngle;
+        if (nearest <= 0)  return false;
+    }
+    return true;
 }
 
 // Get "camera-like" view matrix for a spotlight
@@ -89,106 +115,280 @@ CVector3 Spotlight::GetFacing()
     return Normalise(model->WorldMatrix().GetZAxis());
 }
 
-// Render the scene from the given light's point of view. Only renders depth buffer
-void Spotlight::RenderShadowMap(int numModels, SceneModel* models[])
+// Copy the per-frame constants with a light's matrices in place of the camera's, and send them to the GPU
+// A local copy is used because the other lights and the main scene may be recorded at the same time
+static void SetLightFrameConstants(CommandStream& commands, const CMatrix4x4& viewMatrix, const CMatrix4x4& projectionMatrix)
 {
-    // Get camera-like matrices from the spotlight, set in the constant buffer and send over to GPU
-    gPerFrameConstants.viewMatrix = CalculateLightViewMatrix();
-    gPerFrameConstants.projectionMatrix = CalculateLightProjectionMatrix();
-    gPerFrameConstants.viewProjectionMatrix = gPerFrameConstants.viewMatrix * gPerFrameConstants.projectionMatrix;
-    UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
+    // Set the light's camera-like matrices in the constant buffer and send over to GPU
+    PerFrameConstants frameConstants = gPerFrameConstants;
+    frameConstants.viewMatrix = viewMatrix;
+    frameConstants.projectionMatrix = projectionMatrix;
+    frameConstants.viewProjectionMatrix = frameConstants.viewMatrix * frameConstants.projectionMatrix;
+    commands.UpdateConstants(gPerFrameConstantBuffer, frameConstants);
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+    commands.BindConstantBuffer(0, gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
+}
+
+// True if the model is one of the given shadow casters
+static bool IsShadowCaster(const SceneModel* model, ShadowCasters casters)
+{
+    if (casters == ShadowCasters::All)  return true;
+    return model->dynamicShadow == (casters == ShadowCasters::Dynamic);
+}
 
+// Render the given models' depths into the current shadow map
+static void RenderDepthCasters(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters)
+{
     //// Only render models that cast shadows ////
 
-    // Use special depth-only rendering shaders
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gDepthOnlyPixelShader, nullptr, 0);
+    // Each render mode's shadow pipeline uses special depth-only rendering shaders (see the render mode table in Scene.cpp)
+    // No textures are used in this step so the only change between objects is the pipeline for different modes
+    for (int mode = 0; mode < NumRenderModes; ++mode)
+    {
+        const RenderModeInfo& renderMode = gRenderModes[mode];
+        if (renderMode.shadowPipeline == nullptr || renderMode.colouredShadow)  continue;
+
+        bool pipelineSet = false;
+        for (int i = 0; i < numModels; i++)
+        {
+            if (models[i]->renderMode == mode && IsShadowCaster(models[i], casters))
+            {
+                if (!pipelineSet)
+                {
+                    commands.SetPipeline(renderMode.shadowPipeline);
+                    pipelineSet = true;
+                }
+                models[i]->model->Render(commands, { 1, 1, 1 }, SHADOW_LOD_BIAS);
+            }
+        }
+    }
+}
+
+// Render the given transparent models into the current colour map
+static void RenderColourCasters(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters)
+{
+    /// Transparent models ///
+    // Multiplicative blending so the order doesn't matter
+    for (int mode = 0; mode < NumRenderModes; ++mode)
+    {
+        const RenderModeInfo& renderMode = gRenderModes[mode];
+        if (renderMode.shadowPipeline == nullptr || !renderMode.colouredShadow)  continue;
+
+        bool pipelineSet = false;
+        for (int i = 0; i < numModels; i++)
+        {
+            if (models[i]->renderMode == mode && IsShadowCaster(models[i], casters))
+            {
+                if (!pipelineSet)
+                {
+                    commands.SetPipeline(renderMode.shadowPipeline);
+                    pipelineSet = true;
+                }
+                models[i]->BindTextures(commands, UsesDiffuseMap);
+                models[i]->model->Render(commands, { 1, 1, 1 }, SHADOW_LOD_BIAS);
+            }
+        }
+    }
+}
+
+// Render the scene from the given light's point of view. Only renders depth buffer
+void Spotlight::RenderShadowMap(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters)
+{
+    SetLightFrameConstants(commands, mViewMatrix, mProjectionMatrix); // Calculated in SetBuffer
+    RenderDepthCasters(commands, numModels, models, casters);
+}
+
+void Spotlight::RenderColourMap(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters)
+{
+    SetLightFrameConstants(commands, mViewMatrix, mProjectionMatrix);
+    RenderColourCasters(commands, numModels, models, casters);
+}
+
+// The atlas region must already be clear, or hold the static shadows from the cache and casters be Dynamic
+void Spotlight::RenderFromLightPOV(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters)
+{
+    if (shadowRect.size == 0)  return; // Didn't fit in the atlas
+
+    // Setup the viewport to cover the light's region of the atlas
+    commands.SetViewport(static_cast<float>(shadowRect.size), static_cast<float>(shadowRect.size),
+                         static_cast<float>(shadowRect.x),    static_cast<float>(shadowRect.y));
+
+    // Select the shadow atlas as the current depth buffer. We will not be rendering any pixel colours
+    commands.SetRenderTargets(nullptr, shadowAtlasDepthStencil);
+
+    // Render the scene from the point of view of light (only depth values written)
+    RenderShadowMap(commands, numModels, models, casters);
+
+    // Create colour map
+    commands.SetRenderTargets(colourAtlasRenderTarget, shadowAtlasDepthStencil);
+
+    RenderColourMap(commands, numModels, models, casters);
+}
 
-    // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-    gD3DContext->RSSetState(gCullFrontState);
 
-    // Render models - no state changes required between each object in this situation (no textures used in this step)
-    for (int i = 0; i < numModels; i++)
+// Check if the static shadow cache is out of date. staticModelsVersion must change whenever a static model moves. Call each
+// frame after SetBuffer and SetShadowRect. Returns true if the cache must be rendered this frame (and counts the rebuild)
+bool Spotlight::UpdateShadowCache(unsigned int staticModelsVersion)
+{
+    if (shadowRect.size == 0)
     {
-        if (models[i]->renderMode == Default || models[i]->renderMode == TextureFade || models[i]->renderMode == NormalMap || models[i]->renderMode == ParallaxMap || models[i]->renderMode == Bright ||
-            models[i]->renderMode == TextureGradient || models[i]->renderMode == CubeMapLight || models[i]->renderMode == CubeMap)
-            models[i]->model->Render();
+        mCacheValid = false; // No shadows at all
+        return false;
     }
-    gD3DContext->VSSetShader(gWiggleVertexShader, nullptr, 0);
-    for (int i = 0; i < numModels; i++)
+
+    if (mCacheValid && staticModelsVersion == mCachedStaticVersion &&
+        shadowRect.x == mCachedRect.x && shadowRect.y == mCachedRect.y && shadowRect.size == mCachedRect.size &&
+        std::memcmp(&buffer.viewProjectionMatrix, &mCachedViewProjectionMatrix, sizeof(CMatrix4x4)) == 0)
     {
-        if (models[i]->renderMode == Wiggle) models[i]->model->Render();
+        return false;
     }
+
+    mCacheValid                 = true;
+    mCachedStaticVersion        = staticModelsVersion;
+    mCachedRect                 = shadowRect;
+    mCachedViewProjectionMatrix = buffer.viewProjectionMatrix;
+    ++cacheRebuilds;
+    return true;
 }
 
-void Spotlight::RenderColourMap(int numModels, SceneModel* models[])
+
+// Add the commands to render the static models' shadows into this light's region of the cache
+// The colour map is only depth tested against the static models, so a moving model between the light and a transparent
+// static model is still tinted by it. A small error given the transparent models and moving models in this scene
+void Spotlight::RenderShadowCache(CommandStream& commands, int numModels, SceneModel* models[])
 {
-    // Get camera-like matrices from the spotlight, set in the constant buffer and send over to GPU
-    gPerFrameConstants.viewMatrix = CalculateLightViewMatrix();
-    gPerFrameConstants.projectionMatrix = CalculateLightProjectionMatrix();
-    gPerFrameConstants.viewProjectionMatrix = gPerFrameConstants.viewMatrix * gPerFrameConstants.projectionMatrix;
-    UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
+    if (shadowRect.size == 0)  return; // Didn't fit in the atlas
 
-    // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+    commands.SetViewport(static_cast<float>(shadowRect.size), static_cast<float>(shadowRect.size),
+                         static_cast<float>(shadowRect.x),    static_cast<float>(shadowRect.y));
 
-    /// Transparent models ///
-    // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gMultiplicativeBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-    gD3DContext->RSSetState(gCullNoneState);
+    // Clear this light's region, the rest of the cache holds the other lights' shadows
+    commands.SetRenderTargets(colourCacheRenderTarget, shadowCacheDepthStencil);
+    commands.SetPipeline(gShadowClearPipeline);
+    commands.DrawGenerated(3);
+
+    commands.SetRenderTargets(nullptr, shadowCacheDepthStencil);
+    RenderShadowMap(commands, numModels, models, ShadowCasters::Static);
+
+    commands.SetRenderTargets(colourCacheRenderTarget, shadowCacheDepthStencil);
+    RenderColourMap(commands, numModels, models, ShadowCasters::Static);
+}
+
+CVector3 DirectionalLight::GetFacing()
+{
+    return Normalise(model->WorldMatrix().GetZAxis());
+}
+
+// Set a cascade's region of a shadow atlas of the given size, also stored in the buffer for the shaders
+void DirectionalLight::SetCascadeRect(int cascade, const AtlasRect& rect, uint32_t atlasSize)
+{
+    cascadeRects[cascade] = rect;
+    buffer.cascadeRects[cascade][0] = static_cast<float>(rect.x)    / atlasSize;
+    buffer.cascadeRects[cascade][1] = static_cast<float>(rect.y)    / atlasSize;
+    buffer.cascadeRects[cascade][2] = static_cast<float>(rect.size) / atlasSize;
+    buffer.cascadeRects[cascade][3] = static_cast<float>(rect.size) / atlasSize;
+}
+
+// Fit the cascades to the camera and fill in the buffer. Call each frame after SetCascadeRect
+void DirectionalLight::SetBuffer(Camera* camera)
+{
+    uint32_t resolutions[MAX_SHADOW_CASCADES];
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i)  resolutions[i] = cascadeRects[i].size;
+    cascades.Update(camera->ViewMatrix(), camera->ProjectionMatrix(), camera->NearClip(), GetFacing(), resolutions);
 
-    // Shaders
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gAlphaPixelShader, nullptr, 0);
+    buffer.direction   = GetFacing();
+    buffer.numCascades = static_cast<float>(cascades.NumCascades());
+    buffer.colour      = colour * (strength / DIRECTIONAL_LIGHT_REFERENCE_DISTANCE);
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i)
+    {
+        buffer.cascadeViewProjection[i] = cascades.ViewMatrix(i) * cascades.ProjectionMatrix(i);
+    }
+}
 
-    // Render models
-    for (int i = 0; i < numModels; i++)
+// Choose the models that cast shadows into each cascade, models that can't reach a cascade aren't drawn into it. Call each
+// frame after SetBuffer and before recording any cascade's passes
+void DirectionalLight::ChooseCasters(int numModels, SceneModel* models[])
+{
+    for (int cascade = 0; cascade < cascades.NumCascades(); ++cascade)
     {
-        if (models[i]->renderMode == AddBlendLight)
+        mCasters[cascade].clear();
+    }
+
+    for (int i = 0; i < numModels; ++i)
+    {
+        if (gRenderModes[models[i]->renderMode].shadowPipeline == nullptr)  continue;
+
+        BoundingSphere bounds = models[i]->model->Bounds();
+        for (int cascade = 0; cascade < cascades.NumCascades(); ++cascade)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &models[i]->texture->diffuseSpecularMapSRV);
-            models[i]->model->Render();
+            if (cascades.IsCaster(cascade, bounds.centre, bounds.radius))  mCasters[cascade].push_back(models[i]);
         }
     }
 }
 
-void Spotlight::RenderFromLightPOV(int numModels, SceneModel* models[])
+// Add the commands to clear a cascade's region of the atlas and render its shadow and colour maps
+void DirectionalLight::RenderCascade(CommandStream& commands, int cascade)
 {
-    // Setup the viewport to the size of the shadow map texture
-    D3D11_VIEWPORT vp;
-    vp.Width = static_cast<FLOAT>(shadowMapSize);
-    vp.Height = static_cast<FLOAT>(shadowMapSize);
-    vp.MinDepth = 0.0f;
-    vp.MaxDepth = 1.0f;
-    vp.TopLeftX = 0;
-    vp.TopLeftY = 0;
-    gD3DContext->RSSetViewports(1, &vp);
+    const AtlasRect& rect = cascadeRects[cascade];
+    if (rect.size == 0)  return; // Didn't fit in the atlas
 
-    // Select the shadow map texture as the current depth buffer. We will not be rendering any pixel colours
-    // Also clear the the shadow map depth buffer to the far distance
-    gD3DContext->OMSetRenderTargets(0, nullptr, shadowMapDepthStencil);
-    gD3DContext->ClearDepthStencilView(shadowMapDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    commands.SetViewport(static_cast<float>(rect.size), static_cast<float>(rect.size),
+                         static_cast<float>(rect.x),    static_cast<float>(rect.y));
 
-    // Render the scene from the point of view of light (only depth values written)
-    RenderShadowMap(numModels, models);
+    // Clear the cascade's region, the rest of the atlas holds the other shadow maps
+    commands.SetRenderTargets(colourAtlasRenderTarget, shadowAtlasDepthStencil);
+    commands.SetPipeline(gShadowClearPipeline);
+    commands.DrawGenerated(3);
 
-    // Create colour map
-    gD3DContext->OMSetRenderTargets(1, &colourMapRenderTarget, shadowMapDepthStencil);
-    gD3DContext->ClearRenderTargetView(colourMapRenderTarget, gWhite);
+    int numCasters = NumCasters(cascade);
+    SceneModel** casters = mCasters[cascade].data();
+    SetLightFrameConstants(commands, cascades.ViewMatrix(cascade), cascades.ProjectionMatrix(cascade));
+
+    commands.SetRenderTargets(nullptr, shadowAtlasDepthStencil);
+    RenderDepthCasters(commands, numCasters, casters, ShadowCasters::All);
+
+    commands.SetRenderTargets(colourAtlasRenderTarget, shadowAtlasDepthStencil);
+    RenderColourCasters(commands, numCasters, casters, ShadowCasters::All);
+}
+
+// Perceived brightness of a point light of the given intensity
+float PointlightLuminance(const CVector3& intensity)
+{
+    return 0.2126f * intensity.x + 0.7152f * intensity.y + 0.0722f * intensity.z;
+}
 
-    RenderColourMap(numModels, models);
+// Distance at which a point light of the given intensity (colour times strength, scaled as above) drops below the threshold
+// Luminance (perceived brightness) of the intensity falls off as luminance / distance^2, solve for the distance at the threshold
+float PointlightInfluenceRadius(const CVector3& intensity)
+{
+    float luminance = PointlightLuminance(intensity);
+    if (luminance <= 0)  return 0;
+    return sqrt(luminance / POINTLIGHT_LUMINANCE_THRESHOLD);
+}
+
+// Colour times strength, scaled for inverse-square falloff. This is what the shaders use as the light colour
+CVector3 Pointlight::Intensity()
+{
+    return colour * strength * POINTLIGHT_REFERENCE_DISTANCE;
+}
+
+// Distance beyond which the light has no effect, zero if the light is off
+float Pointlight::InfluenceRadius()
+{
+    return PointlightInfluenceRadius(Intensity());
+}
+
+// Bounding sphere of everything the light can reach
+BoundingSphere Pointlight::Bounds()
+{
+    return { model->Position(), InfluenceRadius() };
 }
 
 void Pointlight::SetBuffer()
 {
-    buffer.colour = colour * strength;
-    buffer.position = model->Position();
+    BoundingSphere bounds = Bounds();
+    buffer.colour = Intensity();
+    buffer.position = bounds.centre;
+    buffer.radius = bounds.radius;
 }
\ No newline at end of file
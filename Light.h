@@ -1,5 +1,13 @@
 #pragma once
 #include "SceneModel.h"
+#include "ShadowAtlas.h"
+#include "ShadowCascades.h"
+#include "LightAnimation.h"
+
+#include <vector>
+
+class Camera;
+struct ClusterView;
 
 // Base light class
 class Light : public SceneModel
@@ -9,30 +17,10 @@ public:
     CVector3 colour;
     float    strength;
 
-    // Flickering
-    bool flicker;
+    // Flickering and colour change are animated together with all the other animated lights (see LightAnimation.h)
     float flickerTime = 1.2f;
-    float strengthMax;
-    float currentStrength;
-    bool flickerDown = true;
-
-    // Colour change
-    bool colourChange = false;
-    CVector3 colours[7]
-    {
-        { 1.0f,  0.0f, 0.24f },
-        { 1.0f,  0.4f, 0.0f  },
-        { 0.9f,  1.0f, 0.0f  },
-        { 0.0f,  1.0f, 0.58f },
-        { 0.0f,  1.0f, 1.0f  },
-        { 0.0f,  0.5f, 1.0f  },
-        { 0.83f, 0.0f, 1.0f  }
-    };
-    int lastColour = 6;
     float colourSpeed = 1;
-    int currentColour = 0;
-    int nextColour = 1;
-    float colourProgress = 0;
+    int   animation = -1; // The light's index in the LightAnimation, -1 if not animated
 
     Light()
     {
@@ -41,49 +29,168 @@ public:
 
     virtual void SetStrength(float newStrength);
 
-    void MakeFlicker();
-    void MakeRainbow();
+    // Set the colour and strength first, they are what the animation starts from
+    void MakeFlicker(LightAnimation& lightAnimation);
+    void MakeRainbow(LightAnimation& lightAnimation);
 
-    void Update(float frameTime);
+    // Copy the colour and strength from the animation if they changed in its last update
+    void Update(const LightAnimation& lightAnimation);
+};
+
+// Which models to draw into a shadow map, see the static shadow cache below
+enum class ShadowCasters
+{
+    All,
+    Static,  // Models without SceneModel::dynamicShadow
+    Dynamic, // Models with SceneModel::dynamicShadow
 };
 
 // Spotlight class with shadows
 class Spotlight : public Light
 {
 public:
-    const int shadowMapSize = 4096; // Dimensions of shadow map texture - controls quality of shadows
-
     SpotlightBuffer buffer;
     float gSpotlightConeAngle = 90.0f; // Spot light cone angle (degrees), like the FOV (field-of-view) of the spot light
-    bool isSpot = true;
 
-    // The shadow texture - effectively a depth buffer of the scene **from the light's point of view**
+    // The shadow map - effectively a depth buffer of the scene **from the light's point of view**
     // Each frame it is rendered to, then the texture is used to help the per-pixel lighting shader identify pixels in shadow
-    ID3D11Texture2D* shadowMapTexture = nullptr; // This object represents the memory used by the texture on the GPU
-    ID3D11DepthStencilView* shadowMapDepthStencil = nullptr; // This object is used when we want to render to the texture above **as a depth buffer**
-    ID3D11ShaderResourceView* shadowMapSRV = nullptr; // This object is used to give shaders access to the texture above (SRV = shader resource view)
-
-    ID3D11Texture2D* colourMapTexture = nullptr;
-    ID3D11RenderTargetView* colourMapRenderTarget = nullptr;
-    ID3D11ShaderResourceView* colourMapSRV = nullptr;
+    // All the lights share one depth texture and one colour texture, each light renders into its own region (see ShadowAtlas.h)
+    // The textures are owned by the scene, the light only keeps the views it renders to
+    AtlasRect shadowRect = { 0, 0, 0 }; // The light's region of the atlas, no shadows if the size is zero
+    ID3D11DepthStencilView* shadowAtlasDepthStencil = nullptr;
+    ID3D11RenderTargetView* colourAtlasRenderTarget = nullptr;
+
+    // Static shadow cache - the shadows of models that don't move are rendered into a second pair of atlas textures laid out
+    // the same way. They are only rendered again when the light, its atlas region or a static model changes. Each frame the
+    // scene copies the cache into the atlas and the lights only draw the moving models on top
+    ID3D11DepthStencilView* shadowCacheDepthStencil = nullptr;
+    ID3D11RenderTargetView* colourCacheRenderTarget = nullptr;
+    unsigned int cacheRebuilds = 0; // Number of times the cache has been rendered
 
     Spotlight()
     {
 
     }
 
+    // Fill in the buffer for the shaders and the matrices for rendering the shadow maps. Call each frame before adding the
+    // shadow map passes. The matrices are only calculated again if the light has moved
     void SetBuffer();
 
+    // Set the light's region of a shadow atlas of the given size, also stored in the buffer for the shaders
+    void SetShadowRect(const AtlasRect& rect, uint32_t atlasSize);
+
+    // Rough measure of how much of the screen the light's shadows cover, from 0 to 1. Used to choose its shadow map resolution
+    float ShadowImportance(const CVector3& cameraPosition, float cameraFOV);
+
     CVector3 GetFacing();
 
-    void RenderFromLightPOV(int numModels, SceneModel* models[]);
-    void RenderColourMap(int numModels, SceneModel* models[]);
+    // Whether the light may light anything in a camera's view (see MakeClusterView), false if it is off or its cone is wholly
+    // outside one of the view's planes. Call after SetBuffer
+    bool LightsView(const ClusterView& view);
+
+    // Check if the static shadow cache is out of date. staticModelsVersion must change whenever a static model moves. Call each
+    // frame after SetBuffer and SetShadowRect. Returns true if the cache must be rendered this frame (and counts the rebuild)
+    bool UpdateShadowCache(unsigned int staticModelsVersion);
+
+    // Mark the cache as out of date, e.g. if the cache textures have been cleared
+    void InvalidateShadowCache()  { mCacheValid = false; }
+
+    // Add the commands to render the static models' shadows into this light's region of the cache
+    void RenderShadowCache(CommandStream& commands, int numModels, SceneModel* models[]);
+
+    // Add the commands to render the shadow and colour maps for this light to the given stream. Only reads the light and models,
+    // so the passes for each light can be recorded on different threads at the same time (see PassRecorder.h)
+    // The atlas region must already be clear, or hold the static shadows from the cache and casters be Dynamic
+    void RenderFromLightPOV(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters = ShadowCasters::All);
+    void RenderColourMap(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters = ShadowCasters::All);
 
     CMatrix4x4 CalculateLightViewMatrix();
     CMatrix4x4 CalculateLightProjectionMatrix();
-    void RenderShadowMap(int numModels, SceneModel* models[]);
+    void RenderShadowMap(CommandStream& commands, int numModels, SceneModel* models[], ShadowCasters casters = ShadowCasters::All);
+
+private:
+    // What the buffer's matrices and cone were last calculated from, they are only calculated again when these change
+    bool       mBufferValid = false;
+    CMatrix4x4 mBufferWorldMatrix;
+    float      mBufferConeAngle = 0;
+    CMatrix4x4 mViewMatrix;       // Camera-like matrices for rendering the shadow maps, from the last SetBuffer
+    CMatrix4x4 mProjectionMatrix;
+
+    // What the cache was rendered with
+    bool         mCacheValid = false;
+    CMatrix4x4   mCachedViewProjectionMatrix;
+    AtlasRect    mCachedRect = { 0, 0, 0 };
+    unsigned int mCachedStaticVersion = 0;
+};
+
+// Directional light strengths in the scene were chosen for an older fake directional light, a spotlight whose light was divided
+// by this distance. The directional light's colour is scaled to give the same brightness
+const float DIRECTIONAL_LIGHT_REFERENCE_DISTANCE = 150.0f;
+
+// Directional light, like the sun. The light travels the way the light's model faces, the model's position is only used to show
+// where the light is. Shadows use cascades fitted to the camera's view (see ShadowCascades.h), each cascade rendering into its own
+// region of the shadow atlas shared with the spotlights. Cascades are rendered every frame as they move with the camera, so they
+// don't use the static shadow cache
+class DirectionalLight : public Light
+{
+public:
+    DirectionalLightBuffer buffer;
+    ShadowCascades cascades;
+
+    AtlasRect cascadeRects[MAX_SHADOW_CASCADES] = {}; // Each cascade's region of the atlas, no shadows if the size is zero
+    ID3D11DepthStencilView* shadowAtlasDepthStencil = nullptr;
+    ID3D11RenderTargetView* colourAtlasRenderTarget = nullptr;
+
+    DirectionalLight()
+    {
+
+    }
+
+    CVector3 GetFacing();
+
+    // Set a cascade's region of a shadow atlas of the given size, also stored in the buffer for the shaders
+    void SetCascadeRect(int cascade, const AtlasRect& rect, uint32_t atlasSize);
+
+    // Fit the cascades to the camera and fill in the buffer. Call each frame after SetCascadeRect
+    void SetBuffer(Camera* camera);
+
+    // Choose the models that cast shadows into each cascade, models that can't reach a cascade aren't drawn into it. Call each
+    // frame after SetBuffer and before recording any cascade's passes
+    void ChooseCasters(int numModels, SceneModel* models[]);
+
+    // Number of models drawn into a cascade this frame
+    int NumCasters(int cascade) const  { return static_cast<int>(mCasters[cascade].size()); }
+
+    // Add the commands to clear a cascade's region of the atlas and render its shadow and colour maps. Only reads the light
+    // and models, so each cascade's pass can be recorded on a different thread (see PassRecorder.h)
+    void RenderCascade(CommandStream& commands, int cascade);
+
+private:
+    std::vector<SceneModel*> mCasters[MAX_SHADOW_CASCADES];
 };
 
+// Shadow casters are drawn this many levels of detail simpler than in the main pass (see MeshSimplifier.h). Shadow maps have
+// fewer texels than the screen and the silhouette is all that shows, so the lost detail is rarely visible
+const int SHADOW_LOD_BIAS = 1;
+
+// Spotlights are assumed to cast shadows over about this distance in front of them when judging their importance
+const float SPOTLIGHT_SHADOW_RANGE = 30.0f;
+
+// Point lights fall off with the inverse square of distance, like real lights. The falloff is smoothly brought down to zero at
+// the light's influence radius, the distance where its luminance would drop below this threshold. Lights have no effect
+// outside their radius, so culling and cluster assignment (see LightClusters.h) can skip them
+const float POINTLIGHT_LUMINANCE_THRESHOLD = 0.005f;
+
+// Light strengths in the scene were chosen for an older 1 / distance falloff. Point light intensity is scaled so the
+// inverse-square falloff gives the same brightness at this distance
+const float POINTLIGHT_REFERENCE_DISTANCE = 20.0f;
+
+// Perceived brightness of a point light of the given intensity
+float PointlightLuminance(const CVector3& intensity);
+
+// Distance at which a point light of the given intensity (colour times strength, scaled as above) drops below the threshold
+float PointlightInfluenceRadius(const CVector3& intensity);
+
 class Pointlight : public Light
 {
 public:
@@ -94,5 +201,14 @@ public:
 
     PointlightBuffer buffer;
 
+    // Colour times strength, scaled for inverse-square falloff. This is what the shaders use as the light colour
+    CVector3 Intensity();
+
+    // Distance beyond which the light has no effect, zero if the light is off
+    float InfluenceRadius();
+
+    // Bounding sphere of everything the light can reach
+    BoundingSphere Bounds();
+
     void SetBuffer();
 };
\ No newline at end of file
@@ -0,0 +1,157 @@
+//--------------------------------------------------------------------------------------
+// Light animation - flickering and colour cycling for many lights at once
+//--------------------------------------------------------------------------------------
+
+#include "LightAnimation.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LIGHT_ANIMATION_USE_SSE
+#endif
+
+// Values in mChanged
+const uint8_t CHANGED_IN_UPDATE    = 1;
+const uint8_t CHANGED_SINCE_UPDATE = 2; // Added or changed since the last update, so will be listed by the next
+
+
+// Add a light with the given colour and strength, which stay as they are until the light is made to flicker or change
+// colour. Returns the light's index
+uint32_t LightAnimation::AddLight(const CVector3& colour, float strength)
+{
+    uint32_t light = NumLights();
+
+    mStrengths.push_back(strength);
+    mMaxStrengths.push_back(strength);
+    mFlickerRates.push_back(0);
+
+    mColourProgress.push_back(0);
+    mColourSpeeds.push_back(0);
+    mFromRed.push_back(colour.x);  mFromGreen.push_back(colour.y);  mFromBlue.push_back(colour.z);
+    mToRed.push_back(colour.x);    mToGreen.push_back(colour.y);    mToBlue.push_back(colour.z);
+    mNextColours.push_back(0);
+
+    mRed.push_back(colour.x);  mGreen.push_back(colour.y);  mBlue.push_back(colour.z);
+
+    mChanged.push_back(CHANGED_SINCE_UPDATE);
+    return light;
+}
+
+
+// Fade the light's strength down to zero and back up to its strength, taking flickerTime seconds each way
+void LightAnimation::MakeFlicker(uint32_t light, float flickerTime)
+{
+    mFlickerRates[light] = -mMaxStrengths[light] / flickerTime; // Starts fading out
+    mChanged[light] = CHANGED_SINCE_UPDATE;
+}
+
+
+// Blend the light's colour through the rainbow colours, starting from the given one. Moves on colourSpeed colours a second
+void LightAnimation::MakeRainbow(uint32_t light, float colourSpeed, int firstColour /*= 0*/)
+{
+    int toColour = (firstColour + 1) % NUM_RAINBOW_COLOURS;
+    const CVector3& from = RAINBOW_COLOURS[firstColour];
+    const CVector3& to   = RAINBOW_COLOURS[toColour];
+
+    mColourProgress[light] = 0;
+    mColourSpeeds[light]   = colourSpeed;
+    mFromRed[light] = from.x;  mFromGreen[light] = from.y;  mFromBlue[light] = from.z;
+    mToRed[light]   = to.x;    mToGreen[light]   = to.y;    mToBlue[light]   = to.z;
+    mNextColours[light] = (toColour + 1) % NUM_RAINBOW_COLOURS;
+
+    mRed[light] = from.x;  mGreen[light] = from.y;  mBlue[light] = from.z;
+    mChanged[light] = CHANGED_SINCE_UPDATE;
+}
+
+
+// Animate all the lights over the given time, then list the ones that changed
+void LightAnimation::Update(float frameTime)
+{
+    uint32_t numLights = NumLights();
+
+    // Move a light on to blending towards the next rainbow colour, called when its progress passes 1. Rare enough to not
+    // be worth doing four at a time
+    auto nextColour = [&](uint32_t i)
+    {
+        const CVector3& to = RAINBOW_COLOURS[mNextColours[i]];
+        mColourProgress[i] -= 1.0f;
+        mFromRed[i] = mToRed[i];  mFromGreen[i] = mToGreen[i];  mFromBlue[i] = mToBlue[i];
+        mToRed[i]   = to.x;       mToGreen[i]   = to.y;         mToBlue[i]   = to.z;
+        mNextColours[i] = (mNextColours[i] + 1) % NUM_RAINBOW_COLOURS;
+    };
+
+    mChangedLights.clear();
+    uint32_t i = 0;
+
+#ifdef LIGHT_ANIMATION_USE_SSE
+    // Four lights at a time
+    __m128 time     = _mm_set1_ps(frameTime);
+    __m128 zero     = _mm_setzero_ps();
+    __m128 one      = _mm_set1_ps(1.0f);
+    __m128 signMask = _mm_set1_ps(-0.0f);
+    for (; i + 4 <= numLights; i += 4)
+    {
+        //// Flickering ////
+
+        // Move the strength at the flicker rate, turning round when it reaches zero or the light's full strength
+        __m128 rate        = _mm_loadu_ps(&mFlickerRates[i]);
+        __m128 maxStrength = _mm_loadu_ps(&mMaxStrengths[i]);
+        __m128 strength    = _mm_add_ps(_mm_loadu_ps(&mStrengths[i]), _mm_mul_ps(rate, time));
+        __m128 turn        = _mm_or_ps(_mm_cmplt_ps(strength, zero), _mm_cmpgt_ps(strength, maxStrength));
+        _mm_storeu_ps(&mStrengths[i], _mm_min_ps(_mm_max_ps(strength, zero), maxStrength));
+        _mm_storeu_ps(&mFlickerRates[i], _mm_xor_ps(rate, _mm_and_ps(turn, signMask)));
+
+        //// Colour cycling ////
+
+        __m128 speed    = _mm_loadu_ps(&mColourSpeeds[i]);
+        __m128 progress = _mm_add_ps(_mm_loadu_ps(&mColourProgress[i]), _mm_mul_ps(speed, time));
+        _mm_storeu_ps(&mColourProgress[i], progress);
+        int passed = _mm_movemask_ps(_mm_cmpgt_ps(progress, one));
+        if (passed != 0)
+        {
+            for (uint32_t lane = 0; lane < 4; ++lane)
+            {
+                if (passed & (1 << lane))  nextColour(i + lane);
+            }
+            progress = _mm_loadu_ps(&mColourProgress[i]);
+        }
+
+        // Blend between the two colours, lights that don't change colour have the same colour at both ends
+        __m128 fromRed   = _mm_loadu_ps(&mFromRed[i]);
+        __m128 fromGreen = _mm_loadu_ps(&mFromGreen[i]);
+        __m128 fromBlue  = _mm_loadu_ps(&mFromBlue[i]);
+        _mm_storeu_ps(&mRed[i],   _mm_add_ps(fromRed,   _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&mToRed[i]),   fromRed),   progress)));
+        _mm_storeu_ps(&mGreen[i], _mm_add_ps(fromGreen, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&mToGreen[i]), fromGreen), progress)));
+        _mm_storeu_ps(&mBlue[i],  _mm_add_ps(fromBlue,  _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&mToBlue[i]),  fromBlue),  progress)));
+
+        //// Changes ////
+
+        // Animated lights change every update, others only if they were changed since the last
+        int animated = _mm_movemask_ps(_mm_or_ps(_mm_cmpneq_ps(rate, zero), _mm_cmpneq_ps(speed, zero)));
+        for (uint32_t lane = 0; lane < 4; ++lane)
+        {
+            bool changed = (animated & (1 << lane)) || mChanged[i + lane] == CHANGED_SINCE_UPDATE;
+            mChanged[i + lane] = changed ? CHANGED_IN_UPDATE : 0;
+            if (changed)  mChangedLights.push_back(i + lane);
+        }
+    }
+#endif
+
+    // Remaining lights (or all of them without SSE)
+    for (; i < numLights; ++i)
+    {
+        float strength = mStrengths[i] + mFlickerRates[i] * frameTime;
+        if (strength < 0 || strength > mMaxStrengths[i])  mFlickerRates[i] = -mFlickerRates[i];
+        mStrengths[i] = (strength < 0) ? 0 : (strength > mMaxStrengths[i]) ? mMaxStrengths[i] : strength;
+
+        mColourProgress[i] += mColourSpeeds[i] * frameTime;
+        if (mColourProgress[i] > 1.0f)  nextColour(i);
+        float progress = mColourProgress[i];
+        mRed[i]   = mFromRed[i]   + (mToRed[i]   - mFromRed[i])   * progress;
+        mGreen[i] = mFromGreen[i] + (mToGreen[i] - mFromGreen[i]) * progress;
+        mBlue[i]  = mFromBlue[i]  + (mToBlue[i]  - mFromBlue[i])  * progress;
+
+        bool changed = mFlickerRates[i] != 0 || mColourSpeeds[i] != 0 || mChanged[i] == CHANGED_SINCE_UPDATE;
+        mChanged[i] = changed ? CHANGED_IN_UPDATE : 0;
+        if (changed)  mChangedLights.push_back(i);
+    }
+}
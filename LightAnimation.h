@@ -0,0 +1,85 @@
+//--------------------------------------------------------------------------------------
+// Light animation - flickering and colour cycling for many lights at once
+//--------------------------------------------------------------------------------------
+// Lights that flicker (fade out and back in) or cycle through the rainbow colours are all
+// animated together here rather than one at a time. The animation state is kept in structure of
+// arrays form so each step is done for four lights at once with SSE, with no branches for the
+// different kinds of animation: a light that doesn't flicker just has a flicker rate of zero.
+//
+// After each update the lights whose colour or strength changed are listed, so the scene only
+// copies those back and everything else (buffers, influence radii) can be left as it was.
+// Doesn't use any Direct3D so it can be profiled on any platform.
+
+#ifndef _LIGHT_ANIMATION_H_INCLUDED_
+#define _LIGHT_ANIMATION_H_INCLUDED_
+
+#include "CVector3.h"
+
+#include <vector>
+#include <cstdint>
+
+// Colours rainbow lights cycle through, in order
+const int NUM_RAINBOW_COLOURS = 7;
+const CVector3 RAINBOW_COLOURS[NUM_RAINBOW_COLOURS] =
+{
+    { 1.0f,  0.0f, 0.24f },
+    { 1.0f,  0.4f, 0.0f  },
+    { 0.9f,  1.0f, 0.0f  },
+    { 0.0f,  1.0f, 0.58f },
+    { 0.0f,  1.0f, 1.0f  },
+    { 0.0f,  0.5f, 1.0f  },
+    { 0.83f, 0.0f, 1.0f  }
+};
+
+class LightAnimation
+{
+public:
+    // Add a light with the given colour and strength, which stay as they are until the light is made to flicker or change
+    // colour. Returns the light's index
+    uint32_t AddLight(const CVector3& colour, float strength);
+
+    // Fade the light's strength down to zero and back up to its strength, taking flickerTime seconds each way
+    void MakeFlicker(uint32_t light, float flickerTime);
+
+    // Blend the light's colour through the rainbow colours, starting from the given one. Moves on colourSpeed colours a second
+    void MakeRainbow(uint32_t light, float colourSpeed, int firstColour = 0);
+
+    // Animate all the lights over the given time, then list the ones that changed
+    void Update(float frameTime);
+
+    uint32_t NumLights() const  { return static_cast<uint32_t>(mStrengths.size()); }
+
+    // Current colour and strength of a light
+    CVector3 Colour(uint32_t light) const  { return { mRed[light], mGreen[light], mBlue[light] }; }
+    float    Strength(uint32_t light) const  { return mStrengths[light]; }
+
+    // True if a light's colour or strength changed in the last update (or it was added or changed since)
+    bool Changed(uint32_t light) const  { return mChanged[light] != 0; }
+
+    // The lights that changed in the last update, in order
+    const std::vector<uint32_t>& ChangedLights() const  { return mChangedLights; }
+
+private:
+    // Flickering. The rate is the change in strength per second, negative while fading out, zero if the light doesn't flicker
+    std::vector<float> mStrengths;
+    std::vector<float> mMaxStrengths;
+    std::vector<float> mFlickerRates;
+
+    // Colour cycling. Colours are blended from one rainbow colour to the next, zero speed if the light doesn't change colour
+    // (it then has the same colour at both ends)
+    std::vector<float> mColourProgress;
+    std::vector<float> mColourSpeeds;
+    std::vector<float> mFromRed, mFromGreen, mFromBlue;
+    std::vector<float> mToRed,   mToGreen,   mToBlue;
+    std::vector<int>   mNextColours; // Rainbow colour after the one being blended to
+
+    // Current colour
+    std::vector<float> mRed, mGreen, mBlue;
+
+    // Lights changed by the last update or since
+    std::vector<uint8_t>  mChanged;
+    std::vector<uint32_t> mChangedLights;
+};
+
+
+#endif //_LIGHT_ANIMATION_H_INCLUDED_
@@ -0,0 +1,296 @@
+//--------------------------------------------------------------------------------------
+// Light clusters - assigning point lights to a 3D grid over the camera's view frustum
+//--------------------------------------------------------------------------------------
+
+#include "LightClusters.h"
+
+#include <thread>
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define LIGHT_CLUSTERS_USE_SSE
+#endif
+
+
+// Size of the cluster grid. Depth slices cover clusterNear to clusterFar, anything nearer is in the first slice
+// and anything further is in the last. Assignment is split between numThreads threads (0 to use all cores)
+LightClusters::LightClusters(uint32_t tilesX /*= 16*/, uint32_t tilesY /*= 9*/, uint32_t slices /*= 24*/,
+                             float clusterNear /*= 1.0f*/, float clusterFar /*= 1000.0f*/, unsigned int numThreads /*= 0*/)
+    : mTilesX(tilesX), mTilesY(tilesY), mSlices(slices), mClusterNear(clusterNear), mClusterFar(clusterFar)
+{
+    // slice = log(depth / near) / log(far / near) * slices, rearranged to a single multiply-add in the shader
+    float logRange = std::log(clusterFar / clusterNear);
+    mDepthScale = slices / logRange;
+    mDepthBias  = -slices * std::log(clusterNear) / logRange;
+
+    if (numThreads == 0)  numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min(numThreads, slices);
+
+    // Each thread gets an even share of the slices
+    mRanges.resize(numThreads);
+    for (unsigned int i = 0; i < numThreads; ++i)
+    {
+        mRanges[i].firstSlice = slices * i / numThreads;
+        mRanges[i].lastSlice  = slices * (i + 1) / numThreads;
+    }
+
+    mClusters.resize(tilesX * tilesY * slices);
+    mClusterMin.resize(mClusters.size());
+    mClusterMax.resize(mClusters.size());
+    mSliceDepths.resize(slices + 1);
+}
+
+
+// Set the camera's (perspective) projection matrix and clip distances. Cluster bounds are only recalculated if they change
+void LightClusters::SetProjection(const CMatrix4x4& projectionMatrix, float nearClip, float farClip)
+{
+    if (projectionMatrix.e00 == mScaleX && projectionMatrix.e11 == mScaleY && nearClip == mNearClip && farClip == mFarClip)  return;
+
+    mScaleX   = projectionMatrix.e00;
+    mScaleY   = projectionMatrix.e11;
+    mNearClip = nearClip;
+    mFarClip  = farClip;
+    CalculateClusterBounds();
+}
+
+
+// Calculate the view-space bounding box of every cluster. A point at view depth z is on screen if -z < x * scaleX < z
+// (same for y), so the edges of each tile are lines through the camera and the box is found from the tile corners
+// at the near and far depth of the slice
+void LightClusters::CalculateClusterBounds()
+{
+    // The first and last slices stretch to the camera's clip distances
+    for (uint32_t slice = 0; slice <= mSlices; ++slice)
+    {
+        mSliceDepths[slice] = mClusterNear * std::pow(mClusterFar / mClusterNear, static_cast<float>(slice) / mSlices);
+    }
+    mSliceDepths[0]       = std::min(mNearClip, mClusterNear);
+    mSliceDepths[mSlices] = std::max(mFarClip,  mClusterFar);
+
+    for (uint32_t slice = 0; slice < mSlices; ++slice)
+    {
+        float nearZ = mSliceDepths[slice];
+        float farZ  = mSliceDepths[slice + 1];
+        for (uint32_t y = 0; y < mTilesY; ++y)
+        {
+            // Tile rows go from the top of the screen down
+            float top    = 1.0f - 2.0f *  y      / mTilesY;
+            float bottom = 1.0f - 2.0f * (y + 1) / mTilesY;
+            for (uint32_t x = 0; x < mTilesX; ++x)
+            {
+                float left  = -1.0f + 2.0f *  x      / mTilesX;
+                float right = -1.0f + 2.0f * (x + 1) / mTilesX;
+
+                uint32_t cluster = x + (y + slice * mTilesY) * mTilesX;
+                mClusterMin[cluster] = { std::min(left  * nearZ, left  * farZ) / mScaleX,
+                                         std::min(bottom * nearZ, bottom * farZ) / mScaleY, nearZ };
+                mClusterMax[cluster] = { std::max(right * nearZ, right * farZ) / mScaleX,
+                                         std::max(top    * nearZ, top    * farZ) / mScaleY, farZ };
+            }
+        }
+    }
+}
+
+
+// Find the clusters touched by each light. Lights are given by world position and radius of influence,
+// their index in these arrays is the index stored in the cluster lists
+void LightClusters::AssignLights(const CVector3* positions, const float* radii, uint32_t numLights, const CMatrix4x4& viewMatrix)
+{
+    //// Transform the lights into view space ////
+
+    mX.resize(numLights);
+    mY.resize(numLights);
+    mZ.resize(numLights);
+    for (uint32_t i = 0; i < numLights; ++i)
+    {
+        mX[i] = positions[i].x;
+        mY[i] = positions[i].y;
+        mZ[i] = positions[i].z;
+    }
+
+    mViewX.resize(numLights);
+    mViewY.resize(numLights);
+    mViewZ.resize(numLights);
+    uint32_t i = 0;
+
+#ifdef LIGHT_CLUSTERS_USE_SSE
+    // Four lights at a time
+    __m128 m00 = _mm_set1_ps(viewMatrix.e00), m01 = _mm_set1_ps(viewMatrix.e01), m02 = _mm_set1_ps(viewMatrix.e02);
+    __m128 m10 = _mm_set1_ps(viewMatrix.e10), m11 = _mm_set1_ps(viewMatrix.e11), m12 = _mm_set1_ps(viewMatrix.e12);
+    __m128 m20 = _mm_set1_ps(viewMatrix.e20), m21 = _mm_set1_ps(viewMatrix.e21), m22 = _mm_set1_ps(viewMatrix.e22);
+    __m128 m30 = _mm_set1_ps(viewMatrix.e30), m31 = _mm_set1_ps(viewMatrix.e31), m32 = _mm_set1_ps(viewMatrix.e32);
+    for (; i + 4 <= numLights; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&mX[i]);
+        __m128 y = _mm_loadu_ps(&mY[i]);
+        __m128 z = _mm_loadu_ps(&mZ[i]);
+        _mm_storeu_ps(&mViewX[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m00), _mm_mul_ps(y, m10)), _mm_add_ps(_mm_mul_ps(z, m20), m30)));
+        _mm_storeu_ps(&mViewY[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m01), _mm_mul_ps(y, m11)), _mm_add_ps(_mm_mul_ps(z, m21), m31)));
+        _mm_storeu_ps(&mViewZ[i], _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m02), _mm_mul_ps(y, m12)), _mm_add_ps(_mm_mul_ps(z, m22), m32)));
+    }
+#endif
+
+    // Remaining lights (or all of them without SSE)
+    for (; i < numLights; ++i)
+    {
+        mViewX[i] = mX[i] * viewMatrix.e00 + mY[i] * viewMatrix.e10 + mZ[i] * viewMatrix.e20 + viewMatrix.e30;
+        mViewY[i] = mX[i] * viewMatrix.e01 + mY[i] * viewMatrix.e11 + mZ[i] * viewMatrix.e21 + viewMatrix.e31;
+        mViewZ[i] = mX[i] * viewMatrix.e02 + mY[i] * viewMatrix.e12 + mZ[i] * viewMatrix.e22 + viewMatrix.e32;
+    }
+
+    //// Assign lights to clusters, a range of slices on each thread ////
+
+    std::vector<std::thread> threads;
+    for (size_t range = 1; range < mRanges.size(); ++range)
+    {
+        threads.emplace_back(&LightClusters::AssignSlices, this, std::ref(mRanges[range]), radii, numLights);
+    }
+    AssignSlices(mRanges[0], radii, numLights);
+    for (auto& thread : threads)  thread.join();
+
+    //// Join the lists from each thread into one ////
+
+    // Ranges are in slice order and each range's clusters are contiguous, so only the offsets need adjusting
+    mLightIndices.clear();
+    mMaxLightsPerCluster = 0;
+    for (auto& range : mRanges)
+    {
+        uint32_t base = static_cast<uint32_t>(mLightIndices.size());
+        uint32_t firstCluster = range.firstSlice * mTilesX * mTilesY;
+        uint32_t lastCluster  = range.lastSlice  * mTilesX * mTilesY;
+        for (uint32_t cluster = firstCluster; cluster < lastCluster; ++cluster)
+        {
+            mClusters[cluster].offset += base;
+        }
+        mLightIndices.insert(mLightIndices.end(), range.indices.begin(), range.indices.end());
+        mMaxLightsPerCluster = std::max(mMaxLightsPerCluster, range.maxLightsPerCluster);
+    }
+}
+
+
+// Assign lights to the clusters in one range of slices. Offsets in mClusters are relative to the range's own index list
+// Each slice first finds the lights that overlap its depth range and the tiles they might cover, then checks each of
+// those lights against the bounding boxes of the clusters in its tile range
+void LightClusters::AssignSlices(SliceRange& range, const float* radii, uint32_t numLights)
+{
+    uint32_t numTiles = mTilesX * mTilesY;
+    range.indices.clear();
+    range.maxLightsPerCluster = 0;
+
+    for (uint32_t slice = range.firstSlice; slice < range.lastSlice; ++slice)
+    {
+        float nearZ = mSliceDepths[slice];
+        float farZ  = mSliceDepths[slice + 1];
+
+        //// Find lights touching the slice ////
+
+        range.candidates.clear();
+        uint32_t i = 0;
+
+#ifdef LIGHT_CLUSTERS_USE_SSE
+        // Test depths four lights at a time, most lights are usually outside any given slice
+        __m128 sliceNear = _mm_set1_ps(nearZ);
+        __m128 sliceFar  = _mm_set1_ps(farZ);
+        for (; i + 4 <= numLights; i += 4)
+        {
+            __m128 z = _mm_loadu_ps(&mViewZ[i]);
+            __m128 r = _mm_loadu_ps(radii + i);
+            __m128 inside = _mm_and_ps(_mm_cmpgt_ps(_mm_add_ps(z, r), sliceNear), _mm_cmplt_ps(_mm_sub_ps(z, r), sliceFar));
+            int mask = _mm_movemask_ps(inside);
+            while (mask != 0)
+            {
+                int lane = 0;
+                while (!(mask & (1 << lane)))  ++lane;
+                mask &= ~(1 << lane);
+                range.candidates.push_back({ i + lane, 0, 0, 0, 0 });
+            }
+        }
+#endif
+        for (; i < numLights; ++i)
+        {
+            if (mViewZ[i] + radii[i] > nearZ && mViewZ[i] - radii[i] < farZ)
+            {
+                range.candidates.push_back({ i, 0, 0, 0, 0 });
+            }
+        }
+
+        // Find the range of tiles each candidate might touch. The projected x of a point is x * scaleX / z, so the extremes of
+        // the sphere's x range within the slice are at the nearest or furthest depth of the part of the sphere inside it
+        for (auto& candidate : range.candidates)
+        {
+            uint32_t light = candidate.light;
+            float radius = radii[light];
+            float z0 = std::max(nearZ, mViewZ[light] - radius);
+            float z1 = std::min(farZ,  mViewZ[light] + radius);
+
+            float left   = (mViewX[light] - radius) * mScaleX;
+            float right  = (mViewX[light] + radius) * mScaleX;
+            float bottom = (mViewY[light] - radius) * mScaleY;
+            float top    = (mViewY[light] + radius) * mScaleY;
+            float minX = std::min(left   / z0, left   / z1);
+            float maxX = std::max(right  / z0, right  / z1);
+            float minY = std::min(bottom / z0, bottom / z1);
+            float maxY = std::max(top    / z0, top    / z1);
+
+            // Convert from -1 to 1 screen coordinates to tiles, top row first
+            auto toTile = [](float screen, uint32_t numTiles)
+            {
+                float tile = std::floor(screen * numTiles);
+                return static_cast<uint32_t>(std::min(std::max(tile, 0.0f), numTiles - 1.0f));
+            };
+            candidate.minX = toTile((minX + 1.0f) * 0.5f, mTilesX);
+            candidate.maxX = toTile((maxX + 1.0f) * 0.5f, mTilesX);
+            candidate.minY = toTile((1.0f - maxY) * 0.5f, mTilesY);
+            candidate.maxY = toTile((1.0f - minY) * 0.5f, mTilesY);
+        }
+
+        //// Build each cluster's list ////
+
+        // Test each candidate against the clusters in its tile range, keeping the tile and light of each hit
+        range.hits.clear();
+        for (auto& candidate : range.candidates)
+        {
+            uint32_t light = candidate.light;
+            float radiusSquared = radii[light] * radii[light];
+            for (uint32_t y = candidate.minY; y <= candidate.maxY; ++y)
+            {
+                for (uint32_t x = candidate.minX; x <= candidate.maxX; ++x)
+                {
+                    // Sphere against box - distance from the light to the nearest point in the box
+                    uint32_t tile = x + y * mTilesX;
+                    const CVector3& boxMin = mClusterMin[tile + slice * numTiles];
+                    const CVector3& boxMax = mClusterMax[tile + slice * numTiles];
+                    float dx = std::max(std::max(boxMin.x - mViewX[light], 0.0f), mViewX[light] - boxMax.x);
+                    float dy = std::max(std::max(boxMin.y - mViewY[light], 0.0f), mViewY[light] - boxMax.y);
+                    float dz = std::max(std::max(boxMin.z - mViewZ[light], 0.0f), mViewZ[light] - boxMax.z);
+                    if (dx * dx + dy * dy + dz * dz <= radiusSquared)
+                    {
+                        range.hits.push_back({ tile, light });
+                    }
+                }
+            }
+        }
+
+        // Counting sort of the hits by tile gives each cluster a contiguous list, lights stay in index order
+        range.counts.assign(numTiles, 0);
+        for (auto& hit : range.hits)  ++range.counts[hit.tile];
+
+        uint32_t offset = static_cast<uint32_t>(range.indices.size());
+        for (uint32_t tile = 0; tile < numTiles; ++tile)
+        {
+            uint32_t count = range.counts[tile];
+            mClusters[tile + slice * numTiles] = { offset, count };
+            range.counts[tile] = offset;
+            offset += count;
+            range.maxLightsPerCluster = std::max(range.maxLightsPerCluster, count);
+        }
+
+        range.indices.resize(offset);
+        for (auto& hit : range.hits)
+        {
+            range.indices[range.counts[hit.tile]++] = hit.light;
+        }
+    }
+}
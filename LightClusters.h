@@ -0,0 +1,113 @@
+//--------------------------------------------------------------------------------------
+// Light clusters - assigning point lights to a 3D grid over the camera's view frustum
+//--------------------------------------------------------------------------------------
+// The view frustum is split into tiles across the screen and slices in depth, each cell is a
+// "cluster". Every frame each point light (a sphere, its position and range) is added to the
+// list of every cluster it touches. The lists are sent to the GPU and each pixel shader finds its
+// cluster from its screen position and depth and only loops over the lights in that list. So the
+// cost of lighting a pixel depends on the number of lights that actually reach it rather than on
+// the number of lights in the scene, which allows thousands of small lights.
+//
+// Depth slices get thicker further from the camera (exponentially), which keeps clusters roughly
+// cube shaped. Slices are split between threads and lights are checked against each slice four at
+// a time with SSE. Doesn't use any Direct3D so it can be profiled on any platform.
+
+#ifndef _LIGHT_CLUSTERS_H_INCLUDED_
+#define _LIGHT_CLUSTERS_H_INCLUDED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+#include <cstdint>
+
+// The lights in one cluster, matches the uint2 read by the shaders
+struct LightCluster
+{
+    uint32_t offset; // Position of the cluster's first light in the light index list
+    uint32_t count;  // Number of lights in the cluster
+};
+
+class LightClusters
+{
+public:
+    // Size of the cluster grid. Depth slices cover clusterNear to clusterFar, anything nearer is in the first slice
+    // and anything further is in the last. Assignment is split between numThreads threads (0 to use all cores)
+    LightClusters(uint32_t tilesX = 16, uint32_t tilesY = 9, uint32_t slices = 24,
+                  float clusterNear = 1.0f, float clusterFar = 1000.0f, unsigned int numThreads = 0);
+
+    // Set the camera's (perspective) projection matrix and clip distances. Cluster bounds are only recalculated if they change
+    void SetProjection(const CMatrix4x4& projectionMatrix, float nearClip, float farClip);
+
+    // Find the clusters touched by each light. Lights are given by world position and radius of influence,
+    // their index in these arrays is the index stored in the cluster lists
+    void AssignLights(const CVector3* positions, const float* radii, uint32_t numLights, const CMatrix4x4& viewMatrix);
+
+    // Results of AssignLights. Clusters are ordered by tile x, then tile y (top row first), then depth slice
+    const std::vector<LightCluster>& Clusters() const      { return mClusters; }
+    const std::vector<uint32_t>&     LightIndices() const  { return mLightIndices; }
+
+    uint32_t TilesX() const  { return mTilesX; }
+    uint32_t TilesY() const  { return mTilesY; }
+    uint32_t Slices() const  { return mSlices; }
+
+    // The depth slice of a point is floor(log(view depth) * DepthScale() + DepthBias()), clamped to the slice range
+    float DepthScale() const  { return mDepthScale; }
+    float DepthBias() const   { return mDepthBias; }
+
+    // Statistics for the last AssignLights
+    uint32_t MaxLightsPerCluster() const  { return mMaxLightsPerCluster; }
+
+private:
+    // Lights are checked against one slice at a time, these are the ones found to touch it
+    struct Candidate
+    {
+        uint32_t light;
+        uint32_t minX, maxX, minY, maxY; // Range of tiles the light might touch in this slice
+    };
+
+    // A light found to touch the cluster at the given tile of the current slice
+    struct Hit
+    {
+        uint32_t tile;
+        uint32_t light;
+    };
+
+    // Work for one thread, a range of depth slices. The vectors are kept between frames to reuse the memory
+    struct SliceRange
+    {
+        uint32_t firstSlice, lastSlice;
+        std::vector<uint32_t>  indices;
+        std::vector<Candidate> candidates;
+        std::vector<Hit>       hits;
+        std::vector<uint32_t>  counts; // Per tile
+        uint32_t maxLightsPerCluster;
+    };
+
+    void CalculateClusterBounds();
+    void AssignSlices(SliceRange& range, const float* radii, uint32_t numLights);
+
+    uint32_t mTilesX, mTilesY, mSlices;
+    float    mClusterNear, mClusterFar;
+    float    mDepthScale, mDepthBias;
+
+    // Camera projection, only x and y scales are needed
+    float mScaleX = 0, mScaleY = 0;
+    float mNearClip = 0, mFarClip = 0;
+
+    // View-space bounds of each cluster and the depths of each slice (mSlices + 1 values)
+    std::vector<CVector3> mClusterMin, mClusterMax;
+    std::vector<float>    mSliceDepths;
+
+    // Light positions in view space, stored as separate arrays of x, y and z to transform and test four at a time
+    std::vector<float> mX, mY, mZ;
+    std::vector<float> mViewX, mViewY, mViewZ;
+
+    std::vector<SliceRange>   mRanges;
+    std::vector<LightCluster> mClusters;
+    std::vector<uint32_t>     mLightIndices;
+    uint32_t                  mMaxLightsPerCluster = 0;
+};
+
+
+#endif //_LIGHT_CLUSTERS_H_INCLUDED_
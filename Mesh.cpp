@@ -1,267 +1,360 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a mesh
 //--------------------------------------------------------------------------------------
-// The mesh class splits the mesh into sub-meshes that only use one texture each.
-// ** THIS VERSION WILL ONLY KEEP THE FIRST SUB-MESH OTHER PARTS WILL BE MISSING **
-// ** DO NOT USE THIS VERSION FOR PROJECTS **
+// The mesh class splits the mesh into sub-meshes that only use one texture each. The mesh's vertices
+// and indices are kept in a geometry pool shared with other meshes (see GeometryPool.h), each
+// sub-mesh is drawn from its own range of the mesh's part of the pool.
 // The class also doesn't load textures, filters or shaders as the outer code is
 // expected to select these things. A later lab will introduce a more robust loader.
 
 #include "Mesh.h"
-#include "Shader.h" // Needed for helper function CreateSignatureForVertexLayout
-#include "CVector2.h" 
+#include "MeshImport.h"
+#include "MeshCache.h"
+#include "MeshOptimiser.h"
+#include "MeshClusters.h"
 #include "CVector3.h" 
 
-#include <assimp/Importer.hpp>
-#include <assimp/DefaultLogger.hpp>
-#include <assimp/postprocess.h>
-#include <assimp/scene.h>
-
 #include <memory>
+#include <stdexcept>
+#include <vector>
+#include <cstring>
+#include <cmath>
 
 
-// Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
-// Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
-// Will throw a std::runtime_error exception on failure (since constructors can't return errors).
-Mesh::Mesh(const std::string& fileName, bool requireTangents /*= false*/)
+// Triangles drawn by all meshes, the scene resets it each frame. Atomic since meshes are rendered on several threads
+std::atomic<uint64_t> gTrianglesSubmitted(0);
+
+// Clusters tested and culled by all meshes, reset each frame like the triangles
+std::atomic<uint64_t> gClustersTested(0);
+std::atomic<uint64_t> gClustersCulled(0);
+
+
+// True if each vertex in the mesh data has the given part
+bool Mesh::HasVertexElement(const MeshData& data, VertexSemantic semantic)
 {
-    Assimp::Importer importer;
-
-    // Flags for processing the mesh. Assimp provides a huge amount of control - right click any of these
-    // and "Peek Definition" to see documention above each constant
-    unsigned int assimpFlags = aiProcess_MakeLeftHanded |
-                               aiProcess_GenSmoothNormals |
-                               aiProcess_FixInfacingNormals |
-                               aiProcess_GenUVCoords | 
-                               aiProcess_TransformUVCoords |
-                               aiProcess_FlipUVs |
-                               aiProcess_FlipWindingOrder |
-                               aiProcess_Triangulate |
-                               aiProcess_PreTransformVertices |
-                               aiProcess_JoinIdenticalVertices |
-                               aiProcess_ImproveCacheLocality |
-                               aiProcess_SortByPType |
-                               aiProcess_FindInvalidData | 
-                               aiProcess_OptimizeMeshes |
-                               aiProcess_FindInstances |
-                               aiProcess_FindDegenerates |
-                               aiProcess_RemoveRedundantMaterials |
-                               aiProcess_Debone |
-                               aiProcess_RemoveComponent;
-
-    // Flags to specify what mesh data to ignore
-    int removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS | 
-                           aiComponent_BONEWEIGHTS | aiComponent_ANIMATIONS | aiComponent_MATERIALS;
-
-    // Add / remove tangents as required by user
-    if (requireTangents)
+    for (uint32_t i = 0; i < data.description.numElements; ++i)
     {
-        assimpFlags |= aiProcess_CalcTangentSpace;
+        if (data.description.elements[i].semantic == semantic)  return true;
     }
-    else
+    return false;
+}
+
+
+// Copy of the mesh data with one part removed from each vertex, e.g. the tangents
+std::unique_ptr<MeshData> Mesh::RemoveVertexElement(const MeshData& data, VertexSemantic semantic)
+{
+    const CookedMesh& source = data.description;
+    auto result = std::make_unique<MeshData>();
+    CookedMesh& mesh = result->description;
+    mesh = source;
+
+    // The parts after the removed one move down to fill the gap
+    uint32_t removedSize = 0;
+    mesh.numElements = 0;
+    for (uint32_t i = 0; i < source.numElements; ++i)
     {
-        removeComponents |= aiComponent_TANGENTS_AND_BITANGENTS;
+        if (source.elements[i].semantic == semantic)
+        {
+            removedSize = VertexElementSize(source.elements[i]);
+            continue;
+        }
+        mesh.elements[mesh.numElements] = source.elements[i];
+        mesh.elements[mesh.numElements].offset -= removedSize;
+        ++mesh.numElements;
     }
+    mesh.vertexSize = source.vertexSize - removedSize;
 
-    // Other miscellaneous settings
-    importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, 80.0f); // Smoothing angle for normals
-    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);  // Remove points and lines (keep triangles only)
-    importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);                 // Remove degenerate triangles
-    importer.SetPropertyBool(AI_CONFIG_PP_DB_ALL_OR_NONE, true);            // Default to removing bones/weights from meshes that don't need skinning
-  
-    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removeComponents);
-
-    // Import mesh with assimp given above requirements - log output
-    Assimp::DefaultLogger::create("", Assimp::DefaultLogger::VERBOSE);
-    const aiScene* scene = importer.ReadFile(fileName, assimpFlags);
-    Assimp::DefaultLogger::kill();
-    if (scene == nullptr)  throw std::runtime_error("Error loading mesh (" + fileName + "). " + importer.GetErrorString());
-    if (scene->mNumMeshes == 0)  throw std::runtime_error("No usable geometry in mesh: " + fileName);
-
-
-    //-----------------------------------
-
-    // Only importing first submesh - significant limitation - do not use this importer for your own projects
-    aiMesh* assimpMesh = scene->mMeshes[0];
-    std::string subMeshName = assimpMesh->mName.C_Str();
-
-    
-    //-----------------------------------
-
-    // Check for presence of position and normal data. Tangents and UVs are optional.
-    std::vector<D3D11_INPUT_ELEMENT_DESC> vertexElements;
-    unsigned int offset = 0;
-    
-    if (!assimpMesh->HasPositions())  throw std::runtime_error("No position data for sub-mesh " + subMeshName + " in " + fileName);
-    unsigned int positionOffset = offset;
-    vertexElements.push_back( { "Position", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, positionOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-    offset += 12;
-
-    if (!assimpMesh->HasNormals())  throw std::runtime_error("No normal data for sub-mesh " + subMeshName + " in " + fileName);
-    unsigned int normalOffset = offset;
-    vertexElements.push_back( { "Normal", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, normalOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-    offset += 12;
-
-    unsigned int tangentOffset = offset;
-    if (requireTangents)
+    // Copy each part of each vertex to its new place
+    result->vertices = std::make_unique<unsigned char[]>(mesh.numVertices * mesh.vertexSize);
+    const unsigned char* sourceVertex = static_cast<const unsigned char*>(source.vertices);
+    unsigned char* vertex = result->vertices.get();
+    for (uint32_t v = 0; v < mesh.numVertices; ++v)
     {
-        if (!assimpMesh->HasTangentsAndBitangents())  throw std::runtime_error("No tangent data for sub-mesh " + subMeshName + " in " + fileName);
-        vertexElements.push_back( { "Tangent", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, tangentOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-        offset += 12;
+        unsigned char* part = vertex;
+        for (uint32_t i = 0; i < source.numElements; ++i)
+        {
+            const VertexElement& element = source.elements[i];
+            if (element.semantic == semantic)  continue;
+            std::memcpy(part, sourceVertex + element.offset, VertexElementSize(element));
+            part += VertexElementSize(element);
+        }
+        sourceVertex += source.vertexSize;
+        vertex += mesh.vertexSize;
     }
-    
-    unsigned int uvOffset = offset;
-    if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
+    mesh.vertices = result->vertices.get();
+
+    result->indices = std::make_unique<unsigned char[]>(mesh.numIndices * mesh.indexSize);
+    std::memcpy(result->indices.get(), source.indices, mesh.numIndices * mesh.indexSize);
+    mesh.indices = result->indices.get();
+
+    result->subMeshes = std::make_unique<SubMesh[]>(mesh.numSubMeshes * mesh.numLods);
+    std::memcpy(result->subMeshes.get(), source.subMeshes, mesh.numSubMeshes * mesh.numLods * sizeof(SubMesh));
+    mesh.subMeshes = result->subMeshes.get();
+
+    result->clusters = std::make_unique<MeshCluster[]>(mesh.numClusters);
+    std::memcpy(result->clusters.get(), source.clusters, mesh.numClusters * sizeof(MeshCluster));
+    mesh.clusters = result->clusters.get();
+
+    return result;
+}
+
+
+// A cube from -1 to 1 with normals, tangents and UVs, drawn in place of meshes that are still loading
+std::unique_ptr<MeshData> Mesh::Box()
+{
+    // Each face's normal and the direction of its U texture coordinate (its tangent)
+    const CVector3 faces[6][2] = { { {  1, 0, 0 }, { 0, 0,  1 } }, { { -1, 0, 0 }, { 0, 0, -1 } },
+                                   { { 0,  1, 0 }, { 1, 0,  0 } }, { { 0, -1, 0 }, { 1, 0,  0 } },
+                                   { { 0, 0,  1 }, { -1, 0, 0 } }, { { 0, 0, -1 }, { 1, 0,  0 } } };
+    const float corners[4][2] = { { -1, -1 }, { -1, 1 }, { 1, 1 }, { 1, -1 } };
+
+    auto data = std::make_unique<MeshData>();
+    CookedMesh& mesh = data->description;
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Position, VertexFormat::Float, 3, 0 };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Normal,   VertexFormat::Float, 3, 12 };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Tangent,  VertexFormat::Float, 3, 24 };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::UV,       VertexFormat::Float, 2, 36 };
+    mesh.vertexSize  = 44;
+    mesh.numVertices = 24;
+    mesh.numIndices  = 36;
+
+    data->vertices  = std::make_unique<unsigned char[]>(mesh.numVertices * mesh.vertexSize);
+    data->indices   = std::make_unique<unsigned char[]>(mesh.numIndices * 4);
+    data->subMeshes = std::make_unique<SubMesh[]>(1);
+    float*    vertex = reinterpret_cast<float*>(data->vertices.get());
+    uint32_t* index  = reinterpret_cast<uint32_t*>(data->indices.get());
+    for (uint32_t f = 0; f < 6; ++f)
     {
-        if (assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
-        vertexElements.push_back( { "UV", 0, DXGI_FORMAT_R32G32_FLOAT, 0, uvOffset, D3D11_INPUT_PER_VERTEX_DATA, 0 } );
-        offset += 8;
+        // The V direction is chosen so the corners are clockwise when seen from outside
+        const CVector3& normal  = faces[f][0];
+        const CVector3& tangent = faces[f][1];
+        CVector3 bitangent = Cross(tangent, normal);
+        for (auto& corner : corners)
+        {
+            CVector3 position = normal + tangent * corner[0] + bitangent * corner[1];
+            float values[11] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, tangent.x, tangent.y, tangent.z,
+                                 (corner[0] + 1) * 0.5f, (1 - corner[1]) * 0.5f };
+            std::memcpy(vertex, values, sizeof(values));
+            vertex += 11;
+        }
+        const uint32_t faceIndices[6] = { 0, 1, 2, 0, 2, 3 };
+        for (uint32_t i : faceIndices)  *index++ = f * 4 + i;
     }
-
-    mVertexSize = offset;
+    data->subMeshes[0] = { 0, mesh.numIndices, 0, 0 };
+
+    mesh.vertices     = data->vertices.get();
+    mesh.indices      = data->indices.get();
+    mesh.numSubMeshes = 1;
+    mesh.subMeshes    = data->subMeshes.get();
+    mesh.boundsRadius = std::sqrt(3.0f);
+    return data;
+}
 
 
-    // Create a "vertex layout" to describe to DirectX what is data in each vertex of this mesh
-    auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
-    HRESULT hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
-                                               shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
-                                               &mVertexLayout);
-    if (shaderSignature)  shaderSignature->Release();
-    if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + fileName);
+// Copy of the mesh data in a compressed layout, see MeshOptimiser.h
+std::unique_ptr<MeshData> Mesh::Compress(const MeshData& data)
+{
+    auto result = std::make_unique<MeshData>();
+    CookedMesh& mesh = result->description;
+    CompressVertexLayout(data.description, mesh);
 
+    result->vertices = std::make_unique<unsigned char[]>(mesh.numVertices * mesh.vertexSize);
+    CompressVertices(data.description, mesh, result->vertices.get());
+    mesh.vertices = result->vertices.get();
 
+    result->indices = std::make_unique<unsigned char[]>(mesh.numIndices * mesh.indexSize);
+    std::memcpy(result->indices.get(), data.description.indices, mesh.numIndices * mesh.indexSize);
+    mesh.indices = result->indices.get();
 
-    //-----------------------------------
+    result->subMeshes = std::make_unique<SubMesh[]>(mesh.numSubMeshes * mesh.numLods);
+    std::memcpy(result->subMeshes.get(), data.description.subMeshes, mesh.numSubMeshes * mesh.numLods * sizeof(SubMesh));
+    mesh.subMeshes = result->subMeshes.get();
 
-    // Create CPU-side buffers to hold current mesh data - exact content is flexible so can't use a structure for a vertex - so just a block of bytes
-    // Note: for large arrays a unique_ptr is better than a vector because vectors default-initialise all the values which is a waste of time.
-    mNumVertices = assimpMesh->mNumVertices;
-    mNumIndices  = assimpMesh->mNumFaces * 3;
-    auto vertices = std::make_unique<unsigned char[]>(mNumVertices * mVertexSize);
-    auto indices  = std::make_unique<unsigned char[]>(mNumIndices * 4); // Using 32 bit indexes (4 bytes) for each indeex
+    result->clusters = std::make_unique<MeshCluster[]>(mesh.numClusters);
+    std::memcpy(result->clusters.get(), data.description.clusters, mesh.numClusters * sizeof(MeshCluster));
+    mesh.clusters = result->clusters.get();
 
+    return result;
+}
 
-    //-----------------------------------
 
-    // Copy mesh data from assimp to our CPU-side vertex buffer
+// Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
+// Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
+// Will throw a std::runtime_error exception on failure (since constructors can't return errors).
+Mesh::Mesh(GeometryPool& pool, const std::string& fileName, bool requireTangents)
+    : mPool(pool)
+{
+    auto data = ImportMesh(fileName, requireTangents);
+    if (requireTangents && !HasVertexElement(*data, VertexSemantic::Tangent))  throw std::runtime_error("No tangent data in " + fileName);
+    CreateBuffers(data->description, fileName);
+}
 
-    CVector3* assimpPosition = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
-    unsigned char* position = vertices.get() + positionOffset;
-    unsigned char* positionEnd = position + mNumVertices * mVertexSize;
-    while (position != positionEnd)
-    {
-        *(CVector3*)position = *assimpPosition;
-        position += mVertexSize;
-        ++assimpPosition;
-    }
 
-    CVector3* assimpNormal = reinterpret_cast<CVector3*>(assimpMesh->mNormals);
-    unsigned char* normal = vertices.get() + normalOffset;
-    unsigned char* normalEnd = normal + mNumVertices * mVertexSize;
-    while (normal != normalEnd)
-    {
-        *(CVector3*)normal = *assimpNormal;
-        normal += mVertexSize;
-        ++assimpNormal;
-    }
+// Create a mesh from data already imported (see MeshImport.h). The name is only used in error messages
+// Will throw a std::runtime_error exception on failure
+Mesh::Mesh(GeometryPool& pool, const MeshData& data, const std::string& name)
+    : mPool(pool)
+{
+    CreateBuffers(data.description, name);
+}
 
-    if (requireTangents)
-    {
-      CVector3* assimpTangent = reinterpret_cast<CVector3*>(assimpMesh->mTangents);
-      unsigned char* tangent =  vertices.get() + tangentOffset;
-      unsigned char* tangentEnd = tangent + mNumVertices * mVertexSize;
-      while (tangent != tangentEnd)
-      {
-        *(CVector3*)tangent = *assimpTangent;
-        tangent += mVertexSize;
-        ++assimpTangent;
-      }
-    }
 
-    if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
-    {
-        aiVector3D* assimpUV = assimpMesh->mTextureCoords[0];
-        unsigned char* uv = vertices.get() + uvOffset;
-        unsigned char* uvEnd = uv + mNumVertices * mVertexSize;
-        while (uv != uvEnd)
-        {
-            *(CVector2*)uv = CVector2(assimpUV->x, assimpUV->y);
-            uv += mVertexSize;
-            ++assimpUV;
-        }
-    }
+// Create an empty mesh to be loaded in the background, it draws nothing until BeginUpload is called
+Mesh::Mesh(GeometryPool& pool, const std::string& name)
+    : mPool(pool), mName(name)
+{
+}
 
 
-    //-----------------------------------
+// Copy a mesh imported by assimp or loaded from a cooked file into the geometry pool
+void Mesh::CreateBuffers(const CookedMesh& cookedMesh, const std::string& fileName)
+{
+    ReadDescription(cookedMesh);
 
-    // Copy face data from assimp to our CPU-side index buffer
-    if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
+    // Copy the vertices and indices into the shared buffers, the pool creates the vertex layout for new vertex formats
+    mGeometry = mPool.Add(cookedMesh, fileName);
+    mLoaded = true;
+}
 
-    DWORD* index = reinterpret_cast<DWORD*>(indices.get());
-    for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
-    {
-        *index++ = assimpMesh->mFaces[face].mIndices[0];
-        *index++ = assimpMesh->mFaces[face].mIndices[1];
-        *index++ = assimpMesh->mFaces[face].mIndices[2];
-    }
 
+// Start copying mesh data to an empty mesh, the placeholder is drawn around its bounds until the copy is finished
+void Mesh::BeginUpload(const MeshData& data, MeshHandle placeholder)
+{
+    ReadDescription(data.description);
+    mGeometry = mPool.Reserve(data.description, mName);
+    mBytesUploaded = 0;
+
+    // Draw the placeholder as a box around the bounding sphere by changing how its positions are decoded
+    mPlaceholder = placeholder;
+    float size = mBounds.radius;
+    const CVector3& scale  = placeholder->PositionScale();
+    const CVector3& offset = placeholder->PositionOffset();
+    mPositionScale     = { scale.x * size, scale.y * size, scale.z * size };
+    mPositionOffset    = mBounds.centre + offset * size;
+    mOctahedralNormals = placeholder->OctahedralNormals();
+}
 
-    //-----------------------------------
 
-    D3D11_BUFFER_DESC bufferDesc;
-    D3D11_SUBRESOURCE_DATA initData;
+// Copy no more than maxBytes more of the data given to BeginUpload to the GPU, returns the number of bytes copied
+uint32_t Mesh::ContinueUpload(const MeshData& data, uint32_t maxBytes)
+{
+    if (mLoaded)  return 0;
+    uint32_t copied = mPool.Upload(mGeometry, data.description, mBytesUploaded, maxBytes);
+    mBytesUploaded += copied;
+    if (mBytesUploaded >= GeometryPool::UploadBytes(data.description))
+    {
+        // All there, draw the mesh itself from now on
+        ReadDescription(data.description);
+        mPlaceholder.reset();
+        mLoaded = true;
+    }
+    return copied;
+}
 
-    // Create GPU-side vertex buffer and copy the vertices imported by assimp into it
-    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
-    bufferDesc.Usage = D3D11_USAGE_DEFAULT;          // Default usage for this buffer - we'll see other usages later
-    bufferDesc.ByteWidth = mNumVertices * mVertexSize; // Size of the buffer in bytes
-    bufferDesc.CPUAccessFlags = 0;
-    bufferDesc.MiscFlags = 0;
-    initData.pSysMem = vertices.get(); // Fill the new vertex buffer with data loaded by assimp
-    
-    hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mVertexBuffer);
-    if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + fileName);
 
+// Take the counts, ranges, clusters and bounds from a mesh description
+void Mesh::ReadDescription(const CookedMesh& cookedMesh)
+{
+    mNumVertices = cookedMesh.numVertices;
+    mNumIndices  = cookedMesh.numIndices;
+    mPositionScale  = cookedMesh.positionScale;
+    mPositionOffset = cookedMesh.positionOffset;
+    mBounds      = { cookedMesh.boundsCentre, cookedMesh.boundsRadius };
+
+    // A mesh without sub-mesh ranges is drawn as one part
+    mNumSubMeshes = cookedMesh.numSubMeshes;
+    mNumLods      = cookedMesh.numLods;
+    mSubMeshes.assign(cookedMesh.subMeshes, cookedMesh.subMeshes + cookedMesh.numSubMeshes * cookedMesh.numLods);
+    if (mSubMeshes.empty())
+    {
+        mSubMeshes.push_back({ 0, mNumIndices, 0, 0 });
+        mNumSubMeshes = 1;
+        mNumLods      = 1;
+    }
 
-    // Create GPU-side index buffer and copy the vertices imported by assimp into it
-    bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER; // Indicate it is an index buffer
-    bufferDesc.Usage = D3D11_USAGE_DEFAULT;         // Default usage for this buffer - we'll see other usages later
-    bufferDesc.ByteWidth = mNumIndices * sizeof(DWORD); // Size of the buffer in bytes
-    bufferDesc.CPUAccessFlags = 0;
-    bufferDesc.MiscFlags = 0;
-    initData.pSysMem = indices.get(); // Fill the new index buffer with data loaded by assimp
+    // Clusters of each full detail sub-mesh, the clusters are in sub-mesh order
+    mClusters.assign(cookedMesh.clusters, cookedMesh.clusters + cookedMesh.numClusters);
+    mFirstCluster.assign(mNumSubMeshes + 1, 0);
+    for (auto& cluster : mClusters)
+    {
+        if (cluster.subMesh < mNumSubMeshes)  ++mFirstCluster[cluster.subMesh + 1];
+    }
+    for (uint32_t i = 0; i < mNumSubMeshes; ++i)  mFirstCluster[i + 1] += mFirstCluster[i];
 
-    hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &mIndexBuffer);
-    if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + fileName);
+    // The vertex shaders decode both normals and tangents if either are octahedral (they always are together)
+    mOctahedralNormals = false;
+    for (uint32_t i = 0; i < cookedMesh.numElements; ++i)
+    {
+        if (cookedMesh.elements[i].format == VertexFormat::Octahedral16)  mOctahedralNormals = true;
+    }
 }
 
 
 Mesh::~Mesh()
 {
-    if (mIndexBuffer)   mIndexBuffer ->Release();
-    if (mVertexBuffer)  mVertexBuffer->Release();
-    if (mVertexLayout)  mVertexLayout->Release();
+    mPool.Remove(mGeometry);
 }
 
 
 // The render function assumes shaders, matrices, textures, samplers etc. have been set up already.
-// It simply draws this mesh with whatever settings the GPU is currently using.
-void Mesh::Render()
+// It simply draws this mesh with whatever settings the given context is currently using.
+void Mesh::Render(CommandStream& commands, int lod /*= 0*/, const ClusterView* view /*= nullptr*/)
 {
-    // Set vertex buffer as next data source for GPU
-    UINT stride = mVertexSize;
-    UINT offset = 0;
-    gD3DContext->IASetVertexBuffers(0, 1, &mVertexBuffer, &stride, &offset);
-
-    // Indicate the layout of vertex buffer
-    gD3DContext->IASetInputLayout(mVertexLayout);
+    // A mesh still loading draws its placeholder, the model has already sent the decoding constants to fit it to the bounds
+    if (!mLoaded)
+    {
+        if (mPlaceholder)  mPlaceholder->Render(commands);
+        return;
+    }
 
-    // Set index buffer as next data source for GPU, indicate it uses 32-bit integers
-    gD3DContext->IASetIndexBuffer(mIndexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    // Set the pool's vertex buffer for this mesh's format and its layout as next data source for GPU, the index buffer uses
+    // 16 or 32-bit integers. Using triangle lists only in this class (the only topology command streams support)
+    // Meshes of the same format share these buffers, so the backend only binds them when the format changes
+    commands.SetGeometry(mPool.Geometry(mGeometry));
+
+    // Render each sub-mesh of the chosen level of detail from its range of the mesh's part of the pool
+    uint32_t startIndex = mPool.StartIndex(mGeometry);
+    int32_t  baseVertex = mPool.BaseVertex(mGeometry);
+    lod = (lod < 0) ? 0 : (lod >= static_cast<int>(mNumLods)) ? mNumLods - 1 : lod;
+    uint32_t triangles = 0;
+    for (uint32_t i = 0; i < mNumSubMeshes; ++i)
+    {
+        const SubMesh& subMesh = mSubMeshes[lod * mNumSubMeshes + i];
+        uint32_t firstCluster = mFirstCluster[i];
+        uint32_t numClusters  = mFirstCluster[i + 1] - firstCluster;
+        if (view == nullptr || lod != 0 || numClusters == 0)
+        {
+            commands.DrawIndexed(subMesh.numIndices, startIndex + subMesh.startIndex, baseVertex + subMesh.baseVertex);
+            triangles += subMesh.numIndices / 3;
+            continue;
+        }
 
-    // Using triangle lists only in this class
-    gD3DContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+        // Cull the sub-mesh's clusters and draw each run of visible clusters, which are next to each other in the indices
+        // (see MeshClusters.h). Per thread space for the results as meshes are rendered on several threads at once
+        static thread_local std::vector<uint8_t> visible;
+        visible.resize(numClusters);
+        const MeshCluster* clusters = &mClusters[firstCluster];
+        uint32_t numVisible = CullClusters(clusters, numClusters, *view, visible.data());
+        gClustersTested += numClusters;
+        gClustersCulled += numClusters - numVisible;
 
-    // Render mesh
-    gD3DContext->DrawIndexed(mNumIndices, 0, 0);
+        for (uint32_t c = 0; c < numClusters; )
+        {
+            if (!visible[c])
+            {
+                ++c;
+                continue;
+            }
+            uint32_t runStart = clusters[c].startIndex;
+            uint32_t runEnd   = runStart;
+            while (c < numClusters && visible[c] && clusters[c].startIndex == runEnd)
+            {
+                runEnd += clusters[c].numIndices;
+                ++c;
+            }
+            commands.DrawIndexed(runEnd - runStart, startIndex + runStart, baseVertex + subMesh.baseVertex);
+            triangles += (runEnd - runStart) / 3;
+        }
+    }
+    gTrianglesSubmitted += triangles;
 }
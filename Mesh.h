@@ -1,45 +1,147 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a mesh
 //--------------------------------------------------------------------------------------
-// The mesh class splits the mesh into sub-meshes that only use one texture each.
-// ** THIS VERSION WILL ONLY KEEP THE FIRST SUB-MESH OTHER PARTS WILL BE MISSING **
-// ** DO NOT USE THIS VERSION FOR PROJECTS **
+// The mesh class splits the mesh into sub-meshes that only use one texture each. The mesh's vertices
+// and indices are kept in a geometry pool shared with other meshes (see GeometryPool.h), each
+// sub-mesh is drawn from its own range of the mesh's part of the pool.
 // The class also doesn't load textures, filters or shaders as the outer code is
 // expected to select these things. A later lab will introduce a more robust loader.
 
 #include "common.h"
+#include "CommandStream.h"
+#include "MeshCache.h"
+#include "MeshCook.h"
+#include "GeometryPool.h"
+#include "MeshClusters.h"
 
 #include <string>
+#include <memory>
+#include <vector>
+#include <atomic>
 
 #ifndef _MESH_H_INCLUDED_
 #define _MESH_H_INCLUDED_
 
+// Meshes are shared between models, see MeshManager.h. The mesh is released when the last handle to it goes
+class Mesh;
+using MeshHandle = std::shared_ptr<Mesh>;
+
 class Mesh
 {
 public:
     // Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
-    // Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
+    // Request tangents to be calculated if they are needed (for normal and parallax mapping - see later lab)
+    // The imported mesh is saved as a cooked file next to the source, later runs load that instead (see MeshCache.h)
+    // The vertices and indices are copied into the given pool, which must outlive the mesh
     // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
-    Mesh(const std::string& fileName, bool requireTangents = false);
+    Mesh(GeometryPool& pool, const std::string& fileName, bool requireTangents);
+
+    // Create a mesh from data already imported (see MeshImport.h). The name is only used in error messages
+    // Will throw a std::runtime_error exception on failure
+    Mesh(GeometryPool& pool, const MeshData& data, const std::string& name);
+
+    // Create an empty mesh to be loaded in the background (see MeshManager.h), it draws nothing until BeginUpload is called
+    Mesh(GeometryPool& pool, const std::string& name);
+
     ~Mesh();
 
+    // Copy of the mesh data with one part removed from each vertex, e.g. the tangents
+    static std::unique_ptr<MeshData> RemoveVertexElement(const MeshData& data, VertexSemantic semantic);
+
+    // Copy of the mesh data in a compressed layout: smaller positions, normals, tangents and UVs (see MeshOptimiser.h)
+    static std::unique_ptr<MeshData> Compress(const MeshData& data);
+
+    // True if each vertex in the mesh data has the given part
+    static bool HasVertexElement(const MeshData& data, VertexSemantic semantic);
+
+    // A cube from -1 to 1 with normals, tangents and UVs, drawn in place of meshes that are still loading
+    static std::unique_ptr<MeshData> Box();
+
+
+    // Start copying mesh data to an empty mesh. Until the copy is finished the mesh draws the placeholder mesh instead,
+    // scaled to fit around the new mesh's bounds, so the placeholder must have a layout with the same parts or more
+    // Will throw a std::runtime_error exception on failure
+    void BeginUpload(const MeshData& data, MeshHandle placeholder);
+
+    // Copy no more than maxBytes more of the data given to BeginUpload to the GPU, returns the number of bytes copied.
+    // The mesh draws itself once it is all copied. Only call between frames, when the mesh isn't being rendered
+    uint32_t ContinueUpload(const MeshData& data, uint32_t maxBytes);
+
+    // True once the mesh draws its own geometry
+    bool IsLoaded()  { return mLoaded; }
+
     // The render function assumes shaders, matrices, textures, samplers etc. have been set up already.
-    // It simply draws this mesh with whatever settings the GPU is currently using.
-    void Render();
+    // It simply adds commands to draw this mesh with whatever settings are current in the command stream.
+    // Choose the level of detail to draw, 0 is full detail (see MeshSimplifier.h), it is limited to the levels the mesh has
+    // Pass a view in the mesh's model space to skip clusters that can't be seen (see MeshClusters.h), full detail only
+    // Can be called from several threads at once
+    void Render(CommandStream& commands, int lod = 0, const ClusterView* view = nullptr);
+
+    // Number of clusters that can be culled separately, zero if the mesh is always drawn whole
+    unsigned int NumClusters()  { return mLoaded ? static_cast<unsigned int>(mClusters.size()) : 0; }
+
+    // Number of levels of detail, including the full detail mesh
+    int NumLods()  { return static_cast<int>(mNumLods); }
+
+    // Number of sub-meshes and the material slot each uses
+    unsigned int NumSubMeshes()  { return mNumSubMeshes; }
+    unsigned int SubMeshMaterial(unsigned int subMesh)  { return mSubMeshes[subMesh].material; }
+
+    // How the vertex shaders decode the positions, normals and tangents of compressed meshes, sent in the per-model constants.
+    // Model space position = stored position * scale + offset
+    const CVector3& PositionScale()     { return mPositionScale; }
+    const CVector3& PositionOffset()    { return mPositionOffset; }
+    bool            OctahedralNormals() { return mOctahedralNormals; }
+
+    // Bounding sphere of the mesh in model space
+    const BoundingSphere& Bounds()  { return mBounds; }
 
 
 private:
-    unsigned int       mVertexSize;             // Size in bytes of a single vertex (depends on what it contains, uvs, tangents etc.)
-    ID3D11InputLayout* mVertexLayout = nullptr; // DirectX specification of data held in a single vertex
+    // Copy a mesh imported by assimp or loaded from a cooked file into the geometry pool
+    void CreateBuffers(const CookedMesh& cookedMesh, const std::string& fileName);
+
+    // Take the counts, ranges, clusters and bounds from a mesh description
+    void ReadDescription(const CookedMesh& cookedMesh);
+
+    // The mesh's part of the geometry pool, holding its vertices and indices
+    GeometryPool&      mPool;
+    uint32_t           mGeometry = ~0u;
+
+    // Background loading. The placeholder is drawn until all the data is copied to the pool
+    std::string        mName;
+    bool               mLoaded = false;
+    MeshHandle         mPlaceholder;
+    uint32_t           mBytesUploaded = 0;
 
-    // GPU-side vertex and index buffers
-    unsigned int       mNumVertices;
-    ID3D11Buffer*      mVertexBuffer = nullptr;
+    unsigned int       mNumVertices = 0;
+    unsigned int       mNumIndices  = 0;
 
-    unsigned int       mNumIndices;
-    ID3D11Buffer*      mIndexBuffer  = nullptr;
+    // Decoding compressed vertices, of the placeholder while it is drawn
+    CVector3           mPositionScale  = { 1, 1, 1 };
+    CVector3           mPositionOffset = { 0, 0, 0 };
+    bool               mOctahedralNormals = false;
+
+    // Range of the buffers used by each sub-mesh at each level of detail, full detail first
+    unsigned int         mNumSubMeshes = 0;
+    unsigned int         mNumLods      = 1;
+    std::vector<SubMesh> mSubMeshes;
+
+    // Clusters of the full detail sub-meshes, and the first cluster of each sub-mesh (one more entry for the end)
+    std::vector<MeshCluster> mClusters;
+    std::vector<uint32_t>    mFirstCluster;
+
+    BoundingSphere     mBounds = { { 0, 0, 0 }, 0 };
 };
 
 
+// Triangles drawn by all meshes, the scene resets it each frame. Atomic since meshes are rendered on several threads
+extern std::atomic<uint64_t> gTrianglesSubmitted;
+
+// Clusters tested and culled by all meshes, reset each frame like the triangles
+extern std::atomic<uint64_t> gClustersTested;
+extern std::atomic<uint64_t> gClustersCulled;
+
+
 #endif //_MESH_H_INCLUDED_
 
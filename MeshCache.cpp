@@ -0,0 +1,309 @@
+//--------------------------------------------------------------------------------------
+// Mesh cache - meshes cooked into a binary file ready for the GPU
+//--------------------------------------------------------------------------------------
+
+#include "MeshCache.h"
+
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Memory mapped files
+//--------------------------------------------------------------------------------------
+
+// Map the given file, returns false if it can't be opened (or is empty)
+bool MappedFile::Open(const std::string& fileName)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)  return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (data == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    mFile    = file;
+    mMapping = mapping;
+    mData    = static_cast<const uint8_t*>(data);
+    mSize    = static_cast<size_t>(size.QuadPart);
+#else
+    int file = open(fileName.c_str(), O_RDONLY);
+    if (file < 0)  return false;
+
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0)
+    {
+        close(file);
+        return false;
+    }
+
+    void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    close(file); // The mapping keeps the file open
+    if (data == MAP_FAILED)  return false;
+
+    mData = static_cast<const uint8_t*>(data);
+    mSize = static_cast<size_t>(info.st_size);
+#endif
+    return true;
+}
+
+
+void MappedFile::Close()
+{
+    if (mData == nullptr)  return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(mData);
+    CloseHandle(mMapping);
+    CloseHandle(mFile);
+    mMapping = nullptr;
+    mFile    = nullptr;
+#else
+    munmap(const_cast<uint8_t*>(mData), mSize);
+#endif
+    mData = nullptr;
+    mSize = 0;
+}
+
+
+// 64-bit FNV-1a hash of a block of memory
+uint64_t HashBytes(const void* data, size_t size)
+{
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+
+// Hash of a file's contents, returns false if the file can't be read
+bool HashFile(const std::string& fileName, uint64_t& hash)
+{
+    MappedFile file;
+    if (!file.Open(fileName))  return false;
+    hash = HashBytes(file.Data(), file.Size());
+    return true;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Cooked meshes
+//--------------------------------------------------------------------------------------
+
+// Cooked files start with this header. The vertex, index, sub-mesh and cluster data follow, each starting on a 16 byte boundary
+struct CookedMeshHeader
+{
+    uint32_t      magic;
+    uint32_t      version;
+    uint64_t      sourceHash;
+    uint32_t      importFlags;
+    uint32_t      numElements;
+    VertexElement elements[MAX_VERTEX_ELEMENTS];
+    uint32_t      vertexSize;
+    uint32_t      numVertices;
+    uint32_t      indexSize;
+    uint32_t      numIndices;
+    uint32_t      numSubMeshes;
+    uint32_t      numLods;
+    uint32_t      numClusters;
+    float         position[6]; // Scale and offset
+    float         bounds[4];   // Centre and radius
+    float         stats[6];    // Order stats before and after optimisation
+    uint64_t      vertexDataOffset;
+    uint64_t      indexDataOffset;
+    uint64_t      subMeshDataOffset;
+    uint64_t      clusterDataOffset;
+};
+
+const uint32_t COOKED_MESH_MAGIC   = 0x48534D43; // "CMSH"
+const uint32_t COOKED_MESH_VERSION = 9;          // Change whenever the format or the way meshes are imported changes
+
+static uint64_t AlignTo16(uint64_t offset)  { return (offset + 15) & ~15ull; }
+
+
+// Name of the cooked file for a source mesh imported with the given settings. importFlags can be anything that changes the result
+std::string CookedMeshFileName(const std::string& sourceFile, uint32_t importFlags)
+{
+    char flags[16];
+    std::snprintf(flags, sizeof(flags), "%08X", importFlags);
+    return sourceFile + "." + flags + ".cmesh";
+}
+
+
+// Save a mesh imported from a source file with the given hash and settings. Returns false if the file can't be written
+bool WriteCookedMesh(const std::string& cookedFile, uint64_t sourceHash, uint32_t importFlags, const CookedMesh& mesh)
+{
+    if (mesh.numElements > MAX_VERTEX_ELEMENTS)  return false;
+
+    CookedMeshHeader header;
+    std::memset(&header, 0, sizeof(header)); // No uninitialised padding in the file
+    header.magic       = COOKED_MESH_MAGIC;
+    header.version     = COOKED_MESH_VERSION;
+    header.sourceHash  = sourceHash;
+    header.importFlags = importFlags;
+    header.numElements = mesh.numElements;
+    for (uint32_t i = 0; i < mesh.numElements; ++i)  header.elements[i] = mesh.elements[i];
+    header.vertexSize  = mesh.vertexSize;
+    header.numVertices = mesh.numVertices;
+    header.indexSize   = mesh.indexSize;
+    header.numIndices  = mesh.numIndices;
+    header.numSubMeshes = mesh.numSubMeshes;
+    header.numLods     = mesh.numLods;
+    header.numClusters = mesh.numClusters;
+    header.position[0] = mesh.positionScale.x;
+    header.position[1] = mesh.positionScale.y;
+    header.position[2] = mesh.positionScale.z;
+    header.position[3] = mesh.positionOffset.x;
+    header.position[4] = mesh.positionOffset.y;
+    header.position[5] = mesh.positionOffset.z;
+    header.bounds[0]   = mesh.boundsCentre.x;
+    header.bounds[1]   = mesh.boundsCentre.y;
+    header.bounds[2]   = mesh.boundsCentre.z;
+    header.bounds[3]   = mesh.boundsRadius;
+    header.stats[0]    = mesh.statsBefore.acmr;
+    header.stats[1]    = mesh.statsBefore.atvr;
+    header.stats[2]    = mesh.statsBefore.overdraw;
+    header.stats[3]    = mesh.statsAfter.acmr;
+    header.stats[4]    = mesh.statsAfter.atvr;
+    header.stats[5]    = mesh.statsAfter.overdraw;
+
+    uint64_t vertexBytes = static_cast<uint64_t>(mesh.vertexSize) * mesh.numVertices;
+    uint64_t indexBytes  = static_cast<uint64_t>(mesh.indexSize)  * mesh.numIndices;
+    uint64_t subMeshBytes = sizeof(SubMesh) * static_cast<uint64_t>(mesh.numSubMeshes) * mesh.numLods;
+    uint64_t clusterBytes = sizeof(MeshCluster) * static_cast<uint64_t>(mesh.numClusters);
+    header.vertexDataOffset  = AlignTo16(sizeof(header));
+    header.indexDataOffset   = AlignTo16(header.vertexDataOffset + vertexBytes);
+    header.subMeshDataOffset = AlignTo16(header.indexDataOffset + indexBytes);
+    header.clusterDataOffset = AlignTo16(header.subMeshDataOffset + subMeshBytes);
+
+    std::ofstream file(cookedFile, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file)  return false;
+
+    const char padding[16] = {};
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(padding, header.vertexDataOffset - sizeof(header));
+    file.write(static_cast<const char*>(mesh.vertices), vertexBytes);
+    file.write(padding, header.indexDataOffset - (header.vertexDataOffset + vertexBytes));
+    file.write(static_cast<const char*>(mesh.indices), indexBytes);
+    file.write(padding, header.subMeshDataOffset - (header.indexDataOffset + indexBytes));
+    file.write(reinterpret_cast<const char*>(mesh.subMeshes), subMeshBytes);
+    file.write(padding, header.clusterDataOffset - (header.subMeshDataOffset + subMeshBytes));
+    file.write(reinterpret_cast<const char*>(mesh.clusters), clusterBytes);
+    file.close();
+
+    // Don't leave a partly written file behind
+    if (!file)
+    {
+        std::remove(cookedFile.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+// Map a cooked file and point the mesh at its contents. The file must stay open while the mesh data is used. Returns false if
+// the file is missing, damaged, from an older version of the format or was cooked from a different source or with other settings
+bool LoadCookedMesh(const std::string& cookedFile, uint64_t sourceHash, uint32_t importFlags, MappedFile& file, CookedMesh& mesh)
+{
+    if (!file.Open(cookedFile))  return false;
+
+    // Check the header matches and the data it describes is all in the file
+    CookedMeshHeader header;
+    if (file.Size() < sizeof(header))  return false;
+    std::memcpy(&header, file.Data(), sizeof(header));
+
+    uint64_t vertexBytes = static_cast<uint64_t>(header.vertexSize) * header.numVertices;
+    uint64_t indexBytes  = static_cast<uint64_t>(header.indexSize)  * header.numIndices;
+    uint64_t subMeshBytes = sizeof(SubMesh) * static_cast<uint64_t>(header.numSubMeshes) * header.numLods;
+    uint64_t clusterBytes = sizeof(MeshCluster) * static_cast<uint64_t>(header.numClusters);
+    if (header.magic != COOKED_MESH_MAGIC || header.version != COOKED_MESH_VERSION ||
+        header.sourceHash != sourceHash   || header.importFlags != importFlags     ||
+        header.numElements > MAX_VERTEX_ELEMENTS || header.numLods == 0 ||
+        header.vertexDataOffset + vertexBytes > file.Size() || header.indexDataOffset + indexBytes > file.Size() ||
+        header.subMeshDataOffset + subMeshBytes > file.Size() || header.clusterDataOffset + clusterBytes > file.Size())
+    {
+        file.Close();
+        return false;
+    }
+
+    // Every sub-mesh must draw from inside the index and vertex data
+    const SubMesh* subMeshes = reinterpret_cast<const SubMesh*>(file.Data() + header.subMeshDataOffset);
+    for (uint32_t i = 0; i < header.numSubMeshes * header.numLods; ++i)
+    {
+        if (static_cast<uint64_t>(subMeshes[i].startIndex) + subMeshes[i].numIndices > header.numIndices ||
+            subMeshes[i].baseVertex < 0 || static_cast<uint32_t>(subMeshes[i].baseVertex) >= header.numVertices)
+        {
+            file.Close();
+            return false;
+        }
+    }
+
+    // Every cluster must be inside its full detail sub-mesh
+    const MeshCluster* clusters = reinterpret_cast<const MeshCluster*>(file.Data() + header.clusterDataOffset);
+    for (uint32_t i = 0; i < header.numClusters; ++i)
+    {
+        const MeshCluster& cluster = clusters[i];
+        if (cluster.subMesh >= header.numSubMeshes || cluster.startIndex < subMeshes[cluster.subMesh].startIndex ||
+            static_cast<uint64_t>(cluster.startIndex) + cluster.numIndices >
+            static_cast<uint64_t>(subMeshes[cluster.subMesh].startIndex) + subMeshes[cluster.subMesh].numIndices)
+        {
+            file.Close();
+            return false;
+        }
+    }
+
+    mesh.numElements = header.numElements;
+    for (uint32_t i = 0; i < header.numElements; ++i)  mesh.elements[i] = header.elements[i];
+    mesh.vertexSize   = header.vertexSize;
+    mesh.numVertices  = header.numVertices;
+    mesh.vertices     = file.Data() + header.vertexDataOffset;
+    mesh.indexSize    = header.indexSize;
+    mesh.numIndices   = header.numIndices;
+    mesh.indices      = file.Data() + header.indexDataOffset;
+    mesh.numSubMeshes = header.numSubMeshes;
+    mesh.numLods      = header.numLods;
+    mesh.subMeshes    = subMeshes;
+    mesh.numClusters  = header.numClusters;
+    mesh.clusters     = clusters;
+    mesh.positionScale  = { header.position[0], header.position[1], header.position[2] };
+    mesh.positionOffset = { header.position[3], header.position[4], header.position[5] };
+    mesh.boundsCentre = { header.bounds[0], header.bounds[1], header.bounds[2] };
+    mesh.boundsRadius = header.bounds[3];
+    mesh.statsBefore  = { header.stats[0], header.stats[1], header.stats[2] };
+    mesh.statsAfter   = { header.stats[3], header.stats[4], header.stats[5] };
+    return true;
+}
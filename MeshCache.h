@@ -0,0 +1,179 @@
+//--------------------------------------------------------------------------------------
+// Mesh cache - meshes cooked into a binary file ready for the GPU
+//--------------------------------------------------------------------------------------
+// Importing a mesh with assimp parses the source file (the .x files are text) and runs a long
+// list of processing steps every time the app starts. The first time a mesh is imported the
+// result is saved as a cooked mesh file: a header describing the vertex layout and bounds,
+// followed by the vertex and index data exactly as the GPU buffers hold them and the draw range
+// of each sub-mesh at each level of detail, then the bounds of the mesh's clusters (see
+// MeshClusters.h). Later runs map
+// the cooked file into memory and create the buffers straight from the mapping, with no parsing
+// or copying.
+//
+// A cooked file is only used if it was made from the same source file (checked with a hash of
+// its contents) with the same import settings. Doesn't use any Direct3D so cooking and loading
+// can be tested on any platform.
+
+#ifndef _MESH_CACHE_H_INCLUDED_
+#define _MESH_CACHE_H_INCLUDED_
+
+#include "CVector3.h"
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+//--------------------------------------------------------------------------------------
+// Memory mapped files
+//--------------------------------------------------------------------------------------
+
+// Read-only view of a whole file, the file's contents appear in memory without being read in
+class MappedFile
+{
+public:
+    MappedFile() {}
+    ~MappedFile()  { Close(); }
+
+    // Map the given file, returns false if it can't be opened (or is empty)
+    bool Open(const std::string& fileName);
+    void Close();
+
+    const uint8_t* Data() const  { return mData; }
+    size_t         Size() const  { return mSize; }
+
+private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* mData = nullptr;
+    size_t         mSize = 0;
+#ifdef _WIN32
+    void* mFile    = nullptr;
+    void* mMapping = nullptr;
+#endif
+};
+
+// 64-bit FNV-1a hash of a block of memory
+uint64_t HashBytes(const void* data, size_t size);
+
+// Hash of a file's contents, returns false if the file can't be read
+bool HashFile(const std::string& fileName, uint64_t& hash);
+
+
+//--------------------------------------------------------------------------------------
+// Cooked meshes
+//--------------------------------------------------------------------------------------
+
+// What each part of a vertex holds. The names match the semantics used in the vertex shaders
+enum class VertexSemantic : uint32_t
+{
+    Position,
+    Normal,
+    Tangent,
+    UV,
+};
+
+// How each part of a vertex is stored. Imported meshes use floats, the others are used by compressed meshes (see
+// MeshOptimiser.h)
+enum class VertexFormat : uint32_t
+{
+    Float,        // 32-bit floats
+    SNorm16,      // 16-bit signed normalised integers (-1 to 1). Positions are scaled to the mesh's bounding box, see CookedMesh
+    Octahedral16, // Unit vector folded onto an octahedron and stored in two 16-bit signed normalised integers
+    Half,         // 16-bit floats
+};
+
+// One part of a vertex: a number of components in the given format at the given byte offset
+struct VertexElement
+{
+    VertexSemantic semantic;
+    VertexFormat   format;
+    uint32_t       components;
+    uint32_t       offset;
+};
+
+// Size in bytes of a part of a vertex
+inline uint32_t VertexElementSize(const VertexElement& element)
+{
+    return element.components * (element.format == VertexFormat::Float ? 4 : 2);
+}
+
+const uint32_t MAX_VERTEX_ELEMENTS = 8;
+
+// One part of a mesh drawn with a single material. All the parts share the mesh's vertex and index data, each part's indices
+// are relative to its first vertex
+struct SubMesh
+{
+    uint32_t startIndex;
+    uint32_t numIndices;
+    int32_t  baseVertex;
+    uint32_t material;   // Material slot in the source file, for choosing textures etc.
+};
+
+// A run of about a hundred neighbouring triangles of a full detail sub-mesh, with bounds to cull it when it is off screen or
+// faces away from the camera (see MeshClusters.h)
+struct MeshCluster
+{
+    CVector3 centre;     // Bounding sphere in model space
+    float    radius;
+    CVector3 coneAxis;   // Average direction the triangles face
+    float    coneCutoff; // Sine of the angle between the axis and the furthest triangle normal, 1 if the cluster can't face away
+    uint32_t startIndex; // Range of the mesh's indices, the sub-mesh's base vertex is added to them
+    uint32_t numIndices;
+    uint32_t subMesh;
+    uint32_t padding;
+};
+
+// How well a mesh's triangle order suits the GPU, see MeshOptimiser.h. Zero if not measured
+struct MeshOrderStats
+{
+    float acmr     = 0; // Average cache miss ratio: vertex shader runs per triangle
+    float atvr     = 0; // Average transformed vertex ratio: vertex shader runs per vertex
+    float overdraw = 0; // Pixels shaded per pixel covered
+};
+
+// A mesh ready to be copied into GPU buffers. When loaded from a cooked file the data pointers point into the file's mapping
+struct CookedMesh
+{
+    uint32_t      numElements = 0;
+    VertexElement elements[MAX_VERTEX_ELEMENTS];
+    uint32_t      vertexSize  = 0; // Bytes per vertex
+    uint32_t      numVertices = 0;
+    const void*   vertices    = nullptr;
+
+    uint32_t      indexSize   = 4; // Bytes per index
+    uint32_t      numIndices  = 0; // Triangle list
+    const void*   indices     = nullptr;
+
+    // Ranges of each sub-mesh for each level of detail, all of the sub-meshes for the full detail mesh first (see
+    // MeshSimplifier.h). The levels share the vertices, each has its own indices
+    uint32_t       numSubMeshes = 0;
+    uint32_t       numLods      = 1;
+    const SubMesh* subMeshes    = nullptr;
+
+    // Clusters of the full detail sub-meshes, in sub-mesh order. Small sub-meshes have none and are always drawn whole
+    uint32_t           numClusters = 0;
+    const MeshCluster* clusters    = nullptr;
+
+    CVector3      positionScale  = { 1, 1, 1 }; // Model space position = stored position * scale + offset
+    CVector3      positionOffset = { 0, 0, 0 };
+
+    CVector3      boundsCentre = { 0, 0, 0 }; // Bounding sphere in model space
+    float         boundsRadius = 0;
+
+    MeshOrderStats statsBefore; // Triangle order as imported and after optimisation, measured when the mesh was cooked
+    MeshOrderStats statsAfter;
+};
+
+// Name of the cooked file for a source mesh imported with the given settings. importFlags can be anything that changes the result
+std::string CookedMeshFileName(const std::string& sourceFile, uint32_t importFlags);
+
+// Save a mesh imported from a source file with the given hash and settings. Returns false if the file can't be written
+bool WriteCookedMesh(const std::string& cookedFile, uint64_t sourceHash, uint32_t importFlags, const CookedMesh& mesh);
+
+// Map a cooked file and point the mesh at its contents. The file must stay open while the mesh data is used. Returns false if
+// the file is missing, damaged, from an older version of the format or was cooked from a different source or with other settings
+bool LoadCookedMesh(const std::string& cookedFile, uint64_t sourceHash, uint32_t importFlags, MappedFile& file, CookedMesh& mesh);
+
+
+#endif //_MESH_CACHE_H_INCLUDED_
@@ -0,0 +1,350 @@
+//--------------------------------------------------------------------------------------
+// Mesh clusters - culling parts of large meshes
+//--------------------------------------------------------------------------------------
+
+#include "MeshClusters.h"
+#include "MeshOptimiser.h"
+
+#include <cstring>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define MESH_CLUSTERS_USE_SSE
+#endif
+
+// The culling loads each cluster's centre and radius, then its cone, as groups of four floats
+static_assert(sizeof(CVector3) == 12 && sizeof(MeshCluster) == 48, "MeshCluster layout doesn't suit the SSE culling");
+
+
+//--------------------------------------------------------------------------------------
+// Building clusters
+//--------------------------------------------------------------------------------------
+
+static CVector3 ReadVector(const uint8_t* vertices, uint32_t vertexSize, uint32_t offset, uint32_t vertex)
+{
+    CVector3 v;
+    std::memcpy(&v, vertices + static_cast<size_t>(vertex) * vertexSize + offset, sizeof(v));
+    return v;
+}
+
+
+// Bounding sphere and normal cone of the triangles from indices[start] up to indices[end]
+static MeshCluster MakeCluster(const uint8_t* vertices, uint32_t vertexSize, uint32_t positionOffset, uint32_t normalOffset,
+                               bool hasNormals, const uint32_t* indices, uint32_t start, uint32_t end, float padding)
+{
+    MeshCluster cluster = {};
+    cluster.startIndex = start;
+    cluster.numIndices = end - start;
+
+    // Sphere around the centre of the bounding box, padded a little so positions moved by compression are still inside
+    CVector3 boxMin = ReadVector(vertices, vertexSize, positionOffset, indices[start]);
+    CVector3 boxMax = boxMin;
+    for (uint32_t i = start; i < end; ++i)
+    {
+        CVector3 p = ReadVector(vertices, vertexSize, positionOffset, indices[i]);
+        if (p.x < boxMin.x)  boxMin.x = p.x;
+        if (p.y < boxMin.y)  boxMin.y = p.y;
+        if (p.z < boxMin.z)  boxMin.z = p.z;
+        if (p.x > boxMax.x)  boxMax.x = p.x;
+        if (p.y > boxMax.y)  boxMax.y = p.y;
+        if (p.z > boxMax.z)  boxMax.z = p.z;
+    }
+    cluster.centre = (boxMin + boxMax) * 0.5f;
+    float radius = 0;
+    for (uint32_t i = start; i < end; ++i)
+    {
+        float distance = Length(ReadVector(vertices, vertexSize, positionOffset, indices[i]) - cluster.centre);
+        if (distance > radius)  radius = distance;
+    }
+    cluster.radius = radius + padding;
+
+    // Front faces are clockwise (the Direct3D default) in a left-handed space, so a triangle faces the direction of
+    // Cross(p1 - p0, p2 - p0). The cone is the average direction, widened to hold every triangle's direction
+    std::vector<CVector3> normals;
+    CVector3 axis = { 0, 0, 0 };
+    bool canCull = true;
+    for (uint32_t i = start; i < end; i += 3)
+    {
+        CVector3 p0 = ReadVector(vertices, vertexSize, positionOffset, indices[i]);
+        CVector3 p1 = ReadVector(vertices, vertexSize, positionOffset, indices[i + 1]);
+        CVector3 p2 = ReadVector(vertices, vertexSize, positionOffset, indices[i + 2]);
+        CVector3 normal = Cross(p1 - p0, p2 - p0);
+        float length = Length(normal);
+        if (length <= 0)  continue; // Degenerate triangles are never drawn
+        normal = normal * (1 / length);
+
+        // Only trust the winding where the lighting normals agree with it, otherwise the cluster is never culled for facing away
+        if (hasNormals)
+        {
+            CVector3 vertexNormals = ReadVector(vertices, vertexSize, normalOffset, indices[i]) +
+                                     ReadVector(vertices, vertexSize, normalOffset, indices[i + 1]) +
+                                     ReadVector(vertices, vertexSize, normalOffset, indices[i + 2]);
+            if (Dot(vertexNormals, normal) < 0)  canCull = false;
+        }
+        normals.push_back(normal);
+        axis += normal;
+    }
+
+    // The axis must be unit length even when the cone is never culled, the test relies on it
+    float axisLength = Length(axis);
+    axis = axisLength > 0 ? axis * (1 / axisLength) : CVector3{ 0, 0, 1 };
+    float minDot = -1;
+    if (axisLength > 0 && canCull)
+    {
+        minDot = 1;
+        for (auto& normal : normals)
+        {
+            float d = Dot(normal, axis);
+            if (d < minDot)  minDot = d;
+        }
+    }
+    cluster.coneAxis = axis;
+
+    // The cone's half angle has cosine minDot. A cone of 90 degrees or more always has some triangles facing the camera.
+    // A small margin covers normals changed by compressing the positions
+    const float coneMargin = 0.02f;
+    if (minDot <= 0)  cluster.coneCutoff = 1;
+    else              cluster.coneCutoff = std::fmin(1.0f, std::sqrt(1 - minDot * minDot) + coneMargin);
+
+    return cluster;
+}
+
+
+// Split each large full detail sub-mesh of a mesh with float positions and normals and 32-bit indices into clusters
+void BuildClusters(const CookedMesh& mesh, const uint8_t* vertices, const uint32_t* indices, std::vector<MeshCluster>& clusters)
+{
+    uint32_t positionOffset = 0, normalOffset = 0;
+    bool hasNormals = false;
+    for (uint32_t i = 0; i < mesh.numElements; ++i)
+    {
+        if (mesh.elements[i].semantic == VertexSemantic::Position)  positionOffset = mesh.elements[i].offset;
+        if (mesh.elements[i].semantic == VertexSemantic::Normal)
+        {
+            normalOffset = mesh.elements[i].offset;
+            hasNormals = true;
+        }
+    }
+
+    // Compressed positions move by up to half a step of 16 bits over the mesh's bounds (see MeshOptimiser.h)
+    float padding = mesh.boundsRadius * 2.0f / 65535.0f;
+
+    std::vector<uint32_t> clusterOfVertex;
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)
+    {
+        const SubMesh& subMesh = mesh.subMeshes[s];
+        if (subMesh.numIndices / 3 < MIN_CLUSTERED_TRIANGLES)  continue;
+
+        const uint8_t* subVertices = vertices + static_cast<size_t>(subMesh.baseVertex) * mesh.vertexSize;
+        clusterOfVertex.assign(SubMeshVertexCount(mesh, s), ~0u);
+
+        // Take triangles in order until the next one would go over either limit
+        uint32_t clusterNumber = 0;
+        uint32_t start = subMesh.startIndex;
+        uint32_t end   = subMesh.startIndex + subMesh.numIndices;
+        uint32_t numVertices = 0;
+        for (uint32_t i = start; i < end; i += 3)
+        {
+            uint32_t newVertices = 0;
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                if (clusterOfVertex[indices[i + corner]] != clusterNumber)  ++newVertices;
+            }
+            if ((i - start) / 3 == MAX_CLUSTER_TRIANGLES || numVertices + newVertices > MAX_CLUSTER_VERTICES)
+            {
+                clusters.push_back(MakeCluster(subVertices, mesh.vertexSize, positionOffset, normalOffset, hasNormals, indices, start, i, padding));
+                clusters.back().subMesh = s;
+                start = i;
+                numVertices = 0;
+                ++clusterNumber;
+            }
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t& vertexCluster = clusterOfVertex[indices[i + corner]];
+                if (vertexCluster != clusterNumber)
+                {
+                    vertexCluster = clusterNumber;
+                    ++numVertices;
+                }
+            }
+        }
+        clusters.push_back(MakeCluster(subVertices, mesh.vertexSize, positionOffset, normalOffset, hasNormals, indices, start, end, padding));
+        clusters.back().subMesh = s;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Views
+//--------------------------------------------------------------------------------------
+
+static void NormalisePlane(float plane[4])
+{
+    float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+    if (length <= 0)  return;
+    for (int i = 0; i < 4; ++i)  plane[i] /= length;
+}
+
+
+// View for a camera's view-projection matrix (row vectors, as used throughout) and position, in world space
+ClusterView MakeClusterView(const CMatrix4x4& viewProjectionMatrix, const CVector3& cameraPosition, bool cullBackFaces)
+{
+    // A point is inside the frustum when its clip space x, y are between -w and w and z is between 0 and w. Clip space
+    // coordinate j is the point dotted with column j of the matrix, so each plane is a sum or difference of two columns
+    const CMatrix4x4& m = viewProjectionMatrix;
+    const float columns[4][4] =
+    {
+        { m.e00, m.e10, m.e20, m.e30 },
+        { m.e01, m.e11, m.e21, m.e31 },
+        { m.e02, m.e12, m.e22, m.e32 },
+        { m.e03, m.e13, m.e23, m.e33 },
+    };
+
+    ClusterView view;
+    for (int i = 0; i < 4; ++i)
+    {
+        view.planes[0][i] = columns[3][i] + columns[0][i]; // Left
+        view.planes[1][i] = columns[3][i] - columns[0][i]; // Right
+        view.planes[2][i] = columns[3][i] + columns[1][i]; // Bottom
+        view.planes[3][i] = columns[3][i] - columns[1][i]; // Top
+        view.planes[4][i] = columns[2][i];                 // Near
+        view.planes[5][i] = columns[3][i] - columns[2][i]; // Far
+    }
+    for (auto& plane : view.planes)  NormalisePlane(plane);
+    view.cameraPosition = cameraPosition;
+    view.cullBackFaces  = cullBackFaces;
+    return view;
+}
+
+
+// The view in the model space of a model with the given world matrix. The frustum test works with any scaling, back faces
+// are only culled if the model is scaled the same on each axis
+ClusterView ModelClusterView(const ClusterView& view, const CMatrix4x4& worldMatrix)
+{
+    // A world space point is the model space point times the world matrix, so a world space plane becomes the world matrix
+    // times the plane (as a column) in model space. Sides of a plane don't change with the transform, only distances, so
+    // the planes are normalised again
+    const CMatrix4x4& w = worldMatrix;
+    const float rows[4][4] =
+    {
+        { w.e00, w.e01, w.e02, w.e03 },
+        { w.e10, w.e11, w.e12, w.e13 },
+        { w.e20, w.e21, w.e22, w.e23 },
+        { w.e30, w.e31, w.e32, w.e33 },
+    };
+    ClusterView modelView;
+    for (int p = 0; p < 6; ++p)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            modelView.planes[p][i] = rows[i][0] * view.planes[p][0] + rows[i][1] * view.planes[p][1] +
+                                     rows[i][2] * view.planes[p][2] + rows[i][3] * view.planes[p][3];
+        }
+        NormalisePlane(modelView.planes[p]);
+    }
+
+    CMatrix4x4 inverse = InverseAffine(worldMatrix);
+    const CVector3& c = view.cameraPosition;
+    modelView.cameraPosition = { c.x * inverse.e00 + c.y * inverse.e10 + c.z * inverse.e20 + inverse.e30,
+                                 c.x * inverse.e01 + c.y * inverse.e11 + c.z * inverse.e21 + inverse.e31,
+                                 c.x * inverse.e02 + c.y * inverse.e12 + c.z * inverse.e22 + inverse.e32 };
+
+    // Directions only keep their angles if the scaling is the same on each axis
+    CVector3 scale = worldMatrix.GetScale();
+    float minScale = std::fmin(scale.x, std::fmin(scale.y, scale.z));
+    float maxScale = std::fmax(scale.x, std::fmax(scale.y, scale.z));
+    modelView.cullBackFaces = view.cullBackFaces && maxScale <= minScale * 1.001f;
+    return modelView;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Culling
+//--------------------------------------------------------------------------------------
+
+// A cluster faces away when every point of its sphere is seen from behind every triangle direction in its cone:
+// dot(centre - camera, axis) >= cutoff * |centre - camera| + radius (as in Zeux's meshoptimizer)
+static bool ClusterVisible(const MeshCluster& cluster, const ClusterView& view)
+{
+    for (auto& plane : view.planes)
+    {
+        if (plane[0] * cluster.centre.x + plane[1] * cluster.centre.y + plane[2] * cluster.centre.z + plane[3] < -cluster.radius)  return false;
+    }
+    if (view.cullBackFaces)
+    {
+        CVector3 toCluster = cluster.centre - view.cameraPosition;
+        if (Dot(toCluster, cluster.coneAxis) >= cluster.coneCutoff * Length(toCluster) + cluster.radius)  return false;
+    }
+    return true;
+}
+
+
+// Test clusters against a view in model space, setting visible[i] to 1 if cluster i may be seen and 0 if not. Returns the
+// number visible
+uint32_t CullClusters(const MeshCluster* clusters, uint32_t numClusters, const ClusterView& view, uint8_t* visible)
+{
+    uint32_t numVisible = 0;
+    uint32_t i = 0;
+
+#ifdef MESH_CLUSTERS_USE_SSE
+    // Four clusters at a time, their spheres and cones turned into separate x, y, z and radius (or cutoff) registers
+    __m128 planes[6][4];
+    for (int p = 0; p < 6; ++p)
+    {
+        for (int c = 0; c < 4; ++c)  planes[p][c] = _mm_set1_ps(view.planes[p][c]);
+    }
+    __m128 cameraX = _mm_set1_ps(view.cameraPosition.x);
+    __m128 cameraY = _mm_set1_ps(view.cameraPosition.y);
+    __m128 cameraZ = _mm_set1_ps(view.cameraPosition.z);
+    __m128 zero    = _mm_setzero_ps();
+    for (; i + 4 <= numClusters; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&clusters[i + 0].centre.x);
+        __m128 y = _mm_loadu_ps(&clusters[i + 1].centre.x);
+        __m128 z = _mm_loadu_ps(&clusters[i + 2].centre.x);
+        __m128 radius = _mm_loadu_ps(&clusters[i + 3].centre.x);
+        _MM_TRANSPOSE4_PS(x, y, z, radius);
+
+        __m128 culled = zero;
+        __m128 negativeRadius = _mm_sub_ps(zero, radius);
+        for (int p = 0; p < 6; ++p)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[p][0], x), _mm_mul_ps(planes[p][1], y)),
+                                         _mm_add_ps(_mm_mul_ps(planes[p][2], z), planes[p][3]));
+            culled = _mm_or_ps(culled, _mm_cmplt_ps(distance, negativeRadius));
+        }
+
+        if (view.cullBackFaces)
+        {
+            __m128 axisX = _mm_loadu_ps(&clusters[i + 0].coneAxis.x);
+            __m128 axisY = _mm_loadu_ps(&clusters[i + 1].coneAxis.x);
+            __m128 axisZ = _mm_loadu_ps(&clusters[i + 2].coneAxis.x);
+            __m128 cutoff = _mm_loadu_ps(&clusters[i + 3].coneAxis.x);
+            _MM_TRANSPOSE4_PS(axisX, axisY, axisZ, cutoff);
+
+            __m128 dx = _mm_sub_ps(x, cameraX);
+            __m128 dy = _mm_sub_ps(y, cameraY);
+            __m128 dz = _mm_sub_ps(z, cameraZ);
+            __m128 dot = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, axisX), _mm_mul_ps(dy, axisY)), _mm_mul_ps(dz, axisZ));
+            __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+            __m128 limit = _mm_add_ps(_mm_mul_ps(cutoff, distance), radius);
+            culled = _mm_or_ps(culled, _mm_cmpge_ps(dot, limit));
+        }
+
+        int culledMask = _mm_movemask_ps(culled);
+        for (int c = 0; c < 4; ++c)
+        {
+            visible[i + c] = (culledMask & (1 << c)) ? 0 : 1;
+            numVisible += visible[i + c];
+        }
+    }
+#endif
+
+    // Remaining clusters (or all of them without SSE)
+    for (; i < numClusters; ++i)
+    {
+        visible[i] = ClusterVisible(clusters[i], view) ? 1 : 0;
+        numVisible += visible[i];
+    }
+    return numVisible;
+}
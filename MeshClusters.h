@@ -0,0 +1,62 @@
+//--------------------------------------------------------------------------------------
+// Mesh clusters - culling parts of large meshes
+//--------------------------------------------------------------------------------------
+// Models are culled whole, so a large mesh like the hills or a building is drawn in full when
+// any of it is on screen, including the parts off to the side and the parts facing away. When a
+// mesh is cooked (see MeshCache.h) each full detail sub-mesh is split into clusters of up to 124
+// triangles using up to 64 vertices. Each cluster has a bounding sphere and a cone holding the
+// directions its triangles face, so it can be skipped when the sphere is outside the view
+// frustum or every triangle faces away from the camera.
+//
+// The triangles have already been put in vertex cache order (see MeshOptimiser.h), which keeps
+// neighbouring triangles together, so each cluster is just the next run of the indices. Culling
+// leaves a list of visible runs and neighbouring runs are joined, so the mesh is drawn with a few
+// index ranges of its existing index buffer and nothing is written to the GPU.
+//
+// Clusters are tested four at a time with SSE, in the mesh's model space so they don't need
+// transforming. Meshes are rendered on the pass recorder's threads (see PassRecorder.h), so the
+// culling is spread over those threads. Doesn't use any Direct3D so clusters can be built and
+// culled on any platform.
+
+#ifndef _MESH_CLUSTERS_H_INCLUDED_
+#define _MESH_CLUSTERS_H_INCLUDED_
+
+#include "MeshCache.h"
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+#include <cstdint>
+
+// Cluster size limits, the same as GPU mesh shader limits so the clusters would suit those too
+const uint32_t MAX_CLUSTER_VERTICES  = 64;
+const uint32_t MAX_CLUSTER_TRIANGLES = 124;
+
+// Sub-meshes with fewer triangles than this are always drawn whole, splitting them would cost more in draws than it saves
+const uint32_t MIN_CLUSTERED_TRIANGLES = 1024;
+
+// A view to cull clusters against
+struct ClusterView
+{
+    float    planes[6][4];   // Frustum planes, points inside have dot(plane.xyz, p) + plane.w >= 0. The xyz are unit length
+    CVector3 cameraPosition;
+    bool     cullBackFaces;  // Also cull clusters facing away from the camera, only if the render mode culls back faces
+};
+
+
+// Split each large full detail sub-mesh of a mesh with float positions and normals and 32-bit indices into clusters
+void BuildClusters(const CookedMesh& mesh, const uint8_t* vertices, const uint32_t* indices, std::vector<MeshCluster>& clusters);
+
+// View for a camera's view-projection matrix (row vectors, as used throughout) and position, in world space
+ClusterView MakeClusterView(const CMatrix4x4& viewProjectionMatrix, const CVector3& cameraPosition, bool cullBackFaces);
+
+// The view in the model space of a model with the given world matrix. The frustum test works with any scaling, back faces
+// are only culled if the model is scaled the same on each axis
+ClusterView ModelClusterView(const ClusterView& view, const CMatrix4x4& worldMatrix);
+
+// Test clusters against a view in model space, setting visible[i] to 1 if cluster i may be seen and 0 if not. Returns the
+// number visible
+uint32_t CullClusters(const MeshCluster* clusters, uint32_t numClusters, const ClusterView& view, uint8_t* visible);
+
+
+#endif //_MESH_CLUSTERS_H_INCLUDED_
@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// Mesh cooking - the steps between importing a mesh and saving it as a cooked file
+//--------------------------------------------------------------------------------------
+
+#include "MeshCook.h"
+#include "MeshOptimiser.h"
+#include "MeshSimplifier.h"
+#include "MeshClusters.h"
+
+#include <vector>
+#include <cstring>
+
+
+// Prepare a mesh just imported, with float positions and normals, 32-bit indices and one level of detail, for the GPU:
+// reorder it, add levels of detail and clusters and use 16-bit indices if they fit. The description must point at the data's
+// own arrays, the index, sub-mesh and cluster arrays are replaced
+void CookMesh(MeshData& data)
+{
+    CookedMesh& cookedMesh = data.description;
+
+    // Reorder the triangles and vertices to suit the GPU, recording how much that helped (see MeshOptimiser.h). This replaces
+    // assimp's aiProcess_ImproveCacheLocality, which doesn't reduce overdraw or vertex fetches
+    OptimiseMesh(cookedMesh, data.vertices.get(), reinterpret_cast<uint32_t*>(data.indices.get()));
+
+    // Add simpler levels of detail after the full detail indices (see MeshSimplifier.h)
+    uint32_t* fullDetailIndices = reinterpret_cast<uint32_t*>(data.indices.get());
+    std::vector<uint32_t> lodIndices(fullDetailIndices, fullDetailIndices + cookedMesh.numIndices);
+    std::vector<SubMesh>  lodSubMeshes(data.subMeshes.get(), data.subMeshes.get() + cookedMesh.numSubMeshes);
+    GenerateLods(cookedMesh, data.vertices.get(), lodIndices, lodSubMeshes);
+
+    data.indices   = std::make_unique<unsigned char[]>(lodIndices.size() * 4);
+    data.subMeshes = std::make_unique<SubMesh[]>(lodSubMeshes.size());
+    std::memcpy(data.indices.get(), lodIndices.data(), lodIndices.size() * 4);
+    std::memcpy(data.subMeshes.get(), lodSubMeshes.data(), lodSubMeshes.size() * sizeof(SubMesh));
+    cookedMesh.indices   = data.indices.get();
+    cookedMesh.subMeshes = data.subMeshes.get();
+
+    // Split the large full detail sub-meshes into clusters that can be culled separately (see MeshClusters.h)
+    std::vector<MeshCluster> clusters;
+    BuildClusters(cookedMesh, data.vertices.get(), reinterpret_cast<const uint32_t*>(data.indices.get()), clusters);
+    data.clusters = std::make_unique<MeshCluster[]>(clusters.size());
+    std::memcpy(data.clusters.get(), clusters.data(), clusters.size() * sizeof(MeshCluster));
+    cookedMesh.numClusters = static_cast<uint32_t>(clusters.size());
+    cookedMesh.clusters    = data.clusters.get();
+
+    // Halve the size of the indices if they fit in 16 bits, the spare half of the index data isn't used
+    ConvertTo16BitIndices(cookedMesh, reinterpret_cast<uint32_t*>(data.indices.get()));
+}
@@ -0,0 +1,39 @@
+//--------------------------------------------------------------------------------------
+// Mesh cooking - the steps between importing a mesh and saving it as a cooked file
+//--------------------------------------------------------------------------------------
+// Once a mesh has been imported into plain float vertices and 32-bit indices (see MeshImport.h)
+// it is prepared for the GPU: the triangles and vertices are reordered (see MeshOptimiser.h),
+// simpler levels of detail are added (see MeshSimplifier.h), the large sub-meshes are split into
+// clusters (see MeshClusters.h) and the indices are halved in size where they fit in 16 bits.
+// The result is what is saved in the cooked file (see MeshCache.h).
+//
+// Kept apart from the assimp import and doesn't use any Direct3D, so the cooking steps can be run,
+// tested and timed on meshes made in code on any platform.
+
+#ifndef _MESH_COOK_H_INCLUDED_
+#define _MESH_COOK_H_INCLUDED_
+
+#include "MeshCache.h"
+
+#include <memory>
+
+// Mesh data on the CPU ready to be copied to the GPU. Either imported by assimp into the arrays here, or mapped from a
+// cooked file (see MeshCache.h). The description gives the layout, counts and bounds and points at the data
+struct MeshData
+{
+    CookedMesh                       description;
+    std::unique_ptr<unsigned char[]> vertices;   // Imported data, not used if the data is in the cooked file
+    std::unique_ptr<unsigned char[]> indices;
+    std::unique_ptr<SubMesh[]>       subMeshes;
+    std::unique_ptr<MeshCluster[]>   clusters;
+    std::unique_ptr<MappedFile>      cookedFile;
+};
+
+
+// Prepare a mesh just imported, with float positions and normals, 32-bit indices and one level of detail, for the GPU:
+// reorder it, add levels of detail and clusters and use 16-bit indices if they fit. The description must point at the data's
+// own arrays, the index, sub-mesh and cluster arrays are replaced
+void CookMesh(MeshData& data);
+
+
+#endif //_MESH_COOK_H_INCLUDED_
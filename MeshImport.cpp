@@ -0,0 +1,294 @@
+//--------------------------------------------------------------------------------------
+// Mesh import - reading mesh files with assimp
+//--------------------------------------------------------------------------------------
+
+#include "MeshImport.h"
+#include "MeshCook.h"
+#include "MeshTangents.h"
+#include "CVector2.h"
+#include "CVector3.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/DefaultLogger.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <stdexcept>
+#include <cstring>
+
+
+// Send assimp's log of each import to the debugger. There is one log for all threads, so call before starting any threads
+// that import meshes and call StopImportLog after they have all finished
+void StartImportLog()
+{
+    Assimp::DefaultLogger::create("", Assimp::DefaultLogger::VERBOSE);
+}
+
+void StopImportLog()
+{
+    Assimp::DefaultLogger::kill();
+}
+
+
+// Import a mesh file to the CPU without creating any GPU buffers, from the cooked file if there is an up to date one
+// Tangents are included if requested and the mesh has texture coordinates to calculate them from
+// Pass false for useCookedFile to always import with assimp and not save a cooked file, e.g. to time the import
+// Will throw a std::runtime_error exception on failure
+std::unique_ptr<MeshData> ImportMesh(const std::string& fileName, bool calculateTangents, bool useCookedFile /*= true*/)
+{
+    Assimp::Importer importer;
+
+    // Flags for processing the mesh. Assimp provides a huge amount of control - right click any of these
+    // and "Peek Definition" to see documention above each constant
+    // Normals for files without them and tangents are calculated after importing, on several threads, and identical vertices
+    // are joined after that so the normals can keep hard edges (see MeshTangents.h)
+    unsigned int assimpFlags = aiProcess_MakeLeftHanded |
+                               aiProcess_FixInfacingNormals |
+                               aiProcess_GenUVCoords | 
+                               aiProcess_TransformUVCoords |
+                               aiProcess_FlipUVs |
+                               aiProcess_FlipWindingOrder |
+                               aiProcess_Triangulate |
+                               aiProcess_PreTransformVertices |
+                               aiProcess_SortByPType |
+                               aiProcess_FindInvalidData | 
+                               aiProcess_OptimizeMeshes |
+                               aiProcess_FindInstances |
+                               aiProcess_FindDegenerates |
+                               aiProcess_RemoveRedundantMaterials |
+                               aiProcess_Debone |
+                               aiProcess_RemoveComponent;
+
+    // Flags to specify what mesh data to ignore
+    // Materials are kept so sub-meshes with different materials stay separate and each has its material slot
+    // Tangents are always calculated by GenerateTangents rather than read from the file
+    int removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS | 
+                           aiComponent_BONEWEIGHTS | aiComponent_ANIMATIONS | aiComponent_TANGENTS_AND_BITANGENTS;
+
+    // Other miscellaneous settings
+    importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);  // Remove points and lines (keep triangles only)
+    importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);                 // Remove degenerate triangles
+    importer.SetPropertyBool(AI_CONFIG_PP_DB_ALL_OR_NONE, true);            // Default to removing bones/weights from meshes that don't need skinning
+  
+    importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, removeComponents);
+
+
+    //-----------------------------------
+
+    // Use the cooked version of the mesh saved by an earlier run if there is one for this source file and these settings (see
+    // MeshCache.h). The GPU buffers are created straight from the mapped file. The cooked flags mark the files with tangents with
+    // aiProcess_CalcTangentSpace, although assimp doesn't calculate them now
+    unsigned int cookedFlags = assimpFlags | (calculateTangents ? aiProcess_CalcTangentSpace : 0);
+    uint64_t sourceHash = 0;
+    bool sourceHashed = useCookedFile && HashFile(fileName, sourceHash);
+    std::string cookedFile = CookedMeshFileName(fileName, cookedFlags);
+    auto data = std::make_unique<MeshData>();
+    if (sourceHashed)
+    {
+        data->cookedFile = std::make_unique<MappedFile>();
+        if (LoadCookedMesh(cookedFile, sourceHash, cookedFlags, *data->cookedFile, data->description))  return data;
+        data->cookedFile.reset();
+    }
+
+
+    // Import mesh with assimp given above requirements. Logged if StartImportLog has been called
+    const aiScene* scene = importer.ReadFile(fileName, assimpFlags);
+    if (scene == nullptr)  throw std::runtime_error("Error loading mesh (" + fileName + "). " + importer.GetErrorString());
+    if (scene->mNumMeshes == 0)  throw std::runtime_error("No usable geometry in mesh: " + fileName);
+
+
+    //-----------------------------------
+
+    // All the sub-meshes are loaded into one set of vertices and indices, each drawn from its own range (see Render)
+    // Check every sub-mesh has the data needed and count their vertices and indices
+    unsigned int numVertices = 0;
+    unsigned int numIndices  = 0;
+    bool hasTangents = false;
+    bool hasUVs      = false;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        aiMesh* assimpMesh = scene->mMeshes[m];
+        std::string subMeshName = assimpMesh->mName.C_Str();
+
+        if (!assimpMesh->HasPositions())  throw std::runtime_error("No position data for sub-mesh " + subMeshName + " in " + fileName);
+        if (!assimpMesh->HasFaces())      throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
+        if (assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
+        {
+            if (assimpMesh->mNumUVComponents[0] != 2)  throw std::runtime_error("Unsupported texture coordinates in " + subMeshName + " in " + fileName);
+            hasUVs = true;
+        }
+
+        // Tangents can't be calculated without texture coordinates, Mesh checks for them if they are required
+        if (calculateTangents && hasUVs)  hasTangents = true;
+
+        // Each triangle corner gets its own vertex until normals have been calculated
+        numVertices += assimpMesh->mNumFaces * 3;
+        numIndices  += assimpMesh->mNumFaces * 3;
+    }
+
+
+    //-----------------------------------
+
+    // Position data is required and normals are calculated if missing. Tangents and UVs are included if any sub-mesh has them, sub-meshes without
+    // them get zeros. The layout is described in the cooked mesh (see MeshCache.h), the DirectX layout is created from that
+    CookedMesh& cookedMesh = data->description;
+    unsigned int offset = 0;
+    
+    unsigned int positionOffset = offset;
+    cookedMesh.elements[cookedMesh.numElements++] = { VertexSemantic::Position, VertexFormat::Float, 3, positionOffset };
+    offset += 12;
+
+    unsigned int normalOffset = offset;
+    cookedMesh.elements[cookedMesh.numElements++] = { VertexSemantic::Normal, VertexFormat::Float, 3, normalOffset };
+    offset += 12;
+
+    unsigned int tangentOffset = offset;
+    if (hasTangents)
+    {
+        cookedMesh.elements[cookedMesh.numElements++] = { VertexSemantic::Tangent, VertexFormat::Float, 3, tangentOffset };
+        offset += 12;
+    }
+    
+    unsigned int uvOffset = offset;
+    if (hasUVs)
+    {
+        cookedMesh.elements[cookedMesh.numElements++] = { VertexSemantic::UV, VertexFormat::Float, 2, uvOffset };
+        offset += 8;
+    }
+
+    unsigned int vertexSize = offset;
+
+
+    //-----------------------------------
+
+    // Create CPU-side buffers to hold current mesh data - exact content is flexible so can't use a structure for a vertex - so just a block of bytes
+    // Note: for large arrays a unique_ptr is better than a vector because vectors default-initialise all the values which is a waste of time.
+    data->vertices  = std::make_unique<unsigned char[]>(numVertices * vertexSize);
+    data->indices   = std::make_unique<unsigned char[]>(numIndices * 4); // Using 32 bit indexes (4 bytes) for each indeex
+    data->subMeshes = std::make_unique<SubMesh[]>(scene->mNumMeshes);
+
+
+    //-----------------------------------
+
+    // Bounding sphere around the centre of the bounding box of all the sub-meshes. Not the smallest sphere but close enough
+    // for culling and lighting
+    CVector3 boxMin = *reinterpret_cast<CVector3*>(&scene->mMeshes[0]->mVertices[0]);
+    CVector3 boxMax = boxMin;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        CVector3* assimpPositions = reinterpret_cast<CVector3*>(scene->mMeshes[m]->mVertices);
+        for (unsigned int i = 0; i < scene->mMeshes[m]->mNumVertices; ++i)
+        {
+            const CVector3& p = assimpPositions[i];
+            if (p.x < boxMin.x)  boxMin.x = p.x;
+            if (p.y < boxMin.y)  boxMin.y = p.y;
+            if (p.z < boxMin.z)  boxMin.z = p.z;
+            if (p.x > boxMax.x)  boxMax.x = p.x;
+            if (p.y > boxMax.y)  boxMax.y = p.y;
+            if (p.z > boxMax.z)  boxMax.z = p.z;
+        }
+    }
+    cookedMesh.boundsCentre = (boxMin + boxMax) * 0.5f;
+    cookedMesh.boundsRadius = 0;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        CVector3* assimpPositions = reinterpret_cast<CVector3*>(scene->mMeshes[m]->mVertices);
+        for (unsigned int i = 0; i < scene->mMeshes[m]->mNumVertices; ++i)
+        {
+            float distance = Length(assimpPositions[i] - cookedMesh.boundsCentre);
+            if (distance > cookedMesh.boundsRadius)  cookedMesh.boundsRadius = distance;
+        }
+    }
+
+
+    //-----------------------------------
+
+    // Copy each sub-mesh's data from assimp to our CPU-side vertex and index buffers, after the sub-meshes before it. Each
+    // triangle corner gets its own copy of the assimp vertex so normals can differ either side of a hard edge, the vertices
+    // that end up the same are joined again below
+    unsigned int baseVertex = 0;
+    unsigned int startIndex = 0;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        aiMesh* assimpMesh = scene->mMeshes[m];
+        unsigned char* vertex = data->vertices.get() + baseVertex * vertexSize;
+        unsigned int subMeshVertices = assimpMesh->mNumFaces * 3;
+        bool subMeshUVs = assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0);
+
+        CVector3* assimpPositions = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
+        CVector3* assimpNormals   = reinterpret_cast<CVector3*>(assimpMesh->mNormals);
+        for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
+        {
+            for (unsigned int corner = 0; corner < 3; ++corner)
+            {
+                unsigned int i = assimpMesh->mFaces[face].mIndices[corner];
+                *(CVector3*)(vertex + positionOffset) = assimpPositions[i];
+
+                // Calculated with GenerateNormals below if the file has none
+                *(CVector3*)(vertex + normalOffset) = assimpMesh->HasNormals() ? assimpNormals[i] : CVector3{ 0, 0, 0 };
+
+                // Calculated with GenerateTangents below, sub-meshes without texture coordinates are left with zero tangents
+                if (hasTangents)  *(CVector3*)(vertex + tangentOffset) = CVector3{ 0, 0, 0 };
+
+                if (hasUVs)
+                {
+                    aiVector3D assimpUV = subMeshUVs ? assimpMesh->mTextureCoords[0][i] : aiVector3D(0, 0, 0);
+                    *(CVector2*)(vertex + uvOffset) = CVector2(assimpUV.x, assimpUV.y);
+                }
+                vertex += vertexSize;
+            }
+        }
+
+        // Indices are relative to the sub-mesh's first vertex, the draw call adds the base vertex
+        uint32_t* index = reinterpret_cast<uint32_t*>(data->indices.get()) + startIndex;
+        for (unsigned int i = 0; i < subMeshVertices; ++i)  *index++ = i;
+
+        SubMesh& subMesh = data->subMeshes[m];
+        subMesh.startIndex = startIndex;
+        subMesh.numIndices = assimpMesh->mNumFaces * 3;
+        subMesh.baseVertex = static_cast<int32_t>(baseVertex);
+        subMesh.material   = assimpMesh->mMaterialIndex;
+
+        baseVertex += subMeshVertices;
+        startIndex += subMesh.numIndices;
+    }
+
+
+    //-----------------------------------
+
+    cookedMesh.vertexSize   = vertexSize;
+    cookedMesh.numVertices  = numVertices;
+    cookedMesh.vertices     = data->vertices.get();
+    cookedMesh.indexSize    = 4;
+    cookedMesh.numIndices   = numIndices;
+    cookedMesh.indices      = data->indices.get();
+    cookedMesh.numSubMeshes = scene->mNumMeshes;
+    cookedMesh.subMeshes    = data->subMeshes.get();
+
+    // Smooth normals for sub-meshes without any, then join the vertices that are the same in every part, which leaves
+    // separate vertices only where the normal or another part changes (see MeshTangents.h)
+    uint32_t* indices = reinterpret_cast<uint32_t*>(data->indices.get());
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        if (!scene->mMeshes[m]->HasNormals())  GenerateNormals(cookedMesh, m, data->vertices.get(), indices);
+    }
+    cookedMesh.numVertices = JoinIdenticalVertices(cookedMesh, data->vertices.get(), indices, data->subMeshes.get());
+
+    // Tangents from the normals and texture coordinates
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        aiMesh* assimpMesh = scene->mMeshes[m];
+        if (hasTangents && assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0))
+        {
+            GenerateTangents(cookedMesh, m, data->vertices.get(), indices);
+        }
+    }
+
+    // Reorder, add levels of detail and clusters (see MeshCook.h)
+    CookMesh(*data);
+
+    // Save the imported mesh so later runs can skip assimp. Not fatal if this fails, the mesh will just be imported again
+    if (sourceHashed)  WriteCookedMesh(cookedFile, sourceHash, cookedFlags, cookedMesh);
+
+    return data;
+}
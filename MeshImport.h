@@ -0,0 +1,30 @@
+//--------------------------------------------------------------------------------------
+// Mesh import - reading mesh files with assimp
+//--------------------------------------------------------------------------------------
+// Uses assimp (http://www.assimp.org/) to read many mesh file types into plain float vertices
+// and 32-bit indices, calculates their tangents (see MeshTangents.h) and cooks them (see
+// MeshCook.h). The cooked mesh is saved next to the source file and later imports map that file
+// instead of running assimp again (see MeshCache.h). Doesn't use any Direct3D, so meshes can be
+// imported and cooked without a device, e.g. by tools and tests.
+
+#ifndef _MESH_IMPORT_H_INCLUDED_
+#define _MESH_IMPORT_H_INCLUDED_
+
+#include "MeshCook.h"
+
+#include <string>
+#include <memory>
+
+// Send assimp's log of each import to the debugger. There is one log for all threads, so call before starting any threads
+// that import meshes and call StopImportLog after they have all finished. Imports aren't logged otherwise
+void StartImportLog();
+void StopImportLog();
+
+// Import a mesh file to the CPU without creating any GPU buffers, from the cooked file if there is an up to date one
+// Tangents are included if requested and the mesh has texture coordinates to calculate them from
+// Pass false for useCookedFile to always import with assimp and not save a cooked file, e.g. to time the import
+// Will throw a std::runtime_error exception on failure
+std::unique_ptr<MeshData> ImportMesh(const std::string& fileName, bool calculateTangents, bool useCookedFile = true);
+
+
+#endif //_MESH_IMPORT_H_INCLUDED_
@@ -0,0 +1,341 @@
+//--------------------------------------------------------------------------------------
+// Mesh manager - shares meshes between everything that uses the same file
+//--------------------------------------------------------------------------------------
+
+#include "MeshManager.h"
+#include "MeshImport.h"
+#include "MeshOptimiser.h"
+#include "MeshSimplifier.h"
+
+#include <stdexcept>
+
+
+MeshManager::~MeshManager()
+{
+    Shutdown();
+}
+
+
+// Get the mesh for a file, loading it in the background the first time it is asked for. Pass true to get a layout with
+// tangents (for normal and parallax mapping). The mesh stays loaded while there are handles to it
+MeshHandle MeshManager::Load(const std::string& fileName, bool requireTangents /*= false*/)
+{
+    ++mNumRequests;
+
+    auto key = std::make_tuple(fileName, requireTangents, mCompressVertices);
+    MeshHandle mesh = mMeshes[key].lock();
+    if (mesh)  return mesh;
+
+    mesh = std::make_shared<Mesh>(mPool, fileName);
+    mMeshes[key] = mesh;
+
+    Request request = { mNextRequest++, requireTangents, mCompressVertices };
+    Loading& loading = mLoading[request.id];
+    loading.mesh      = mesh;
+    loading.name      = fileName + (requireTangents ? " (tangents)" : "");
+    loading.requested = std::chrono::high_resolution_clock::now();
+    loading.tangents  = requireTangents;
+    loading.compress  = mCompressVertices;
+
+    // Lay out the file's imported data if there is some. If the file is already being imported the request waits for that,
+    // or joins the import job if it hasn't started yet. Otherwise start importing the file, always with tangents
+    auto imported = mImports.find(fileName);
+    if (imported != mImports.end())
+    {
+        QueueJob({ fileName, imported->second, { request } });
+    }
+    else if (mImporting.count(fileName) > 0)
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto& job : mJobs)
+        {
+            if (job.fileName == fileName && !job.imported)
+            {
+                job.requests.push_back(request);
+                return mesh;
+            }
+        }
+        mWaiting[fileName].push_back(request);
+    }
+    else
+    {
+        mImporting.insert(fileName);
+        ++mNumImports;
+        QueueJob({ fileName, nullptr, { request } });
+    }
+    return mesh;
+}
+
+
+// Pick up meshes the loading threads have finished and copy no more than maxUploadBytes of mesh data to the GPU
+void MeshManager::Update(uint32_t maxUploadBytes)
+{
+    std::deque<JobResult> results;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        results.swap(mResults);
+    }
+
+    for (auto& result : results)
+    {
+        mReport += result.report;
+
+        // Requests that arrived after the file's import started can be laid out now
+        if (result.importedFile)
+        {
+            mImporting.erase(result.fileName);
+            std::vector<Request> waiting;
+            waiting.swap(mWaiting[result.fileName]);
+            mWaiting.erase(result.fileName);
+            if (result.error.empty())
+            {
+                mImports[result.fileName] = result.imported;
+                if (!waiting.empty())  QueueJob({ result.fileName, result.imported, waiting });
+            }
+            else
+            {
+                for (auto& request : waiting)  Fail(request.id, result.error);
+            }
+        }
+
+        for (auto& layout : result.layouts)
+        {
+            mLoadTime += layout.decodeTime;
+            auto loading = mLoading.find(layout.id);
+            if (loading == mLoading.end())  continue;
+            if (!result.error.empty() || !layout.error.empty())
+            {
+                Fail(layout.id, result.error.empty() ? layout.error : result.error);
+                continue;
+            }
+
+            // Nothing to do if the mesh was let go while it was loading
+            MeshHandle mesh = loading->second.mesh.lock();
+            if (!mesh)
+            {
+                mLoading.erase(loading);
+                continue;
+            }
+
+            loading->second.decodeTime = layout.decodeTime;
+            loading->second.data       = std::move(layout.data);
+            loading->second.imported   = loading->second.data ? nullptr : result.imported;
+            const MeshData& data = loading->second.data ? *loading->second.data : *loading->second.imported;
+            try
+            {
+                mesh->BeginUpload(data, Placeholder(loading->second.tangents, loading->second.compress));
+            }
+            catch (std::runtime_error e)
+            {
+                Fail(layout.id, e.what());
+                continue;
+            }
+            mUploads.push_back(layout.id);
+            ++mLoadedVersion;
+        }
+    }
+
+    // Copy the meshes to the GPU in the order they became ready, carrying on with the same mesh next frame if the limit is reached
+    auto start = std::chrono::high_resolution_clock::now();
+    uint32_t bytesLeft = maxUploadBytes;
+    while (!mUploads.empty() && bytesLeft > 0)
+    {
+        auto loading = mLoading.find(mUploads.front());
+        MeshHandle mesh = (loading != mLoading.end()) ? loading->second.mesh.lock() : nullptr;
+        if (!mesh)
+        {
+            if (loading != mLoading.end())  mLoading.erase(loading);
+            mUploads.pop_front();
+            continue;
+        }
+
+        const MeshData& data = loading->second.data ? *loading->second.data : *loading->second.imported;
+        bytesLeft -= mesh->ContinueUpload(data, bytesLeft);
+        if (!mesh->IsLoaded())  break;
+
+        auto now = std::chrono::high_resolution_clock::now();
+        MeshLoadTime loadTime;
+        loadTime.name       = loading->second.name;
+        loadTime.decodeTime = loading->second.decodeTime;
+        loadTime.latency    = std::chrono::duration<float>(now - loading->second.requested).count();
+        mLoadTimes.push_back(loadTime);
+        mReport += loadTime.name + ": drawn after " + std::to_string(static_cast<int>(loadTime.latency * 1000 + 0.5f)) + "ms, " +
+                   std::to_string(static_cast<int>(loadTime.decodeTime * 1000 + 0.5f)) + "ms loading\n";
+
+        mLoading.erase(loading);
+        mUploads.pop_front();
+        ++mLoadedVersion;
+    }
+    mLoadTime += std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+
+// Stop the loading threads and drop any meshes still loading. Call before the geometry pool is released
+void MeshManager::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+        mJobs.clear();
+    }
+    mWorkAvailable.notify_all();
+    for (auto& worker : mWorkers)  worker.join();
+    if (!mWorkers.empty())  StopImportLog();
+    mWorkers.clear();
+
+    mResults.clear();
+    mLoading.clear();
+    mUploads.clear();
+    mImporting.clear();
+    mWaiting.clear();
+    for (auto& placeholders : mPlaceholders)
+    {
+        for (auto& placeholder : placeholders)  placeholder.reset();
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Loading threads
+//--------------------------------------------------------------------------------------
+
+// Queue a job for the loading threads, starting them the first time
+void MeshManager::QueueJob(Job job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mShutdown)  return;
+        mJobs.push_back(std::move(job));
+    }
+    if (mWorkers.empty())
+    {
+        StartImportLog(); // Shared by the loading threads, so made before they start and destroyed after they finish
+        unsigned int numThreads = (mNumThreads > 0) ? mNumThreads : 1;
+        for (unsigned int i = 0; i < numThreads; ++i)  mWorkers.emplace_back(&MeshManager::WorkerLoop, this);
+    }
+    mWorkAvailable.notify_one();
+}
+
+
+// Main function of each loading thread - runs jobs from the queue until shutdown
+void MeshManager::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        mWorkAvailable.wait(lock, [this] { return mShutdown || !mJobs.empty(); });
+        if (mShutdown)  return;
+
+        // Once taken off the queue no more requests can be added to the job
+        Job job = std::move(mJobs.front());
+        mJobs.pop_front();
+
+        lock.unlock();
+        JobResult result = RunJob(job);
+        lock.lock();
+
+        mResults.push_back(std::move(result));
+    }
+}
+
+
+// Run a job on a loading thread, catching any errors into the result. Doesn't use any of the manager's data so several can
+// run at once
+MeshManager::JobResult MeshManager::RunJob(const Job& job)
+{
+    JobResult result;
+    result.fileName     = job.fileName;
+    result.importedFile = !job.imported;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    std::shared_ptr<const MeshData> imported = job.imported;
+    if (!imported)
+    {
+        try
+        {
+            auto data = ImportMesh(job.fileName, true);
+            result.report += MeshOrderReport(job.fileName, data->description) + "\n";
+            result.report += MeshLodReport(job.fileName, data->description) + "\n";
+            imported = std::move(data);
+        }
+        catch (std::runtime_error e)
+        {
+            result.error = e.what();
+        }
+    }
+    result.imported = imported;
+
+    // The import time is counted in the first layout, which is the one that waited for it
+    for (auto& request : job.requests)
+    {
+        JobResult::Layout layout;
+        layout.id = request.id;
+        if (imported)
+        {
+            try
+            {
+                layout.data = MakeLayout(*imported, job.fileName, request.tangents, request.compress, result.report);
+            }
+            catch (std::runtime_error e)
+            {
+                layout.error = e.what();
+            }
+        }
+        auto now = std::chrono::high_resolution_clock::now();
+        layout.decodeTime = std::chrono::duration<float>(now - start).count();
+        start = now;
+        result.layouts.push_back(std::move(layout));
+    }
+    return result;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Helpers
+//--------------------------------------------------------------------------------------
+
+// The data for a mesh with the given layout of a file, made from the imported data. Returns null if the imported data can be
+// used as it is. Will throw a std::runtime_error exception on failure
+std::unique_ptr<MeshData> MeshManager::MakeLayout(const MeshData& imported, const std::string& fileName, bool requireTangents,
+                                                  bool compress, std::string& report)
+{
+    // Derive the layout wanted from the imported data
+    bool hasTangents = Mesh::HasVertexElement(imported, VertexSemantic::Tangent);
+    if (requireTangents && !hasTangents)  throw std::runtime_error("No tangent data in " + fileName);
+    std::unique_ptr<MeshData> withoutTangents;
+    if (hasTangents && !requireTangents)  withoutTangents = Mesh::RemoveVertexElement(imported, VertexSemantic::Tangent);
+    const MeshData& layout = withoutTangents ? *withoutTangents : imported;
+
+    if (!compress)  return withoutTangents;
+
+    auto compressed = Mesh::Compress(layout);
+    report += MeshSizeReport(fileName + (requireTangents ? " (tangents)" : ""), layout.description, compressed->description) + "\n";
+    return compressed;
+}
+
+
+// Box with the same layout as meshes with these settings, drawn in place of meshes still being copied to the GPU. Made from
+// Mesh::Box the same way as meshes are made from their files, so it uses the same vertex buffer in the pool
+MeshHandle MeshManager::Placeholder(bool tangents, bool compress)
+{
+    MeshHandle& placeholder = mPlaceholders[tangents][compress];
+    if (!placeholder)
+    {
+        auto box = Mesh::Box();
+        std::string unused;
+        auto layout = MakeLayout(*box, "placeholder box", tangents, compress, unused);
+        placeholder = std::make_shared<Mesh>(mPool, layout ? *layout : *box, "placeholder box");
+    }
+    return placeholder;
+}
+
+
+// Report a mesh that couldn't be loaded, it stays empty
+void MeshManager::Fail(uint64_t id, const std::string& error)
+{
+    auto loading = mLoading.find(id);
+    if (loading == mLoading.end())  return;
+    mReport += "Error loading " + loading->second.name + ": " + error + "\n";
+    mLoading.erase(loading);
+    ++mNumFailed;
+}
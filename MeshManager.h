@@ -0,0 +1,203 @@
+//--------------------------------------------------------------------------------------
+// Mesh manager - shares meshes between everything that uses the same file
+//--------------------------------------------------------------------------------------
+// Asking for the same mesh file twice used to import it twice. The manager imports each file
+// once and hands out shared handles to the meshes made from it, so all models using a file share
+// one set of GPU buffers.
+//
+// A file wanted both with and without tangents (e.g. Sphere.x for plain and normal mapped
+// models) is imported once with tangents, and the layout without them is made by removing the
+// tangents from each vertex of the imported data rather than running assimp again. Meshes can
+// also be given compressed layouts the same way (see MeshOptimiser.h). The meshes' vertices and
+// indices all go into one geometry pool (see GeometryPool.h).
+//
+// Meshes are loaded in the background so the window doesn't wait for them. Load hands out an
+// empty mesh straight away and a small pool of loading threads reads, imports and lays out the
+// file. Update, called once a frame, then copies the finished meshes to the GPU a limited number
+// of bytes at a time so no frame stalls on a large copy. While a mesh is being copied it draws a
+// box around its bounds (see Mesh::BeginUpload). A file that fails to load leaves its meshes
+// empty and the error is reported, the rest of the scene carries on.
+
+#ifndef _MESH_MANAGER_H_INCLUDED_
+#define _MESH_MANAGER_H_INCLUDED_
+
+#include "Mesh.h"
+
+#include <string>
+#include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <tuple>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// How long a mesh took to load
+struct MeshLoadTime
+{
+    std::string name;
+    float       decodeTime; // Seconds spent on a loading thread reading, importing and laying out the mesh
+    float       latency;    // Seconds from the mesh being asked for to it being drawn
+};
+
+class MeshManager
+{
+public:
+    // Meshes are created in the given pool, which must outlive them. The loading threads are started when first needed
+    MeshManager(GeometryPool& pool, unsigned int numThreads = 2) : mPool(pool), mNumThreads(numThreads) {}
+    ~MeshManager();
+
+    // Get the mesh for a file, loading it the first time it is asked for. Pass true to get a layout with tangents (for normal and
+    // parallax mapping). The mesh stays loaded while there are handles to it
+    // Returns without waiting, the mesh is loaded in the background by the loading threads and Update. It draws nothing until
+    // its bounds are known and then a box around them until it is ready. Errors are reported by Update rather than thrown
+    MeshHandle Load(const std::string& fileName, bool requireTangents = false);
+
+    // Pick up meshes the loading threads have finished and copy no more than maxUploadBytes of mesh data to the GPU. Call
+    // once a frame between frames, as it changes meshes that may be being drawn
+    void Update(uint32_t maxUploadBytes);
+
+    // Stop the loading threads and drop any meshes still loading. Call before the geometry pool is released
+    void Shutdown();
+
+    // Use compressed vertex layouts for meshes made after this
+    void SetCompressVertices(bool compress)  { mCompressVertices = compress; }
+
+    // Free the imported data kept to create more layouts of the same files. Call when everything is loaded, files asked for
+    // again after this are imported again
+    void ReleaseImportData()  { mImports.clear(); }
+
+    // Number of files imported, number of meshes asked for and total time spent loading in seconds
+    int   NumImports()  { return mNumImports; }
+    int   NumRequests() { return mNumRequests; }
+    float LoadTime()    { return mLoadTime; }
+
+    // Number of meshes still loading in the background and the number that failed
+    int NumLoading()  { return static_cast<int>(mLoading.size()); }
+    int NumFailed()   { return mNumFailed; }
+
+    // Changes whenever a background mesh starts drawing its placeholder or itself, so cached renders (e.g. static shadows)
+    // know to update
+    unsigned int LoadedVersion()  { return mLoadedVersion; }
+
+    // How long each mesh loaded in the background took, in the order they became ready
+    const std::vector<MeshLoadTime>& LoadTimes()  { return mLoadTimes; }
+
+    // Lines for each file imported with how well its triangle order suits the GPU before and after optimisation and the
+    // triangles in each level of detail, and for each mesh made with the memory it uses and the bytes read to draw it. Background loads add their load times and errors
+    const std::string& OptimisationReport()  { return mReport; }
+
+private:
+    // A mesh wanted from a file, identified by the order they were asked for
+    struct Request
+    {
+        uint64_t id;
+        bool     tangents;
+        bool     compress;
+    };
+
+    // Work for a loading thread: import a file if it hasn't been already and lay it out for each request
+    struct Job
+    {
+        std::string                     fileName;
+        std::shared_ptr<const MeshData> imported; // Null if the file needs importing
+        std::vector<Request>            requests;
+    };
+
+    // What a loading thread made from a job
+    struct JobResult
+    {
+        struct Layout
+        {
+            uint64_t                  id;
+            std::unique_ptr<MeshData> data;       // Null if the imported data is used as it is
+            std::string               error;
+            float                     decodeTime;
+        };
+
+        std::string                     fileName;
+        std::shared_ptr<const MeshData> imported;     // The imported data the layouts were made from
+        bool                            importedFile; // True if this job imported the file
+        std::string                     error;        // Set if the import failed, none of the layouts were made
+        std::vector<Layout>             layouts;
+        std::string                     report;
+    };
+
+    // A mesh being loaded in the background
+    struct Loading
+    {
+        std::weak_ptr<Mesh>                            mesh;
+        std::string                                    name;
+        std::chrono::high_resolution_clock::time_point requested;
+        bool                                           tangents;
+        bool                                           compress;
+        std::shared_ptr<const MeshData>                imported;  // The mesh's data if the imported data is used as it is
+        std::unique_ptr<MeshData>                      data;      // Otherwise its own layout
+        float                                          decodeTime = 0;
+    };
+
+    // The data for a mesh with the given layout of a file, made from the imported data. Returns null if the imported data can be
+    // used as it is. Adds a line to the report for compressed meshes
+    // Will throw a std::runtime_error exception on failure
+    static std::unique_ptr<MeshData> MakeLayout(const MeshData& imported, const std::string& fileName, bool requireTangents,
+                                                bool compress, std::string& report);
+
+    // Run a job on a loading thread, catching any errors into the result
+    static JobResult RunJob(const Job& job);
+
+    // Main function of each loading thread - runs jobs from the queue until shutdown
+    void WorkerLoop();
+
+    void QueueJob(Job job);
+
+    // Box with the same layout as meshes with these settings, drawn in place of meshes still being copied to the GPU
+    MeshHandle Placeholder(bool tangents, bool compress);
+
+    // Report a mesh that couldn't be loaded, it stays empty
+    void Fail(uint64_t id, const std::string& error);
+
+
+    GeometryPool& mPool;
+
+    // Meshes handed out, by file name, tangents and compression. Weak pointers so the manager doesn't keep unused meshes alive
+    std::map<std::tuple<std::string, bool, bool>, std::weak_ptr<Mesh>> mMeshes;
+
+    // Data imported from each file, always with tangents if the file has texture coordinates
+    std::map<std::string, std::shared_ptr<const MeshData>> mImports;
+
+    bool  mCompressVertices = false;
+
+    int   mNumImports  = 0;
+    int   mNumRequests = 0;
+    float mLoadTime    = 0;
+
+    std::string mReport;
+
+    // Background loading, all but the queues are only used on the main thread. Meshes still loading by request id, files being
+    // imported by a job that has already started and the requests waiting for them, and the requests ready to copy to the GPU
+    // in the order they became ready
+    std::map<uint64_t, Loading>                  mLoading;
+    uint64_t                                     mNextRequest = 0;
+    std::set<std::string>                        mImporting;
+    std::map<std::string, std::vector<Request>>  mWaiting;
+    std::deque<uint64_t>                         mUploads;
+    MeshHandle                                   mPlaceholders[2][2];
+    int                                          mNumFailed = 0;
+    unsigned int                                 mLoadedVersion = 0;
+    std::vector<MeshLoadTime>                    mLoadTimes;
+
+    // Loading threads. Jobs not yet started can still have requests added to them. Protected by mMutex
+    unsigned int             mNumThreads;
+    std::vector<std::thread> mWorkers;
+    std::deque<Job>          mJobs;
+    std::deque<JobResult>    mResults;
+    bool                     mShutdown = false;
+    std::mutex               mMutex;
+    std::condition_variable  mWorkAvailable;
+};
+
+
+#endif //_MESH_MANAGER_H_INCLUDED_
@@ -0,0 +1,619 @@
+//--------------------------------------------------------------------------------------
+// Mesh optimiser - reorders triangles and vertices to suit the GPU
+//--------------------------------------------------------------------------------------
+
+#include "MeshOptimiser.h"
+
+#include "CVector3.h"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+
+// Width and height of the software depth buffer used to measure overdraw
+const int OVERDRAW_RESOLUTION = 128;
+
+
+static CVector3 VertexPosition(const uint8_t* vertices, uint32_t vertexSize, uint32_t positionOffset, uint32_t vertex)
+{
+    CVector3 position;
+    std::memcpy(&position, vertices + static_cast<size_t>(vertex) * vertexSize + positionOffset, sizeof(position));
+    return position;
+}
+
+
+// One coordinate of a vector, 0 = x, 1 = y, 2 = z
+static float Axis(const CVector3& v, int axis)
+{
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+
+// Number of vertices used by a sub-mesh, from its base vertex up to the next sub-mesh's
+uint32_t SubMeshVertexCount(const CookedMesh& mesh, uint32_t subMesh)
+{
+    uint32_t baseVertex = static_cast<uint32_t>(mesh.subMeshes[subMesh].baseVertex);
+    uint32_t endVertex  = mesh.numVertices;
+    for (uint32_t other = 0; other < mesh.numSubMeshes; ++other)
+    {
+        uint32_t otherBase = static_cast<uint32_t>(mesh.subMeshes[other].baseVertex);
+        if (otherBase > baseVertex && otherBase < endVertex)  endVertex = otherBase;
+    }
+    return endVertex - baseVertex;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Measuring
+//--------------------------------------------------------------------------------------
+
+// ACMR and ATVR of a triangle list with a first in first out vertex cache of the given size. The indices refer to
+// numVertices vertices, the ATVR only counts vertices that are used
+void AnalyseVertexCache(const uint32_t* indices, uint32_t numIndices, uint32_t numVertices, uint32_t cacheSize,
+                        MeshOrderStats& stats)
+{
+    // A vertex is in the cache if fewer than cacheSize other vertices have been added since it was (0 = never added)
+    std::vector<uint32_t> addedAtMiss(numVertices, 0);
+    uint32_t misses = 0;
+    uint32_t usedVertices = 0;
+    for (uint32_t i = 0; i < numIndices; ++i)
+    {
+        uint32_t vertex = indices[i];
+        if (addedAtMiss[vertex] == 0)  ++usedVertices;
+        if (addedAtMiss[vertex] == 0 || misses - addedAtMiss[vertex] >= cacheSize)
+        {
+            ++misses;
+            addedAtMiss[vertex] = misses;
+        }
+    }
+
+    uint32_t numTriangles = numIndices / 3;
+    stats.acmr = numTriangles > 0 ? static_cast<float>(misses) / numTriangles : 0;
+    stats.atvr = usedVertices > 0 ? static_cast<float>(misses) / usedVertices : 0;
+}
+
+
+// Overdraw of a triangle list drawn from six directions with a depth test, using the CVector3 position at the given offset
+// in each vertex. Rasterised in software at a low resolution, so it is an estimate
+void AnalyseOverdraw(const uint32_t* indices, uint32_t numIndices, const uint8_t* vertices, uint32_t vertexSize,
+                     uint32_t positionOffset, MeshOrderStats& stats)
+{
+    stats.overdraw = 0;
+    if (numIndices < 3)  return;
+
+    // Bounding box of the triangles
+    CVector3 boxMin = VertexPosition(vertices, vertexSize, positionOffset, indices[0]);
+    CVector3 boxMax = boxMin;
+    for (uint32_t i = 1; i < numIndices; ++i)
+    {
+        CVector3 p = VertexPosition(vertices, vertexSize, positionOffset, indices[i]);
+        boxMin = { p.x < boxMin.x ? p.x : boxMin.x, p.y < boxMin.y ? p.y : boxMin.y, p.z < boxMin.z ? p.z : boxMin.z };
+        boxMax = { p.x > boxMax.x ? p.x : boxMax.x, p.y > boxMax.y ? p.y : boxMax.y, p.z > boxMax.z ? p.z : boxMax.z };
+    }
+
+    std::vector<float> depthBuffer(OVERDRAW_RESOLUTION * OVERDRAW_RESOLUTION);
+    uint64_t shaded  = 0;
+    uint64_t covered = 0;
+
+    // Look along each axis in each direction. Only triangles facing one way are drawn in each view (back face culling), the
+    // view from the other direction draws the rest, so it doesn't matter which way round the mesh's triangles are wound
+    for (int view = 0; view < 6; ++view)
+    {
+        int   depthAxis = view / 2;
+        float direction = (view % 2 == 0) ? 1.0f : -1.0f;
+        int   xAxis = (depthAxis + 1) % 3;
+        int   yAxis = (depthAxis + 2) % 3;
+        float xScale = OVERDRAW_RESOLUTION / std::max(Axis(boxMax, xAxis) - Axis(boxMin, xAxis), FLT_EPSILON);
+        float yScale = OVERDRAW_RESOLUTION / std::max(Axis(boxMax, yAxis) - Axis(boxMin, yAxis), FLT_EPSILON);
+
+        std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+        for (uint32_t i = 0; i + 2 < numIndices; i += 3)
+        {
+            // Triangle corners in pixels, with depth increasing away from the viewer
+            float x[3], y[3], z[3];
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                CVector3 p = VertexPosition(vertices, vertexSize, positionOffset, indices[i + corner]);
+                x[corner] = (Axis(p, xAxis) - Axis(boxMin, xAxis)) * xScale;
+                y[corner] = (Axis(p, yAxis) - Axis(boxMin, yAxis)) * yScale;
+                z[corner] = Axis(p, depthAxis) * direction;
+            }
+
+            float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+            if (area * direction <= 0)  continue;
+
+            int minX = std::max(static_cast<int>(std::min({ x[0], x[1], x[2] })), 0);
+            int minY = std::max(static_cast<int>(std::min({ y[0], y[1], y[2] })), 0);
+            int maxX = std::min(static_cast<int>(std::max({ x[0], x[1], x[2] })), OVERDRAW_RESOLUTION - 1);
+            int maxY = std::min(static_cast<int>(std::max({ y[0], y[1], y[2] })), OVERDRAW_RESOLUTION - 1);
+            for (int pixelY = minY; pixelY <= maxY; ++pixelY)
+            {
+                for (int pixelX = minX; pixelX <= maxX; ++pixelX)
+                {
+                    // Barycentric coordinates of the pixel centre, all positive inside the triangle
+                    float px = pixelX + 0.5f;
+                    float py = pixelY + 0.5f;
+                    float w0 = ((x[1] - px) * (y[2] - py) - (x[2] - px) * (y[1] - py)) / area;
+                    float w1 = ((x[2] - px) * (y[0] - py) - (x[0] - px) * (y[2] - py)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    if (w0 < 0 || w1 < 0 || w2 < 0)  continue;
+
+                    // A pixel is shaded if it passes the depth test when the triangle is drawn
+                    float depth = w0 * z[0] + w1 * z[1] + w2 * z[2];
+                    float& bufferDepth = depthBuffer[pixelY * OVERDRAW_RESOLUTION + pixelX];
+                    if (depth < bufferDepth)
+                    {
+                        if (bufferDepth == FLT_MAX)  ++covered;
+                        bufferDepth = depth;
+                        ++shaded;
+                    }
+                }
+            }
+        }
+    }
+
+    stats.overdraw = covered > 0 ? static_cast<float>(shaded) / covered : 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Optimising
+//--------------------------------------------------------------------------------------
+
+// Reorder the triangles for the vertex cache (Tipsify). The index of the first triangle of each cluster is added to
+// clusters, a cluster ends where the triangle order had to jump to a distant part of the mesh
+void OptimiseVertexCache(uint32_t* indices, uint32_t numIndices, uint32_t numVertices, uint32_t cacheSize,
+                         std::vector<uint32_t>& clusters)
+{
+    uint32_t numTriangles = numIndices / 3;
+    if (numTriangles == 0)  return;
+
+    // Triangles using each vertex, stored for all vertices in one array
+    std::vector<uint32_t> liveTriangles(numVertices, 0); // Triangles using each vertex not yet added to the new order
+    for (uint32_t i = 0; i < numTriangles * 3; ++i)  ++liveTriangles[indices[i]];
+    std::vector<uint32_t> firstTriangle(numVertices + 1, 0);
+    for (uint32_t v = 0; v < numVertices; ++v)  firstTriangle[v + 1] = firstTriangle[v] + liveTriangles[v];
+    std::vector<uint32_t> vertexTriangles(numTriangles * 3);
+    std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+    for (uint32_t i = 0; i < numTriangles * 3; ++i)  vertexTriangles[fill[indices[i]]++] = i / 3;
+
+    std::vector<uint32_t> cacheTime(numVertices, 0);  // Time each vertex was last added to the cache
+    std::vector<bool>     emitted(numTriangles, false);
+    std::vector<uint32_t> deadEnds;                  // Recently used vertices, to go back to when there's nowhere better
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> newIndices;
+    newIndices.reserve(numTriangles * 3);
+
+    uint32_t time = cacheSize + 1;
+    uint32_t cursor = 0; // Vertices before this have no live triangles left
+    int64_t  fanVertex = 0;
+    clusters.push_back(0);
+    while (fanVertex >= 0)
+    {
+        // Add all the remaining triangles around the fanning vertex
+        candidates.clear();
+        uint32_t fan = static_cast<uint32_t>(fanVertex);
+        for (uint32_t t = firstTriangle[fan]; t < firstTriangle[fan + 1]; ++t)
+        {
+            uint32_t triangle = vertexTriangles[t];
+            if (emitted[triangle])  continue;
+            emitted[triangle] = true;
+            for (int corner = 0; corner < 3; ++corner)
+            {
+                uint32_t v = indices[triangle * 3 + corner];
+                newIndices.push_back(v);
+                deadEnds.push_back(v);
+                candidates.push_back(v);
+                --liveTriangles[v];
+                if (time - cacheTime[v] > cacheSize)  cacheTime[v] = time++;
+            }
+        }
+
+        // Fan around the candidate that will still be in the cache after its remaining triangles are added, and has been
+        // there longest. If there isn't one use a recently used vertex, otherwise start a new cluster anywhere in the mesh
+        fanVertex = -1;
+        int64_t best = -1;
+        for (uint32_t v : candidates)
+        {
+            if (liveTriangles[v] == 0)  continue;
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)  priority = time - cacheTime[v];
+            if (priority > best)
+            {
+                best = priority;
+                fanVertex = v;
+            }
+        }
+        if (fanVertex < 0)
+        {
+            while (!deadEnds.empty() && fanVertex < 0)
+            {
+                uint32_t v = deadEnds.back();
+                deadEnds.pop_back();
+                if (liveTriangles[v] > 0)  fanVertex = v;
+            }
+        }
+        if (fanVertex < 0)
+        {
+            while (cursor < numVertices && liveTriangles[cursor] == 0)  ++cursor;
+            if (cursor < numVertices)
+            {
+                fanVertex = cursor;
+                uint32_t clusterStart = static_cast<uint32_t>(newIndices.size() / 3);
+                if (clusterStart != clusters.back())  clusters.push_back(clusterStart);
+            }
+        }
+    }
+
+    std::memcpy(indices, newIndices.data(), newIndices.size() * sizeof(uint32_t));
+}
+
+
+// Reorder the clusters found by OptimiseVertexCache so those facing out from the centre of the mesh are drawn first.
+// Keeps the triangle order within each cluster so the vertex cache use hardly changes
+void OptimiseOverdraw(uint32_t* indices, uint32_t numIndices, const std::vector<uint32_t>& clusters,
+                      const uint8_t* vertices, uint32_t vertexSize, uint32_t positionOffset)
+{
+    uint32_t numTriangles = numIndices / 3;
+    if (clusters.size() < 2)  return;
+
+    // Area weighted centre and normal of each cluster and of the whole mesh. The lengths of the triangle normals are twice
+    // their areas
+    struct Cluster
+    {
+        uint32_t start, end;
+        CVector3 centre, normal;
+        float    area, sortKey;
+    };
+    std::vector<Cluster> sorted(clusters.size());
+    CVector3 meshCentre = { 0, 0, 0 };
+    float    meshArea   = 0;
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        Cluster& cluster = sorted[c];
+        cluster.start  = clusters[c];
+        cluster.end    = (c + 1 < clusters.size()) ? clusters[c + 1] : numTriangles;
+        cluster.centre = { 0, 0, 0 };
+        cluster.normal = { 0, 0, 0 };
+        cluster.area   = 0;
+        for (uint32_t t = cluster.start; t < cluster.end; ++t)
+        {
+            CVector3 p0 = VertexPosition(vertices, vertexSize, positionOffset, indices[t * 3 + 0]);
+            CVector3 p1 = VertexPosition(vertices, vertexSize, positionOffset, indices[t * 3 + 1]);
+            CVector3 p2 = VertexPosition(vertices, vertexSize, positionOffset, indices[t * 3 + 2]);
+            CVector3 normal = Cross(p1 - p0, p2 - p0);
+            float area = Length(normal);
+            cluster.centre += (p0 + p1 + p2) * (area / 3);
+            cluster.normal += normal;
+            cluster.area   += area;
+        }
+        meshCentre += cluster.centre;
+        meshArea   += cluster.area;
+        if (cluster.area > 0)  cluster.centre = cluster.centre * (1 / cluster.area);
+    }
+    if (meshArea <= 0)  return;
+    meshCentre = meshCentre * (1 / meshArea);
+
+    // Clusters facing out from the centre are more likely to hide others so are drawn first. Which way the normals face
+    // depends on the winding order, so check which way most of the surface faces
+    float outwards = 0;
+    for (auto& cluster : sorted)
+    {
+        float normalLength = Length(cluster.normal);
+        cluster.sortKey = normalLength > 0 ? Dot(cluster.centre - meshCentre, cluster.normal) / normalLength : 0;
+        outwards += cluster.sortKey * cluster.area;
+    }
+    float sign = outwards >= 0 ? 1.0f : -1.0f;
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [sign](const Cluster& a, const Cluster& b) { return a.sortKey * sign > b.sortKey * sign; });
+
+    std::vector<uint32_t> newIndices;
+    newIndices.reserve(numTriangles * 3);
+    for (auto& cluster : sorted)
+    {
+        newIndices.insert(newIndices.end(), indices + cluster.start * 3, indices + cluster.end * 3);
+    }
+    std::memcpy(indices, newIndices.data(), newIndices.size() * sizeof(uint32_t));
+}
+
+
+// Store the vertices in the order the indices first use them and update the indices to match. Unused vertices are
+// moved to the end
+void OptimiseVertexFetch(uint32_t* indices, uint32_t numIndices, uint8_t* vertices, uint32_t vertexSize, uint32_t numVertices)
+{
+    const uint32_t NOT_USED = ~0u;
+    std::vector<uint32_t> newVertex(numVertices, NOT_USED);
+    uint32_t nextVertex = 0;
+    for (uint32_t i = 0; i < numIndices; ++i)
+    {
+        uint32_t& vertex = newVertex[indices[i]];
+        if (vertex == NOT_USED)  vertex = nextVertex++;
+        indices[i] = vertex;
+    }
+    for (auto& vertex : newVertex)
+    {
+        if (vertex == NOT_USED)  vertex = nextVertex++;
+    }
+
+    std::vector<uint8_t> oldVertices(vertices, vertices + static_cast<size_t>(numVertices) * vertexSize);
+    for (uint32_t v = 0; v < numVertices; ++v)
+    {
+        std::memcpy(vertices + static_cast<size_t>(newVertex[v]) * vertexSize, oldVertices.data() + static_cast<size_t>(v) * vertexSize,
+                    vertexSize);
+    }
+}
+
+
+// All of the above on each sub-mesh of a mesh with 32-bit indices. The mesh's data pointers are ignored, the vertices and
+// indices passed are changed instead. Fills in the mesh's stats before and after
+void OptimiseMesh(CookedMesh& mesh, uint8_t* vertices, uint32_t* indices)
+{
+    uint32_t positionOffset = 0;
+    for (uint32_t i = 0; i < mesh.numElements; ++i)
+    {
+        if (mesh.elements[i].semantic == VertexSemantic::Position)  positionOffset = mesh.elements[i].offset;
+    }
+
+    // Stats for the whole mesh are the sub-meshes' stats weighted by their size
+    MeshOrderStats before, after;
+    float totalTriangles = 0, totalVertices = 0;
+    auto addStats = [&](MeshOrderStats& total, const MeshOrderStats& stats, float numTriangles, float numVertices)
+    {
+        total.acmr     += stats.acmr     * numTriangles;
+        total.atvr     += stats.atvr     * numVertices;
+        total.overdraw += stats.overdraw * numTriangles;
+    };
+
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)
+    {
+        const SubMesh& subMesh = mesh.subMeshes[s];
+        uint32_t* subIndices  = indices + subMesh.startIndex;
+        uint8_t*  subVertices = vertices + static_cast<size_t>(subMesh.baseVertex) * mesh.vertexSize;
+        uint32_t  numVertices = SubMeshVertexCount(mesh, s);
+
+        MeshOrderStats stats;
+        AnalyseVertexCache(subIndices, subMesh.numIndices, numVertices, VERTEX_CACHE_SIZE, stats);
+        AnalyseOverdraw(subIndices, subMesh.numIndices, subVertices, mesh.vertexSize, positionOffset, stats);
+        addStats(before, stats, subMesh.numIndices / 3.0f, static_cast<float>(numVertices));
+
+        std::vector<uint32_t> clusters;
+        OptimiseVertexCache(subIndices, subMesh.numIndices, numVertices, VERTEX_CACHE_SIZE, clusters);
+        OptimiseOverdraw(subIndices, subMesh.numIndices, clusters, subVertices, mesh.vertexSize, positionOffset);
+        OptimiseVertexFetch(subIndices, subMesh.numIndices, subVertices, mesh.vertexSize, numVertices);
+
+        AnalyseVertexCache(subIndices, subMesh.numIndices, numVertices, VERTEX_CACHE_SIZE, stats);
+        AnalyseOverdraw(subIndices, subMesh.numIndices, subVertices, mesh.vertexSize, positionOffset, stats);
+        addStats(after, stats, subMesh.numIndices / 3.0f, static_cast<float>(numVertices));
+
+        totalTriangles += subMesh.numIndices / 3.0f;
+        totalVertices  += numVertices;
+    }
+
+    if (totalTriangles > 0)
+    {
+        before.acmr /= totalTriangles;  before.overdraw /= totalTriangles;
+        after.acmr  /= totalTriangles;  after.overdraw  /= totalTriangles;
+    }
+    if (totalVertices > 0)
+    {
+        before.atvr /= totalVertices;
+        after.atvr  /= totalVertices;
+    }
+    mesh.statsBefore = before;
+    mesh.statsAfter  = after;
+}
+
+
+// One line description of the stats, e.g. for logging
+std::string MeshOrderReport(const std::string& name, const CookedMesh& mesh)
+{
+    char report[256];
+    std::snprintf(report, sizeof(report), "%s: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, overdraw %.3f -> %.3f",
+                  name.c_str(), mesh.statsBefore.acmr, mesh.statsAfter.acmr, mesh.statsBefore.atvr, mesh.statsAfter.atvr,
+                  mesh.statsBefore.overdraw, mesh.statsAfter.overdraw);
+    return report;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Compressing
+//--------------------------------------------------------------------------------------
+
+// Store the 32-bit indices of a mesh in 16 bits in the same memory if none are too large. Returns false if the indices
+// are left as they are
+bool ConvertTo16BitIndices(CookedMesh& mesh, uint32_t* indices)
+{
+    if (mesh.indexSize != 4)  return false;
+    for (uint32_t i = 0; i < mesh.numIndices; ++i)
+    {
+        if (indices[i] > 0xFFFF)  return false;
+    }
+
+    // Each 16-bit index is written at or before the 32-bit index it comes from, so nothing is overwritten before it is read
+    uint16_t* indices16 = reinterpret_cast<uint16_t*>(indices);
+    for (uint32_t i = 0; i < mesh.numIndices; ++i)
+    {
+        indices16[i] = static_cast<uint16_t>(indices[i]);
+    }
+    mesh.indexSize = 2;
+    return true;
+}
+
+
+// Convert to a 16-bit signed normalised integer, -1 to 1 becomes -32767 to 32767
+static int16_t FloatToSNorm16(float value)
+{
+    value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+    return static_cast<int16_t>(value * 32767.0f + (value >= 0 ? 0.5f : -0.5f));
+}
+
+
+// Convert to a 16-bit float, rounding to nearest. Values too small for a normal 16-bit float become zero
+static uint16_t FloatToHalf(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign     = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    int32_t  exponent = static_cast<int32_t>((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+
+    if (((bits >> 23) & 0xFF) == 0xFF)  return sign | 0x7C00 | (mantissa != 0 ? 0x200 : 0); // Infinity or NaN
+    if (exponent <= 0)  return sign;
+    if (exponent >= 31)  return sign | 0x7C00;
+
+    // Rounding can carry into the exponent, which gives the right result (up to infinity)
+    uint32_t half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+    half += (mantissa >> 12) & 1;
+    return sign | static_cast<uint16_t>(half > 0x7C00 ? 0x7C00 : half);
+}
+
+
+// Fold a unit vector onto an octahedron and flatten that into a square with corners at (+-1, +-1)
+static void OctahedralEncode(const CVector3& v, int16_t encoded[2])
+{
+    float length = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    float x = length > 0 ? v.x / length : 0;
+    float y = length > 0 ? v.y / length : 0;
+    if (v.z < 0)
+    {
+        float foldedX = (1 - std::abs(y)) * (x >= 0 ? 1.0f : -1.0f);
+        float foldedY = (1 - std::abs(x)) * (y >= 0 ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    encoded[0] = FloatToSNorm16(x);
+    encoded[1] = FloatToSNorm16(y);
+}
+
+
+// Describe the compressed layout of a mesh, and the scale and offset that turn its positions back into model space. The
+// result's data pointers are left pointing at the original data
+void CompressVertexLayout(const CookedMesh& source, CookedMesh& compressed)
+{
+    compressed = source;
+
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < source.numElements; ++i)
+    {
+        VertexElement& element = compressed.elements[i];
+        if (element.format == VertexFormat::Float)
+        {
+            if (element.semantic == VertexSemantic::Position)
+            {
+                // There is no three component 16-bit format, the fourth is unused
+                element.format = VertexFormat::SNorm16;
+                element.components = 4;
+            }
+            else if ((element.semantic == VertexSemantic::Normal || element.semantic == VertexSemantic::Tangent) &&
+                     element.components == 3)
+            {
+                element.format = VertexFormat::Octahedral16;
+                element.components = 2;
+            }
+            else if (element.semantic == VertexSemantic::UV && (element.components == 2 || element.components == 4))
+            {
+                element.format = VertexFormat::Half;
+            }
+        }
+        element.offset = offset;
+        offset += VertexElementSize(element);
+    }
+    compressed.vertexSize = offset;
+
+    // Positions are stored relative to the centre of their bounding box, scaled so the box goes from -1 to 1
+    for (uint32_t i = 0; i < source.numElements; ++i)
+    {
+        const VertexElement& element = source.elements[i];
+        if (element.semantic != VertexSemantic::Position || element.format != VertexFormat::Float || source.numVertices == 0)  continue;
+
+        const uint8_t* vertices = static_cast<const uint8_t*>(source.vertices);
+        CVector3 boxMin = VertexPosition(vertices, source.vertexSize, element.offset, 0);
+        CVector3 boxMax = boxMin;
+        for (uint32_t v = 1; v < source.numVertices; ++v)
+        {
+            CVector3 p = VertexPosition(vertices, source.vertexSize, element.offset, v);
+            boxMin = { p.x < boxMin.x ? p.x : boxMin.x, p.y < boxMin.y ? p.y : boxMin.y, p.z < boxMin.z ? p.z : boxMin.z };
+            boxMax = { p.x > boxMax.x ? p.x : boxMax.x, p.y > boxMax.y ? p.y : boxMax.y, p.z > boxMax.z ? p.z : boxMax.z };
+        }
+        CVector3 halfSize = (boxMax - boxMin) * 0.5f;
+        compressed.positionOffset = (boxMin + boxMax) * 0.5f;
+        compressed.positionScale  = { std::max(halfSize.x, FLT_EPSILON), std::max(halfSize.y, FLT_EPSILON),
+                                      std::max(halfSize.z, FLT_EPSILON) };
+    }
+}
+
+
+// Write the source mesh's vertices in the compressed layout. The vertices must hold numVertices * compressed.vertexSize bytes
+void CompressVertices(const CookedMesh& source, const CookedMesh& compressed, uint8_t* vertices)
+{
+    const uint8_t* sourceVertex = static_cast<const uint8_t*>(source.vertices);
+    uint8_t*       vertex = vertices;
+    for (uint32_t v = 0; v < source.numVertices; ++v)
+    {
+        for (uint32_t i = 0; i < source.numElements; ++i)
+        {
+            const VertexElement& from = source.elements[i];
+            const VertexElement& to   = compressed.elements[i];
+            const uint8_t* input  = sourceVertex + from.offset;
+            uint8_t*       output = vertex + to.offset;
+            if (from.format == to.format)
+            {
+                std::memcpy(output, input, VertexElementSize(to));
+                continue;
+            }
+
+            float values[4] = { 0, 0, 0, 0 };
+            std::memcpy(values, input, VertexElementSize(from));
+            int16_t  packed[4] = { 0, 0, 0, 0 };
+            uint16_t halves[4] = { 0, 0, 0, 0 };
+            switch (to.format)
+            {
+            case VertexFormat::SNorm16:
+                packed[0] = FloatToSNorm16((values[0] - compressed.positionOffset.x) / compressed.positionScale.x);
+                packed[1] = FloatToSNorm16((values[1] - compressed.positionOffset.y) / compressed.positionScale.y);
+                packed[2] = FloatToSNorm16((values[2] - compressed.positionOffset.z) / compressed.positionScale.z);
+                std::memcpy(output, packed, VertexElementSize(to));
+                break;
+
+            case VertexFormat::Octahedral16:
+                OctahedralEncode({ values[0], values[1], values[2] }, packed);
+                std::memcpy(output, packed, VertexElementSize(to));
+                break;
+
+            case VertexFormat::Half:
+                for (uint32_t c = 0; c < to.components; ++c)  halves[c] = FloatToHalf(values[c]);
+                std::memcpy(output, halves, VertexElementSize(to));
+                break;
+
+            default:
+                break;
+            }
+        }
+        sourceVertex += source.vertexSize;
+        vertex += compressed.vertexSize;
+    }
+}
+
+
+// One line description of the memory used by a mesh and the bytes read to draw it, compared to the same mesh stored with
+// floats and 32-bit indices
+std::string MeshSizeReport(const std::string& name, const CookedMesh& uncompressed, const CookedMesh& mesh)
+{
+    // A full detail draw reads all its indices and each vertex the vertex cache misses (see the ACMR above)
+    uint32_t drawIndices = 0;
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)  drawIndices += mesh.subMeshes[s].numIndices;
+    float numTriangles = drawIndices / 3.0f;
+    float vertexReads  = mesh.statsAfter.acmr > 0 ? mesh.statsAfter.acmr * numTriangles : static_cast<float>(mesh.numVertices);
+
+    float memoryBefore = (static_cast<float>(mesh.numVertices) * uncompressed.vertexSize + mesh.numIndices * 4.0f) / 1024;
+    float memoryAfter  = (static_cast<float>(mesh.numVertices) * mesh.vertexSize + static_cast<float>(mesh.numIndices) * mesh.indexSize) / 1024;
+    float readBefore   = (vertexReads * uncompressed.vertexSize + drawIndices * 4.0f) / 1024;
+    float readAfter    = (vertexReads * mesh.vertexSize + static_cast<float>(drawIndices) * mesh.indexSize) / 1024;
+
+    char report[256];
+    std::snprintf(report, sizeof(report), "%s: %u byte vertices, %u byte indices, %.1fKB -> %.1fKB memory, %.1fKB -> %.1fKB read per draw",
+                  name.c_str(), mesh.vertexSize, mesh.indexSize, memoryBefore, memoryAfter, readBefore, readAfter);
+    return report;
+}
@@ -0,0 +1,107 @@
+//--------------------------------------------------------------------------------------
+// Mesh optimiser - reorders triangles and vertices to suit the GPU
+//--------------------------------------------------------------------------------------
+// The order of a mesh's triangles and vertices doesn't change what is drawn, but makes a big
+// difference to how fast it is drawn:
+// - The GPU keeps the last few vertices it has shaded in a small cache, so triangles that share
+//   vertices should be drawn close together. Measured as the ACMR (vertex shader runs per
+//   triangle, 0.5 is ideal for large meshes, 3 is the worst) and ATVR (runs per vertex, 1 is
+//   ideal).
+// - Triangles on the outside of a mesh are more likely to hide others, so drawing them first lets
+//   the depth test reject more hidden pixels before they are shaded. Measured as overdraw (pixels
+//   shaded per pixel covered, 1 is ideal).
+// - Vertices are read from memory in the order the indices first use them, so storing them in
+//   that order makes the reads close together.
+//
+// Meshes are optimised when they are cooked (see MeshCache.h): Tipsify (Sander et al., "Fast
+// Triangle Reordering for Vertex Locality and Reduced Overdraw") orders the triangles for the
+// cache in clusters, the clusters are sorted so those facing out from the mesh are drawn first,
+// then the vertices are stored in first use order. Doesn't use any Direct3D so meshes can be
+// cooked and measured on any platform.
+//
+// Meshes can also be made smaller, which saves memory and the bandwidth used to read them:
+// - Indices are stored in 16 bits when no sub-mesh has more than 65536 vertices (indices are
+//   relative to each sub-mesh's base vertex).
+// - Compressed layouts store positions as 16-bit integers scaled to the mesh's bounding box,
+//   normals and tangents folded onto an octahedron in two 16-bit integers and UVs as 16-bit
+//   floats. A vertex with tangents takes 20 bytes rather than 44. The vertex shaders decode them
+//   with the scale, offset and flag in the per-model constants.
+
+#ifndef _MESH_OPTIMISER_H_INCLUDED_
+#define _MESH_OPTIMISER_H_INCLUDED_
+
+#include "MeshCache.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Size of the vertex cache assumed when optimising and measuring
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// Number of vertices used by a sub-mesh, from its base vertex up to the next sub-mesh's
+uint32_t SubMeshVertexCount(const CookedMesh& mesh, uint32_t subMesh);
+
+
+//--------------------------------------------------------------------------------------
+// Measuring
+//--------------------------------------------------------------------------------------
+
+// ACMR and ATVR of a triangle list with a first in first out vertex cache of the given size. The indices refer to
+// numVertices vertices, the ATVR only counts vertices that are used
+void AnalyseVertexCache(const uint32_t* indices, uint32_t numIndices, uint32_t numVertices, uint32_t cacheSize,
+                        MeshOrderStats& stats);
+
+// Overdraw of a triangle list drawn from six directions with a depth test, using the CVector3 position at the given offset
+// in each vertex. Rasterised in software at a low resolution, so it is an estimate
+void AnalyseOverdraw(const uint32_t* indices, uint32_t numIndices, const uint8_t* vertices, uint32_t vertexSize,
+                     uint32_t positionOffset, MeshOrderStats& stats);
+
+
+//--------------------------------------------------------------------------------------
+// Optimising
+//--------------------------------------------------------------------------------------
+
+// Reorder the triangles for the vertex cache (Tipsify). The index of the first triangle of each cluster is added to
+// clusters, a cluster ends where the triangle order had to jump to a distant part of the mesh
+void OptimiseVertexCache(uint32_t* indices, uint32_t numIndices, uint32_t numVertices, uint32_t cacheSize,
+                         std::vector<uint32_t>& clusters);
+
+// Reorder the clusters found by OptimiseVertexCache so those facing out from the centre of the mesh are drawn first.
+// Keeps the triangle order within each cluster so the vertex cache use hardly changes
+void OptimiseOverdraw(uint32_t* indices, uint32_t numIndices, const std::vector<uint32_t>& clusters,
+                      const uint8_t* vertices, uint32_t vertexSize, uint32_t positionOffset);
+
+// Store the vertices in the order the indices first use them and update the indices to match. Unused vertices are
+// moved to the end
+void OptimiseVertexFetch(uint32_t* indices, uint32_t numIndices, uint8_t* vertices, uint32_t vertexSize, uint32_t numVertices);
+
+// All of the above on each sub-mesh of a mesh with 32-bit indices. The mesh's data pointers are ignored, the vertices and
+// indices passed are changed instead. Fills in the mesh's stats before and after
+void OptimiseMesh(CookedMesh& mesh, uint8_t* vertices, uint32_t* indices);
+
+// One line description of the stats, e.g. for logging
+std::string MeshOrderReport(const std::string& name, const CookedMesh& mesh);
+
+
+//--------------------------------------------------------------------------------------
+// Compressing
+//--------------------------------------------------------------------------------------
+
+// Store the 32-bit indices of a mesh in 16 bits in the same memory if none are too large. Returns false if the indices
+// are left as they are
+bool ConvertTo16BitIndices(CookedMesh& mesh, uint32_t* indices);
+
+// Describe the compressed layout of a mesh, and the scale and offset that turn its positions back into model space. The
+// result's data pointers are left pointing at the original data
+void CompressVertexLayout(const CookedMesh& source, CookedMesh& compressed);
+
+// Write the source mesh's vertices in the compressed layout. The vertices must hold numVertices * compressed.vertexSize bytes
+void CompressVertices(const CookedMesh& source, const CookedMesh& compressed, uint8_t* vertices);
+
+// One line description of the memory used by a mesh and the bytes read to draw it, compared to the same mesh stored with
+// floats and 32-bit indices
+std::string MeshSizeReport(const std::string& name, const CookedMesh& uncompressed, const CookedMesh& mesh);
+
+
+#endif //_MESH_OPTIMISER_H_INCLUDED_
@@ -0,0 +1,331 @@
+//--------------------------------------------------------------------------------------
+// Mesh simplifier - levels of detail made when meshes are cooked
+//--------------------------------------------------------------------------------------
+
+#include "MeshSimplifier.h"
+#include "MeshOptimiser.h"
+
+#include "CVector3.h"
+
+#include <algorithm>
+#include <unordered_map>
+#include <cstring>
+#include <cmath>
+
+// Each level of detail aims for this fraction of the full detail triangles, and allows collapses up to this fraction of the
+// mesh's bounding radius from the original surface. A level is dropped if it doesn't remove enough of the previous level's
+// triangles to be worth having
+const float LOD_TRIANGLE_FRACTIONS[MAX_MESH_LODS] = { 1.0f, 0.5f, 0.25f, 0.125f };
+const float LOD_MAX_ERRORS[MAX_MESH_LODS]         = { 0.0f, 0.01f, 0.03f, 0.08f };
+const float LOD_MIN_REDUCTION = 0.2f;
+
+
+//--------------------------------------------------------------------------------------
+// Quadrics
+//--------------------------------------------------------------------------------------
+
+// Sum of squared distances to a set of planes, as a symmetric 3x3 matrix A, vector b and constant c:
+// error(p) = p.A.p + 2 b.p + c
+struct Quadric
+{
+    double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+    double b0 = 0, b1 = 0, b2 = 0;
+    double c = 0;
+
+    // Add the plane with the given unit normal through the given point
+    void AddPlane(const CVector3& normal, const CVector3& point)
+    {
+        double nx = normal.x, ny = normal.y, nz = normal.z;
+        double d = -(nx * point.x + ny * point.y + nz * point.z);
+        a00 += nx * nx;  a01 += nx * ny;  a02 += nx * nz;
+        a11 += ny * ny;  a12 += ny * nz;  a22 += nz * nz;
+        b0 += nx * d;  b1 += ny * d;  b2 += nz * d;
+        c += d * d;
+    }
+
+    void Add(const Quadric& q)
+    {
+        a00 += q.a00;  a01 += q.a01;  a02 += q.a02;  a11 += q.a11;  a12 += q.a12;  a22 += q.a22;
+        b0 += q.b0;  b1 += q.b1;  b2 += q.b2;
+        c += q.c;
+    }
+
+    double Error(const CVector3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double error = a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                       2 * (b0 * x + b1 * y + b2 * z) + c;
+        return error > 0 ? error : 0; // Rounding can make it slightly negative
+    }
+};
+
+
+//--------------------------------------------------------------------------------------
+// Simplification
+//--------------------------------------------------------------------------------------
+
+// Simplify a triangle list to about targetIndices indices, without any collapse having an error (distance from the original
+// surface) over maxError. Uses the CVector3 position at the given offset in each vertex. Returns the new indices, which refer
+// to the same vertices, and sets resultError to the largest error of any collapse
+std::vector<uint32_t> SimplifyMesh(const uint32_t* indices, uint32_t numIndices, const uint8_t* vertices, uint32_t vertexSize,
+                                   uint32_t positionOffset, uint32_t numVertices, uint32_t targetIndices, float maxError,
+                                   float& resultError)
+{
+    std::vector<uint32_t> triangles(indices, indices + numIndices - numIndices % 3);
+    resultError = 0;
+
+    std::vector<CVector3> positions(numVertices);
+    for (uint32_t v = 0; v < numVertices; ++v)
+    {
+        std::memcpy(&positions[v], vertices + static_cast<size_t>(v) * vertexSize + positionOffset, sizeof(CVector3));
+    }
+
+    // Vertices that must not move: seams (several vertices at the same position) and open edges (used by one triangle)
+    std::vector<bool> locked(numVertices, false);
+    struct PositionHash
+    {
+        size_t operator()(const CVector3& p) const
+        {
+            uint32_t bits[3];
+            std::memcpy(bits, &p, sizeof(bits));
+            return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+        }
+    };
+    struct PositionEqual
+    {
+        bool operator()(const CVector3& a, const CVector3& b) const  { return a.x == b.x && a.y == b.y && a.z == b.z; }
+    };
+    std::unordered_map<CVector3, uint32_t, PositionHash, PositionEqual> firstAtPosition;
+    for (uint32_t v = 0; v < numVertices; ++v)
+    {
+        auto inserted = firstAtPosition.insert({ positions[v], v });
+        if (!inserted.second)
+        {
+            locked[v] = true;
+            locked[inserted.first->second] = true;
+        }
+    }
+
+    auto edgeKey = [](uint32_t a, uint32_t b) { return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a; };
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    for (size_t i = 0; i < triangles.size(); i += 3)
+    {
+        for (int corner = 0; corner < 3; ++corner)  ++edgeUses[edgeKey(triangles[i + corner], triangles[i + (corner + 1) % 3])];
+    }
+    for (auto& edge : edgeUses)
+    {
+        if (edge.second == 1)
+        {
+            locked[static_cast<uint32_t>(edge.first >> 32)] = true;
+            locked[static_cast<uint32_t>(edge.first)] = true;
+        }
+    }
+
+    // Each vertex starts with the planes of the triangles around it
+    std::vector<Quadric> quadrics(numVertices);
+    for (size_t i = 0; i < triangles.size(); i += 3)
+    {
+        const CVector3& p0 = positions[triangles[i]];
+        CVector3 normal = Cross(positions[triangles[i + 1]] - p0, positions[triangles[i + 2]] - p0);
+        float length = Length(normal);
+        if (length <= 0)  continue;
+        normal = normal * (1 / length);
+        for (int corner = 0; corner < 3; ++corner)  quadrics[triangles[i + corner]].AddPlane(normal, p0);
+    }
+
+    // Collapse edges in passes. Each pass collapses the cheapest edges whose surroundings haven't already changed in the pass,
+    // so the costs and checks stay correct without updating them after every collapse
+    struct Collapse
+    {
+        double   cost;
+        uint32_t from, to;
+    };
+    double maxCost = static_cast<double>(maxError) * maxError;
+    std::vector<uint32_t> remap(numVertices);
+    std::vector<uint32_t> firstTriangle(numVertices + 1);
+    std::vector<uint32_t> vertexTriangles;
+    std::vector<uint64_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<bool>     touched(numVertices);
+    while (triangles.size() > targetIndices)
+    {
+        // Triangles around each vertex
+        uint32_t numTriangles = static_cast<uint32_t>(triangles.size() / 3);
+        std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+        for (uint32_t index : triangles)  ++firstTriangle[index + 1];
+        for (uint32_t v = 0; v < numVertices; ++v)  firstTriangle[v + 1] += firstTriangle[v];
+        vertexTriangles.resize(triangles.size());
+        std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (uint32_t i = 0; i < numTriangles * 3; ++i)  vertexTriangles[fill[triangles[i]]++] = i / 3;
+
+        // Cheapest direction to collapse each edge
+        edges.clear();
+        for (uint32_t i = 0; i < numTriangles * 3; i += 3)
+        {
+            for (int corner = 0; corner < 3; ++corner)  edges.push_back(edgeKey(triangles[i + corner], triangles[i + (corner + 1) % 3]));
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+        collapses.clear();
+        for (uint64_t edge : edges)
+        {
+            uint32_t a = static_cast<uint32_t>(edge >> 32);
+            uint32_t b = static_cast<uint32_t>(edge);
+            Quadric q = quadrics[a];
+            q.Add(quadrics[b]);
+            double costAToB = locked[a] ? -1 : q.Error(positions[b]);
+            double costBToA = locked[b] ? -1 : q.Error(positions[a]);
+            if (costAToB < 0 && costBToA < 0)  continue;
+            if (costBToA < 0 || (costAToB >= 0 && costAToB <= costBToA))  collapses.push_back({ costAToB, a, b });
+            else                                                          collapses.push_back({ costBToA, b, a });
+        }
+        std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+        // Collapse edges until enough triangles have gone
+        for (uint32_t v = 0; v < numVertices; ++v)  remap[v] = v;
+        std::fill(touched.begin(), touched.end(), false);
+        uint32_t trianglesToRemove = static_cast<uint32_t>((triangles.size() - targetIndices) / 3);
+        uint32_t removed = 0;
+        for (const Collapse& collapse : collapses)
+        {
+            if (collapse.cost > maxCost || removed >= trianglesToRemove)  break;
+            if (touched[collapse.from] || touched[collapse.to])  continue;
+
+            // Don't collapse if any remaining triangle around the moving vertex would flip over
+            bool flips = false;
+            uint32_t trianglesRemoved = 0;
+            for (uint32_t t = firstTriangle[collapse.from]; t < firstTriangle[collapse.from + 1] && !flips; ++t)
+            {
+                const uint32_t* triangle = &triangles[vertexTriangles[t] * 3];
+                if (triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to)
+                {
+                    ++trianglesRemoved;
+                    continue;
+                }
+                CVector3 before[3], after[3];
+                for (int corner = 0; corner < 3; ++corner)
+                {
+                    before[corner] = positions[triangle[corner]];
+                    after[corner]  = positions[triangle[corner] == collapse.from ? collapse.to : triangle[corner]];
+                }
+                CVector3 normalBefore = Cross(before[1] - before[0], before[2] - before[0]);
+                CVector3 normalAfter  = Cross(after[1]  - after[0],  after[2]  - after[0]);
+                if (Dot(normalBefore, normalAfter) <= 0)  flips = true;
+            }
+            if (flips)  continue;
+
+            remap[collapse.from] = collapse.to;
+            quadrics[collapse.to].Add(quadrics[collapse.from]);
+            if (collapse.cost > resultError * resultError)  resultError = static_cast<float>(std::sqrt(collapse.cost));
+            removed += trianglesRemoved;
+
+            // The triangles around the moved vertex have changed, so their vertices can't be used again this pass
+            for (uint32_t t = firstTriangle[collapse.from]; t < firstTriangle[collapse.from + 1]; ++t)
+            {
+                const uint32_t* triangle = &triangles[vertexTriangles[t] * 3];
+                touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+            }
+        }
+        if (removed == 0)  break; // Nothing more can be collapsed within the error limit
+
+        // Move the collapsed vertices and remove the triangles that have become lines
+        size_t kept = 0;
+        for (size_t i = 0; i < triangles.size(); i += 3)
+        {
+            uint32_t a = remap[triangles[i]], b = remap[triangles[i + 1]], c = remap[triangles[i + 2]];
+            if (a == b || b == c || c == a)  continue;
+            triangles[kept++] = a;
+            triangles[kept++] = b;
+            triangles[kept++] = c;
+        }
+        triangles.resize(kept);
+    }
+
+    return triangles;
+}
+
+
+// Add levels of detail to a mesh with float positions and 32-bit indices. The indices and sub-mesh ranges for the new
+// levels are added to the given arrays, which must hold the mesh's current indices and sub-meshes. Sets the mesh's number
+// of levels, but not its data pointers as the arrays may have moved
+void GenerateLods(CookedMesh& mesh, const uint8_t* vertices, std::vector<uint32_t>& indices, std::vector<SubMesh>& subMeshes)
+{
+    uint32_t positionOffset = 0;
+    for (uint32_t i = 0; i < mesh.numElements; ++i)
+    {
+        if (mesh.elements[i].semantic == VertexSemantic::Position)  positionOffset = mesh.elements[i].offset;
+    }
+
+    // Sub-mesh vertex counts are found from the full detail ranges
+    CookedMesh fullDetail = mesh;
+    fullDetail.subMeshes = subMeshes.data();
+
+    mesh.numLods = 1;
+    for (int lod = 1; lod < MAX_MESH_LODS; ++lod)
+    {
+        // Simplify each sub-mesh of the previous level
+        size_t firstNewIndex = indices.size();
+        uint32_t previousTriangles = 0, newTriangles = 0;
+        std::vector<SubMesh> newSubMeshes;
+        for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)
+        {
+            SubMesh previous = subMeshes[(lod - 1) * mesh.numSubMeshes + s];
+            uint32_t numVertices = SubMeshVertexCount(fullDetail, s);
+            uint32_t target = static_cast<uint32_t>(subMeshes[s].numIndices / 3 * LOD_TRIANGLE_FRACTIONS[lod]) * 3;
+
+            float error;
+            std::vector<uint32_t> simplified = SimplifyMesh(&indices[previous.startIndex], previous.numIndices,
+                                                            vertices + static_cast<size_t>(previous.baseVertex) * mesh.vertexSize,
+                                                            mesh.vertexSize, positionOffset, numVertices, target,
+                                                            LOD_MAX_ERRORS[lod] * mesh.boundsRadius, error);
+
+            // Reorder the simplified triangles for the vertex cache. The vertices are shared with the full detail mesh so
+            // their order can't change
+            std::vector<uint32_t> clusters;
+            OptimiseVertexCache(simplified.data(), static_cast<uint32_t>(simplified.size()), numVertices, VERTEX_CACHE_SIZE, clusters);
+
+            newSubMeshes.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(simplified.size()),
+                                     previous.baseVertex, previous.material });
+            indices.insert(indices.end(), simplified.begin(), simplified.end());
+            previousTriangles += previous.numIndices / 3;
+            newTriangles      += static_cast<uint32_t>(simplified.size() / 3);
+        }
+
+        // Stop when simplifying doesn't help enough, e.g. every vertex of a cube is on a seam
+        if (newTriangles > previousTriangles * (1 - LOD_MIN_REDUCTION))
+        {
+            indices.resize(firstNewIndex);
+            break;
+        }
+        subMeshes.insert(subMeshes.end(), newSubMeshes.begin(), newSubMeshes.end());
+        fullDetail.subMeshes = subMeshes.data();
+        mesh.numLods = lod + 1;
+    }
+    mesh.numIndices = static_cast<uint32_t>(indices.size());
+}
+
+
+// A line giving the number of triangles in each of a cooked mesh's levels of detail
+std::string MeshLodReport(const std::string& name, const CookedMesh& mesh)
+{
+    std::string report = name + ": LOD triangles ";
+    for (uint32_t lod = 0; lod < mesh.numLods; ++lod)
+    {
+        uint32_t numTriangles = 0;
+        for (uint32_t i = 0; i < mesh.numSubMeshes; ++i)  numTriangles += mesh.subMeshes[lod * mesh.numSubMeshes + i].numIndices / 3;
+        report += (lod == 0 ? "" : " -> ") + std::to_string(numTriangles);
+    }
+    return report;
+}
+
+
+// The level of detail to draw for a model whose bounding sphere radius is the given fraction of half the screen height.
+// Pass the level used last frame
+int SelectLod(float screenSize, int currentLod, int numLods)
+{
+    int lod = (currentLod < 0) ? 0 : (currentLod >= numLods) ? numLods - 1 : currentLod;
+    while (lod + 1 < numLods && screenSize < LOD_SCREEN_SIZES[lod] * (1 - LOD_HYSTERESIS))  ++lod;
+    while (lod > 0 && screenSize > LOD_SCREEN_SIZES[lod - 1] * (1 + LOD_HYSTERESIS))  --lod;
+    return lod;
+}
@@ -0,0 +1,59 @@
+//--------------------------------------------------------------------------------------
+// Mesh simplifier - levels of detail made when meshes are cooked
+//--------------------------------------------------------------------------------------
+// A mesh far from the camera covers a few pixels but costs as much to draw as when it fills the
+// screen. When a mesh is cooked (see MeshCache.h) a chain of simpler versions is made, each with
+// about half the triangles of the one before, and models far away draw a simpler one.
+//
+// Simplification collapses edges, moving one vertex onto the other, cheapest first. The cost of a
+// collapse is measured with quadrics (Garland & Heckbert, "Surface Simplification Using Quadric
+// Error Metrics"): the squared distance from the new position to the planes of the triangles that
+// met at both vertices. Vertices only ever move onto existing vertices, so all the levels share the
+// mesh's vertices and each just has its own indices. Vertices on open edges and on seams (where
+// vertices at the same position have different normals or UVs) are never moved, so holes and UV
+// or lighting seams don't appear.
+//
+// The level drawn is chosen from the size of the model's bounding sphere on screen, with a margin
+// either side of each switch point so models near one don't keep switching. Doesn't use any
+// Direct3D so meshes can be simplified on any platform.
+
+#ifndef _MESH_SIMPLIFIER_H_INCLUDED_
+#define _MESH_SIMPLIFIER_H_INCLUDED_
+
+#include "MeshCache.h"
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Most levels of detail made for a mesh, including the full detail mesh
+const int MAX_MESH_LODS = 4;
+
+// Each level is used while a model's bounding sphere radius is at least this fraction of half the screen height, otherwise
+// a simpler level is used. Models switch to a level this fraction beyond the switch point, so they don't flip back and forth
+const float LOD_SCREEN_SIZES[MAX_MESH_LODS - 1] = { 0.25f, 0.1f, 0.04f };
+const float LOD_HYSTERESIS = 0.15f;
+
+
+// Simplify a triangle list to about targetIndices indices, without any collapse having an error (distance from the original
+// surface) over maxError. Uses the CVector3 position at the given offset in each vertex. Returns the new indices, which refer
+// to the same vertices, and sets resultError to the largest error of any collapse
+std::vector<uint32_t> SimplifyMesh(const uint32_t* indices, uint32_t numIndices, const uint8_t* vertices, uint32_t vertexSize,
+                                   uint32_t positionOffset, uint32_t numVertices, uint32_t targetIndices, float maxError,
+                                   float& resultError);
+
+// Add levels of detail to a mesh with float positions and 32-bit indices. The indices and sub-mesh ranges for the new
+// levels are added to the given arrays, which must hold the mesh's current indices and sub-meshes. Sets the mesh's number
+// of levels, but not its data pointers as the arrays may have moved
+void GenerateLods(CookedMesh& mesh, const uint8_t* vertices, std::vector<uint32_t>& indices, std::vector<SubMesh>& subMeshes);
+
+// A line giving the number of triangles in each of a cooked mesh's levels of detail, e.g. "Teapot.x: LOD triangles 2256 ->
+// 1128 -> 564"
+std::string MeshLodReport(const std::string& name, const CookedMesh& mesh);
+
+// The level of detail to draw for a model whose bounding sphere radius is the given fraction of half the screen height.
+// Pass the level used last frame
+int SelectLod(float screenSize, int currentLod, int numLods);
+
+
+#endif //_MESH_SIMPLIFIER_H_INCLUDED_
@@ -0,0 +1,383 @@
+//--------------------------------------------------------------------------------------
+// Mesh tangents - smooth normals and tangents for imported meshes
+//--------------------------------------------------------------------------------------
+
+#include "MeshTangents.h"
+#include "MeshOptimiser.h"
+
+#include "CVector3.h"
+
+#include <vector>
+#include <thread>
+#include <cstring>
+#include <cmath>
+
+
+//--------------------------------------------------------------------------------------
+// Helpers
+//--------------------------------------------------------------------------------------
+
+// Call function(begin, end) for parts of the range 0 to count on up to numThreads threads (0 to use all cores), or just this
+// one if the count is small. Each part only writes its own items so the results don't depend on the number of threads
+template <typename Function>
+static void ParallelFor(uint32_t count, unsigned int numThreads, Function function)
+{
+    if (numThreads == 0)  numThreads = std::thread::hardware_concurrency();
+    if (numThreads > count / MIN_ITEMS_PER_THREAD)  numThreads = count / MIN_ITEMS_PER_THREAD;
+    if (numThreads <= 1)
+    {
+        function(0u, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t < numThreads; ++t)
+    {
+        uint32_t begin = static_cast<uint32_t>(static_cast<uint64_t>(count) * t / numThreads);
+        uint32_t end   = static_cast<uint32_t>(static_cast<uint64_t>(count) * (t + 1) / numThreads);
+        threads.emplace_back(function, begin, end);
+    }
+    function(0u, static_cast<uint32_t>(count / numThreads));
+    for (auto& thread : threads)  thread.join();
+}
+
+
+// Where each part of a vertex is, the mesh must have been imported so every part is floats
+struct VertexParts
+{
+    uint32_t vertexSize;
+    int      position = -1, normal = -1, tangent = -1, uv = -1;
+
+    VertexParts(const CookedMesh& mesh) : vertexSize(mesh.vertexSize)
+    {
+        for (uint32_t i = 0; i < mesh.numElements; ++i)
+        {
+            int offset = static_cast<int>(mesh.elements[i].offset);
+            if (mesh.elements[i].semantic == VertexSemantic::Position)  position = offset;
+            if (mesh.elements[i].semantic == VertexSemantic::Normal)    normal   = offset;
+            if (mesh.elements[i].semantic == VertexSemantic::Tangent)   tangent  = offset;
+            if (mesh.elements[i].semantic == VertexSemantic::UV)        uv       = offset;
+        }
+    }
+};
+
+static CVector3 ReadVector(const uint8_t* vertices, uint32_t vertexSize, int offset, uint32_t vertex)
+{
+    CVector3 v;
+    std::memcpy(&v, vertices + static_cast<size_t>(vertex) * vertexSize + offset, sizeof(v));
+    return v;
+}
+
+static void WriteVector(uint8_t* vertices, uint32_t vertexSize, int offset, uint32_t vertex, const CVector3& v)
+{
+    std::memcpy(vertices + static_cast<size_t>(vertex) * vertexSize + offset, &v, sizeof(v));
+}
+
+// Unit length copy of a vector, or zero if it has no length
+static CVector3 SafeNormalise(const CVector3& v)
+{
+    float length = Length(v);
+    return (length > 1e-20f) ? v * (1 / length) : CVector3{ 0, 0, 0 };
+}
+
+
+// The triangles using each vertex of a sub-mesh, in triangle order. Triangles of vertex v are triangles[first[v]] up to
+// triangles[first[v + 1]]
+struct VertexTriangles
+{
+    std::vector<uint32_t> first;
+    std::vector<uint32_t> triangles;
+
+    // Pass the group of each vertex to list the triangles using any vertex of the group, or null for each vertex on its own
+    VertexTriangles(const uint32_t* indices, uint32_t numTriangles, uint32_t numGroups, const uint32_t* group)
+    {
+        first.assign(numGroups + 1, 0);
+        for (uint32_t i = 0; i < numTriangles * 3; ++i)  ++first[(group ? group[indices[i]] : indices[i]) + 1];
+        for (uint32_t g = 0; g < numGroups; ++g)  first[g + 1] += first[g];
+
+        // A triangle using two vertices of the same group is only listed once
+        std::vector<uint32_t> next(first.begin(), first.end() - 1);
+        triangles.resize(numTriangles * 3);
+        for (uint32_t t = 0; t < numTriangles; ++t)
+        {
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                uint32_t g = group ? group[indices[t * 3 + c]] : indices[t * 3 + c];
+                if (next[g] > first[g] && triangles[next[g] - 1] == t)  continue;
+                triangles[next[g]++] = t;
+            }
+        }
+
+        // Close the gaps left by triangles listed once
+        uint32_t used = 0;
+        for (uint32_t g = 0; g < numGroups; ++g)
+        {
+            uint32_t start = first[g];
+            first[g] = used;
+            for (uint32_t i = start; i < next[g]; ++i)  triangles[used++] = triangles[i];
+        }
+        first[numGroups] = used;
+        triangles.resize(used);
+    }
+};
+
+
+// Number the different items in a list in the order they first appear. number[i] is set to the number of item i and
+// firstItems[n] to the first item with number n. hash(i) returns a 64-bit hash of item i and same(a, b) whether two items
+// are the same. The hashes are calculated on several threads, the items are numbered on this one
+template <typename Hash, typename Same>
+static void NumberDistinct(uint32_t count, unsigned int numThreads, Hash hash, Same same,
+                           std::vector<uint32_t>& number, std::vector<uint32_t>& firstItems)
+{
+    std::vector<uint64_t> hashes(count);
+    ParallelFor(count, numThreads, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t i = begin; i < end; ++i)  hashes[i] = hash(i);
+    });
+
+    // Open addressing table at least twice the size of the list, holding the first item seen with each value. Slots come from
+    // the top bits of the hash, the low bits of HashBytes are weak
+    const uint32_t EMPTY = ~0u;
+    uint32_t tableBits = 1;
+    while ((uint64_t{ 1 } << tableBits) < uint64_t{ count } * 2)  ++tableBits;
+    size_t tableMask = (size_t{ 1 } << tableBits) - 1;
+    std::vector<uint32_t> table(tableMask + 1, EMPTY);
+
+    number.resize(count);
+    firstItems.clear();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        size_t slot = static_cast<size_t>(hashes[i] >> (64 - tableBits));
+        while (table[slot] != EMPTY && (hashes[table[slot]] != hashes[i] || !same(table[slot], i)))
+        {
+            slot = (slot + 1) & tableMask;
+        }
+        if (table[slot] == EMPTY)
+        {
+            table[slot] = i;
+            number[i] = static_cast<uint32_t>(firstItems.size());
+            firstItems.push_back(i);
+        }
+        else
+        {
+            number[i] = number[table[slot]];
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Normals
+//--------------------------------------------------------------------------------------
+
+// Calculate smooth normals for a sub-mesh with float positions and normals and 32-bit indices, imported without joining
+// identical vertices so each triangle has its own. Triangles facing more than smoothingAngle (degrees) apart aren't smoothed
+// together. Large sub-meshes are split between numThreads threads (0 to use all cores)
+void GenerateNormals(const CookedMesh& mesh, uint32_t subMesh, uint8_t* vertices, const uint32_t* indices,
+                     float smoothingAngle /*= NORMAL_SMOOTHING_ANGLE*/, unsigned int numThreads /*= 0*/)
+{
+    VertexParts parts(mesh);
+    const SubMesh& range = mesh.subMeshes[subMesh];
+    uint8_t*        subVertices  = vertices + static_cast<size_t>(range.baseVertex) * parts.vertexSize;
+    const uint32_t* subIndices   = indices + range.startIndex;
+    uint32_t        numTriangles = range.numIndices / 3;
+    uint32_t        numVertices  = SubMeshVertexCount(mesh, subMesh);
+
+    // Normal of each triangle. Front faces are clockwise in a left-handed space, so they face Cross(p1 - p0, p2 - p0)
+    std::vector<CVector3> triangleNormals(numTriangles);
+    ParallelFor(numTriangles, numThreads, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t t = begin; t < end; ++t)
+        {
+            CVector3 p0 = ReadVector(subVertices, parts.vertexSize, parts.position, subIndices[t * 3]);
+            CVector3 p1 = ReadVector(subVertices, parts.vertexSize, parts.position, subIndices[t * 3 + 1]);
+            CVector3 p2 = ReadVector(subVertices, parts.vertexSize, parts.position, subIndices[t * 3 + 2]);
+            triangleNormals[t] = SafeNormalise(Cross(p1 - p0, p2 - p0));
+        }
+    });
+
+    // Group the vertices at each position, the corners of all the triangles meeting there. Adding zero makes -0 into 0 so
+    // they hash the same, as they compare the same
+    auto position = [&](uint32_t v)
+    {
+        CVector3 p = ReadVector(subVertices, parts.vertexSize, parts.position, v);
+        return CVector3{ p.x + 0.0f, p.y + 0.0f, p.z + 0.0f };
+    };
+    std::vector<uint32_t> group, groupFirst;
+    NumberDistinct(numVertices, numThreads,
+                   [&](uint32_t v) { CVector3 p = position(v);  return HashBytes(&p, sizeof(p)); },
+                   [&](uint32_t a, uint32_t b)
+                   {
+                       CVector3 pa = position(a), pb = position(b);
+                       return pa.x == pb.x && pa.y == pb.y && pa.z == pb.z;
+                   },
+                   group, groupFirst);
+    uint32_t numGroups = static_cast<uint32_t>(groupFirst.size());
+
+    VertexTriangles ownTriangles(subIndices, numTriangles, numVertices, nullptr);
+    VertexTriangles groupTriangles(subIndices, numTriangles, numGroups, group.data());
+
+    // Each vertex's normal is the average of the triangles at its position facing within the smoothing angle of its own
+    // triangle, unweighted like assimp. Vertices of the triangles on either side of a sharper edge get different normals so
+    // the edge stays hard. Vertices given the same triangles add them in the same order, so can be joined afterwards
+    float minDot = std::cos(ToRadians(smoothingAngle));
+    ParallelFor(numVertices, numThreads, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t v = begin; v < end; ++v)
+        {
+            CVector3 own = { 0, 0, 0 };
+            for (uint32_t i = ownTriangles.first[v]; i < ownTriangles.first[v + 1]; ++i)
+            {
+                own += triangleNormals[ownTriangles.triangles[i]];
+            }
+            own = SafeNormalise(own);
+
+            CVector3 normal = { 0, 0, 0 };
+            uint32_t g = group[v];
+            for (uint32_t i = groupTriangles.first[g]; i < groupTriangles.first[g + 1]; ++i)
+            {
+                const CVector3& triangleNormal = triangleNormals[groupTriangles.triangles[i]];
+                if (Dot(triangleNormal, own) >= minDot)  normal += triangleNormal;
+            }
+            normal = SafeNormalise(normal);
+            if (Length(normal) == 0)  normal = (Length(own) > 0) ? own : CVector3{ 0, 1, 0 }; // Unused or degenerate vertex
+            WriteVector(subVertices, parts.vertexSize, parts.normal, v, normal);
+        }
+    });
+}
+
+
+//--------------------------------------------------------------------------------------
+// Joining vertices
+//--------------------------------------------------------------------------------------
+
+// Join the vertices of each sub-mesh that are the same in every part and renumber the indices to match. The vertices left
+// are moved down so each sub-mesh follows straight on from the one before, and the base vertices in subMeshes (the mesh's
+// own sub-mesh array) are updated. Each sub-mesh must have its own vertices, after those of the sub-mesh before (as imported).
+// Returns the new number of vertices. Threads as above
+uint32_t JoinIdenticalVertices(const CookedMesh& mesh, uint8_t* vertices, uint32_t* indices, SubMesh* subMeshes,
+                               unsigned int numThreads /*= 0*/)
+{
+    uint32_t vertexSize = mesh.vertexSize;
+
+    // Vertex counts come from the base vertices, so find them all before any base vertex changes
+    std::vector<uint32_t> vertexCounts(mesh.numSubMeshes);
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)  vertexCounts[s] = SubMeshVertexCount(mesh, s);
+
+    uint32_t newBaseVertex = 0;
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)
+    {
+        SubMesh& subMesh = subMeshes[s];
+        uint8_t* subVertices = vertices + static_cast<size_t>(subMesh.baseVertex) * vertexSize;
+        auto vertex = [&](uint32_t v) { return subVertices + static_cast<size_t>(v) * vertexSize; };
+
+        std::vector<uint32_t> newVertex, oldVertices;
+        NumberDistinct(vertexCounts[s], numThreads,
+                       [&](uint32_t v) { return HashBytes(vertex(v), vertexSize); },
+                       [&](uint32_t a, uint32_t b) { return std::memcmp(vertex(a), vertex(b), vertexSize) == 0; },
+                       newVertex, oldVertices);
+
+        // The vertices kept are numbered in the order they first appear, so each moves down (or stays) onto space already
+        // copied from, never over a vertex still to be copied
+        uint8_t* newVertices = vertices + static_cast<size_t>(newBaseVertex) * vertexSize;
+        for (uint32_t v = 0; v < oldVertices.size(); ++v)
+        {
+            std::memmove(newVertices + static_cast<size_t>(v) * vertexSize, vertex(oldVertices[v]), vertexSize);
+        }
+
+        uint32_t* subIndices = indices + subMesh.startIndex;
+        ParallelFor(subMesh.numIndices, numThreads, [&](uint32_t begin, uint32_t end)
+        {
+            for (uint32_t i = begin; i < end; ++i)  subIndices[i] = newVertex[subIndices[i]];
+        });
+
+        subMesh.baseVertex = static_cast<int32_t>(newBaseVertex);
+        newBaseVertex += static_cast<uint32_t>(oldVertices.size());
+    }
+    return newBaseVertex;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Tangents
+//--------------------------------------------------------------------------------------
+
+// Calculate tangents for a sub-mesh with float positions, normals, tangents and UVs and 32-bit indices (an imported mesh)
+void GenerateTangents(const CookedMesh& mesh, uint32_t subMesh, uint8_t* vertices, const uint32_t* indices)
+{
+    VertexParts parts(mesh);
+    const SubMesh& range = mesh.subMeshes[subMesh];
+    uint8_t*        subVertices  = vertices + static_cast<size_t>(range.baseVertex) * parts.vertexSize;
+    const uint32_t* subIndices   = indices + range.startIndex;
+    uint32_t        numTriangles = range.numIndices / 3;
+    uint32_t        numVertices  = SubMeshVertexCount(mesh, subMesh);
+
+    auto readUV = [&](uint32_t v, float& u, float& w)
+    {
+        float uv[2];
+        std::memcpy(uv, subVertices + static_cast<size_t>(v) * parts.vertexSize + parts.uv, sizeof(uv));
+        u = uv[0];
+        w = uv[1];
+    };
+
+    // Each triangle's tangent, the direction across it in which U increases, from the change in position and UV along two edges.
+    // Zero where the UVs don't span an area
+    std::vector<CVector3> triangleTangents(numTriangles);
+    ParallelFor(numTriangles, 0, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t t = begin; t < end; ++t)
+        {
+            uint32_t i0 = subIndices[t * 3], i1 = subIndices[t * 3 + 1], i2 = subIndices[t * 3 + 2];
+            CVector3 p0 = ReadVector(subVertices, parts.vertexSize, parts.position, i0);
+            CVector3 edge1 = ReadVector(subVertices, parts.vertexSize, parts.position, i1) - p0;
+            CVector3 edge2 = ReadVector(subVertices, parts.vertexSize, parts.position, i2) - p0;
+            float u0, v0, u1, v1, u2, v2;
+            readUV(i0, u0, v0);
+            readUV(i1, u1, v1);
+            readUV(i2, u2, v2);
+            float du1 = u1 - u0, dv1 = v1 - v0;
+            float du2 = u2 - u0, dv2 = v2 - v0;
+            float area = du1 * dv2 - du2 * dv1;
+            triangleTangents[t] = (std::fabs(area) > 1e-20f) ? SafeNormalise((edge1 * dv2 - edge2 * dv1) * (1 / area)) : CVector3{ 0, 0, 0 };
+        }
+    });
+
+    VertexTriangles vertexTriangles(subIndices, numTriangles, numVertices, nullptr);
+
+    // Each vertex's tangent is the sum of its triangles' tangents made perpendicular to the vertex normal, weighted by the
+    // triangle's angle at the vertex, then made perpendicular again and unit length (MikkTSpace)
+    ParallelFor(numVertices, 0, [&](uint32_t begin, uint32_t end)
+    {
+        for (uint32_t v = begin; v < end; ++v)
+        {
+            CVector3 normal = SafeNormalise(ReadVector(subVertices, parts.vertexSize, parts.normal, v));
+            CVector3 p = ReadVector(subVertices, parts.vertexSize, parts.position, v);
+
+            CVector3 tangent = { 0, 0, 0 };
+            for (uint32_t i = vertexTriangles.first[v]; i < vertexTriangles.first[v + 1]; ++i)
+            {
+                uint32_t t = vertexTriangles.triangles[i];
+                CVector3 triangleTangent = triangleTangents[t];
+                triangleTangent = SafeNormalise(triangleTangent - normal * Dot(normal, triangleTangent));
+                if (Length(triangleTangent) == 0)  continue;
+
+                // Angle between the two edges leaving this vertex
+                uint32_t c = (subIndices[t * 3] == v) ? 0 : (subIndices[t * 3 + 1] == v) ? 1 : 2;
+                CVector3 edgeA = SafeNormalise(ReadVector(subVertices, parts.vertexSize, parts.position, subIndices[t * 3 + (c + 1) % 3]) - p);
+                CVector3 edgeB = SafeNormalise(ReadVector(subVertices, parts.vertexSize, parts.position, subIndices[t * 3 + (c + 2) % 3]) - p);
+                float cosAngle = Dot(edgeA, edgeB);
+                cosAngle = (cosAngle < -1) ? -1 : (cosAngle > 1) ? 1 : cosAngle;
+                tangent += triangleTangent * std::acos(cosAngle);
+            }
+            tangent = SafeNormalise(tangent - normal * Dot(normal, tangent));
+
+            // No UV direction here (unused vertex or no UV area), any direction along the surface will do
+            if (Length(tangent) == 0)
+            {
+                CVector3 axis = (std::fabs(normal.x) < 0.9f) ? CVector3{ 1, 0, 0 } : CVector3{ 0, 1, 0 };
+                tangent = SafeNormalise(axis - normal * Dot(normal, axis));
+            }
+            WriteVector(subVertices, parts.vertexSize, parts.tangent, v, tangent);
+        }
+    });
+}
@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Mesh tangents - smooth normals and tangents for imported meshes
+//--------------------------------------------------------------------------------------
+// Normal and parallax mapping need a tangent at each vertex, the direction of increasing U
+// texture coordinate across the surface. These used to be calculated by assimp, along with
+// normals for files without them, one sub-mesh at a time on a single thread. Now they are
+// calculated from the imported vertices and indices before the mesh is cooked (see MeshCache.h),
+// spread over all the CPU's threads for large sub-meshes.
+//
+// Normals are calculated like assimp's smooth normals, before identical vertices are joined, when
+// every triangle still has its own three vertices. Each vertex gets the average normal of the
+// triangles at its position that face within the smoothing angle of its own triangle, so edges
+// sharper than that stay hard. JoinIdenticalVertices then joins the vertices that have ended up
+// the same, as assimp did after its normals. Unlike assimp, only exactly equal positions are
+// treated as the same place.
+//
+// Tangents are calculated as in MikkTSpace, the standard most tools bake normal maps with: each
+// triangle's tangent comes from its texture coordinates, is made perpendicular to the vertex
+// normal and is weighted by the triangle's angle at the vertex. The vertices have already been
+// split wherever the normal or texture coordinates change, so each is one MikkTSpace group.
+// Only the tangent is stored, the shaders make the bitangent from the normal and tangent, so
+// mirrored texture coordinates are not supported (as before). Doesn't use any Direct3D so meshes
+// can be processed on any platform.
+
+#ifndef _MESH_TANGENTS_H_INCLUDED_
+#define _MESH_TANGENTS_H_INCLUDED_
+
+#include "MeshCache.h"
+
+#include <cstdint>
+
+// Triangles more than this angle apart (in degrees) are not smoothed together, the same as the assimp setting used before
+const float NORMAL_SMOOTHING_ANGLE = 80.0f;
+
+// Sub-meshes are split between threads in parts of at least this many triangles or vertices, smaller ones use one thread
+const uint32_t MIN_ITEMS_PER_THREAD = 16384;
+
+
+// Calculate smooth normals for a sub-mesh with float positions and normals and 32-bit indices, imported without joining
+// identical vertices so each triangle has its own. Triangles facing more than smoothingAngle (degrees) apart aren't smoothed
+// together. Large sub-meshes are split between numThreads threads (0 to use all cores)
+void GenerateNormals(const CookedMesh& mesh, uint32_t subMesh, uint8_t* vertices, const uint32_t* indices,
+                     float smoothingAngle = NORMAL_SMOOTHING_ANGLE, unsigned int numThreads = 0);
+
+// Join the vertices of each sub-mesh that are the same in every part and renumber the indices to match. The vertices left
+// are moved down so each sub-mesh follows straight on from the one before, and the base vertices in subMeshes (the mesh's
+// own sub-mesh array) are updated. Each sub-mesh must have its own vertices, after those of the sub-mesh before (as imported).
+// Returns the new number of vertices. Threads as above
+uint32_t JoinIdenticalVertices(const CookedMesh& mesh, uint8_t* vertices, uint32_t* indices, SubMesh* subMeshes,
+                               unsigned int numThreads = 0);
+
+// Calculate tangents for a sub-mesh with float positions, normals, tangents and UVs and 32-bit indices (an imported mesh)
+void GenerateTangents(const CookedMesh& mesh, uint32_t subMesh, uint8_t* vertices, const uint32_t* indices);
+
+
+#endif //_MESH_TANGENTS_H_INCLUDED_
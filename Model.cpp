@@ -9,22 +9,58 @@
 #include "Common.h"
 #include "GraphicsHelpers.h"
 #include "Mesh.h"
+#include "MeshSimplifier.h"
 
-void Model::Render()
+void Model::Render(CommandStream& commands, const CVector3& objectColour /*= { 1, 1, 1 }*/, int lodBias /*= 0*/,
+                   const ClusterView* view /*= nullptr*/)
 {
-    UpdateWorldMatrix();
-
-    gPerModelConstants.worldMatrix = mWorldMatrix; // Update C++ side constant buffer
-    UpdateConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
+    // Using local constants rather than gPerModelConstants as models may be rendered on several threads at once
+    PerModelConstants modelConstants;
+    modelConstants.worldMatrix  = CalculateWorldMatrix(); // Update C++ side constant buffer
+    modelConstants.objectColour = objectColour;
+    modelConstants.numObjectLights = static_cast<float>(mLights.count);
+    for (uint32_t i = 0; i < MAX_OBJECT_LIGHTS; ++i)
+    {
+        modelConstants.objectLights[i] = mLights.lights[i];
+    }
+    modelConstants.positionScale     = mMesh->PositionScale();
+    modelConstants.positionOffset    = mMesh->PositionOffset();
+    modelConstants.octahedralNormals = mMesh->OctahedralNormals() ? 1.0f : 0.0f;
+    commands.UpdateConstants(gPerModelConstantBuffer, modelConstants); // Send to GPU
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(1, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-    gD3DContext->PSSetConstantBuffers(1, 1, &gPerModelConstantBuffer);
+    commands.BindConstantBuffer(1, gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
 
-    mMesh->Render();
+    // Clusters are culled in the mesh's model space
+    if (view != nullptr && mMesh->NumClusters() > 0)
+    {
+        ClusterView modelView = ModelClusterView(*view, modelConstants.worldMatrix);
+        mMesh->Render(commands, mLod + lodBias, &modelView);
+    }
+    else
+    {
+        mMesh->Render(commands, mLod + lodBias);
+    }
 }
 
 
+// Choose the mesh level of detail to render from the model's size on screen (see MeshSimplifier.h). Call once a frame
+// before rendering. The projection scale is the projection matrix's y scale (cot(fovY/2))
+void Model::SelectLod(const CVector3& cameraPosition, float projectionScale)
+{
+    // Bounding sphere radius as a fraction of half the screen height. Full detail when the camera is inside the sphere
+    BoundingSphere bounds = Bounds();
+    float distance = Length(bounds.centre - cameraPosition);
+    if (distance <= bounds.radius)
+    {
+        mLod = 0;
+        return;
+    }
+    float screenSize = bounds.radius * projectionScale / distance;
+
+    mLod = ::SelectLod(screenSize, mLod, mMesh->NumLods());
+}
+
 
 // Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
 void Model::Control(float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,
@@ -74,7 +110,30 @@ void Model::Control(float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode t
 }
 
 
+// Bounding sphere of the model in world space, the mesh's bounds moved, rotated and scaled with the model
+BoundingSphere Model::Bounds()
+{
+    UpdateWorldMatrix();
+    const BoundingSphere& meshBounds = mMesh->Bounds();
+
+    // Transform the centre as a point (including the translation in the bottom row), scale the radius by the largest scaling
+    CVector3 centre = meshBounds.centre.x * mWorldMatrix.GetXAxis() + meshBounds.centre.y * mWorldMatrix.GetYAxis() +
+                      meshBounds.centre.z * mWorldMatrix.GetZAxis() + mWorldMatrix.GetPosition();
+    CVector3 scale = mWorldMatrix.GetScale();
+    float maxScale = scale.x;
+    if (scale.y > maxScale)  maxScale = scale.y;
+    if (scale.z > maxScale)  maxScale = scale.z;
+
+    return { centre, meshBounds.radius * maxScale };
+}
+
+
 void Model::UpdateWorldMatrix()
 {
-    mWorldMatrix = MatrixScaling(mScale) * MatrixRotationZ(mRotation.z) * MatrixRotationX(mRotation.x) * MatrixRotationY(mRotation.y) * MatrixTranslation(mPosition);
+    mWorldMatrix = CalculateWorldMatrix();
+}
+
+CMatrix4x4 Model::CalculateWorldMatrix() const
+{
+    return MatrixScaling(mScale) * MatrixRotationZ(mRotation.z) * MatrixRotationX(mRotation.x) * MatrixRotationY(mRotation.y) * MatrixTranslation(mPosition);
 }
\ No newline at end of file
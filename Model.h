@@ -1,19 +1,20 @@
 //--------------------------------------------------------------------------------------
 // Class encapsulating a model
 //--------------------------------------------------------------------------------------
-// Holds a pointer to a mesh as well as position, rotation and scaling, which are converted to a world matrix when required
+// Holds a shared handle to a mesh as well as position, rotation and scaling, which are converted to a world matrix when required
 // This is more of a convenience class, the Mesh class does most of the difficult work.
 
 #include "Common.h"
+#include "CommandStream.h"
+#include "ObjectLights.h"
 #include "CVector3.h"
 #include "CMatrix4x4.h"
 #include "Input.h"
+#include "Mesh.h"
 
 #ifndef _MODEL_H_INCLUDED_
 #define _MODEL_H_INCLUDED_
 
-class Mesh;
-
 class Model
 {
 public:
@@ -21,15 +22,24 @@ public:
 	// Construction / Usage
 	//-------------------------------------
 
-    Model(Mesh* mesh, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1)
+    Model(MeshHandle mesh, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1)
         : mMesh(mesh), mPosition(position), mRotation(rotation), mScale({ scale, scale, scale })
     {
     }
 
-    // The render function sets the world matrix in the per-frame constant buffer and makes that buffer available
-    // to vertex & pixel shader. Then it calls Mesh:Render, which renders the geometry with current GPU settings.
+    // The render function adds commands to set the world matrix in the per-model constant buffer and make that buffer
+    // available to vertex & pixel shader. Then it calls Mesh:Render, which renders the geometry with current settings.
     // So all other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
-    void Render();
+    // Doesn't change the model, so several threads can render the same model into different streams at once.
+    // The object colour is only used by the light model shader to tint the light to match the colour it casts.
+    // Draws the level of detail chosen by SelectLod, made that many levels simpler by lodBias (e.g. for shadows)
+    // Pass a world space view to skip the parts of large meshes that can't be seen from it (see MeshClusters.h)
+    void Render(CommandStream& commands, const CVector3& objectColour = { 1, 1, 1 }, int lodBias = 0,
+                const ClusterView* view = nullptr);
+
+    // Choose the mesh level of detail to render from the model's size on screen (see MeshSimplifier.h). Call once a frame
+    // before rendering. The projection scale is the projection matrix's y scale (cot(fovY/2))
+    void SelectLod(const CVector3& cameraPosition, float projectionScale);
 
 
 	// Control the model's position and rotation using keys provided. Amount of motion performed depends on frame time
@@ -64,14 +74,24 @@ public:
 	// Read only access to model world matrix, updated on request
 	CMatrix4x4 WorldMatrix()  { UpdateWorldMatrix();  return mWorldMatrix; }
 
+    // Bounding sphere of the model in world space, the mesh's bounds moved, rotated and scaled with the model
+    BoundingSphere Bounds();
+
+    // Point lights sent with this model's constants, used when per-object light lists are on (see ObjectLights.h)
+    void SetLights(const ObjectLightList& lights)  { mLights = lights; }
+
+    // Mesh level of detail chosen by SelectLod, 0 is full detail
+    int Lod()  { return mLod; }
+
 
 	//-------------------------------------
 	// Private data / members
 	//-------------------------------------
 private:
     void UpdateWorldMatrix();
+    CMatrix4x4 CalculateWorldMatrix() const;
 
-    Mesh* mMesh;
+    MeshHandle mMesh;
 
 	// Position, rotation and scaling for the model
 	CVector3 mPosition;
@@ -80,6 +100,10 @@ private:
 
 	// World matrix for the model - built from the above
 	CMatrix4x4 mWorldMatrix;
+
+    ObjectLightList mLights = {};
+
+    int mLod = 0;
 };
 
 
@@ -0,0 +1,223 @@
+//--------------------------------------------------------------------------------------
+// Null command stream backend
+//--------------------------------------------------------------------------------------
+
+#include "NullBackend.h"
+#include "PipelineState.h"
+
+#include <cstring>
+
+// Slot limits of the D3D11 pipeline, repeated here so this file doesn't need d3d11.h
+const uint32_t MAX_TEXTURE_SLOTS  = 128;
+const uint32_t MAX_SAMPLER_SLOTS  = 16;
+const uint32_t MAX_CONSTANT_SLOTS = 14;
+
+
+void NullBackend::Execute(const CommandStream& commands)
+{
+    // Each stream starts from default state, the same as a deferred context
+    const PipelineState*      pipeline = nullptr;
+    GeometryCommand           geometry = {};
+    ID3D11ShaderResourceView* textures[MAX_TEXTURE_SLOTS] = {};
+    ID3D11SamplerState*       samplers[MAX_SAMPLER_SLOTS] = {};
+    ID3D11Buffer*             constantBuffers[MAX_CONSTANT_SLOTS] = {};
+    bool hasTargets  = false;
+    bool hasViewport = false;
+
+    mStats.streamBytes += commands.SizeInBytes();
+
+    size_t commandIndex = 0;
+    CommandStream::Reader reader(commands);
+    while (reader.Next())
+    {
+        RenderCommand type = reader.Type();
+        if (type >= RenderCommand::NumCommands)
+        {
+            Error(commandIndex, "unknown command type");
+            ++commandIndex;
+            continue;
+        }
+        ++mStats.numCommands[static_cast<size_t>(type)];
+
+        switch (type)
+        {
+        case RenderCommand::SetPipeline:
+        {
+            // Pipeline states are shared, so the same state always has the same pointer
+            auto newPipeline = reader.Get<PipelineCommand>().pipeline;
+            if (newPipeline == nullptr)
+            {
+                Error(commandIndex, "null pipeline state");
+                break;
+            }
+            if (newPipeline->desc.vertexShader == nullptr)  Error(commandIndex, "pipeline has no vertex shader");
+            if (newPipeline == pipeline)  ++mStats.redundantStateChanges;
+            pipeline = newPipeline;
+            samplers[0] = pipeline->desc.sampler; // Pipelines include the texture sampler
+            break;
+        }
+
+        case RenderCommand::SetRenderTargets:
+        {
+            auto& targets = reader.Get<RenderTargetsCommand>();
+            if (targets.renderTarget == nullptr && targets.depthStencil == nullptr)  Error(commandIndex, "no render target or depth buffer");
+            hasTargets = true;
+            break;
+        }
+
+        case RenderCommand::SetViewport:
+        {
+            auto& viewport = reader.Get<ViewportCommand>();
+            if (viewport.width <= 0 || viewport.height <= 0)  Error(commandIndex, "empty viewport");
+            if (viewport.left < 0 || viewport.top < 0)         Error(commandIndex, "viewport starts outside the render target");
+            hasViewport = true;
+            break;
+        }
+
+        case RenderCommand::ClearRenderTarget:
+            if (reader.Get<ClearRenderTargetCommand>().renderTarget == nullptr)  Error(commandIndex, "clearing null render target");
+            break;
+
+        case RenderCommand::ClearDepth:
+            if (reader.Get<ClearDepthCommand>().depthStencil == nullptr)  Error(commandIndex, "clearing null depth buffer");
+            break;
+
+        case RenderCommand::BindTextures:
+        {
+            auto& bind  = reader.Get<TexturesCommand>();
+            auto  views = static_cast<ID3D11ShaderResourceView* const*>(reader.Extra<TexturesCommand>());
+            if (bind.count == 0 || bind.slot + bind.count > MAX_TEXTURE_SLOTS)
+            {
+                Error(commandIndex, "texture slots out of range");
+                break;
+            }
+            if (std::memcmp(&textures[bind.slot], views, bind.count * sizeof(*views)) == 0)  ++mStats.redundantStateChanges;
+            std::memcpy(&textures[bind.slot], views, bind.count * sizeof(*views));
+            break;
+        }
+
+        case RenderCommand::BindSampler:
+        {
+            auto& bind = reader.Get<SamplerCommand>();
+            if (bind.slot >= MAX_SAMPLER_SLOTS)
+            {
+                Error(commandIndex, "sampler slot out of range");
+                break;
+            }
+            if (bind.sampler == nullptr)  Error(commandIndex, "binding null sampler");
+            if (bind.sampler == samplers[bind.slot])  ++mStats.redundantStateChanges;
+            samplers[bind.slot] = bind.sampler;
+            break;
+        }
+
+        case RenderCommand::BindConstantBuffer:
+        {
+            auto& bind = reader.Get<ConstantBufferCommand>();
+            if (bind.slot >= MAX_CONSTANT_SLOTS)
+            {
+                Error(commandIndex, "constant buffer slot out of range");
+                break;
+            }
+            if (bind.buffer == nullptr)  Error(commandIndex, "binding null constant buffer");
+            if (bind.buffer == constantBuffers[bind.slot])  ++mStats.redundantStateChanges;
+            constantBuffers[bind.slot] = bind.buffer;
+            break;
+        }
+
+        case RenderCommand::UpdateConstants:
+        {
+            auto& update = reader.Get<UpdateConstantsCommand>();
+            if (update.buffer == nullptr)  Error(commandIndex, "updating null constant buffer");
+            if (update.size == 0 || update.size % 16 != 0)  Error(commandIndex, "constant data size is not a multiple of 16 bytes");
+            mStats.constantBytesUploaded += update.size;
+            break;
+        }
+
+        case RenderCommand::SetGeometry:
+        {
+            auto& newGeometry = reader.Get<GeometryCommand>();
+            if (newGeometry.vertexLayout == nullptr || newGeometry.vertexBuffer == nullptr || newGeometry.indexBuffer == nullptr)
+            {
+                Error(commandIndex, "geometry has null layout or buffers");
+            }
+            if (newGeometry.vertexSize == 0)  Error(commandIndex, "zero vertex size");
+            if (newGeometry.indexSize != 2 && newGeometry.indexSize != 4)  Error(commandIndex, "index size must be 2 or 4 bytes");
+            if (std::memcmp(&newGeometry, &geometry, sizeof(geometry)) == 0)  ++mStats.redundantStateChanges;
+            geometry = newGeometry;
+            break;
+        }
+
+        case RenderCommand::DrawIndexed:
+        {
+            auto& draw = reader.Get<DrawCommand>();
+            if (pipeline == nullptr)               Error(commandIndex, "draw without a pipeline");
+            if (geometry.vertexLayout == nullptr)  Error(commandIndex, "draw without geometry");
+            if (!hasTargets)                       Error(commandIndex, "draw without render targets");
+            if (!hasViewport)                      Error(commandIndex, "draw without a viewport");
+            if (draw.indexCount == 0)              Error(commandIndex, "draw with no indices");
+            ++mStats.numDraws;
+            mStats.numTriangles += draw.indexCount / 3;
+            break;
+        }
+
+        case RenderCommand::DrawGenerated:
+        {
+            auto& draw = reader.Get<DrawGeneratedCommand>();
+            if (pipeline == nullptr)   Error(commandIndex, "draw without a pipeline");
+            if (!hasTargets)           Error(commandIndex, "draw without render targets");
+            if (!hasViewport)          Error(commandIndex, "draw without a viewport");
+            if (draw.vertexCount == 0) Error(commandIndex, "draw with no vertices");
+            geometry.vertexLayout = nullptr; // The input layout is removed, geometry must be set again before an indexed draw
+            ++mStats.numDraws;
+            mStats.numTriangles += draw.vertexCount / 3;
+            break;
+        }
+
+        case RenderCommand::CopyTexture:
+        {
+            auto& copy = reader.Get<CopyTextureCommand>();
+            if (copy.destination == nullptr || copy.source == nullptr)  Error(commandIndex, "copying null texture");
+            if (copy.destination == copy.source)                        Error(commandIndex, "copying texture to itself");
+            break;
+        }
+
+        case RenderCommand::Timestamp:
+            if (reader.Get<TimestampCommand>().query == nullptr)  Error(commandIndex, "null timestamp query");
+            break;
+
+        default:
+            break;
+        }
+
+        ++commandIndex;
+    }
+}
+
+
+void NullBackend::Error(size_t commandIndex, const std::string& message)
+{
+    std::string prefix = mStreamName.empty() ? "" : mStreamName + ", ";
+    mErrors.push_back(prefix + "command " + std::to_string(commandIndex) + ": " + message);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Headless pass recorder
+//--------------------------------------------------------------------------------------
+
+// Queue a pass for recording, one of the workers will pick it up straight away if it is free
+void NullPassRecorder::AddPass(const std::string& name, RecordPassFunction recordPass)
+{
+    mQueue.Add(name, recordPass);
+}
+
+// Wait for all queued passes to finish recording, then replay them in the order they were added
+void NullPassRecorder::Submit()
+{
+    mQueue.Submit([this](const std::string& name, const CommandStream& commands, void*)
+    {
+        mBackend.SetStreamName(name);
+        mBackend.Execute(commands);
+        ++mNumPasses;
+    });
+}
@@ -0,0 +1,82 @@
+//--------------------------------------------------------------------------------------
+// Null command stream backend
+//--------------------------------------------------------------------------------------
+// Replays command streams without a GPU. Nothing is drawn, instead the backend counts the
+// commands, draws and triangles, and checks the stream is valid (e.g. a draw always has a
+// pipeline and geometry set). Doesn't need Direct3D so it can be used to run and profile the
+// scene's CPU-side rendering code on any platform.
+
+#ifndef _NULL_BACKEND_H_INCLUDED_
+#define _NULL_BACKEND_H_INCLUDED_
+
+#include "CommandStream.h"
+#include "PassRecorder.h"
+
+#include <string>
+#include <vector>
+
+class NullBackend : public RenderBackend
+{
+public:
+    // Totals over all streams executed since the last ResetStats call
+    struct Stats
+    {
+        size_t numCommands[static_cast<size_t>(RenderCommand::NumCommands)] = {};
+        size_t numDraws              = 0;
+        size_t numTriangles          = 0;
+        size_t constantBytesUploaded = 0;
+        size_t redundantStateChanges = 0; // Commands that wouldn't change the current state (the D3D11 backend skips these)
+        size_t streamBytes           = 0;
+    };
+
+    void Execute(const CommandStream& commands) override;
+
+    void ResetStats()  { mStats = Stats(); mErrors.clear(); }
+
+    // Name to put at the start of errors found in the following streams (e.g. the pass name)
+    void SetStreamName(const std::string& name)  { mStreamName = name; }
+
+    const Stats& GetStats()  { return mStats; }
+
+    // Description of each problem found in the streams, empty if they were all valid
+    const std::vector<std::string>& Errors()  { return mErrors; }
+
+private:
+    void Error(size_t commandIndex, const std::string& message);
+
+    Stats                    mStats;
+    std::vector<std::string> mErrors;
+    std::string              mStreamName;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Headless pass recorder
+//--------------------------------------------------------------------------------------
+// Records passes on worker threads with a PassQueue, like DeferredPassRecorder, and replays them through a NullBackend in
+// the order they were added when they are submitted. Problems found in a pass are reported with the pass name at the start
+// of the error. Call Backend().ResetStats() each frame to get per-frame figures
+class NullPassRecorder : public PassRecorder
+{
+public:
+    // Pass the number of worker threads to use (0 picks one per hardware thread)
+    NullPassRecorder(unsigned int numThreads = 1) : mQueue(numThreads) {}
+
+    void AddPass(const std::string& name, RecordPassFunction recordPass) override;
+    void Submit() override;
+
+    NullBackend& Backend()  { return mBackend; }
+
+    // Total number of passes submitted
+    size_t NumPasses()  { return mNumPasses; }
+
+    unsigned int NumThreads()  { return mQueue.NumThreads(); }
+
+private:
+    NullBackend mBackend;
+    PassQueue   mQueue;
+    size_t      mNumPasses = 0;
+};
+
+
+#endif //_NULL_BACKEND_H_INCLUDED_
@@ -0,0 +1,168 @@
+//--------------------------------------------------------------------------------------
+// Object lights - choosing the most influential point lights for each object
+//--------------------------------------------------------------------------------------
+
+#include "ObjectLights.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// Set this frame's lights: position, influence radius and luminance (brightness) of each. The lights are sorted
+// into a grid ready for AssignObjects
+void ObjectLights::SetLights(const CVector3* positions, const float* radii, const float* luminances, uint32_t numLights)
+{
+    mPositions.assign(positions, positions + numLights);
+    mRadii.assign(radii, radii + numLights);
+    mLuminances.assign(luminances, luminances + numLights);
+
+    mGridSize[0] = mGridSize[1] = mGridSize[2] = 0;
+    mCellStarts.assign(1, 0);
+    mCellLights.clear();
+    if (numLights == 0)  return;
+
+    //// Choose the grid ////
+
+    // Cover all the light spheres. Cells are about the size of an average light so each light touches a few cells,
+    // but there's a limit to the number of cells so a few very large lights don't make a huge grid
+    const int MAX_CELLS_PER_SIDE = 32;
+    CVector3 gridMin = positions[0];
+    CVector3 gridMax = positions[0];
+    float totalRadius = 0;
+    for (uint32_t i = 0; i < numLights; ++i)
+    {
+        CVector3 extent = { radii[i], radii[i], radii[i] };
+        CVector3 lightMin = positions[i] - extent;
+        CVector3 lightMax = positions[i] + extent;
+        gridMin = { std::min(gridMin.x, lightMin.x), std::min(gridMin.y, lightMin.y), std::min(gridMin.z, lightMin.z) };
+        gridMax = { std::max(gridMax.x, lightMax.x), std::max(gridMax.y, lightMax.y), std::max(gridMax.z, lightMax.z) };
+        totalRadius += radii[i];
+    }
+    CVector3 gridExtent = gridMax - gridMin;
+    float largestExtent = std::max(std::max(gridExtent.x, gridExtent.y), gridExtent.z);
+
+    mGridMin  = gridMin;
+    mCellSize = std::max(2.0f * totalRadius / numLights, largestExtent / MAX_CELLS_PER_SIDE);
+    mCellSize = std::max(mCellSize, 0.001f);
+    mGridSize[0] = std::max(1, static_cast<int>(std::ceil(gridExtent.x / mCellSize)));
+    mGridSize[1] = std::max(1, static_cast<int>(std::ceil(gridExtent.y / mCellSize)));
+    mGridSize[2] = std::max(1, static_cast<int>(std::ceil(gridExtent.z / mCellSize)));
+
+    //// Sort the lights into the cells they touch ////
+
+    // Count the lights in each cell, convert the counts to starting positions, then fill in the lights
+    size_t numCells = static_cast<size_t>(mGridSize[0]) * mGridSize[1] * mGridSize[2];
+    mCellStarts.assign(numCells + 1, 0);
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (uint32_t i = 0; i < numLights; ++i)
+        {
+            CVector3 extent = { radii[i], radii[i], radii[i] };
+            int minCell[3], maxCell[3];
+            CellRange(positions[i] - extent, positions[i] + extent, minCell, maxCell);
+            for (int z = minCell[2]; z <= maxCell[2]; ++z)
+            {
+                for (int y = minCell[1]; y <= maxCell[1]; ++y)
+                {
+                    for (int x = minCell[0]; x <= maxCell[0]; ++x)
+                    {
+                        size_t cell = x + (y + static_cast<size_t>(z) * mGridSize[1]) * mGridSize[0];
+                        if (pass == 0)  ++mCellStarts[cell + 1];
+                        else            mCellLights[mCellStarts[cell]++] = i;
+                    }
+                }
+            }
+        }
+
+        if (pass == 0)
+        {
+            for (size_t cell = 0; cell < numCells; ++cell)  mCellStarts[cell + 1] += mCellStarts[cell];
+            mCellLights.resize(mCellStarts[numCells]);
+        }
+    }
+
+    // Filling moved each start along to the next cell's start, move them back
+    for (size_t cell = numCells; cell > 0; --cell)  mCellStarts[cell] = mCellStarts[cell - 1];
+    mCellStarts[0] = 0;
+}
+
+
+// Choose the lights for each object given by its bounding sphere. Only lights whose radius reaches the sphere are
+// used, ranked by luminance / distance^2 from the nearest point of the sphere
+void ObjectLights::AssignObjects(const CVector3* centres, const float* radii, uint32_t numObjects)
+{
+    mLists.resize(numObjects);
+    mLightStamps.assign(mPositions.size(), 0);
+
+    for (uint32_t object = 0; object < numObjects; ++object)
+    {
+        ObjectLightList& list = mLists[object];
+        list.count = 0;
+
+        CVector3 centre = centres[object];
+        float    radius = radii[object];
+        CVector3 extent = { radius, radius, radius };
+        int minCell[3], maxCell[3];
+        if (!CellRange(centre - extent, centre + extent, minCell, maxCell))  continue;
+
+        float influences[MAX_OBJECT_LIGHTS]; // Of the lights in the list, in the same order
+        uint32_t stamp = object + 1;
+        for (int z = minCell[2]; z <= maxCell[2]; ++z)
+        {
+            for (int y = minCell[1]; y <= maxCell[1]; ++y)
+            {
+                for (int x = minCell[0]; x <= maxCell[0]; ++x)
+                {
+                    size_t cell = x + (y + static_cast<size_t>(z) * mGridSize[1]) * mGridSize[0];
+                    for (uint32_t i = mCellStarts[cell]; i < mCellStarts[cell + 1]; ++i)
+                    {
+                        uint32_t light = mCellLights[i];
+                        if (mLightStamps[light] == stamp)  continue; // Already seen in another cell
+                        mLightStamps[light] = stamp;
+
+                        // Skip lights that don't reach the object
+                        CVector3 toLight = mPositions[light] - centre;
+                        float distanceSquared = Dot(toLight, toLight);
+                        float reach = mRadii[light] + radius;
+                        if (distanceSquared >= reach * reach)  continue;
+
+                        // Distance from the nearest point on the sphere, at least 1 unit so lights inside the object can still be ranked
+                        float surfaceDistance = std::max(std::sqrt(distanceSquared) - radius, 1.0f);
+                        float influence = mLuminances[light] / (surfaceDistance * surfaceDistance);
+
+                        // Insert into the sorted list if it is among the strongest so far
+                        if (list.count == MAX_OBJECT_LIGHTS && influence <= influences[MAX_OBJECT_LIGHTS - 1])  continue;
+                        uint32_t position = (list.count < MAX_OBJECT_LIGHTS) ? list.count++ : MAX_OBJECT_LIGHTS - 1;
+                        while (position > 0 && influences[position - 1] < influence)
+                        {
+                            influences[position]  = influences[position - 1];
+                            list.lights[position] = list.lights[position - 1];
+                            --position;
+                        }
+                        influences[position]  = influence;
+                        list.lights[position] = light;
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+// Range of grid cells touched by a box, clamped to the grid. Returns false if the box is entirely outside it
+bool ObjectLights::CellRange(const CVector3& boxMin, const CVector3& boxMax, int minCell[3], int maxCell[3]) const
+{
+    const float* boxMinAxes = &boxMin.x;
+    const float* boxMaxAxes = &boxMax.x;
+    const float* gridMinAxes = &mGridMin.x;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float cellMin = std::floor((boxMinAxes[axis] - gridMinAxes[axis]) / mCellSize);
+        float cellMax = std::floor((boxMaxAxes[axis] - gridMinAxes[axis]) / mCellSize);
+        if (cellMax < 0 || cellMin >= mGridSize[axis])  return false;
+
+        minCell[axis] = std::max(static_cast<int>(cellMin), 0);
+        maxCell[axis] = std::min(static_cast<int>(cellMax), mGridSize[axis] - 1);
+    }
+    return true;
+}
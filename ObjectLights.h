@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// Object lights - choosing the most influential point lights for each object
+//--------------------------------------------------------------------------------------
+// An alternative to the light clusters (see LightClusters.h) for forward rendering. Each object
+// is given a short list of the lights that affect it most, ranked by brightness and distance
+// from the object's bounding sphere. The list is sent with the object's per-model constants, so
+// the pixel shader loops over a few lights chosen for that object whatever the number of lights.
+//
+// Lights are sorted into a uniform grid each frame so each object only looks at the lights in
+// the grid cells it overlaps. Doesn't use any Direct3D so it can be profiled on any platform.
+
+#ifndef _OBJECT_LIGHTS_H_INCLUDED_
+#define _OBJECT_LIGHTS_H_INCLUDED_
+
+#include "CVector3.h"
+
+#include <vector>
+#include <cstdint>
+
+// Maximum number of lights for each object, must match the size of the list in the per-model constants
+const uint32_t MAX_OBJECT_LIGHTS = 8;
+
+// The lights chosen for one object, most influential first
+struct ObjectLightList
+{
+    uint32_t count;
+    uint32_t lights[MAX_OBJECT_LIGHTS]; // Indexes into the light arrays passed to SetLights
+};
+
+class ObjectLights
+{
+public:
+    // Set this frame's lights: position, influence radius and luminance (brightness) of each. The lights are sorted
+    // into a grid ready for AssignObjects
+    void SetLights(const CVector3* positions, const float* radii, const float* luminances, uint32_t numLights);
+
+    // Choose the lights for each object given by its bounding sphere. Only lights whose radius reaches the sphere are
+    // used, ranked by luminance / distance^2 from the nearest point of the sphere
+    void AssignObjects(const CVector3* centres, const float* radii, uint32_t numObjects);
+
+    // Results of AssignObjects
+    const ObjectLightList& Lights(uint32_t object) const  { return mLists[object]; }
+
+private:
+    // Range of grid cells touched by a box, clamped to the grid. Returns false if the box is entirely outside it
+    bool CellRange(const CVector3& boxMin, const CVector3& boxMax, int minCell[3], int maxCell[3]) const;
+
+    // Lights in structure of arrays form
+    std::vector<CVector3> mPositions;
+    std::vector<float>    mRadii;
+    std::vector<float>    mLuminances;
+
+    // Uniform grid over the bounds of all the lights. Each cell has a range in mCellLights of the lights that touch it
+    CVector3              mGridMin;
+    float                 mCellSize = 1.0f;
+    int                   mGridSize[3] = { 0, 0, 0 };
+    std::vector<uint32_t> mCellStarts; // One more than the number of cells, the last is the end of the final cell
+    std::vector<uint32_t> mCellLights;
+
+    // Last object each light was checked against, to only check lights found in several cells once
+    std::vector<uint32_t> mLightStamps;
+
+    std::vector<ObjectLightList> mLists;
+};
+
+
+#endif //_OBJECT_LIGHTS_H_INCLUDED_
@@ -6,11 +6,18 @@
 Texture2D DiffuseSpecularMap : register(t0);
 Texture2D NormalHeightMap    : register(t1);
 
-Texture2D ShadowMap[15]      : register(t10);
-Texture2D ColourMap[15]      : register(t30);
+Texture2D ShadowAtlas        : register(t10);
+Texture2D ColourAtlas        : register(t30);
 
 SamplerState TexSampler      : register(s0);
 SamplerState PointClamp      : register(s1);
+SamplerComparisonState ShadowSampler : register(s2);
+
+// Number of times the offset is refined, set for the shader's variants (see ShaderPermutations.h). One step is the basic
+// parallax mapping above, more steps follow steep height changes better
+#ifndef PARALLAX_STEPS
+#define PARALLAX_STEPS 1
+#endif
 
 //--------------------------------------------------------------------------------------
 // Shader code
@@ -51,6 +58,16 @@ float4 main(NormalMappingPixelShaderInput input) : SV_Target
 	// Use the depth of the texture to offset the given texture coordinate - this corrected texture coordinate will be used from here on
 	float2 offsetTexCoord = textureHeight * textureOffsetDir;
 
+#if PARALLAX_STEPS > 1
+	// Look up the height again where the offset landed and move half way towards the offset that height gives, each step
+	// getting closer to where the camera's view actually meets the surface
+	[unroll] for (int step = 1; step < PARALLAX_STEPS; step++)
+	{
+		textureHeight = gParallaxDepth * (NormalHeightMap.Sample(TexSampler, input.uv + offsetTexCoord).a - 0.5f);
+		offsetTexCoord = 0.5f * (offsetTexCoord + textureHeight * textureOffsetDir);
+	}
+#endif
+
 	// Get the texture normal from the normal map. The r,g,b pixel values actually store x,y,z components of a normal. However, r,g,b
 	// values are stored in the range 0->1, whereas the x, y & z components should be in the range -1->1. So some scaling is needed
 	float3 textureNormal = 2.0f * NormalHeightMap.Sample(TexSampler, input.uv + offsetTexCoord).rgb - 1.0f; // Scale from 0->1 to -1->1
@@ -63,7 +80,7 @@ float4 main(NormalMappingPixelShaderInput input) : SV_Target
 	// Calculate lighting
 	float3 diffuseLight;
 	float3 specularLight;
-	CalculateLighting(ShadowMap, input.worldPosition, worldNormal, PointClamp, diffuseLight, specularLight, ColourMap, true);
+	CalculateLighting(ShadowAtlas, input.worldPosition, worldNormal, input.lightProjections, PointClamp, ShadowSampler, diffuseLight, specularLight, ColourAtlas, true);
 
 	////////////////////
 	// Combine lighting and textures
@@ -0,0 +1,90 @@
+//--------------------------------------------------------------------------------------
+// Pass queue - records passes on a pool of worker threads and submits them in order
+//--------------------------------------------------------------------------------------
+
+#include "PassQueue.h"
+
+
+// Pass the number of worker threads to use (0 picks one per hardware thread) and optionally a function to finish each
+// pass on its worker
+PassQueue::PassQueue(unsigned int numThreads /*= 0*/, FinishPassFunction finishPass /*= nullptr*/)
+    : mFinishPass(finishPass)
+{
+    if (numThreads == 0)  numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0)  numThreads = 1;
+
+    for (unsigned int i = 0; i < numThreads; ++i)
+    {
+        mWorkers.emplace_back(&PassQueue::WorkerLoop, this, i);
+    }
+}
+
+
+// Waits for the passes being recorded, passes that were never submitted are dropped without being submitted
+PassQueue::~PassQueue()
+{
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mWorkDone.wait(lock, [this] { return mPassesRecorded == mPasses.size(); });
+        mShutdown = true;
+    }
+    mWorkAvailable.notify_all();
+    for (auto& worker : mWorkers)  worker.join();
+}
+
+
+// Queue a pass for recording, one of the workers will pick it up straight away if it is free
+void PassQueue::Add(const std::string& name, RecordPassFunction recordPass)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        // Pass n always records into stream n, which will usually have grown to the right size in earlier frames
+        if (mCommandStreams.size() <= mPasses.size())  mCommandStreams.push_back(std::make_unique<CommandStream>());
+        mPasses.push_back({ name, recordPass, mCommandStreams[mPasses.size()].get(), nullptr });
+    }
+    mWorkAvailable.notify_one();
+}
+
+
+// Wait for all queued passes to finish recording, then give them to the submit function in the order they were added
+void PassQueue::Submit(SubmitPassFunction submitPass)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWorkDone.wait(lock, [this] { return mPassesRecorded == mPasses.size(); });
+
+    for (auto& pass : mPasses)  submitPass(pass.name, *pass.commands, pass.finished);
+
+    mPasses.clear();
+    mNextPass = 0;
+    mPassesRecorded = 0;
+}
+
+
+// Main function of each worker thread - records passes from the queue in the order they were added
+void PassQueue::WorkerLoop(unsigned int worker)
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while (true)
+    {
+        mWorkAvailable.wait(lock, [this] { return mShutdown || mNextPass < mPasses.size(); });
+        if (mShutdown)  return;
+
+        // Copy what we need out of the pass list - it may grow (and move) while we are recording. The stream is only used by
+        // this pass until it is submitted
+        size_t passIndex = mNextPass++;
+        RecordPassFunction record = mPasses[passIndex].record;
+        std::string name = mPasses[passIndex].name;
+        CommandStream& commands = *mPasses[passIndex].commands;
+        lock.unlock();
+
+        commands.Clear();
+        record(commands);
+        void* finished = mFinishPass ? mFinishPass(worker, name, commands) : nullptr;
+
+        lock.lock();
+        mPasses[passIndex].finished = finished;
+        ++mPassesRecorded;
+        if (mPassesRecorded == mPasses.size())  mWorkDone.notify_all();
+    }
+}
@@ -0,0 +1,87 @@
+//--------------------------------------------------------------------------------------
+// Pass queue - records passes on a pool of worker threads and submits them in order
+//--------------------------------------------------------------------------------------
+// The threading behind the pass recorders (see PassRecorder.h). Passes are added from one thread
+// and each is recorded into its own command stream by whichever worker is free, so passes finish
+// in any order. Submit waits for them all and then hands them back in the order they were added,
+// so the frame comes out the same as if every pass had been recorded serially.
+//
+// A recorder can give a function that is also run on the worker after each pass is recorded, to
+// do more of the work in parallel (e.g. DeferredPassRecorder replays the commands into the
+// worker's own deferred context). Doesn't use any Direct3D so the threading is tested headless
+// with NullPassRecorder (see NullBackend.h).
+
+#ifndef _PASS_QUEUE_H_INCLUDED_
+#define _PASS_QUEUE_H_INCLUDED_
+
+#include "CommandStream.h"
+
+#include <string>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// A pass adds all its rendering to the given command stream. It must not use gD3DContext or write
+// to any shared globals because other passes are being recorded at the same time
+typedef std::function<void(CommandStream& commands)> RecordPassFunction;
+
+// Run on the worker that recorded a pass, straight after recording it. The worker number is from 0 to NumThreads() - 1 and
+// the result is kept with the pass until it is submitted (e.g. a command list)
+typedef std::function<void*(unsigned int worker, const std::string& name, const CommandStream& commands)> FinishPassFunction;
+
+// Run on the submitting thread for each pass in the order the passes were added, with the result of the finish function
+// (null if there isn't one)
+typedef std::function<void(const std::string& name, const CommandStream& commands, void* finished)> SubmitPassFunction;
+
+
+class PassQueue
+{
+public:
+    // Pass the number of worker threads to use (0 picks one per hardware thread) and optionally a function to finish each
+    // pass on its worker
+    PassQueue(unsigned int numThreads = 0, FinishPassFunction finishPass = nullptr);
+
+    // Waits for the passes being recorded, passes that were never submitted are dropped without being submitted (so any
+    // finished results needing releasing should be submitted first)
+    ~PassQueue();
+
+    // Queue a pass for recording, one of the workers will pick it up straight away if it is free
+    void Add(const std::string& name, RecordPassFunction recordPass);
+
+    // Wait for all queued passes to finish recording, then give them to the submit function in the order they were added
+    void Submit(SubmitPassFunction submitPass);
+
+    unsigned int NumThreads()  { return static_cast<unsigned int>(mWorkers.size()); }
+
+private:
+    struct Pass
+    {
+        std::string        name;
+        RecordPassFunction record;
+        CommandStream*     commands = nullptr;
+        void*              finished = nullptr;
+    };
+
+    // Main function of each worker thread - records passes from the queue in the order they were added
+    void WorkerLoop(unsigned int worker);
+
+    std::vector<std::thread> mWorkers;
+    FinishPassFunction       mFinishPass;
+
+    // Passes added this frame. Protected by mMutex, workers take the next unrecorded pass in order. Each pass has its own
+    // command stream, the streams are kept for the next frame to avoid reallocating
+    std::vector<Pass>                           mPasses;
+    std::vector<std::unique_ptr<CommandStream>> mCommandStreams;
+    size_t                                      mNextPass = 0;      // Index of next pass to give to a worker
+    size_t                                      mPassesRecorded = 0;
+    bool                                        mShutdown = false;
+    std::mutex                                  mMutex;
+    std::condition_variable                     mWorkAvailable;
+    std::condition_variable                     mWorkDone;
+};
+
+
+#endif //_PASS_QUEUE_H_INCLUDED_
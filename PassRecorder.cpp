@@ -0,0 +1,124 @@
+//--------------------------------------------------------------------------------------
+// Multithreaded recording of render passes
+//--------------------------------------------------------------------------------------
+
+#include "PassRecorder.h"
+#include "D3D11Backend.h"
+#include "Common.h"
+
+#include <d3d11_1.h> // ID3DUserDefinedAnnotation
+#include <stdexcept>
+#include <thread>
+
+
+// Send a pass's commands to a context, wrapped in an event marker with the pass name so the pass can be found in graphics
+// debuggers and GPU profilers (e.g. PIX, RenderDoc). The context should be in default state
+static void ExecutePass(ID3D11DeviceContext* context, const std::string& name, const CommandStream& commands)
+{
+    ID3DUserDefinedAnnotation* annotation = nullptr;
+    context->QueryInterface(__uuidof(ID3DUserDefinedAnnotation), reinterpret_cast<void**>(&annotation));
+    if (annotation)  annotation->BeginEvent(std::wstring(name.begin(), name.end()).c_str());
+
+    D3D11Backend backend(context);
+    backend.Execute(commands);
+
+    if (annotation)
+    {
+        annotation->EndEvent();
+        annotation->Release();
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Serial recorder
+//--------------------------------------------------------------------------------------
+
+void ImmediatePassRecorder::AddPass(const std::string& name, RecordPassFunction recordPass)
+{
+    // Start each pass from default state, the same as a deferred context would. This also makes sure the shadow maps
+    // are no longer bound as shader inputs when the next frame renders to them
+    gD3DContext->ClearState();
+
+    mCommands.Clear();
+    recordPass(mCommands);
+    ExecutePass(gD3DContext, name, mCommands);
+}
+
+void ImmediatePassRecorder::Submit()
+{
+    // Nothing to do, everything was sent to the GPU as it was added
+}
+
+
+//--------------------------------------------------------------------------------------
+// Deferred context recorder
+//--------------------------------------------------------------------------------------
+
+// Pass the number of worker threads to use (0 picks one per hardware thread)
+// Will throw a std::runtime_error exception on failure (since constructors can't return errors)
+DeferredPassRecorder::DeferredPassRecorder(unsigned int numThreads /*= 0*/)
+{
+    if (numThreads == 0)  numThreads = std::thread::hardware_concurrency();
+    if (numThreads == 0)  numThreads = 1;
+
+    // Create all the deferred contexts before starting any threads so a failure leaves nothing running
+    for (unsigned int i = 0; i < numThreads; ++i)
+    {
+        ID3D11DeviceContext* context = nullptr;
+        if (FAILED(gD3DDevice->CreateDeferredContext(0, &context)))
+        {
+            for (auto deferredContext : mDeferredContexts)  deferredContext->Release();
+            throw std::runtime_error("Error creating deferred context");
+        }
+        mDeferredContexts.push_back(context);
+    }
+
+    // Each pass is sent to the worker's deferred context as soon as it is recorded. FALSE - reset the deferred context to
+    // default state ready for the next pass
+    auto finishPass = [this](unsigned int worker, const std::string& name, const CommandStream& commands)
+    {
+        ID3D11DeviceContext* context = mDeferredContexts[worker];
+        ExecutePass(context, name, commands);
+        ID3D11CommandList* commandList = nullptr;
+        context->FinishCommandList(FALSE, &commandList);
+        return static_cast<void*>(commandList);
+    };
+    mQueue = std::make_unique<PassQueue>(numThreads, finishPass);
+}
+
+
+DeferredPassRecorder::~DeferredPassRecorder()
+{
+    // Any passes that were recorded but never submitted, then stop the workers before their contexts go
+    mQueue->Submit([](const std::string&, const CommandStream&, void* finished)
+    {
+        if (finished)  static_cast<ID3D11CommandList*>(finished)->Release();
+    });
+    mQueue.reset();
+
+    for (auto context : mDeferredContexts)  context->Release();
+}
+
+
+// Queue a pass for recording, one of the workers will pick it up straight away if it is free
+void DeferredPassRecorder::AddPass(const std::string& name, RecordPassFunction recordPass)
+{
+    mQueue->Add(name, recordPass);
+}
+
+
+// Wait for all queued passes to finish recording, then execute them in the order they were added
+void DeferredPassRecorder::Submit()
+{
+    mQueue->Submit([](const std::string&, const CommandStream&, void* finished)
+    {
+        // FALSE - don't restore the immediate context state afterwards, every pass sets up all the state it uses
+        if (finished)
+        {
+            auto commandList = static_cast<ID3D11CommandList*>(finished);
+            gD3DContext->ExecuteCommandList(commandList, FALSE);
+            commandList->Release();
+        }
+    });
+}
@@ -0,0 +1,82 @@
+//--------------------------------------------------------------------------------------
+// Multithreaded recording of render passes
+//--------------------------------------------------------------------------------------
+// Each pass (a shadow map, a slice of the main scene etc.) is recorded on a worker thread into
+// a command stream (see CommandStream.h), which is then replayed into the worker's own deferred context. When the frame is submitted the finished command lists are
+// executed on the immediate context in the order the passes were added, so the result is the
+// same as drawing everything serially. The worker threads and ordering are in PassQueue.h.
+//
+// Scene code only uses the PassRecorder interface and command streams, so the recording side can be
+// replaced by a version that doesn't need a GPU (see NullPassRecorder in NullBackend.h).
+
+#ifndef _PASS_RECORDER_H_INCLUDED_
+#define _PASS_RECORDER_H_INCLUDED_
+
+#include "CommandStream.h"
+#include "PassQueue.h"
+
+#include <string>
+#include <memory>
+#include <vector>
+
+// Declared in d3d11.h, only used by pointer here
+struct ID3D11DeviceContext;
+
+
+//--------------------------------------------------------------------------------------
+// Pass recorder interface
+//--------------------------------------------------------------------------------------
+class PassRecorder
+{
+public:
+    virtual ~PassRecorder() {}
+
+    // Queue a pass for recording, it may start recording straight away on another thread. The name marks the pass's
+    // commands in graphics debuggers and is given in any errors found in them
+    virtual void AddPass(const std::string& name, RecordPassFunction recordPass) = 0;
+
+    // Wait for all queued passes to finish recording, then submit them to the GPU in the order they were added
+    virtual void Submit() = 0;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Serial recorder
+//--------------------------------------------------------------------------------------
+// Records each pass and sends it straight to the immediate context on the calling thread - the original single-threaded behaviour
+class ImmediatePassRecorder : public PassRecorder
+{
+public:
+    void AddPass(const std::string& name, RecordPassFunction recordPass) override;
+    void Submit() override;
+
+private:
+    CommandStream mCommands; // Reused for every pass to avoid reallocating
+};
+
+
+//--------------------------------------------------------------------------------------
+// Deferred context recorder
+//--------------------------------------------------------------------------------------
+// Uses a pool of worker threads (see PassQueue.h), each with its own deferred context
+class DeferredPassRecorder : public PassRecorder
+{
+public:
+    // Pass the number of worker threads to use (0 picks one per hardware thread)
+    // Will throw a std::runtime_error exception on failure (since constructors can't return errors)
+    DeferredPassRecorder(unsigned int numThreads = 0);
+    ~DeferredPassRecorder();
+
+    void AddPass(const std::string& name, RecordPassFunction recordPass) override;
+    void Submit() override;
+
+    unsigned int NumThreads()  { return mQueue->NumThreads(); }
+
+private:
+    // Each worker replays its passes into its own deferred context, one per worker number
+    std::vector<ID3D11DeviceContext*> mDeferredContexts;
+    std::unique_ptr<PassQueue>        mQueue; // Created after the contexts and destroyed before them
+};
+
+
+#endif //_PASS_RECORDER_H_INCLUDED_
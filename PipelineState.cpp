@@ -0,0 +1,74 @@
+//--------------------------------------------------------------------------------------
+// Pipeline state objects
+//--------------------------------------------------------------------------------------
+
+#include "PipelineState.h"
+
+#include <unordered_map>
+#include <memory>
+#include <functional>
+
+
+//--------------------------------------------------------------------------------------
+// Pipeline states
+//--------------------------------------------------------------------------------------
+
+bool PipelineDesc::operator==(const PipelineDesc& other) const
+{
+    return vertexShader      == other.vertexShader      &&
+           pixelShader       == other.pixelShader       &&
+           blendState        == other.blendState        &&
+           depthStencilState == other.depthStencilState &&
+           rasterizerState   == other.rasterizerState   &&
+           sampler           == other.sampler;
+}
+
+
+// Combine the hashes of each object pointer in the description
+static size_t HashPipelineDesc(const PipelineDesc& desc)
+{
+    const void* parts[] = { desc.vertexShader, desc.pixelShader, desc.blendState, desc.depthStencilState, desc.rasterizerState, desc.sampler };
+
+    size_t hash = 0;
+    for (auto part : parts)
+    {
+        hash ^= std::hash<const void*>()(part) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+
+PipelineState::PipelineState(const PipelineDesc& pipelineDesc)
+    : desc(pipelineDesc), hash(HashPipelineDesc(pipelineDesc))
+{
+}
+
+
+//--------------------------------------------------------------------------------------
+// Pipeline state creation / destruction
+//--------------------------------------------------------------------------------------
+
+struct PipelineDescHash
+{
+    size_t operator()(const PipelineDesc& desc) const  { return HashPipelineDesc(desc); }
+};
+
+// All the pipeline states created so far
+static std::unordered_map<PipelineDesc, std::unique_ptr<PipelineState>, PipelineDescHash> gPipelineStates;
+
+
+// Return the pipeline state matching the description, creating it if it doesn't exist yet. Create all pipelines
+// during start-up - this function is not thread-safe so must not be called while passes are being recorded
+const PipelineState* GetPipelineState(const PipelineDesc& desc)
+{
+    auto& pipeline = gPipelineStates[desc];
+    if (!pipeline)  pipeline.reset(new PipelineState(desc));
+    return pipeline.get();
+}
+
+
+// Delete all pipeline states, any pointers previously returned become invalid
+void ReleasePipelineStates()
+{
+    gPipelineStates.clear();
+}
@@ -0,0 +1,60 @@
+//--------------------------------------------------------------------------------------
+// Pipeline state objects
+//--------------------------------------------------------------------------------------
+// A pipeline state bundles the shaders and fixed-function states (from State.cpp) used to
+// draw something, so a whole rendering set-up can be selected with a single command. States
+// are created once at start-up and shared: asking for the same combination twice returns the
+// same object, so two pipelines are the same if (and only if) their pointers are equal.
+//
+// Doesn't include any Direct3D headers so it can be used with the null backend (NullBackend.h).
+
+#ifndef _PIPELINE_STATE_H_INCLUDED_
+#define _PIPELINE_STATE_H_INCLUDED_
+
+#include <cstddef>
+
+// Declared in d3d11.h, only used by pointer here
+struct ID3D11VertexShader;
+struct ID3D11PixelShader;
+struct ID3D11BlendState;
+struct ID3D11DepthStencilState;
+struct ID3D11RasterizerState;
+struct ID3D11SamplerState;
+
+// Everything that makes up a pipeline state. The input layout is not included since it belongs to the vertex
+// data - each Mesh selects the layout for its own vertex format (see GeometryCommand in CommandStream.h)
+struct PipelineDesc
+{
+    ID3D11VertexShader*      vertexShader      = nullptr;
+    ID3D11PixelShader*       pixelShader       = nullptr;
+    ID3D11BlendState*        blendState        = nullptr;
+    ID3D11DepthStencilState* depthStencilState = nullptr;
+    ID3D11RasterizerState*   rasterizerState   = nullptr;
+    ID3D11SamplerState*      sampler           = nullptr; // Pixel shader sampler in slot 0 (the texture sampler)
+
+    bool operator==(const PipelineDesc& other) const;
+};
+
+class PipelineState
+{
+public:
+    PipelineState(const PipelineDesc& pipelineDesc);
+
+    const PipelineDesc desc;
+    const size_t       hash; // Hash of the description, also useful as a sort key to group draws with the same pipeline
+};
+
+
+//--------------------------------------------------------------------------------------
+// Pipeline state creation / destruction
+//--------------------------------------------------------------------------------------
+
+// Return the pipeline state matching the description, creating it if it doesn't exist yet. Create all pipelines
+// during start-up - this function is not thread-safe so must not be called while passes are being recorded
+const PipelineState* GetPipelineState(const PipelineDesc& desc);
+
+// Delete all pipeline states, any pointers previously returned become invalid
+void ReleasePipelineStates();
+
+
+#endif //_PIPELINE_STATE_H_INCLUDED_
@@ -0,0 +1,113 @@
+//--------------------------------------------------------------------------------------
+// Range allocator - hands out ranges of a larger block, e.g. parts of a GPU buffer
+//--------------------------------------------------------------------------------------
+
+#include "RangeAllocator.h"
+
+
+// Ranges are allocated from 0 to size, in whatever units the caller uses
+RangeAllocator::RangeAllocator(uint32_t size /*= 0*/)
+{
+    Reset(size, 0);
+}
+
+
+// Find a free range of the given size. Returns false if there is no free range large enough
+bool RangeAllocator::Allocate(uint32_t size, uint32_t& offset)
+{
+    if (size == 0)  return false;
+
+    // Smallest free range that fits, leaving the larger ones for larger requests
+    auto bestFit = mFreeBySize.lower_bound(size);
+    if (bestFit == mFreeBySize.end())  return false;
+    offset = bestFit->second;
+
+    // Keep what is left over free
+    auto range = mFreeByOffset.find(offset);
+    uint32_t rangeSize = range->second;
+    RemoveFree(range);
+    if (rangeSize > size)  AddFree(offset + size, rangeSize - size);
+
+    mUsed += size;
+    return true;
+}
+
+
+// Return a range to the free space, joining it up with free neighbours
+void RangeAllocator::Free(uint32_t offset, uint32_t size)
+{
+    if (size == 0)  return;
+    mUsed -= size;
+
+    // Join with the free range after
+    auto next = mFreeByOffset.find(offset + size);
+    if (next != mFreeByOffset.end())
+    {
+        size += next->second;
+        RemoveFree(next);
+    }
+
+    // Join with the free range before
+    auto previous = mFreeByOffset.lower_bound(offset);
+    if (previous != mFreeByOffset.begin())
+    {
+        --previous;
+        if (previous->first + previous->second == offset)
+        {
+            offset = previous->first;
+            size  += previous->second;
+            RemoveFree(previous);
+        }
+    }
+
+    AddFree(offset, size);
+}
+
+
+// Make the space larger, the new space at the end is free
+void RangeAllocator::Grow(uint32_t newSize)
+{
+    if (newSize <= mSize)  return;
+    uint32_t oldSize = mSize;
+    mSize = newSize;
+    mUsed += newSize - oldSize; // Free takes it off again
+    Free(oldSize, newSize - oldSize);
+}
+
+
+// Start again with everything from 0 to used allocated and the rest free, e.g. after the contents have been packed together
+void RangeAllocator::Reset(uint32_t size, uint32_t used)
+{
+    mFreeByOffset.clear();
+    mFreeBySize.clear();
+    mSize = size;
+    mUsed = used;
+    if (used < size)  AddFree(used, size - used);
+}
+
+
+uint32_t RangeAllocator::LargestFreeRange() const
+{
+    return mFreeBySize.empty() ? 0 : mFreeBySize.rbegin()->first;
+}
+
+
+void RangeAllocator::AddFree(uint32_t offset, uint32_t size)
+{
+    mFreeByOffset[offset] = size;
+    mFreeBySize.insert({ size, offset });
+}
+
+void RangeAllocator::RemoveFree(std::map<uint32_t, uint32_t>::iterator range)
+{
+    auto sizes = mFreeBySize.equal_range(range->second);
+    for (auto bySize = sizes.first; bySize != sizes.second; ++bySize)
+    {
+        if (bySize->second == range->first)
+        {
+            mFreeBySize.erase(bySize);
+            break;
+        }
+    }
+    mFreeByOffset.erase(range);
+}
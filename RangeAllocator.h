@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------
+// Range allocator - hands out ranges of a larger block, e.g. parts of a GPU buffer
+//--------------------------------------------------------------------------------------
+// Keeps a list of the free ranges, by offset so freed ranges can be joined to their neighbours
+// and by size so the smallest free range that fits (best fit) is found quickly. Only deals with
+// offsets and sizes, the memory itself is managed elsewhere (see GeometryPool.h). Doesn't use any
+// Direct3D so it can be tested on any platform.
+
+#ifndef _RANGE_ALLOCATOR_H_INCLUDED_
+#define _RANGE_ALLOCATOR_H_INCLUDED_
+
+#include <map>
+#include <cstdint>
+
+class RangeAllocator
+{
+public:
+    // Ranges are allocated from 0 to size, in whatever units the caller uses
+    explicit RangeAllocator(uint32_t size = 0);
+
+    // Find a free range of the given size. Returns false if there is no free range large enough
+    bool Allocate(uint32_t size, uint32_t& offset);
+
+    // Return a range to the free space, joining it up with free neighbours
+    void Free(uint32_t offset, uint32_t size);
+
+    // Make the space larger, the new space at the end is free
+    void Grow(uint32_t newSize);
+
+    // Start again with everything from 0 to used allocated and the rest free, e.g. after the contents have been packed together
+    void Reset(uint32_t size, uint32_t used);
+
+    uint32_t Size() const  { return mSize; }
+    uint32_t Used() const  { return mUsed; }
+
+    // Number of separate free ranges and the largest. Many small free ranges mean the space is fragmented: there may be enough
+    // free in total but not in one piece
+    uint32_t NumFreeRanges() const  { return static_cast<uint32_t>(mFreeByOffset.size()); }
+    uint32_t LargestFreeRange() const;
+
+private:
+    void AddFree(uint32_t offset, uint32_t size);
+    void RemoveFree(std::map<uint32_t, uint32_t>::iterator range);
+
+    uint32_t mSize = 0;
+    uint32_t mUsed = 0;
+
+    std::map<uint32_t, uint32_t>      mFreeByOffset; // Offset -> size
+    std::multimap<uint32_t, uint32_t> mFreeBySize;   // Size -> offset
+};
+
+
+#endif //_RANGE_ALLOCATOR_H_INCLUDED_
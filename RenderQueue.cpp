@@ -0,0 +1,162 @@
+//--------------------------------------------------------------------------------------
+// Render queue - view depth sorting of things to draw
+//--------------------------------------------------------------------------------------
+
+#include "RenderQueue.h"
+
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RENDER_QUEUE_USE_SSE
+#endif
+
+
+//--------------------------------------------------------------------------------------
+// Render queue
+//--------------------------------------------------------------------------------------
+
+// Remove all items but keep the memory for reuse
+void RenderQueue::Clear()
+{
+    mItems.clear();
+    mBuckets.clear();
+    mX.clear();
+    mY.clear();
+    mZ.clear();
+}
+
+
+// Add an item at the given world position. Items with lower buckets come first with FrontToBack order
+void RenderQueue::Add(uint32_t index, const CVector3& worldPosition, uint16_t bucket /*= 0*/)
+{
+    mItems.push_back({ 0, index, 0.0f });
+    mBuckets.push_back(bucket);
+    mX.push_back(worldPosition.x);
+    mY.push_back(worldPosition.y);
+    mZ.push_back(worldPosition.z);
+}
+
+
+// Calculate the view-space depth of every item and sort them into the given order
+void RenderQueue::Sort(const CMatrix4x4& viewMatrix, SortOrder order)
+{
+    size_t numItems = mItems.size();
+
+    mDepths.resize(numItems);
+    CalculateViewDepths(mX.data(), mY.data(), mZ.data(), numItems, viewMatrix, mDepths.data());
+
+    for (size_t i = 0; i < numItems; ++i)
+    {
+        uint32_t depthKey = FloatToSortableInt(mDepths[i]);
+        if (order == FrontToBack)
+        {
+            mItems[i].sortKey = (static_cast<uint64_t>(mBuckets[i]) << 32) | depthKey;
+        }
+        else
+        {
+            mItems[i].sortKey = ~depthKey; // Reverse the depth order
+        }
+        mItems[i].depth = mDepths[i];
+    }
+
+    RadixSort(mItems, mScratch);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions
+//--------------------------------------------------------------------------------------
+
+// Calculate view-space depths for count points given as separate x, y, z arrays. Uses SSE where available
+// The depth is the z component of the point transformed by the view matrix (DirectX style, so row 3 is the translation)
+void CalculateViewDepths(const float* x, const float* y, const float* z, size_t count, const CMatrix4x4& viewMatrix, float* depths)
+{
+    size_t i = 0;
+
+#ifdef RENDER_QUEUE_USE_SSE
+    // Four points at a time
+    __m128 mx = _mm_set1_ps(viewMatrix.e02);
+    __m128 my = _mm_set1_ps(viewMatrix.e12);
+    __m128 mz = _mm_set1_ps(viewMatrix.e22);
+    __m128 mw = _mm_set1_ps(viewMatrix.e32);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 depth = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x + i), mx), mw);
+        depth = _mm_add_ps(depth, _mm_mul_ps(_mm_loadu_ps(y + i), my));
+        depth = _mm_add_ps(depth, _mm_mul_ps(_mm_loadu_ps(z + i), mz));
+        _mm_storeu_ps(depths + i, depth);
+    }
+#endif
+
+    // Remaining points (or all of them without SSE)
+    for (; i < count; ++i)
+    {
+        depths[i] = x[i] * viewMatrix.e02 + viewMatrix.e32 + y[i] * viewMatrix.e12 + z[i] * viewMatrix.e22;
+    }
+}
+
+
+// Convert a float to an unsigned integer that sorts in the same order (including negative values)
+// Positive floats sort correctly as integers once the sign bit is set. Negative floats sort in reverse, so flip all their bits
+uint32_t FloatToSortableInt(float value)
+{
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+
+// Sort items by their sortKey, smallest first. Stable, scratch is used as temporary space
+// Least-significant-digit radix sort, one byte of the key per pass. Passes where every key has the same byte
+// are skipped, so keys that only use some of their bits (e.g. no buckets) cost less
+void RadixSort(std::vector<RenderItem>& items, std::vector<RenderItem>& scratch)
+{
+    size_t numItems = items.size();
+    if (numItems < 2)  return;
+    scratch.resize(numItems);
+
+    // Count all byte values for every pass in one read of the keys
+    const int NUM_PASSES = 8;
+    static_assert(sizeof(RenderItem::sortKey) == NUM_PASSES, "One pass per byte of the key");
+    size_t counts[NUM_PASSES][256] = {};
+    for (auto& item : items)
+    {
+        for (int pass = 0; pass < NUM_PASSES; ++pass)
+        {
+            ++counts[pass][(item.sortKey >> (pass * 8)) & 0xff];
+        }
+    }
+
+    RenderItem* source = items.data();
+    RenderItem* dest   = scratch.data();
+    for (int pass = 0; pass < NUM_PASSES; ++pass)
+    {
+        size_t* passCounts = counts[pass];
+        int shift = pass * 8;
+
+        // Skip the pass if all keys have the same value in this byte
+        if (passCounts[(source[0].sortKey >> shift) & 0xff] == numItems)  continue;
+
+        // Convert counts to starting offsets
+        size_t offset = 0;
+        for (int value = 0; value < 256; ++value)
+        {
+            size_t count = passCounts[value];
+            passCounts[value] = offset;
+            offset += count;
+        }
+
+        for (size_t i = 0; i < numItems; ++i)
+        {
+            dest[passCounts[(source[i].sortKey >> shift) & 0xff]++] = source[i];
+        }
+
+        RenderItem* temp = source;
+        source = dest;
+        dest = temp;
+    }
+
+    // Result may have finished in the scratch space
+    if (source != items.data())  items.swap(scratch);
+}
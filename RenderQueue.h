@@ -0,0 +1,77 @@
+//--------------------------------------------------------------------------------------
+// Render queue - view depth sorting of things to draw
+//--------------------------------------------------------------------------------------
+// Items are added with their world position, then the queue calculates the view-space depth
+// of every item and sorts them. Opaque items are drawn nearest first so the depth test rejects
+// as many hidden pixels as possible, grouped by a bucket number (e.g. the pipeline) to avoid
+// changing state for every item. Transparent items are drawn furthest first so they blend
+// correctly over each other.
+//
+// Depths are calculated four at a time with SSE and sorted with a radix sort, so the cost grows
+// linearly with the number of items. Doesn't use any Direct3D so it can be profiled on any platform.
+
+#ifndef _RENDER_QUEUE_H_INCLUDED_
+#define _RENDER_QUEUE_H_INCLUDED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// One thing to draw
+struct RenderItem
+{
+    uint64_t sortKey;
+    uint32_t index;   // Identifies the item to the caller, e.g. index into the scene's model list
+    float    depth;   // View-space depth, calculated by RenderQueue::Sort
+};
+
+class RenderQueue
+{
+public:
+    enum SortOrder
+    {
+        FrontToBack, // Sorted by bucket, then nearest first within each bucket
+        BackToFront, // Furthest first, buckets are ignored
+    };
+
+    // Remove all items but keep the memory for reuse
+    void Clear();
+
+    // Add an item at the given world position. Items with lower buckets come first with FrontToBack order
+    void Add(uint32_t index, const CVector3& worldPosition, uint16_t bucket = 0);
+
+    // Calculate the view-space depth of every item and sort them into the given order
+    void Sort(const CMatrix4x4& viewMatrix, SortOrder order);
+
+    const std::vector<RenderItem>& Items() const  { return mItems; }
+    size_t Size() const  { return mItems.size(); }
+
+private:
+    std::vector<RenderItem> mItems;
+    std::vector<RenderItem> mScratch;  // Temporary space for the radix sort
+    std::vector<uint16_t>   mBuckets;
+
+    // Item world positions, stored as separate arrays of x, y and z to calculate depths four at a time
+    std::vector<float> mX, mY, mZ;
+    std::vector<float> mDepths;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Helper functions (used by the queue, available for other sorting)
+//--------------------------------------------------------------------------------------
+
+// Calculate view-space depths for count points given as separate x, y, z arrays. Uses SSE where available
+void CalculateViewDepths(const float* x, const float* y, const float* z, size_t count, const CMatrix4x4& viewMatrix, float* depths);
+
+// Convert a float to an unsigned integer that sorts in the same order (including negative values)
+uint32_t FloatToSortableInt(float value);
+
+// Sort items by their sortKey, smallest first. Stable, scratch is used as temporary space
+void RadixSort(std::vector<RenderItem>& items, std::vector<RenderItem>& scratch);
+
+
+#endif //_RENDER_QUEUE_H_INCLUDED_
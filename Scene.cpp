@@ -5,6 +5,7 @@
 
 #include "Scene.h"
 #include "Mesh.h"
+#include "MeshManager.h"
 #include "Model.h"
 #include "Camera.h"
 #include "State.h"
@@ -12,6 +13,14 @@
 #include "Input.h"
 #include "Common.h"
 #include "Light.h"
+#include "PassRecorder.h"
+#include "PipelineState.h"
+#include "RenderQueue.h"
+#include "LightClusters.h"
+#include "ObjectLights.h"
+#include "LightAnimation.h"
+#include "StructuredBuffer.h"
+#include "GpuTimer.h"
 
 #include "CVector2.h" 
 #include "CVector3.h" 
@@ -25,6 +34,10 @@
 
 #include <sstream>
 #include <memory>
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cstring>
 
 
 //--------------------------------------------------------------------------------------
@@ -69,17 +82,28 @@ const float MOVEMENT_SPEED = 50.0f; // 50 units per second for movement (what a
 
 
 // Meshes, models and cameras, same meaning as TL-Engine. Meshes prepared in InitGeometry function, Models & camera in InitScene
-Mesh* gTeapotMesh;
-Mesh* gCrateMesh;
-Mesh* gGroundMesh;
-Mesh* gLightMesh;
-Mesh* gSphereMesh;
-Mesh* gTangentSphereMesh;
-Mesh* gCubeMesh;
-Mesh* gTangentCubeMesh;
-Mesh* gQuadMesh;
-Mesh* gBuildingMesh;
-Mesh* gHillMesh;
+MeshHandle gTeapotMesh;
+MeshHandle gCrateMesh;
+MeshHandle gGroundMesh;
+MeshHandle gLightMesh;
+MeshHandle gSphereMesh;
+MeshHandle gTangentSphereMesh;
+MeshHandle gCubeMesh;
+MeshHandle gTangentCubeMesh;
+MeshHandle gQuadMesh;
+MeshHandle gBuildingMesh;
+MeshHandle gHillMesh;
+
+// All the meshes' vertices and indices, in one vertex buffer per vertex format and one index buffer (see GeometryPool.h).
+// The pool is packed together again when freed meshes have left this many gaps in it
+GeometryPool gGeometryPool;
+const uint32_t GEOMETRY_DEFRAGMENT_GAPS = 8;
+
+// Imports each mesh file once in the background and shares the meshes made from it. No more than this many bytes of mesh
+// data are copied to the GPU each frame, so loading doesn't cause frame time spikes
+MeshManager gMeshManager(gGeometryPool);
+const uint32_t MESH_UPLOAD_BYTES_PER_FRAME = 1024 * 1024;
+bool gMeshReportShown = false;
 
 const int NUM_MODELS = 42;
 SceneModel* gModels[NUM_MODELS];
@@ -119,18 +143,22 @@ SceneModel gWiggleTeapot = SceneModel(&gPatternTexture);         // 41
 Camera* gCamera;
 
 // Lights
-const int NUM_SPOTLIGHTS = 3;
+const int NUM_SPOTLIGHTS = 2;
 const int MAX_SPOTLIGHTS = 15;
 
-const int NUM_POINTLIGHTS = 4;
-const int MAX_POINTLIGHTS = 25;
+const int NUM_POINTLIGHTS = 4; // No maximum, point lights are clustered (see below)
 
-const int NUM_LIGHTS = NUM_SPOTLIGHTS + NUM_POINTLIGHTS;
+const int NUM_LIGHTS = NUM_SPOTLIGHTS + NUM_POINTLIGHTS + 1; // Plus the directional light
 
 Light* gLights[NUM_LIGHTS];
 Spotlight gSpotlights[NUM_SPOTLIGHTS];
+int gNumVisibleSpotlights = 0; // Spotlights that may light something on screen this frame, the ones the shaders loop over
+DirectionalLight gDirectionalLight; // Sun-like light over the whole scene with cascaded shadows (see ShadowCascades.h)
 Pointlight gPointlights[NUM_POINTLIGHTS];
 
+// Flickering and colour changing of all the animated lights, including the swarm below (see LightAnimation.h)
+LightAnimation gLightAnimation;
+
 CVector3 gAmbientColour = { 0.01f, 0.1f, 0.25f }; // Background level of light (slightly bluish to match the far background, which is dark blue)
 float    gSpecularPower = 256; // Specular power controls shininess - same for all models in this app
 
@@ -140,6 +168,324 @@ ColourRGBA gBackgroundColor = { 0.2f, 0.2f, 0.3f, 1.0f };
 const float gLightOrbit = 20.0f;
 const float gLightOrbitSpeed = 0.7f;
 
+// Press 4 to add a swarm of small point lights circling around the scene. They have no models, they are
+// only there to show the clustered lighting copes with thousands of lights. They all slowly change colour
+const int NUM_SWARM_LIGHTS = 2000;
+const float SWARM_LIGHT_STRENGTH = 0.2f;
+struct SwarmLight
+{
+    CVector3 centre;
+    float    orbitRadius;
+    float    orbitSpeed;  // Radians per second
+    float    angle;
+    uint32_t animation;   // Index in gLightAnimation
+    CVector3 intensity;   // Colour and strength, see Pointlight::Intensity. Updated when the animation changes
+    float    radius;      // Influence radius for the intensity
+};
+SwarmLight gSwarmLights[NUM_SWARM_LIGHTS];
+uint32_t gFirstSwarmAnimation = 0; // The swarm's lights are together in gLightAnimation, in the same order
+bool gShowSwarm = false;
+
+
+//--------------------------------------------------------------------------------------
+// Shadow atlas
+//--------------------------------------------------------------------------------------
+// The spotlights render their shadow and colour maps into regions of two shared textures (see ShadowAtlas.h) rather than
+// each having its own full size textures. Each light's region is sized by how much of the screen its shadows cover
+// The directional light's shadow cascades also have a region each, after the spotlights'
+
+const uint32_t SHADOW_ATLAS_SIZE   = 4096;
+const uint32_t MIN_SHADOW_MAP_SIZE = 256;
+const uint32_t MAX_SHADOW_MAP_SIZE = 2048;
+
+// Every cascade covers a similar area of the screen, so they all get the same fixed share of the atlas
+const float SHADOW_CASCADE_IMPORTANCE = 0.5f;
+const int   NUM_SHADOW_MAPS = NUM_SPOTLIGHTS + MAX_SHADOW_CASCADES;
+
+// Size of the separate shadow maps each light used to have, to show the memory saved by the atlas
+const uint32_t SEPARATE_SHADOW_MAP_SIZE = 4096;
+
+ShadowAtlas gShadowAtlas(SHADOW_ATLAS_SIZE, MIN_SHADOW_MAP_SIZE, MAX_SHADOW_MAP_SIZE);
+
+ID3D11Texture2D*          gShadowAtlasTexture      = nullptr; // Depth of the scene from each light
+ID3D11DepthStencilView*   gShadowAtlasDepthStencil = nullptr;
+ID3D11ShaderResourceView* gShadowAtlasSRV          = nullptr;
+ID3D11Texture2D*          gColourAtlasTexture      = nullptr; // Colour of the transparent objects each light shines through
+ID3D11RenderTargetView*   gColourAtlasRenderTarget = nullptr;
+ID3D11ShaderResourceView* gColourAtlasSRV          = nullptr;
+
+// Static shadow cache (see Spotlight in Light.h) - the shadows of models that don't move, laid out the same as the atlas
+// and copied into it at the start of each frame. Press 6 to switch the cache off and draw every model into the shadow
+// maps each frame, to compare frame times
+ID3D11Texture2D*        gShadowCacheTexture      = nullptr;
+ID3D11DepthStencilView* gShadowCacheDepthStencil = nullptr;
+ID3D11Texture2D*        gColourCacheTexture      = nullptr;
+ID3D11RenderTargetView* gColourCacheRenderTarget = nullptr;
+bool gCacheShadows = true;
+
+// Changes whenever a static model moves, so the lights rebuild their caches. Each static model's world matrix, render
+// mode and level of detail from last frame are kept to spot changes
+unsigned int            gStaticModelsVersion = 0;
+std::vector<CMatrix4x4> gStaticModelMatrices;
+std::vector<RenderMode> gStaticModelModes;
+std::vector<int>        gStaticModelLods;
+unsigned int            gStaticMeshesLoaded = 0; // Mesh manager's loaded version, meshes loading in change shape
+
+// Shadow draws of static models skipped last frame because they were already in the cache
+int gCachedShadowDraws = 0;
+
+
+//--------------------------------------------------------------------------------------
+// Clustered point lights
+//--------------------------------------------------------------------------------------
+// Each frame the point lights are assigned to clusters of the camera's view frustum (see LightClusters.h) and the
+// lights and cluster lists are sent to the GPU in structured buffers. Pixel shaders only use the lights in their cluster
+
+LightClusters gLightClusters;
+
+StructuredBuffer* gPointlightBuffer       = nullptr; // Every point light this frame (PointlightBuffer)
+StructuredBuffer* gLightClusterBuffer     = nullptr; // Offset and count of each cluster's lights (LightCluster)
+StructuredBuffer* gClusterLightListBuffer = nullptr; // Light indices for all the clusters (uint32_t)
+
+// Press 5 to switch to per-object light lists instead (see ObjectLights.h). Each model is given its most influential
+// point lights in its per-model constants and the shaders only use those
+bool gUseObjectLights = false;
+ObjectLights gObjectLights;
+
+// This frame's point lights, kept between frames to reuse the memory
+std::vector<PointlightBuffer> gPointlightData;
+std::vector<CVector3>         gPointlightPositions;
+std::vector<float>            gPointlightRadii;
+std::vector<float>            gPointlightLuminances;
+
+// Model bounding spheres for choosing per-object lights
+std::vector<CVector3> gModelCentres;
+std::vector<float>    gModelRadii;
+
+
+//--------------------------------------------------------------------------------------
+// Pass recording
+//--------------------------------------------------------------------------------------
+// Shadow map passes and slices of the main scene are recorded on worker threads then submitted in order
+// Press 2 to switch between multithreaded and serial recording to compare frame times
+
+const int NUM_OPAQUE_SLICES = 3; // Number of slices the opaque part of the main scene is split into
+
+PassRecorder* gPassRecorder = nullptr; // The recorder used this frame, one of the two below
+DeferredPassRecorder*  gDeferredPassRecorder  = nullptr;
+ImmediatePassRecorder* gImmediatePassRecorder = nullptr;
+bool gMultithreadedRecording = true;
+
+// Press 3 to switch the depth pre-pass on and off. When on, the depth of all opaque models is rendered first (nearest first)
+// so the lighting pixel shaders only run once per visible pixel instead of for every overlapping model
+bool gDepthPrePass = true;
+
+// GPU timestamps written between the passes each frame (see GpuTimer.h)
+enum GpuTimestamp
+{
+    TimestampShadowsStart,  // Before the spotlights' shadow passes
+    TimestampSpotlightsEnd, // After the spotlights' shadow passes, before the cascades
+    TimestampMainStart,     // Before the depth pre-pass, or the opaque models without it
+    TimestampPrePassEnd,    // After the depth pre-pass, written even without it
+    TimestampOpaqueEnd,     // After the opaque models
+
+    NumGpuTimestamps
+};
+GpuTimer* gGpuTimer = nullptr;
+
+// The GPU times arrive a few frames late, so the settings of recent frames are kept to know what was being timed
+struct FrameSettings
+{
+    bool depthPrePass;
+    bool cacheShadows;
+};
+const int NUM_RECENT_FRAMES = 8;
+FrameSettings gRecentFrames[NUM_RECENT_FRAMES];
+
+// GPU time of the depth pre-pass and opaque models together, averaged over recent frames, without the pre-pass [0] and
+// with it [1]. Both are shown once the pre-pass has been switched off and on, to give the time it saves
+float gOpaqueGpuTime[2] = { 0, 0 };
+
+// GPU time of the spotlights' shadow passes, averaged over recent frames, without the static shadow cache [0] and with it [1]
+// (including the frames rebuilding a light's cache and copying the cache into the atlas)
+float gSpotlightShadowGpuTime[2] = { 0, 0 };
+
+// Press 8 to switch cluster culling on and off. When on, the parts of large meshes that are off screen or face away from the
+// camera are skipped (see MeshClusters.h)
+bool gClusterCulling = true;
+
+// Variant of the lighting pixel shaders used this frame, the smallest that covers the lights and features in use (see
+// ShaderPermutations.h). Press 7 to switch the parallax mapping between a single offset and several refining steps
+ShaderPermutation gShaderPermutation;
+bool gParallaxSteps = false;
+
+// Models to draw this frame sorted by view depth (see RenderQueue.h). Filled before any passes are added and
+// only read while passes are being recorded, the main thread doesn't change them again until after Submit
+RenderQueue gOpaqueQueue;       // Grouped by render mode, nearest first within each mode
+RenderQueue gTransparentQueue;  // Furthest first
+RenderQueue gDepthPrePassQueue; // Nearest first
+
+
+//--------------------------------------------------------------------------------------
+// Render modes
+//--------------------------------------------------------------------------------------
+// How each render mode (see Scene.h) is drawn. Shaders and states are only created at start-up, so the table
+// refers to the global variables that will hold them. CreateRenderModes turns it into pipeline states.
+// Opaque modes are drawn in table order (nearest first within each mode), then all transparent models furthest first.
+// Modes not in the table (None) are never drawn
+
+enum ShadowType
+{
+    NoShadow,
+    DepthShadow,  // Drawn into the light's shadow map
+    ColourShadow, // Drawn into the light's colour map, tinting the light that passes through
+};
+
+struct RenderModeDesc
+{
+    RenderMode                mode;
+    bool                      transparent;
+    int                       textures; // ModelTextures flags
+    ID3D11VertexShader**      vertexShader;
+    ID3D11PixelShader**       pixelShader;
+    ID3D11BlendState**        blendState;
+    ID3D11DepthStencilState** depthStencilState;
+    ID3D11RasterizerState**   rasterizerState;
+    ID3D11SamplerState**      sampler;
+    ShadowType                shadow;
+    ID3D11VertexShader**      depthVertexShader; // Used for shadows and the depth pre-pass, must give exactly the same positions as the main vertex shader
+};
+
+const RenderModeDesc RENDER_MODE_TABLE[] =
+{
+    // Opaque models - no blending, normal depth buffer and culling (except cube maps which are seen from inside)
+    { Default,         false, UsesDiffuseMap,                     &gDefaultVertexShader,       &gDefaultPixelShader,         &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, DepthShadow, &gBasicTransformVertexShader },
+    { Bright,          false, UsesDiffuseMap,                     &gDefaultVertexShader,       &gBrightPixelShader,          &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, DepthShadow, &gBasicTransformVertexShader },
+    { TextureFade,     false, UsesDiffuseMap | UsesSecondTexture, &gDefaultVertexShader,       &gTexFadePixelShader,         &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, DepthShadow, &gBasicTransformVertexShader },
+    { TextureGradient, false, UsesDiffuseMap | UsesSecondTexture, &gDefaultVertexShader,       &gTextureGradientPixelShader, &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, DepthShadow, &gBasicTransformVertexShader },
+    { TexGradientNS,   false, UsesDiffuseMap | UsesSecondTexture, &gDefaultVertexShader,       &gTextureGradientPixelShader, &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, NoShadow,    &gBasicTransformVertexShader },
+    { Wiggle,          false, UsesDiffuseMap,                     &gWiggleVertexShader,        &gWigglePixelShader,          &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, DepthShadow, &gWiggleVertexShader },
+    { NormalMap,       false, UsesDiffuseMap | UsesNormalMap,      &gNormalMappingVertexShader, &gNormalMappingPixelShader,   &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, DepthShadow, &gBasicTransformVertexShader },
+    { ParallaxMap,     false, UsesDiffuseMap | UsesNormalMap,      &gNormalMappingVertexShader, &gParallaxMappingPixelShader, &gNoBlendingState, &gUseDepthBufferState, &gCullBackState, &gAnisotropic4xSampler, DepthShadow, &gBasicTransformVertexShader },
+    { CubeMap,         false, UsesDiffuseMap,                     &gDefaultVertexShader,       &gCubeMapPixelShader,         &gNoBlendingState, &gUseDepthBufferState, &gCullNoneState, &gCubeMapSampler,       DepthShadow, &gBasicTransformVertexShader },
+    { CubeMapLight,    false, UsesDiffuseMap,                     &gDefaultVertexShader,       &gCubeMapLightPixelShader,    &gNoBlendingState, &gUseDepthBufferState, &gCullNoneState, &gCubeMapSampler,       DepthShadow, &gBasicTransformVertexShader },
+    { CubeMapAnimated, false, UsesDiffuseMap | UsesSecondTexture, &gDefaultVertexShader,       &gCubeMapAnimatedPixelShader, &gNoBlendingState, &gUseDepthBufferState, &gCullNoneState, &gCubeMapSampler,       NoShadow,    &gBasicTransformVertexShader },
+
+    // Transparent models - read-only depth buffer and no culling (standard set-up for blending). Drawn after the light models
+    { AddBlend,        true,  UsesDiffuseMap, &gBasicTransformVertexShader, &gAlphaPixelShader,         &gAdditiveBlendingState,       &gDepthReadOnlyState, &gCullNoneState, &gAnisotropic4xSampler, NoShadow,     nullptr },
+    { AlphBlend,       true,  UsesDiffuseMap, &gBasicTransformVertexShader, &gAlphaPixelShader,         &gAlphaBlendingState,          &gDepthReadOnlyState, &gCullNoneState, &gAnisotropic4xSampler, NoShadow,     nullptr },
+    { MultBlend,       true,  UsesDiffuseMap, &gBasicTransformVertexShader, &gAlphaPixelShader,         &gMultiplicativeBlendingState, &gDepthReadOnlyState, &gCullNoneState, &gAnisotropic4xSampler, NoShadow,     nullptr },
+    { AddBlendLight,   true,  UsesDiffuseMap, &gDefaultVertexShader,        &gAlphaLightingPixelShader, &gAdditiveBlendingState,       &gDepthReadOnlyState, &gCullNoneState, &gAnisotropic4xSampler, ColourShadow, &gBasicTransformVertexShader },
+    { Ghost,           true,  UsesDiffuseMap, &gDefaultVertexShader,        &gAlphaLightingPixelShader, &gAdditiveBlendingState,       &gDepthReadOnlyState, &gCullNoneState, &gAnisotropic4xSampler, NoShadow,     nullptr },
+};
+const int NUM_RENDER_MODE_TABLE = sizeof(RENDER_MODE_TABLE) / sizeof(RENDER_MODE_TABLE[0]);
+
+RenderModeInfo gRenderModes[NumRenderModes];
+
+// The light models aren't SceneModels so they have their own pipeline
+const PipelineState* gLightModelPipeline = nullptr;
+
+// Clears the viewport's area of the current depth buffer and render target (see Scene.h)
+const PipelineState* gShadowClearPipeline = nullptr;
+
+
+// Create the pipeline states for each render mode from the table above, call after the shaders and states are created
+void CreateRenderModes()
+{
+    for (int i = 0; i < NUM_RENDER_MODE_TABLE; ++i)
+    {
+        const RenderModeDesc& desc = RENDER_MODE_TABLE[i];
+        RenderModeInfo& info = gRenderModes[desc.mode];
+
+        info.transparent = desc.transparent;
+        info.textures    = desc.textures;
+        info.order       = static_cast<uint16_t>(i);
+
+        // Modes whose depth shader is the basic transform draw the mesh where it is, so its cluster bounds hold
+        info.clusterCulling   = !desc.transparent && desc.depthVertexShader == &gBasicTransformVertexShader;
+        info.clusterBackFaces = info.clusterCulling && desc.rasterizerState == &gCullBackState;
+
+        PipelineDesc pipeline;
+        pipeline.vertexShader      = *desc.vertexShader;
+        pipeline.pixelShader       = *desc.pixelShader;
+        pipeline.blendState        = *desc.blendState;
+        pipeline.depthStencilState = *desc.depthStencilState;
+        pipeline.rasterizerState   = *desc.rasterizerState;
+        pipeline.sampler           = *desc.sampler;
+        info.pipeline = GetPipelineState(pipeline);
+
+        // The same pipeline with each variant of the pixel shader. Shaders without variants get the same pipeline throughout
+        for (int p = 0; p < NUM_SHADER_PERMUTATIONS; ++p)
+        {
+            PipelineDesc permutationPipeline = pipeline;
+            permutationPipeline.pixelShader = GetPixelShaderPermutation(*desc.pixelShader, PermutationFromIndex(p));
+            info.permutationPipelines[p] = GetPipelineState(permutationPipeline);
+            if (!desc.transparent)
+            {
+                permutationPipeline.depthStencilState = gDepthEqualState;
+                info.permutationDepthEqualPipelines[p] = GetPipelineState(permutationPipeline);
+            }
+        }
+
+        // Shadow maps only need depth - depth-only pixel shader, no blending and front face culling to reduce self-shadowing
+        // Colour maps multiply together the colour of every transparent object the light passes through
+        PipelineDesc shadowPipeline;
+        shadowPipeline.vertexShader = desc.shadow != NoShadow ? *desc.depthVertexShader : nullptr;
+        if (desc.shadow == DepthShadow)
+        {
+            shadowPipeline.pixelShader       = gDepthOnlyPixelShader;
+            shadowPipeline.blendState        = gNoBlendingState;
+            shadowPipeline.depthStencilState = gUseDepthBufferState;
+            shadowPipeline.rasterizerState   = gCullFrontState;
+            info.shadowPipeline = GetPipelineState(shadowPipeline);
+        }
+        else if (desc.shadow == ColourShadow)
+        {
+            shadowPipeline.pixelShader       = gAlphaPixelShader;
+            shadowPipeline.blendState        = gMultiplicativeBlendingState;
+            shadowPipeline.depthStencilState = gDepthReadOnlyState;
+            shadowPipeline.rasterizerState   = gCullNoneState;
+            info.shadowPipeline = GetPipelineState(shadowPipeline);
+            info.colouredShadow = true;
+        }
+
+        // The depth pre-pass renders opaque models with their own culling but no shading. The main pass then uses a depth
+        // test for equality with the pre-pass, which requires the depth vertex shader to calculate identical positions
+        if (!desc.transparent)
+        {
+            PipelineDesc depthPipeline;
+            depthPipeline.vertexShader      = *desc.depthVertexShader;
+            depthPipeline.pixelShader       = gDepthOnlyPixelShader;
+            depthPipeline.blendState        = gNoBlendingState;
+            depthPipeline.depthStencilState = gUseDepthBufferState;
+            depthPipeline.rasterizerState   = *desc.rasterizerState;
+            info.depthOnlyPipeline = GetPipelineState(depthPipeline);
+
+            pipeline.depthStencilState = gDepthEqualState;
+            info.depthEqualPipeline = GetPipelineState(pipeline);
+        }
+    }
+
+    // Light models - additive blending, read-only depth buffer and no culling
+    PipelineDesc lightPipeline;
+    lightPipeline.vertexShader      = gBasicTransformVertexShader;
+    lightPipeline.pixelShader       = gLightModelPixelShader;
+    lightPipeline.blendState        = gAdditiveBlendingState;
+    lightPipeline.depthStencilState = gDepthReadOnlyState;
+    lightPipeline.rasterizerState   = gCullNoneState;
+    lightPipeline.sampler           = gAnisotropic4xSampler;
+    gLightModelPipeline = GetPipelineState(lightPipeline);
+
+    // Shadow region clear - a triangle over the viewport that writes the far depth and white whatever is already there
+    PipelineDesc clearPipeline;
+    clearPipeline.vertexShader      = gShadowClearVertexShader;
+    clearPipeline.pixelShader       = gShadowClearPixelShader;
+    clearPipeline.blendState        = gNoBlendingState;
+    clearPipeline.depthStencilState = gDepthAlwaysState;
+    clearPipeline.rasterizerState   = gCullNoneState;
+    gShadowClearPipeline = GetPipelineState(clearPipeline);
+}
+
 
 //--------------------------------------------------------------------------------------
 // Constant Buffers
@@ -164,40 +510,34 @@ ID3D11Buffer*     gPerModelConstantBuffer; // --"--
 // Returns true on success
 bool InitGeometry()
 {
-    // Load mesh geometry data, just like TL-Engine this doesn't create anything in the scene. Create a Model for that.
-    // IMPORTANT NOTE: Will only keep the first object from the mesh - multipart objects will have parts missing - see later lab for more robust loader
-    try 
-    {
-        gTeapotMesh         = new Mesh("Teapot.x");
-        gCrateMesh          = new Mesh("CargoContainer.x");
-        gGroundMesh         = new Mesh("Ground.x", true);
-        gLightMesh          = new Mesh("Light.x");
-        gSphereMesh         = new Mesh("Sphere.x");
-        gTangentSphereMesh  = new Mesh("Sphere.x", true);
-        gCubeMesh           = new Mesh("Cube.x");
-        gTangentCubeMesh    = new Mesh("Cube.x", true);
-        gQuadMesh           = new Mesh("Portal.x");
-        gBuildingMesh       = new Mesh("Building03.x");
-        gHillMesh           = new Mesh("Hills.x");
-    }
-    catch (std::runtime_error e)  // Constructors cannot return error messages so use exceptions to catch mesh errors (fairly standard approach this)
-    {
-        gLastError = e.what(); // This picks up the error message put in the exception (see Mesh.cpp)
-        return false;
-    }
+    // Start loading mesh geometry data, just like TL-Engine this doesn't create anything in the scene. Create a Model for that.
+    // Multipart objects are loaded into one mesh with a draw range for each part (see Mesh.h). The meshes are loaded in the
+    // background (see MeshManager.h) and appear over the first few frames, errors are shown in Visual Studio's output window
+    gMeshManager.SetCompressVertices(true);
+    gTeapotMesh         = gMeshManager.Load("Teapot.x");
+    gCrateMesh          = gMeshManager.Load("CargoContainer.x");
+    gGroundMesh         = gMeshManager.Load("Ground.x", true);
+    gLightMesh          = gMeshManager.Load("Light.x");
+    gSphereMesh         = gMeshManager.Load("Sphere.x");
+    gTangentSphereMesh  = gMeshManager.Load("Sphere.x", true);
+    gCubeMesh           = gMeshManager.Load("Cube.x");
+    gTangentCubeMesh    = gMeshManager.Load("Cube.x", true);
+    gQuadMesh           = gMeshManager.Load("Portal.x");
+    gBuildingMesh       = gMeshManager.Load("Building03.x");
+    gHillMesh           = gMeshManager.Load("Hills.x");
 
 
     // Load the shaders required for the geometry we will use (see Shader.cpp / .h)
     if (!LoadShaders())
     {
-        gLastError = "Error loading shaders";
+        if (gLastError.empty())  gLastError = "Error loading shaders"; // Keep the compiler's error if there is one
         return false;
     }
 
-    // Create shadow map textures
+    // Create the shadow atlas texture shared by all the spotlights' shadow maps
     D3D11_TEXTURE2D_DESC textureDesc = {};
-    textureDesc.Width = gSpotlights[0].shadowMapSize; // Size of the shadow map determines quality / resolution of shadows
-    textureDesc.Height = gSpotlights[0].shadowMapSize;
+    textureDesc.Width = SHADOW_ATLAS_SIZE; // Size of each light's region of the atlas determines quality / resolution of its shadows
+    textureDesc.Height = SHADOW_ATLAS_SIZE;
     textureDesc.MipLevels = 1; // 1 level, means just the main texture, no additional mip-maps. Usually don't use mip-maps when rendering to textures (or we would have to render every level)
     textureDesc.ArraySize = 1;
     textureDesc.Format = DXGI_FORMAT_R32_TYPELESS; // The shadow map contains a single 32-bit value [tech gotcha: have to say typeless because depth buffer and shaders see things slightly differently]
@@ -207,13 +547,11 @@ bool InitGeometry()
     textureDesc.BindFlags = D3D10_BIND_DEPTH_STENCIL | D3D10_BIND_SHADER_RESOURCE; // Indicate we will use texture as a depth buffer and also pass it to shaders
     textureDesc.CPUAccessFlags = 0;
     textureDesc.MiscFlags = 0;
-    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gShadowAtlasTexture)) ||
+        FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gShadowCacheTexture)))
     {
-        if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gSpotlights[i].shadowMapTexture)))
-        {
-            gLastError = "Error creating shadow map texture";
-            return false;
-        }
+        gLastError = "Error creating shadow atlas texture";
+        return false;
     }
 
     // Create the depth stencil view, i.e. indicate that the texture just created is to be used as a depth buffer
@@ -222,13 +560,11 @@ bool InitGeometry()
     dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
     dsvDesc.Texture2D.MipSlice = 0;
     dsvDesc.Flags = 0;
-    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    if (FAILED(gD3DDevice->CreateDepthStencilView(gShadowAtlasTexture, &dsvDesc, &gShadowAtlasDepthStencil)) ||
+        FAILED(gD3DDevice->CreateDepthStencilView(gShadowCacheTexture, &dsvDesc, &gShadowCacheDepthStencil)))
     {
-        if (FAILED(gD3DDevice->CreateDepthStencilView(gSpotlights[i].shadowMapTexture, &dsvDesc, &gSpotlights[i].shadowMapDepthStencil)))
-        {
-            gLastError = "Error creating shadow map depth stencil view";
-            return false;
-        }
+        gLastError = "Error creating shadow atlas depth stencil view";
+        return false;
     }
 
     // We also need to send this texture (resource) to the shaders. To do that we must create a shader-resource "view"
@@ -238,41 +574,34 @@ bool InitGeometry()
     srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
     srvDesc.Texture2D.MostDetailedMip = 0;
     srvDesc.Texture2D.MipLevels = 1;
-    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    if (FAILED(gD3DDevice->CreateShaderResourceView(gShadowAtlasTexture, &srvDesc, &gShadowAtlasSRV)))
     {
-        if (FAILED(gD3DDevice->CreateShaderResourceView(gSpotlights[i].shadowMapTexture, &srvDesc, &gSpotlights[i].shadowMapSRV)))
-        {
-            gLastError = "Error creating shadow map shader resource view";
-            return false;
-        }
+        gLastError = "Error creating shadow atlas shader resource view";
+        return false;
     }
 
-    // Colour maps
+    // Colour maps, arranged in the same way as the shadow maps
     textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
     textureDesc.BindFlags = D3D10_BIND_RENDER_TARGET | D3D10_BIND_SHADER_RESOURCE; // IMPORTANT: Indicate we will use texture as render target, and pass it to shaders
-    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gColourAtlasTexture)) ||
+        FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gColourCacheTexture)))
     {
-        if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, NULL, &gSpotlights[i].colourMapTexture)))
-        {
-            gLastError = "Error creating shadow map texture";
-            return false;
-        }
+        gLastError = "Error creating colour atlas texture";
+        return false;
+    }
 
-        if (FAILED(gD3DDevice->CreateRenderTargetView(gSpotlights[i].colourMapTexture, NULL, &gSpotlights[i].colourMapRenderTarget)))
-        {
-            gLastError = "Error creating colour map render target view";
-            return false;
-        }
+    if (FAILED(gD3DDevice->CreateRenderTargetView(gColourAtlasTexture, NULL, &gColourAtlasRenderTarget)) ||
+        FAILED(gD3DDevice->CreateRenderTargetView(gColourCacheTexture, NULL, &gColourCacheRenderTarget)))
+    {
+        gLastError = "Error creating colour atlas render target view";
+        return false;
     }
 
     srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    if (FAILED(gD3DDevice->CreateShaderResourceView(gColourAtlasTexture, &srvDesc, &gColourAtlasSRV)))
     {
-        if (FAILED(gD3DDevice->CreateShaderResourceView(gSpotlights[i].colourMapTexture, &srvDesc, &gSpotlights[i].colourMapSRV)))
-        {
-            gLastError = "Error creating colour map shader resource view";
-            return false;
-        }
+        gLastError = "Error creating colour atlas shader resource view";
+        return false;
     }
 
     // Create GPU-side constant buffers to receive the gPerFrameConstants and gPerModelConstants structures above
@@ -286,6 +615,20 @@ bool InitGeometry()
         return false;
     }
 
+    // Structured buffers for the clustered point lights. They grow if more space is needed, these sizes avoid that for this scene
+    try
+    {
+        uint32_t numClusters = gLightClusters.TilesX() * gLightClusters.TilesY() * gLightClusters.Slices();
+        gPointlightBuffer       = new StructuredBuffer(sizeof(PointlightBuffer), NUM_POINTLIGHTS + NUM_SWARM_LIGHTS);
+        gLightClusterBuffer     = new StructuredBuffer(sizeof(LightCluster), numClusters);
+        gClusterLightListBuffer = new StructuredBuffer(sizeof(uint32_t), numClusters * 16);
+    }
+    catch (std::runtime_error e)
+    {
+        gLastError = e.what();
+        return false;
+    }
+
     //// Load / prepare textures on the GPU ////
 
     // Load textures and create DirectX objects for them
@@ -343,6 +686,32 @@ bool InitGeometry()
 		return false;
 	}
 
+    // Pipeline states for each render mode, uses the shaders and states created above
+    CreateRenderModes();
+
+    // Worker threads and deferred contexts for recording render passes
+    try
+    {
+        gDeferredPassRecorder = new DeferredPassRecorder();
+    }
+    catch (std::runtime_error e)
+    {
+        gLastError = e.what();
+        return false;
+    }
+    gImmediatePassRecorder = new ImmediatePassRecorder();
+
+    // Timestamp queries to time parts of each frame on the GPU
+    try
+    {
+        gGpuTimer = new GpuTimer(NumGpuTimestamps);
+    }
+    catch (std::runtime_error e)
+    {
+        gLastError = e.what();
+        return false;
+    }
+
 	return true;
 }
 
@@ -364,6 +733,7 @@ bool InitScene()
     gTeapot.model->SetPosition({ 15, 0, -5 });
     gTeapot.model->SetScale(1.2f);
     gTeapot.model->SetRotation({ 0, ToRadians(215.0f), 0 });
+    gTeapot.dynamicShadow = true; // Controlled by the keys
     
     gModels[0] = &gTeapot;
 
@@ -384,6 +754,7 @@ bool InitScene()
     // Wiggle sphere
     gWiggleSphere.model = new Model(gSphereMesh);
     gWiggleSphere.renderMode = Wiggle;
+    gWiggleSphere.dynamicShadow = true; // The wiggle vertex shader moves the vertices every frame
     gWiggleSphere.model->SetPosition({ 0, 6, -5 });
     gWiggleSphere.model->SetScale(0.3f);
     
@@ -564,6 +935,7 @@ bool InitScene()
     // Wggle teapot
     gWiggleTeapot.model = new Model(gTeapotMesh);
     gWiggleTeapot.renderMode = Wiggle;
+    gWiggleTeapot.dynamicShadow = true;
     gWiggleTeapot.model->SetPosition({ -60, 4, 190 });
     gWiggleTeapot.model->SetRotation({ 0.0f, 0.0f, ToRadians(-20.0f) });
     gWiggleTeapot.model->SetScale(1.4f);
@@ -576,11 +948,22 @@ bool InitScene()
     {
         gSpotlights[i].texture = &gLightTexture;
         gSpotlights[i].model = new Model(gLightMesh);
+        gSpotlights[i].shadowAtlasDepthStencil = gShadowAtlasDepthStencil;
+        gSpotlights[i].colourAtlasRenderTarget = gColourAtlasRenderTarget;
+        gSpotlights[i].shadowCacheDepthStencil = gShadowCacheDepthStencil;
+        gSpotlights[i].colourCacheRenderTarget = gColourCacheRenderTarget;
 
         gLights[lightIndex] = &gSpotlights[i];
         lightIndex++;
     }
 
+    gDirectionalLight.texture = &gLightTexture;
+    gDirectionalLight.model = new Model(gLightMesh);
+    gDirectionalLight.shadowAtlasDepthStencil = gShadowAtlasDepthStencil;
+    gDirectionalLight.colourAtlasRenderTarget = gColourAtlasRenderTarget;
+    gLights[lightIndex] = &gDirectionalLight;
+    lightIndex++;
+
     for (int i = 0; i < NUM_POINTLIGHTS; ++i)
     {
         gPointlights[i].texture = &gLightTexture;
@@ -596,34 +979,32 @@ bool InitScene()
     gSpotlights[0].model->SetPosition({ 30, 15, 0 });
     gSpotlights[0].model->FaceTarget(gTeapot.model->Position());
 
-    // Far light
-    gSpotlights[1].colour = { 0.6f, 0.9f, 0.8f };
-    gSpotlights[1].SetStrength(90);
-    gSpotlights[1].model->SetPosition({ -120, 200, 475 });
-    gSpotlights[1].model->FaceTarget({ 0, 0, -100 });
-    gSpotlights[1].isSpot = false;
-    gSpotlights[1].gSpotlightConeAngle = 120;
+    // Far light, shines from the direction the model faces
+    gDirectionalLight.colour = { 0.6f, 0.9f, 0.8f };
+    gDirectionalLight.SetStrength(90);
+    gDirectionalLight.model->SetPosition({ -120, 200, 475 });
+    gDirectionalLight.model->FaceTarget({ 0, 0, -100 });
 
-    gPortalTexture.diffuseSpecularMapSRV = gSpotlights[1].colourMapSRV;
+    gPortalTexture.diffuseSpecularMapSRV = gColourAtlasSRV;
 
     // Colour changing light
-    gSpotlights[2].colour = { 1.0f, 0.0f, 0.24f };
-    gSpotlights[2].SetStrength(45);
-    gSpotlights[2].model->SetPosition({ -15, 10, 30 });
-    gSpotlights[2].model->FaceTarget(gGlassCube.model->Position());
-    gSpotlights[2].MakeRainbow();
+    gSpotlights[1].colour = { 1.0f, 0.0f, 0.24f };
+    gSpotlights[1].SetStrength(45);
+    gSpotlights[1].model->SetPosition({ -15, 10, 30 });
+    gSpotlights[1].model->FaceTarget(gGlassCube.model->Position());
+    gSpotlights[1].MakeRainbow(gLightAnimation);
 
     // Flickering lights
     gPointlights[0].colour = { 0.2f, 0.7f, 1.0f };
     gPointlights[0].SetStrength(10);
     gPointlights[0].model->SetPosition({ -66, 100, 73.5f });
     gPointlights[0].model->FaceTarget(gCamera->Position());
-    gPointlights[0].MakeFlicker();
+    gPointlights[0].MakeFlicker(gLightAnimation);
 
     gPointlights[1].colour = { 0.9f, 0.1f, 0.5f };
     gPointlights[1].SetStrength(10);
     gPointlights[1].model->SetPosition({ -62.8f, 100, 103.5f });
-    gPointlights[1].MakeFlicker();
+    gPointlights[1].MakeFlicker(gLightAnimation);
 
     // Pointlights
     gPointlights[2].colour = { 0.2f, 0.8f, 0.9f };
@@ -634,6 +1015,27 @@ bool InitScene()
     gPointlights[3].SetStrength(15);
     gPointlights[3].model->SetPosition({ -40, 3, 9 });
 
+    // Swarm lights, scattered over the ground. Fixed seed so the swarm is the same each run
+    std::mt19937 random(409);
+    std::uniform_real_distribution<float> randomX(-150.0f, 150.0f), randomY(2.0f, 25.0f), randomZ(-50.0f, 350.0f);
+    std::uniform_real_distribution<float> randomOrbit(2.0f, 15.0f), randomSpeed(-1.5f, 1.5f), randomAngle(0.0f, 6.2832f);
+    std::uniform_real_distribution<float> randomColourSpeed(0.1f, 0.5f);
+    std::uniform_int_distribution<int> randomColour(0, NUM_RAINBOW_COLOURS - 1);
+    gFirstSwarmAnimation = gLightAnimation.NumLights();
+    for (auto& light : gSwarmLights)
+    {
+        light.centre      = { randomX(random), randomY(random), randomZ(random) };
+        light.orbitRadius = randomOrbit(random);
+        light.orbitSpeed  = randomSpeed(random);
+        light.angle       = randomAngle(random);
+
+        int firstColour = randomColour(random);
+        light.animation = gLightAnimation.AddLight(RAINBOW_COLOURS[firstColour], SWARM_LIGHT_STRENGTH);
+        gLightAnimation.MakeRainbow(light.animation, randomColourSpeed(random), firstColour);
+        light.intensity = RAINBOW_COLOURS[firstColour] * SWARM_LIGHT_STRENGTH * POINTLIGHT_REFERENCE_DISTANCE;
+        light.radius    = PointlightInfluenceRadius(light.intensity);
+    }
+
     return true;
 }
 
@@ -641,6 +1043,13 @@ bool InitScene()
 // Release the geometry and scene resources created above
 void ReleaseResources()
 {
+    // Stop the recording threads before anything they might use is released
+    delete gDeferredPassRecorder;   gDeferredPassRecorder  = nullptr;
+    delete gImmediatePassRecorder;  gImmediatePassRecorder = nullptr;
+    gPassRecorder = nullptr;
+    delete gGpuTimer;  gGpuTimer = nullptr;
+
+    ReleasePipelineStates();
     ReleaseStates();
 
     for (int i = 0; i < NUM_TEXTURES; i++)
@@ -648,6 +1057,21 @@ void ReleaseResources()
         gTextures[i]->~Texture();
     }
 
+    if (gColourCacheRenderTarget)  gColourCacheRenderTarget->Release();
+    if (gColourCacheTexture)       gColourCacheTexture->Release();
+    if (gShadowCacheDepthStencil)  gShadowCacheDepthStencil->Release();
+    if (gShadowCacheTexture)       gShadowCacheTexture->Release();
+    if (gColourAtlasSRV)           gColourAtlasSRV->Release();
+    if (gColourAtlasRenderTarget)  gColourAtlasRenderTarget->Release();
+    if (gColourAtlasTexture)       gColourAtlasTexture->Release();
+    if (gShadowAtlasSRV)           gShadowAtlasSRV->Release();
+    if (gShadowAtlasDepthStencil)  gShadowAtlasDepthStencil->Release();
+    if (gShadowAtlasTexture)       gShadowAtlasTexture->Release();
+
+    delete gClusterLightListBuffer;  gClusterLightListBuffer = nullptr;
+    delete gLightClusterBuffer;      gLightClusterBuffer     = nullptr;
+    delete gPointlightBuffer;        gPointlightBuffer       = nullptr;
+
     if (gPerModelConstantBuffer)  gPerModelConstantBuffer->Release();
     if (gPerFrameConstantBuffer)  gPerFrameConstantBuffer->Release();
 
@@ -666,228 +1090,466 @@ void ReleaseResources()
         gModels[i]->~SceneModel();
     }
 
-    delete gLightMesh;         gLightMesh         = nullptr;
-    delete gGroundMesh;        gGroundMesh        = nullptr;
-    delete gCrateMesh;         gCrateMesh         = nullptr;
-    delete gTeapotMesh;        gTeapotMesh        = nullptr;
-    delete gSphereMesh;        gSphereMesh        = nullptr;
-    delete gTangentSphereMesh; gTangentSphereMesh = nullptr;
-    delete gCubeMesh;          gCubeMesh          = nullptr;
-    delete gTangentCubeMesh;   gTangentCubeMesh   = nullptr;
-    delete gBuildingMesh;      gBuildingMesh      = nullptr;
-    delete gQuadMesh;          gQuadMesh          = nullptr;
-    delete gHillMesh;          gHillMesh          = nullptr;
+    gLightMesh.reset();
+    gGroundMesh.reset();
+    gCrateMesh.reset();
+    gTeapotMesh.reset();
+    gSphereMesh.reset();
+    gTangentSphereMesh.reset();
+    gCubeMesh.reset();
+    gTangentCubeMesh.reset();
+    gBuildingMesh.reset();
+    gQuadMesh.reset();
+    gHillMesh.reset();
+
+    gMeshManager.Shutdown(); // Drops meshes still loading and the placeholders
+    gGeometryPool.Release(); // After the meshes, which free their parts of the pool
 }
 
 //--------------------------------------------------------------------------------------
 // Scene Rendering
 //--------------------------------------------------------------------------------------
 
-// Render everything in the scene from the given camera
-// This code is common between rendering the main scene and rendering the scene in the portal
-// See RenderScene function below
-void RenderSceneFromCamera(Camera* camera)
+// Set up the render target, viewport, per-frame constants and shadow maps for the main scene. Each slice of the
+// main pass is recorded into its own command stream (see PassRecorder.h) so every slice must set all of this itself
+void SetMainPassState(CommandStream& commands, const PerFrameConstants& frameConstants)
 {
-    // Set camera matrices in the constant buffer and send over to GPU
-    gPerFrameConstants.viewMatrix           = camera->ViewMatrix();
-    gPerFrameConstants.projectionMatrix     = camera->ProjectionMatrix();
-    gPerFrameConstants.viewProjectionMatrix = camera->ViewProjectionMatrix();
-    UpdateConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
+    // Send the camera's copy of the per-frame constants over to the GPU
+    commands.UpdateConstants(gPerFrameConstantBuffer, frameConstants);
 
     // Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-    gD3DContext->VSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
-    gD3DContext->PSSetConstantBuffers(0, 1, &gPerFrameConstantBuffer);
+    commands.BindConstantBuffer(0, gPerFrameConstantBuffer); // First parameter must match constant buffer number in the shader 
 
+    // Set the back buffer as the target for rendering and select the main depth buffer.
+    // When finished the back buffer is sent to the "front buffer" - which is the monitor.
+    commands.SetRenderTargets(gBackBufferRenderTarget, gDepthStencil);
 
-    //// Render lit models ////
+    // Setup the viewport to the size of the main window
+    commands.SetViewport(static_cast<float>(gViewportWidth), static_cast<float>(gViewportHeight));
 
-    // Select which shaders to use next
-    gD3DContext->VSSetShader(gDefaultVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gDefaultPixelShader,  nullptr, 0);
-    
-    // States - no blending, normal depth buffer and culling
-    gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-    gD3DContext->RSSetState(gCullBackState);
+    // Set shadow maps in shaders
+    // First parameter is the "slot", must match the Texture2D declaration in the HLSL code
+    // In this app the diffuse map uses slot 0, the shadow atlas slot 10 and the colour atlas slot 30
+    commands.BindTextures(10, 1, &gShadowAtlasSRV);
+    commands.BindTextures(30, 1, &gColourAtlasSRV);
+    commands.BindSampler(1, gPointSampler);
+    commands.BindSampler(2, gShadowComparisonSampler); // Filtered shadow map comparisons
+
+    // Clustered point lights use slots 60 onwards
+    ID3D11ShaderResourceView* pointlightBuffers[] = { gPointlightBuffer->SRV(), gLightClusterBuffer->SRV(), gClusterLightListBuffer->SRV() };
+    commands.BindTextures(60, 3, pointlightBuffers);
+}
 
-    // Select the approriate textures and sampler to use in the pixel shader
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
 
-    // Render model - it will update the model's world matrix and send it to the GPU in a constant buffer, then it will call
-    // the Mesh render function, which will set up vertex & index buffer before finally calling Draw on the GPU
-    for (int i = 0; i < NUM_MODELS; i++)
+// Render the items from queue[firstItem] up to (not including) queue[lastItem]. Each item is an index into gModels
+// If depthOnly is true, only render depth for the models. Otherwise the model's render mode pipeline is used, or the
+// depth-equal version of it when afterDepthPrePass is true (the depth buffer already holds the RenderDepthPrePass result)
+// If a cluster view is given, large meshes skip their clusters that it can't see, in render modes that allow it
+void RenderQueuedModels(CommandStream& commands, const RenderQueue& queue, size_t firstItem, size_t lastItem,
+                        bool depthOnly = false, bool afterDepthPrePass = false, const ClusterView* clusterView = nullptr)
+{
+    const PipelineState* currentPipeline = nullptr;
+    for (size_t i = firstItem; i < lastItem; i++)
     {
-        if (gModels[i]->renderMode == Default)
+        SceneModel* sceneModel = gModels[queue.Items()[i].index];
+        const RenderModeInfo& renderMode = gRenderModes[sceneModel->renderMode];
+
+        // Only select the pipeline when it changes, opaque queues are grouped by render mode so this is rare
+        const PipelineState* pipeline = depthOnly         ? renderMode.depthOnlyPipeline  :
+                                        afterDepthPrePass ? renderMode.depthEqualPipeline :
+                                                            renderMode.pipeline;
+        if (pipeline != currentPipeline)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            commands.SetPipeline(pipeline);
+            currentPipeline = pipeline;
         }
-    }
 
-    gD3DContext->PSSetShader(gBrightPixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
-    {
-        if (gModels[i]->renderMode == Bright)
+        // Render model - it will add commands to update the model's world matrix and send it to the GPU in a constant buffer, then it
+        // will call the Mesh render function, which will set up vertex & index buffer before finally calling Draw on the GPU
+        if (!depthOnly)  sceneModel->BindTextures(commands, renderMode.textures);
+        if (clusterView != nullptr && renderMode.clusterCulling)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            ClusterView modeView = *clusterView;
+            modeView.cullBackFaces = renderMode.clusterBackFaces;
+            sceneModel->model->Render(commands, { 1, 1, 1 }, 0, &modeView);
         }
-    }
-
-    gD3DContext->PSSetShader(gTexFadePixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
-    {
-        if (gModels[i]->renderMode == TextureFade)
+        else
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gD3DContext->PSSetShaderResources(4, 1, &gModels[i]->texture2->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            sceneModel->model->Render(commands);
         }
     }
+}
 
-    gD3DContext->PSSetShader(gTextureGradientPixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
+
+// Render the depth of all opaque models without any shading. Models are sorted nearest first, so more of the
+// pixels behind them fail the depth test early. The opaque slices then only shade the pixels that are visible
+// The cluster view must be the same one the opaque slices use, so both passes draw exactly the same triangles
+void RenderDepthPrePass(CommandStream& commands, const ClusterView* clusterView)
+{
+    // Depth buffer only, no render target so no pixel colours are written
+    commands.SetRenderTargets(nullptr, gDepthStencil);
+    RenderQueuedModels(commands, gDepthPrePassQueue, 0, gDepthPrePassQueue.Size(), true, false, clusterView);
+}
+
+
+// Render the light models and then the transparent models, furthest first so they blend correctly. Blending
+// order matters here so this is always recorded as a single slice, submitted after all the opaque slices
+void RenderLightsAndTransparent(CommandStream& commands)
+{
+    //// Render lights ////
+
+    // Additive blending, so the order of the lights doesn't matter
+    commands.SetPipeline(gLightModelPipeline);
+    commands.BindTexture(0, gLightTexture.diffuseSpecularMapSRV); // First parameter must match texture slot number in the shader
+
+    // Render all the lights in the arrays, tinted to match the light colour they cast
+    for (int i = 0; i < NUM_LIGHTS; ++i)
     {
-        if (gModels[i]->renderMode == TextureGradient || gModels[i]->renderMode == TexGradientNS)
-        {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gD3DContext->PSSetShaderResources(4, 1, &gModels[i]->texture2->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
-        }
+        gLights[i]->model->Render(commands, gLights[i]->colour);
     }
 
-    gD3DContext->VSSetShader(gWiggleVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gWigglePixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
+    //// Render transparent objects ////
+
+    RenderQueuedModels(commands, gTransparentQueue, 0, gTransparentQueue.Size());
+}
+
+
+// True if any part of a world space bounding sphere is inside a view's frustum
+bool SphereInView(const ClusterView& view, const BoundingSphere& sphere)
+{
+    for (auto& plane : view.planes)
     {
-        if (gModels[i]->renderMode == Wiggle)
-        {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
-        }
+        float distance = plane[0] * sphere.centre.x + plane[1] * sphere.centre.y + plane[2] * sphere.centre.z + plane[3];
+        if (distance < -sphere.radius)  return false;
     }
+    return true;
+}
+
+
+// Fill the render queues with the models visible from the given view and sort them by view depth. Models whose bounds
+// are outside the view's frustum are left out
+// Opaque models are grouped by render mode in render mode table order, then sorted nearest first
+void BuildRenderQueues(const CMatrix4x4& viewMatrix, const ClusterView& view)
+{
+    gOpaqueQueue.Clear();
+    gTransparentQueue.Clear();
+    gDepthPrePassQueue.Clear();
 
-    gD3DContext->VSSetShader(gNormalMappingVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gNormalMappingPixelShader, nullptr, 0);
     for (int i = 0; i < NUM_MODELS; i++)
     {
-        if (gModels[i]->renderMode == NormalMap)
+        const RenderModeInfo& renderMode = gRenderModes[gModels[i]->renderMode];
+        if (renderMode.pipeline == nullptr)  continue; // Hidden
+        if (!SphereInView(view, gModels[i]->model->Bounds()))  continue;
+
+        CVector3 position = gModels[i]->model->Position();
+        if (renderMode.transparent)
+        {
+            gTransparentQueue.Add(i, position);
+        }
+        else
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gD3DContext->PSSetShaderResources(1, 1, &gModels[i]->texture->normalMapSRV);
-            gModels[i]->model->Render();
+            gOpaqueQueue.Add(i, position, renderMode.order);
+            gDepthPrePassQueue.Add(i, position);
         }
     }
 
-    gD3DContext->PSSetShader(gParallaxMappingPixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
+    gOpaqueQueue.Sort(viewMatrix, RenderQueue::FrontToBack);
+    gTransparentQueue.Sort(viewMatrix, RenderQueue::BackToFront);
+    if (gDepthPrePass)  gDepthPrePassQueue.Sort(viewMatrix, RenderQueue::FrontToBack);
+}
+
+
+// Gather this frame's point lights, assign them to the clusters of the camera's view (or choose the lights for each
+// model) and send everything to the GPU
+// The structured buffers may be recreated here, so this must be done before any passes that bind them are added
+void UpdatePointlights(Camera* camera)
+{
+    // Lights that are switched off (e.g. flickering) have no influence radius and are skipped
+    gPointlightData.clear();
+    for (int i = 0; i < NUM_POINTLIGHTS; i++)
     {
-        if (gModels[i]->renderMode == ParallaxMap)
-        {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gD3DContext->PSSetShaderResources(1, 1, &gModels[i]->texture->normalMapSRV);
-            gModels[i]->model->Render();
-        }
+        gPointlights[i].SetBuffer();
+        if (gPointlights[i].buffer.radius > 0)  gPointlightData.push_back(gPointlights[i].buffer);
     }
 
-    gD3DContext->PSSetSamplers(0, 1, &gCubeMapSampler);
-    gD3DContext->RSSetState(gCullNoneState);
-    gD3DContext->PSSetShader(gCubeMapPixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
+    if (gShowSwarm)
     {
-        if (gModels[i]->renderMode == CubeMap)
+        for (auto& swarmLight : gSwarmLights)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            PointlightBuffer light;
+            light.position = swarmLight.centre + CVector3{ std::cos(swarmLight.angle), 0, std::sin(swarmLight.angle) } * swarmLight.orbitRadius;
+            light.colour   = swarmLight.intensity;
+            light.radius   = swarmLight.radius;
+            light.padding2 = 0;
+            gPointlightData.push_back(light);
         }
     }
 
-    gD3DContext->PSSetShader(gCubeMapLightPixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
+    gPointlightPositions.clear();
+    gPointlightRadii.clear();
+    gPointlightLuminances.clear();
+    for (auto& light : gPointlightData)
     {
-        if (gModels[i]->renderMode == CubeMapLight)
-        {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
-        }
+        gPointlightPositions.push_back(light.position);
+        gPointlightRadii.push_back(light.radius);
+        gPointlightLuminances.push_back(PointlightLuminance(light.colour));
     }
+    uint32_t numLights = static_cast<uint32_t>(gPointlightData.size());
+    gPointlightBuffer->Update(gPointlightData.data(), numLights);
 
-    gD3DContext->PSSetShader(gCubeMapAnimatedPixelShader, nullptr, 0);
-    for (int i = 0; i < NUM_MODELS; i++)
+    gPerFrameConstants.useObjectLights = gUseObjectLights ? 1.0f : 0.0f;
+    if (gUseObjectLights)
     {
-        if (gModels[i]->renderMode == CubeMapAnimated)
+        // Choose the lights for each model from its bounding sphere, they are sent with the model's constants when it is rendered
+        gModelCentres.clear();
+        gModelRadii.clear();
+        for (int i = 0; i < NUM_MODELS; i++)
+        {
+            BoundingSphere bounds = gModels[i]->model->Bounds();
+            gModelCentres.push_back(bounds.centre);
+            gModelRadii.push_back(bounds.radius);
+        }
+        gObjectLights.SetLights(gPointlightPositions.data(), gPointlightRadii.data(), gPointlightLuminances.data(), numLights);
+        gObjectLights.AssignObjects(gModelCentres.data(), gModelRadii.data(), NUM_MODELS);
+        for (int i = 0; i < NUM_MODELS; i++)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gD3DContext->PSSetShaderResources(4, 1, &gModels[i]->texture2->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            gModels[i]->model->SetLights(gObjectLights.Lights(i));
         }
+        return;
     }
 
-    //// Render lights ////
+    // Assign the lights to clusters and send the cluster lists to the GPU
+    gLightClusters.SetProjection(camera->ProjectionMatrix(), camera->NearClip(), camera->FarClip());
+    gLightClusters.AssignLights(gPointlightPositions.data(), gPointlightRadii.data(), numLights, camera->ViewMatrix());
 
-    // Select which shaders to use next
-    gD3DContext->VSSetShader(gBasicTransformVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gLightModelPixelShader,      nullptr, 0);
+    auto& clusters = gLightClusters.Clusters();
+    auto& lightIndices = gLightClusters.LightIndices();
+    gLightClusterBuffer->Update(clusters.data(), static_cast<uint32_t>(clusters.size()));
+    gClusterLightListBuffer->Update(lightIndices.data(), static_cast<uint32_t>(lightIndices.size()));
 
-    // Select the texture and sampler to use in the pixel shader
-    gD3DContext->PSSetShaderResources(0, 1, &gLightTexture.diffuseSpecularMapSRV); // First parameter must match texture slot number in the shaer
-    gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
+    // The shaders need the cluster grid size and depth slicing to find which cluster each pixel is in
+    gPerFrameConstants.clusterTiles = { static_cast<float>(gLightClusters.TilesX()), static_cast<float>(gLightClusters.TilesY()),
+                                        static_cast<float>(gLightClusters.Slices()) };
+    gPerFrameConstants.clusterDepthScale = gLightClusters.DepthScale();
+    gPerFrameConstants.clusterDepthBias  = gLightClusters.DepthBias();
+}
 
-    // States - additive blending, read-only depth buffer and no culling (standard set-up for blending
-    gD3DContext->OMSetBlendState(gAdditiveBlendingState, nullptr, 0xffffff);
-    gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-    gD3DContext->RSSetState(gCullNoneState);
 
-    // Render all the lights in the arrays
-    for (int i = 0; i < NUM_LIGHTS; ++i)
+// Add a pass writing one of the GPU timestamps, the time between two of them is the GPU time of the passes in between
+void AddTimestampPass(GpuTimestamp timestamp)
+{
+    gPassRecorder->AddPass("Timestamp", [timestamp](CommandStream& commands)
+    {
+        gGpuTimer->Timestamp(commands, timestamp);
+    });
+}
+
+
+// Render everything in the scene from the given camera
+// This code is common between rendering the main scene and rendering the scene in the portal
+// The rendering is split into slices that are added to the pass recorder, see RenderScene function below
+void RenderSceneFromCamera(Camera* camera)
+{
+    // Each slice gets its own copy of the per-frame constants with the camera matrices set
+    PerFrameConstants frameConstants = gPerFrameConstants;
+    frameConstants.viewMatrix           = camera->ViewMatrix();
+    frameConstants.projectionMatrix     = camera->ProjectionMatrix();
+    frameConstants.viewProjectionMatrix = camera->ViewProjectionMatrix();
+
+    // View to cull the models and the clusters of large meshes against, copied into each slice. Back face culling is chosen
+    // per render mode
+    ClusterView clusterView = MakeClusterView(frameConstants.viewProjectionMatrix, camera->Position(), true);
+
+    // Sorted before any passes are added, the passes only read the queues
+    BuildRenderQueues(frameConstants.viewMatrix, clusterView);
+    bool clusterCulling = gClusterCulling;
+
+    // The first pass added clears the back buffer to a fixed colour and the depth buffer to the far distance.
+    // Passes are submitted in the order they are added, so the clear happens before anything else is drawn
+    bool depthPrePass = gDepthPrePass;
+    AddTimestampPass(TimestampMainStart);
+    if (depthPrePass)
     {
-        gPerModelConstants.objectColour = gLights[i]->colour; // Set any per-model constants apart from the world matrix just before calling render (light colour here)
-        gLights[i]->model->Render();
+        gPassRecorder->AddPass("Depth pre-pass", [=](CommandStream& commands)
+        {
+            SetMainPassState(commands, frameConstants);
+            commands.ClearRenderTarget(gBackBufferRenderTarget, &gBackgroundColor.r);
+            commands.ClearDepth(gDepthStencil);
+            RenderDepthPrePass(commands, clusterCulling ? &clusterView : nullptr);
+        });
     }
+    AddTimestampPass(TimestampPrePassEnd);
+
+    // The sorted opaque models are split evenly into slices
+    size_t numOpaque = gOpaqueQueue.Size();
+    for (int slice = 0; slice < NUM_OPAQUE_SLICES; ++slice)
+    {
+        size_t firstItem = numOpaque * slice / NUM_OPAQUE_SLICES;
+        size_t lastItem  = numOpaque * (slice + 1) / NUM_OPAQUE_SLICES;
+        gPassRecorder->AddPass("Opaque slice " + std::to_string(slice), [=](CommandStream& commands)
+        {
+            SetMainPassState(commands, frameConstants);
+            if (slice == 0 && !depthPrePass)
+            {
+                commands.ClearRenderTarget(gBackBufferRenderTarget, &gBackgroundColor.r);
+                commands.ClearDepth(gDepthStencil);
+            }
+            RenderQueuedModels(commands, gOpaqueQueue, firstItem, lastItem, false, depthPrePass,
+                               clusterCulling ? &clusterView : nullptr);
+        });
+    }
+    AddTimestampPass(TimestampOpaqueEnd);
+
+    gPassRecorder->AddPass("Lights and transparent", [=](CommandStream& commands)
+    {
+        SetMainPassState(commands, frameConstants);
+        RenderLightsAndTransparent(commands);
+    });
+}
 
-    //// Render transparent objects ////
 
-    gD3DContext->PSSetShader(gAlphaPixelShader, nullptr, 0);
+// Change gStaticModelsVersion if any static model has moved or changed render mode or level of detail since last frame,
+// so the lights' static shadow caches are rebuilt
+void UpdateStaticModelsVersion()
+{
+    gStaticModelMatrices.resize(NUM_MODELS);
+    gStaticModelModes.resize(NUM_MODELS, NumRenderModes);
+    gStaticModelLods.resize(NUM_MODELS, -1);
+    bool changed = false;
     for (int i = 0; i < NUM_MODELS; i++)
     {
-        if (gModels[i]->renderMode == AddBlend)
+        if (gModels[i]->dynamicShadow)  continue;
+
+        CMatrix4x4 worldMatrix = gModels[i]->model->WorldMatrix();
+        if (gModels[i]->renderMode != gStaticModelModes[i] || gModels[i]->model->Lod() != gStaticModelLods[i] ||
+            std::memcmp(&worldMatrix, &gStaticModelMatrices[i], sizeof(CMatrix4x4)) != 0)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            gStaticModelMatrices[i] = worldMatrix;
+            gStaticModelModes[i]    = gModels[i]->renderMode;
+            gStaticModelLods[i]     = gModels[i]->model->Lod();
+            changed = true;
         }
     }
+    if (gMeshManager.LoadedVersion() != gStaticMeshesLoaded)
+    {
+        gStaticMeshesLoaded = gMeshManager.LoadedVersion();
+        changed = true;
+    }
+    if (changed)  ++gStaticModelsVersion;
+}
 
-    gD3DContext->OMSetBlendState(gAlphaBlendingState, nullptr, 0xffffff);
-    for (int i = 0; i < NUM_MODELS; i++)
+
+// Add the passes to render the directional light's shadow cascades into the shadow atlas, after the spotlights' passes
+// Each cascade clears its own region so these passes work whether the atlas was cleared or copied from the cache
+void RenderShadowCascades()
+{
+    for (int i = 0; i < gDirectionalLight.cascades.NumCascades(); i++)
     {
-        if (gModels[i]->renderMode == AlphBlend)
+        gPassRecorder->AddPass("Shadow cascade " + std::to_string(i), [i](CommandStream& commands)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
-        }
+            gDirectionalLight.RenderCascade(commands, i);
+        });
     }
+}
 
-    gD3DContext->OMSetBlendState(gMultiplicativeBlendingState, nullptr, 0xffffff);
-    for (int i = 0; i < NUM_MODELS; i++)
+
+// Add the passes to render the spotlights' shadow and colour maps into the shadow atlas
+void RenderShadowMaps()
+{
+    AddTimestampPass(TimestampShadowsStart);
+    if (!gCacheShadows)
     {
-        if (gModels[i]->renderMode == MultBlend)
+        // Clears always affect the whole texture, so the atlas is cleared once here rather than by each light
+        gPassRecorder->AddPass("Shadow atlas clear", [](CommandStream& commands)
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            const float white[4] = { 1.0f, 1.0f, 1.0f, 1.0f }; // Nothing coloured between the light and the shadow
+            commands.ClearDepth(gShadowAtlasDepthStencil);
+            commands.ClearRenderTarget(gColourAtlasRenderTarget, white);
+        });
+
+        for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+        {
+            Spotlight* light = &gSpotlights[i];
+            light->InvalidateShadowCache();
+            gPassRecorder->AddPass("Spotlight " + std::to_string(i), [light](CommandStream& commands)
+            {
+                light->RenderFromLightPOV(commands, NUM_MODELS, gModels);
+            });
         }
+        gCachedShadowDraws = 0;
+        AddTimestampPass(TimestampSpotlightsEnd);
+        RenderShadowCascades();
+        return;
     }
-    
-    gD3DContext->VSSetShader(gDefaultVertexShader, nullptr, 0);
-    gD3DContext->PSSetShader(gAlphaLightingPixelShader, nullptr, 0);
-    gD3DContext->OMSetBlendState(gAdditiveBlendingState, nullptr, 0xffffff);
+
+    //// Static shadow cache ////
+
+    // Decide which lights need their cache rebuilt before any passes are added, since the light is read while they are recorded
+    UpdateStaticModelsVersion();
+    bool rebuildCache[NUM_SPOTLIGHTS];
+    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    {
+        rebuildCache[i] = gSpotlights[i].UpdateShadowCache(gStaticModelsVersion);
+    }
+
+    // Count the static shadow draws the cache saves this frame
+    int numStaticCasters = 0;
     for (int i = 0; i < NUM_MODELS; i++)
     {
-        if (gModels[i]->renderMode == AddBlendLight || gModels[i]->renderMode == Ghost)
+        const RenderModeInfo& renderMode = gRenderModes[gModels[i]->renderMode];
+        if (renderMode.shadowPipeline != nullptr && !gModels[i]->dynamicShadow)  ++numStaticCasters;
+    }
+    gCachedShadowDraws = 0;
+
+    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    {
+        Spotlight* light = &gSpotlights[i];
+        if (!rebuildCache[i])
         {
-            gD3DContext->PSSetShaderResources(0, 1, &gModels[i]->texture->diffuseSpecularMapSRV);
-            gModels[i]->model->Render();
+            if (light->shadowRect.size != 0)  gCachedShadowDraws += numStaticCasters;
+            continue;
         }
+        gPassRecorder->AddPass("Spotlight " + std::to_string(i) + " cache", [light](CommandStream& commands)
+        {
+            light->RenderShadowCache(commands, NUM_MODELS, gModels);
+        });
+    }
+
+    // Start the atlas as a copy of the cache - depth buffers can only be copied whole, so this copies every light at once.
+    // Also replaces clearing the atlas since every light's region is cleared in the cache
+    gPassRecorder->AddPass("Shadow cache copy", [](CommandStream& commands)
+    {
+        commands.CopyTexture(gShadowAtlasTexture, gShadowCacheTexture);
+        commands.CopyTexture(gColourAtlasTexture, gColourCacheTexture);
+    });
+
+    // Then only the moving models are drawn on top
+    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    {
+        Spotlight* light = &gSpotlights[i];
+        gPassRecorder->AddPass("Spotlight " + std::to_string(i), [light](CommandStream& commands)
+        {
+            light->RenderFromLightPOV(commands, NUM_MODELS, gModels, ShadowCasters::Dynamic);
+        });
     }
+    AddTimestampPass(TimestampSpotlightsEnd);
+
+    RenderShadowCascades();
+}
+
+
+// Pick up the GPU times of an earlier frame if they have arrived and add them to the averages for the settings it used
+void UpdateGpuTimes()
+{
+    uint64_t lastResults = gGpuTimer->ResultsFrame();
+    gGpuTimer->EndFrame();
+    if (gGpuTimer->ResultsFrame() == lastResults)  return;
+
+    // Smoothed over roughly the last 20 frames with each setting
+    auto average = [](float& averageTime, float time) { averageTime = (averageTime == 0) ? time : averageTime * 0.95f + time * 0.05f; };
+    const FrameSettings& settings = gRecentFrames[gGpuTimer->ResultsFrame() % NUM_RECENT_FRAMES];
+    average(gOpaqueGpuTime[settings.depthPrePass], gGpuTimer->Interval(TimestampMainStart, TimestampOpaqueEnd));
+    average(gSpotlightShadowGpuTime[settings.cacheShadows], gGpuTimer->Interval(TimestampShadowsStart, TimestampSpotlightsEnd));
 }
 
 
@@ -898,21 +1560,54 @@ void RenderScene()
     //// Common settings ////
 
     // Set up the light information in the constant buffer
-    gPerFrameConstants.spotlightNumber = (float)NUM_SPOTLIGHTS;
+    gPerFrameConstants.shadowAtlasTexelSize = 1.0f / SHADOW_ATLAS_SIZE;
+
+    // Share out the shadow atlas between the spotlights, by how much of the screen their shadows cover, and the shadow cascades
+    float shadowImportances[NUM_SHADOW_MAPS];
+    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    {
+        shadowImportances[i] = gSpotlights[i].ShadowImportance(gCamera->Position(), gCamera->FOV());
+    }
+    for (int i = 0; i < MAX_SHADOW_CASCADES; i++)
+    {
+        shadowImportances[NUM_SPOTLIGHTS + i] = (i < gDirectionalLight.cascades.NumCascades()) ? SHADOW_CASCADE_IMPORTANCE : 0.0f;
+    }
+    gShadowAtlas.Update(shadowImportances, NUM_SHADOW_MAPS);
+
+    // The shaders list the spotlights most important first, the first few have their shadow map positions worked out in the
+    // vertex shaders (see NUM_VERTEX_SHADOW_LIGHTS in Common.hlsli)
+    int spotlightOrder[NUM_SPOTLIGHTS];
+    for (int i = 0; i < NUM_SPOTLIGHTS; i++)  spotlightOrder[i] = i;
+    std::stable_sort(spotlightOrder, spotlightOrder + NUM_SPOTLIGHTS,
+                     [&](int a, int b) { return shadowImportances[a] > shadowImportances[b]; });
 
     for (int i = 0; i < NUM_SPOTLIGHTS; i++)
     {
+        gSpotlights[i].SetShadowRect(gShadowAtlas.Rect(i), gShadowAtlas.AtlasSize());
         gSpotlights[i].SetBuffer();
-        gPerFrameConstants.spotlights[i] = gSpotlights[i].buffer;
     }
 
-    gPerFrameConstants.pointlightNumber = (float)NUM_POINTLIGHTS;
+    // Only the spotlights that may light something on screen are passed to the shaders, so the shader variant chosen below
+    // loops over as few as possible. Their shadow maps are still rendered, the static shadow cache relies on it
+    ClusterView cameraView = MakeClusterView(gCamera->ViewProjectionMatrix(), gCamera->Position(), false);
+    gNumVisibleSpotlights = 0;
+    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    {
+        Spotlight& light = gSpotlights[spotlightOrder[i]];
+        if (light.LightsView(cameraView))  gPerFrameConstants.spotlights[gNumVisibleSpotlights++] = light.buffer;
+    }
+    gPerFrameConstants.spotlightNumber = (float)gNumVisibleSpotlights;
 
-    for (int i = 0; i < NUM_POINTLIGHTS; i++)
+    for (int i = 0; i < gDirectionalLight.cascades.NumCascades(); i++)
     {
-        gPointlights[i].SetBuffer();
-        gPerFrameConstants.pointlights[i] = gPointlights[i].buffer;
+        gDirectionalLight.SetCascadeRect(i, gShadowAtlas.Rect(NUM_SPOTLIGHTS + i), gShadowAtlas.AtlasSize());
     }
+    gDirectionalLight.SetBuffer(gCamera);
+    gDirectionalLight.ChooseCasters(NUM_MODELS, gModels);
+    gPerFrameConstants.directionalLight = gDirectionalLight.buffer;
+
+    // Point lights are clustered for the main camera
+    UpdatePointlights(gCamera);
 
     gPerFrameConstants.ambientColour  = gAmbientColour;
     gPerFrameConstants.specularPower  = gSpecularPower;
@@ -920,64 +1615,57 @@ void RenderScene()
 
     gPerFrameConstants.parallaxDepth = 0.08f;
 
-    //***************************************//
-    //// Render from light's point of view ////
-    
-    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+    // Choose each model's level of detail from its size on screen, used by the shadow passes too so it is the same everywhere
+    for (int i = 0; i < NUM_MODELS; i++)
     {
-        gSpotlights[i].RenderFromLightPOV(NUM_MODELS, gModels);
+        gModels[i]->model->SelectLod(gCamera->Position(), gCamera->ProjectionMatrix().e11);
     }
+    gTrianglesSubmitted = 0;
+    gClustersTested = 0;
+    gClustersCulled = 0;
 
-    //// Main scene rendering ////
-
-    // Set the back buffer as the target for rendering and select the main depth buffer.
-    // When finished the back buffer is sent to the "front buffer" - which is the monitor.
-    gD3DContext->OMSetRenderTargets(1, &gBackBufferRenderTarget, gDepthStencil);
+    // Choose the shader variant for the frame and switch the render modes over to its pipelines. Coloured shadows are only
+    // needed while some model casts one
+    bool colourShadows = false;
+    for (int i = 0; i < NUM_MODELS; i++)
+    {
+        if (gRenderModes[gModels[i]->renderMode].colouredShadow)  colourShadows = true;
+    }
+    gShaderPermutation = ChooseShaderPermutation(gNumVisibleSpotlights, colourShadows, gParallaxSteps);
+    int permutationIndex = PermutationIndex(gShaderPermutation);
+    for (auto& renderMode : gRenderModes)
+    {
+        if (renderMode.permutationPipelines[permutationIndex] != nullptr)
+        {
+            renderMode.pipeline           = renderMode.permutationPipelines[permutationIndex];
+            renderMode.depthEqualPipeline = renderMode.permutationDepthEqualPipelines[permutationIndex];
+        }
+    }
 
-    // Clear the back buffer to a fixed colour and the depth buffer to the far distance
-    gD3DContext->ClearRenderTargetView(gBackBufferRenderTarget, &gBackgroundColor.r);
-    gD3DContext->ClearDepthStencilView(gDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+    // All the per-frame data above must be complete before any passes are added, from here until the
+    // passes are submitted the scene is only read (possibly from several threads at once)
+    if (gMultithreadedRecording)  gPassRecorder = gDeferredPassRecorder;
+    else                          gPassRecorder = gImmediatePassRecorder;
 
-    // Setup the viewport to the size of the main window
-    D3D11_VIEWPORT vp;
-    vp.Width  = static_cast<FLOAT>(gViewportWidth);
-    vp.Height = static_cast<FLOAT>(gViewportHeight);
-    vp.MinDepth = 0.0f;
-    vp.MaxDepth = 1.0f;
-    vp.TopLeftX = 0;
-    vp.TopLeftY = 0;
-    gD3DContext->RSSetViewports(1, &vp);
+    // Immediate recording sends each pass to the GPU as it is added, so the timer starts the frame before any are
+    gGpuTimer->BeginFrame();
+    gRecentFrames[gGpuTimer->FrameNumber() % NUM_RECENT_FRAMES] = { gDepthPrePass, gCacheShadows };
 
-    // Set shadow maps in shaders
-    // First parameter is the "slot", must match the Texture2D declaration in the HLSL code
-    // In this app the diffuse map uses slot 0, the shadow maps use slots 1 onwards. If we were using other maps (e.g. normal map) then
-    // we might arrange things differently
+    //***************************************//
+    //// Render from light's point of view ////
 
-    ID3D11ShaderResourceView* shadowMaps[NUM_SPOTLIGHTS];
-    ID3D11ShaderResourceView* colourMaps[NUM_SPOTLIGHTS];
-    
-    for (int i = 0; i < NUM_SPOTLIGHTS; i++)
-    {
-        shadowMaps[i] = gSpotlights[i].shadowMapSRV;
-        colourMaps[i] = gSpotlights[i].colourMapSRV;
-    }
+    RenderShadowMaps();
 
-    gD3DContext->PSSetShaderResources(10, NUM_SPOTLIGHTS, shadowMaps);
-    gD3DContext->PSSetShaderResources(30, NUM_SPOTLIGHTS, colourMaps);
-    gD3DContext->PSSetSamplers(1, 1, &gPointSampler);
+    //// Main scene rendering ////
 
     // Render the scene for the main window
     RenderSceneFromCamera(gCamera);
 
-    // Unbind shadow maps from shaders - prevents warnings from DirectX when we try to render to the shadow maps again next frame
-    for (unsigned int i = 0; i < NUM_SPOTLIGHTS; i++)
-    {
-        shadowMaps[i] = nullptr;
-        colourMaps[i] = nullptr;
-    }
-
-    gD3DContext->PSSetShaderResources(10, NUM_SPOTLIGHTS, shadowMaps);
-    gD3DContext->PSSetShaderResources(30, NUM_SPOTLIGHTS, colourMaps);
+    // Send all the recorded passes to the GPU in the order they were added: shadow maps first, then the main scene.
+    // Every pass binds its own targets and shadow maps, and the immediate context is reset after each one is executed,
+    // so the shadow maps never stay bound as shader inputs when they are rendered to next frame
+    gPassRecorder->Submit();
+    UpdateGpuTimes();
 
     //// Scene completion ////
 
@@ -985,7 +1673,6 @@ void RenderScene()
     gSwapChain->Present(0, 0);
 }
 
-
 //--------------------------------------------------------------------------------------
 // Scene Update
 //--------------------------------------------------------------------------------------
@@ -993,10 +1680,18 @@ void RenderScene()
 // Update models and camera. frameTime is the time passed since the last frame
 void UpdateScene(float frameTime)
 {
-    // Light effects
+    // Light effects - all the animated lights are updated together, then only the ones that changed are copied back
+    gLightAnimation.Update(frameTime);
     for (int i = 0; i < NUM_LIGHTS; i++)
     {
-        gLights[i]->Update(frameTime);
+        gLights[i]->Update(gLightAnimation);
+    }
+    for (uint32_t animation : gLightAnimation.ChangedLights())
+    {
+        if (animation < gFirstSwarmAnimation)  continue;
+        SwarmLight& light = gSwarmLights[animation - gFirstSwarmAnimation];
+        light.intensity = gLightAnimation.Colour(animation) * gLightAnimation.Strength(animation) * POINTLIGHT_REFERENCE_DISTANCE;
+        light.radius    = PointlightInfluenceRadius(light.intensity);
     }
 
     // Wiggle effect
@@ -1015,9 +1710,51 @@ void UpdateScene(float frameTime)
     if (go)  rotate -= gLightOrbitSpeed * frameTime;
     if (KeyHit(Key_1))  go = !go;
 
+    // Switch between multithreaded and serial recording of render passes
+    if (KeyHit(Key_2))  gMultithreadedRecording = !gMultithreadedRecording;
+
+    // Switch the depth pre-pass on and off
+    if (KeyHit(Key_3))  gDepthPrePass = !gDepthPrePass;
+
+    // Switch between clustered point lights and per-object light lists
+    if (KeyHit(Key_5))  gUseObjectLights = !gUseObjectLights;
+
+    // Switch the static shadow cache on and off
+    if (KeyHit(Key_6))  gCacheShadows = !gCacheShadows;
+
+    // Switch the parallax mapping between a single offset and several refining steps (a different shader variant)
+    if (KeyHit(Key_7))  gParallaxSteps = !gParallaxSteps;
+
+    // Switch the culling of clusters of large meshes on and off
+    if (KeyHit(Key_8))  gClusterCulling = !gClusterCulling;
+
+    // Show or hide the swarm of point lights, and move them around their circles
+    if (KeyHit(Key_4))  gShowSwarm = !gShowSwarm;
+    if (gShowSwarm)
+    {
+        for (auto& light : gSwarmLights)
+        {
+            light.angle += light.orbitSpeed * frameTime;
+        }
+    }
+
 	// Control camera (will update its view matrix)
 	gCamera->Control(frameTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D );
 
+    // Pick up meshes loaded in the background and copy some more of them to the GPU. Once everything is loaded show the
+    // load times, mesh optimisation results and any errors, and free the imported data
+    gMeshManager.Update(MESH_UPLOAD_BYTES_PER_FRAME);
+    if (!gMeshReportShown && gMeshManager.NumLoading() == 0)
+    {
+        OutputDebugStringA(gMeshManager.OptimisationReport().c_str()); // Shown in Visual Studio's output window
+        gMeshManager.ReleaseImportData();
+        gMeshReportShown = true;
+    }
+
+    // Pack the geometry pool together when meshes freed have left too many gaps. Done here between frames as it replaces the
+    // buffers that recorded commands refer to
+    if (gGeometryPool.NumFreeRanges() >= GEOMETRY_DEFRAGMENT_GAPS)  gGeometryPool.Defragment();
+
     // Show frame time / FPS in the window title //
     const float fpsUpdateTime = 0.5f; // How long between updates (in seconds)
     static float totalFrameTime = 0;
@@ -1031,8 +1768,97 @@ void UpdateScene(float frameTime)
         std::ostringstream frameTimeMs;
         frameTimeMs.precision(2);
         frameTimeMs << std::fixed << avgFrameTime * 1000;
+
+        // GPU time of the opaque models, including the depth pre-pass if it is on, and the time the pre-pass saves once it has
+        // been measured both ways
+        auto milliseconds = [](float seconds)
+        {
+            std::ostringstream text;
+            text.precision(2);
+            text << std::fixed << seconds * 1000 << "ms";
+            return text.str();
+        };
+        std::string opaqueGpuText = ", Opaque GPU: " + milliseconds(gOpaqueGpuTime[gDepthPrePass]);
+        if (gOpaqueGpuTime[0] > 0 && gOpaqueGpuTime[1] > 0)
+        {
+            opaqueGpuText += " (pre-pass saves " + milliseconds(gOpaqueGpuTime[0] - gOpaqueGpuTime[1]) + ")";
+        }
+
+        // Memory used by the shadow atlas and colour atlas compared with a separate shadow map and colour map for each light
+        // (the directional light counted as one), which is what each light had before. The static shadow caches are copies
+        // of the two atlases that separate maps would have needed too, so they are shown on their own
+        const uint64_t shadowBytesPerTexel = 4; // DXGI_FORMAT_R32_TYPELESS
+        const uint64_t colourBytesPerTexel = 4; // DXGI_FORMAT_R8G8B8A8_UNORM
+        uint64_t atlasTexels    = static_cast<uint64_t>(SHADOW_ATLAS_SIZE) * SHADOW_ATLAS_SIZE;
+        uint64_t separateTexels = static_cast<uint64_t>(SEPARATE_SHADOW_MAP_SIZE) * SEPARATE_SHADOW_MAP_SIZE * (NUM_SPOTLIGHTS + 1);
+        uint64_t atlasBytes     = atlasTexels    * (shadowBytesPerTexel + colourBytesPerTexel);
+        uint64_t separateBytes  = separateTexels * (shadowBytesPerTexel + colourBytesPerTexel);
+        uint64_t cacheBytes     = atlasTexels    * (shadowBytesPerTexel + colourBytesPerTexel);
+        int64_t  savedMB        = (static_cast<int64_t>(separateBytes) - static_cast<int64_t>(atlasBytes)) / (1024 * 1024);
+        int64_t  cacheMB        = static_cast<int64_t>(cacheBytes) / (1024 * 1024);
+
+        // Number of times each light's static shadow cache has been rebuilt, and the shadow draws it saved last frame
+        std::string shadowCacheText = ", Shadow cache off";
+        if (gCacheShadows)
+        {
+            shadowCacheText = ", Shadow cache rebuilds:";
+            for (int i = 0; i < NUM_SPOTLIGHTS; i++)
+            {
+                shadowCacheText += (i == 0 ? " " : "/") + std::to_string(gSpotlights[i].cacheRebuilds);
+            }
+            shadowCacheText += ", " + std::to_string(gCachedShadowDraws) + " shadow draws saved";
+        }
+
+        // GPU time of the spotlight shadows, and the time the cache saves once it has been measured both ways
+        shadowCacheText += ", Spotlight shadows GPU: " + milliseconds(gSpotlightShadowGpuTime[gCacheShadows]);
+        if (gSpotlightShadowGpuTime[0] > 0 && gSpotlightShadowGpuTime[1] > 0)
+        {
+            shadowCacheText += " (cache saves " + milliseconds(gSpotlightShadowGpuTime[0] - gSpotlightShadowGpuTime[1]) + ")";
+        }
+
+        // Number of models drawn into each shadow cascade
+        std::string cascadeText = ", Cascade casters:";
+        for (int i = 0; i < gDirectionalLight.cascades.NumCascades(); i++)
+        {
+            cascadeText += (i == 0 ? " " : "/") + std::to_string(gDirectionalLight.NumCasters(i));
+        }
+
+        // Meshes still loading in the background or failed, and the longest any mesh took from being asked for to being drawn
+        std::string meshLoadText;
+        if (gMeshManager.NumLoading() > 0)  meshLoadText += ", " + std::to_string(gMeshManager.NumLoading()) + " loading";
+        if (gMeshManager.NumFailed() > 0)   meshLoadText += ", " + std::to_string(gMeshManager.NumFailed()) + " failed";
+        float slowestLoad = 0;
+        for (auto& loadTime : gMeshManager.LoadTimes())
+        {
+            if (loadTime.latency > slowestLoad)  slowestLoad = loadTime.latency;
+        }
+        if (!gMeshManager.LoadTimes().empty())
+        {
+            meshLoadText += ", slowest drawn after " + std::to_string(static_cast<int>(slowestLoad * 1000 + 0.5f)) + "ms";
+        }
+
         std::string windowTitle = "CO2409 Assignment - Frame Time: " + frameTimeMs.str() +
-                                  "ms, FPS: " + std::to_string(static_cast<int>(1 / avgFrameTime + 0.5f));
+                                  "ms, FPS: " + std::to_string(static_cast<int>(1 / avgFrameTime + 0.5f)) +
+                                  (gMultithreadedRecording ? ", Recording threads: " + std::to_string(gDeferredPassRecorder->NumThreads())
+                                                           : ", Serial recording") +
+                                  (gDepthPrePass ? ", Depth pre-pass" : "") + opaqueGpuText +
+                                  ", Point lights: " + std::to_string(gPointlightData.size()) +
+                                  (gUseObjectLights ? " (per-object)" : " (clustered)") +
+                                  ", Shadow atlas: " + std::to_string(static_cast<int>(gShadowAtlas.Occupancy() * 100 + 0.5f)) +
+                                  "% used, " + std::to_string(savedMB) + "MB saved (+" + std::to_string(cacheMB) + "MB cache)" +
+                                  shadowCacheText + cascadeText +
+                                  ", Shaders: " + ShaderPermutationName(gShaderPermutation) +
+                                  ", Meshes: " + std::to_string(gMeshManager.NumImports()) + " imports for " +
+                                  std::to_string(gMeshManager.NumRequests()) + " requests, " +
+                                  std::to_string(static_cast<int>(gMeshManager.LoadTime() * 1000 + 0.5f)) + "ms" + meshLoadText +
+                                  ", Triangles: " + std::to_string(gTrianglesSubmitted.load()) +
+                                  ", Clusters: " + (gClusterCulling ? std::to_string(gClustersCulled.load()) + " of " +
+                                                                      std::to_string(gClustersTested.load()) + " culled"
+                                                                    : std::string("off")) +
+                                  ", Geometry: " + std::to_string(static_cast<int>(gGeometryPool.Occupancy() * 100 + 0.5f)) + "% of " +
+                                  std::to_string(gGeometryPool.CapacityBytes() / (1024 * 1024)) + "MB used, " +
+                                  std::to_string(gGeometryPool.NumFormats()) + " vertex formats, " +
+                                  std::to_string(gGeometryPool.NumFreeRanges()) + " gaps";
         SetWindowTextA(gHWnd, windowTitle.c_str());
         totalFrameTime = 0;
         frameCount = 0;
@@ -6,7 +6,10 @@
 #ifndef _SCENE_H_INCLUDED_
 #define _SCENE_H_INCLUDED_
 
+#include "ShaderPermutations.h"
+
 class SceneModel;
+class PipelineState;
 
 enum RenderMode
 {
@@ -26,9 +29,51 @@ enum RenderMode
 	Ghost,			 // Same as above, but doesn't cast shadows
 	MultBlend,		 // Transparent object rendered using multiplicative blending, no lighting
 	AlphBlend,		 // Texture transparency is retained, no lighting
-	None			 // Assign this to hide an object
+	None,			 // Assign this to hide an object
+
+	NumRenderModes
 };
 
+// Textures a render mode uses from its SceneModel, combine with |
+enum ModelTextures
+{
+	UsesNoTextures    = 0,
+	UsesDiffuseMap    = 1, // texture->diffuseSpecularMapSRV in slot 0
+	UsesNormalMap     = 2, // texture->normalMapSRV in slot 1
+	UsesSecondTexture = 4, // texture2->diffuseSpecularMapSRV in slot 4
+};
+
+// How models using each render mode are drawn. Built at start-up from the render mode table in Scene.cpp
+struct RenderModeInfo
+{
+	bool                 transparent    = false;   // Drawn after the opaque models
+	unsigned short       order          = 0;       // Opaque models are drawn in order of their render mode, then by depth
+	int                  textures       = UsesNoTextures;
+	const PipelineState* pipeline       = nullptr; // nullptr if never drawn
+	const PipelineState* shadowPipeline = nullptr; // nullptr if no shadow is cast
+	bool                 colouredShadow = false;   // Shadow pipeline draws into the light's colour map rather than the shadow map
+
+	// Opaque modes only, used when the depth pre-pass is on
+	const PipelineState* depthOnlyPipeline  = nullptr; // Writes depth without any shading
+	const PipelineState* depthEqualPipeline = nullptr; // Same as pipeline, but only draws pixels left visible by the pre-pass
+
+	// Large meshes can skip clusters off screen (see MeshClusters.h), only if the vertex shader doesn't move the vertices. Also
+	// clusters facing away if back faces are culled
+	bool clusterCulling  = false;
+	bool clusterBackFaces = false;
+
+	// The two pipelines above for each variant of the pixel shader (see ShaderPermutations.h), indexed by PermutationIndex
+	// Each frame pipeline and depthEqualPipeline are set from these for the variant chosen for the frame
+	const PipelineState* permutationPipelines[NUM_SHADER_PERMUTATIONS]           = {};
+	const PipelineState* permutationDepthEqualPipelines[NUM_SHADER_PERMUTATIONS] = {};
+};
+
+extern RenderModeInfo gRenderModes[NumRenderModes];
+
+// Clears the viewport's area of the current depth buffer and render target to the far distance and white. Used to clear one
+// light's region of a shadow atlas, the clear commands always clear the whole texture
+extern const PipelineState* gShadowClearPipeline;
+
 //--------------------------------------------------------------------------------------
 // Scene Geometry and Layout
 //--------------------------------------------------------------------------------------
@@ -12,4 +12,11 @@ SceneModel::~SceneModel()
 	model = nullptr;
 	texture = nullptr;
 	texture2 = nullptr;
+}
+
+void SceneModel::BindTextures(CommandStream& commands, int textures)
+{
+	if (textures & UsesDiffuseMap)     commands.BindTexture(0, texture->diffuseSpecularMapSRV);
+	if (textures & UsesNormalMap)      commands.BindTexture(1, texture->normalMapSRV);
+	if (textures & UsesSecondTexture)  commands.BindTexture(4, texture2->diffuseSpecularMapSRV);
 }
\ No newline at end of file
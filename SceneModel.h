@@ -27,6 +27,7 @@ public:
 	Texture* texture = nullptr;
 	Texture* texture2 = nullptr;
 	RenderMode renderMode = Default;
+	bool dynamicShadow = false; // Moves or animates, so its shadow is drawn every frame rather than cached with the static models' shadows
 
 	SceneModel()
 	{
@@ -36,5 +37,8 @@ public:
 	SceneModel(Texture* modelTexture, Texture* modelTexture2 = nullptr);
 
 	~SceneModel();
+
+	// Add commands to bind the textures given by a combination of ModelTextures flags (see Scene.h)
+	void BindTextures(CommandStream& commands, int textures);
 };
 
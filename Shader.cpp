@@ -4,6 +4,7 @@
 //--------------------------------------------------------------------------------------
 
 #include "Shader.h"
+#include "ShaderPermutations.h"
 #include <fstream>
 #include <vector>
 #include <d3dcompiler.h>
@@ -33,6 +34,8 @@ ID3D11PixelShader*  gTextureGradientPixelShader = nullptr;
 ID3D11PixelShader*  gCubeMapPixelShader         = nullptr;
 ID3D11PixelShader*  gCubeMapLightPixelShader    = nullptr;
 ID3D11PixelShader*  gCubeMapAnimatedPixelShader = nullptr;
+ID3D11VertexShader* gShadowClearVertexShader    = nullptr; // Clears a region of the shadow atlas (see Scene.cpp)
+ID3D11PixelShader*  gShadowClearPixelShader     = nullptr;
 
 //--------------------------------------------------------------------------------------
 // Shader creation / destruction
@@ -62,24 +65,44 @@ bool LoadShaders()
     gCubeMapPixelShader          = LoadPixelShader("CubeMap_ps");
     gCubeMapLightPixelShader     = LoadPixelShader("CubeMapLight_ps");
     gCubeMapAnimatedPixelShader  = LoadPixelShader("AnimatedCubeMap_ps");
+    gShadowClearVertexShader     = LoadVertexShader("ShadowClear_vs");
+    gShadowClearPixelShader      = LoadPixelShader ("ShadowClear_ps");
 
     if (gDefaultVertexShader        == nullptr  || gDefaultPixelShader       == nullptr   || gBrightPixelShader          == nullptr ||
         gNormalMappingVertexShader  == nullptr  || gNormalMappingPixelShader == nullptr   || gParallaxMappingPixelShader == nullptr ||
         gWiggleVertexShader         == nullptr  || gWigglePixelShader        == nullptr   || gTextureGradientPixelShader == nullptr ||
         gBasicTransformVertexShader == nullptr  || gLightModelPixelShader    == nullptr   || gDepthOnlyPixelShader       == nullptr ||
         gTexFadePixelShader         == nullptr  || gAlphaPixelShader         == nullptr   || gAlphaLightingPixelShader   == nullptr ||
-        gCubeMapPixelShader         == nullptr  || gCubeMapLightPixelShader  == nullptr   || gCubeMapAnimatedPixelShader == nullptr)
+        gCubeMapPixelShader         == nullptr  || gCubeMapLightPixelShader  == nullptr   || gCubeMapAnimatedPixelShader == nullptr ||
+        gShadowClearVertexShader    == nullptr  || gShadowClearPixelShader   == nullptr)
     {
         gLastError = "Error loading shaders";
         return false;
     }
 
+    // Variants of the lighting shaders with only the lights and features a frame needs (see ShaderPermutations.h)
+    // The alpha lighting shader doesn't use coloured shadows, only parallax mapping has parallax steps
+    const int lightingFeatures = PermuteSpotlights | PermuteColourShadows;
+    if (!LoadPixelShaderPermutations(gDefaultPixelShader,         "Default_ps",         lightingFeatures) ||
+        !LoadPixelShaderPermutations(gWigglePixelShader,          "Wiggle_ps",          lightingFeatures) ||
+        !LoadPixelShaderPermutations(gNormalMappingPixelShader,   "NormalMapping_ps",   lightingFeatures) ||
+        !LoadPixelShaderPermutations(gParallaxMappingPixelShader, "ParallaxMapping_ps", lightingFeatures | PermuteParallaxSteps) ||
+        !LoadPixelShaderPermutations(gTexFadePixelShader,         "TextureFade_ps",     lightingFeatures) ||
+        !LoadPixelShaderPermutations(gAlphaLightingPixelShader,   "AlphaLighting_ps",   PermuteSpotlights) ||
+        !LoadPixelShaderPermutations(gBrightPixelShader,          "Bright_ps",          lightingFeatures) ||
+        !LoadPixelShaderPermutations(gTextureGradientPixelShader, "TextureGradient_ps", lightingFeatures) ||
+        !LoadPixelShaderPermutations(gCubeMapLightPixelShader,    "CubeMapLight_ps",    lightingFeatures))
+    {
+        return false; // gLastError set by LoadPixelShaderPermutations
+    }
+
     return true;
 }
 
 
 void ReleaseShaders()
 {
+    ReleasePixelShaderPermutations();
     if (gDepthOnlyPixelShader)        gDepthOnlyPixelShader->Release();
     if (gLightModelPixelShader)       gLightModelPixelShader->Release();
     if (gBasicTransformVertexShader)  gBasicTransformVertexShader->Release();
@@ -98,6 +121,8 @@ void ReleaseShaders()
     if (gCubeMapPixelShader)          gCubeMapPixelShader->Release();
     if (gCubeMapLightPixelShader)     gCubeMapLightPixelShader->Release();
     if (gCubeMapAnimatedPixelShader)  gCubeMapAnimatedPixelShader->Release();
+    if (gShadowClearPixelShader)      gShadowClearPixelShader->Release();
+    if (gShadowClearVertexShader)     gShadowClearVertexShader->Release();
 }
 
 // Load a vertex shader, include the file in the project and pass the name (without the .hlsl extension)
@@ -178,11 +203,18 @@ ID3DBlob* CreateSignatureForVertexLayout(const D3D11_INPUT_ELEMENT_DESC vertexLa
     for (int elt = 0; elt < numElements; ++elt)
     {
         auto& format = vertexLayout[elt].Format;
-        // This list should be more complete for production use
+        // This list should be more complete for production use. Normalised integer and 16-bit float formats are read by the
+        // shader as floats (used by compressed meshes)
         if      (format == DXGI_FORMAT_R32G32B32A32_FLOAT) shaderSource += "float4";
         else if (format == DXGI_FORMAT_R32G32B32_FLOAT)    shaderSource += "float3";
         else if (format == DXGI_FORMAT_R32G32_FLOAT)       shaderSource += "float2";
         else if (format == DXGI_FORMAT_R32_FLOAT)          shaderSource += "float";
+        else if (format == DXGI_FORMAT_R16G16B16A16_SNORM) shaderSource += "float4";
+        else if (format == DXGI_FORMAT_R16G16_SNORM)       shaderSource += "float2";
+        else if (format == DXGI_FORMAT_R16_SNORM)          shaderSource += "float";
+        else if (format == DXGI_FORMAT_R16G16B16A16_FLOAT) shaderSource += "float4";
+        else if (format == DXGI_FORMAT_R16G16_FLOAT)       shaderSource += "float2";
+        else if (format == DXGI_FORMAT_R16_FLOAT)          shaderSource += "float";
         else return nullptr; // Unsupported type in layout
 
         uint8_t index = static_cast<uint8_t>(vertexLayout[elt].SemanticIndex);
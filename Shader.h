@@ -34,6 +34,8 @@ extern ID3D11VertexShader* gSkyVertexShader;
 extern ID3D11PixelShader*  gCubeMapPixelShader;
 extern ID3D11PixelShader*  gCubeMapLightPixelShader;
 extern ID3D11PixelShader*  gCubeMapAnimatedPixelShader;
+extern ID3D11VertexShader* gShadowClearVertexShader;
+extern ID3D11PixelShader*  gShadowClearPixelShader;
 
 //--------------------------------------------------------------------------------------
 // Shader creation / destruction
@@ -0,0 +1,213 @@
+//--------------------------------------------------------------------------------------
+// Shader permutations - variants of the lighting pixel shaders for the lights and features in use
+//--------------------------------------------------------------------------------------
+
+#include "ShaderPermutations.h"
+#include "Shader.h"
+
+#include <d3dcompiler.h>
+#include <fstream>
+#include <vector>
+
+// Number of steps used by the detailed parallax variants
+const int DETAILED_PARALLAX_STEPS = 8;
+
+
+//--------------------------------------------------------------------------------------
+// Choosing variants
+//--------------------------------------------------------------------------------------
+
+// Each permutation has an index from 0 to NUM_SHADER_PERMUTATIONS - 1, e.g. for arrays of pipelines
+int PermutationIndex(const ShaderPermutation& permutation)
+{
+    return (permutation.spotlightBucket * 2 + (permutation.colourShadows ? 1 : 0)) * 2 + (permutation.parallaxSteps ? 1 : 0);
+}
+
+
+// The permutation with the given index, the reverse of the above
+ShaderPermutation PermutationFromIndex(int index)
+{
+    ShaderPermutation permutation;
+    permutation.spotlightBucket = index / 4;
+    permutation.colourShadows   = (index / 2) % 2 == 1;
+    permutation.parallaxSteps   = index % 2 == 1;
+    return permutation;
+}
+
+
+// The smallest variant that can light a frame with the given number of spotlights and features
+ShaderPermutation ChooseShaderPermutation(int numSpotlights, bool colourShadows, bool parallaxSteps)
+{
+    ShaderPermutation permutation;
+    permutation.spotlightBucket = 0;
+    while (permutation.spotlightBucket < NUM_SPOTLIGHT_BUCKETS - 1 && SPOTLIGHT_BUCKETS[permutation.spotlightBucket] < numSpotlights)
+    {
+        ++permutation.spotlightBucket;
+    }
+    permutation.colourShadows = colourShadows;
+    permutation.parallaxSteps = parallaxSteps;
+    return permutation;
+}
+
+
+// Short description of a variant, e.g. for the window title
+std::string ShaderPermutationName(const ShaderPermutation& permutation)
+{
+    return std::to_string(SPOTLIGHT_BUCKETS[permutation.spotlightBucket]) + " spotlights" +
+           (permutation.colourShadows ? ", colour shadows" : "") +
+           (permutation.parallaxSteps ? ", parallax x" + std::to_string(DETAILED_PARALLAX_STEPS) : "");
+}
+
+
+//--------------------------------------------------------------------------------------
+// Compiling and loading variants
+//--------------------------------------------------------------------------------------
+
+struct PixelShaderPermutations
+{
+    ID3D11PixelShader*              shader;   // The shader as built by the project, used to look up its variants
+    std::vector<ID3D11PixelShader*> variants; // For each permutation index. Settings the shader doesn't use share a variant
+};
+std::vector<PixelShaderPermutations> gPixelShaderPermutations;
+
+
+// True if the file exists and was written after the other file (which may not exist)
+static bool IsNewerThan(const std::string& fileName, const std::string& otherFileName)
+{
+    WIN32_FILE_ATTRIBUTE_DATA file, other;
+    if (!GetFileAttributesExA(fileName.c_str(), GetFileExInfoStandard, &file))  return false;
+    if (!GetFileAttributesExA(otherFileName.c_str(), GetFileExInfoStandard, &other))  return true;
+    return CompareFileTime(&file.ftLastWriteTime, &other.ftLastWriteTime) > 0;
+}
+
+
+// Load a variant compiled on an earlier run, or compile it from the shader's source with the given settings and save the
+// result for next time. Returns nullptr on failure, with the compiler's message in gLastError
+static ID3D11PixelShader* LoadPixelShaderVariant(const std::string& shaderName, const std::string& variantName,
+                                                 const D3D_SHADER_MACRO* defines)
+{
+    std::string sourceFile  = shaderName + ".hlsl";
+    std::string variantFile = variantName + ".cso";
+    if (IsNewerThan(variantFile, sourceFile) && IsNewerThan(variantFile, "Common.hlsli"))
+    {
+        ID3D11PixelShader* shader = LoadPixelShader(variantName);
+        if (shader != nullptr)  return shader;
+    }
+
+    // Compile with the same settings as the project's shaders (#include paths are relative to the shader's file)
+    std::wstring wideSourceFile(sourceFile.begin(), sourceFile.end());
+    ID3DBlob* byteCode = nullptr;
+    ID3DBlob* errors   = nullptr;
+    HRESULT hr = D3DCompileFromFile(wideSourceFile.c_str(), defines, D3D_COMPILE_STANDARD_FILE_INCLUDE, "main", "ps_5_0",
+                                    D3DCOMPILE_OPTIMIZATION_LEVEL3, 0, &byteCode, &errors);
+    if (FAILED(hr))
+    {
+        gLastError = "Error compiling shader permutation " + variantName;
+        if (errors != nullptr)
+        {
+            gLastError += "\n" + std::string(static_cast<const char*>(errors->GetBufferPointer()), errors->GetBufferSize());
+            errors->Release();
+        }
+        return nullptr;
+    }
+    if (errors != nullptr)  errors->Release(); // Warnings
+
+    // Save the compiled variant. Not fatal if this fails, the variant will just be compiled again next time
+    std::ofstream file(variantFile, std::ios::out | std::ios::binary);
+    file.write(static_cast<const char*>(byteCode->GetBufferPointer()), byteCode->GetBufferSize());
+    file.close();
+
+    ID3D11PixelShader* shader = nullptr;
+    hr = gD3DDevice->CreatePixelShader(byteCode->GetBufferPointer(), byteCode->GetBufferSize(), nullptr, &shader);
+    byteCode->Release();
+    if (FAILED(hr))
+    {
+        gLastError = "Error creating shader permutation " + variantName;
+        return nullptr;
+    }
+    return shader;
+}
+
+
+// Load the variants of a pixel shader already loaded with LoadPixelShader, compiling any that are missing or out of date.
+// Pass the shader name without the .hlsl extension. Returns false on failure, with the compiler's message in gLastError
+bool LoadPixelShaderPermutations(ID3D11PixelShader* shader, const std::string& shaderName, int features)
+{
+    PixelShaderPermutations permutations;
+    permutations.shader = shader;
+    permutations.variants.assign(NUM_SHADER_PERMUTATIONS, nullptr);
+
+    // Settings the shader doesn't use are left at their defaults, so those permutations share one variant. The first pass
+    // loads the variants, the second shares them with the other permutations
+    bool success = true;
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int index = 0; index < NUM_SHADER_PERMUTATIONS; ++index)
+        {
+            ShaderPermutation permutation = PermutationFromIndex(index);
+            ShaderPermutation variant;
+            if (features & PermuteSpotlights)     variant.spotlightBucket = permutation.spotlightBucket;
+            if (features & PermuteColourShadows)  variant.colourShadows   = permutation.colourShadows;
+            if (features & PermuteParallaxSteps)  variant.parallaxSteps   = permutation.parallaxSteps;
+
+            int variantIndex = PermutationIndex(variant);
+            if (variantIndex != index)
+            {
+                if (pass == 1)  permutations.variants[index] = permutations.variants[variantIndex];
+                continue;
+            }
+            if (pass == 1)  continue;
+
+            std::string spotlights = std::to_string(SPOTLIGHT_BUCKETS[variant.spotlightBucket]);
+            std::string steps      = std::to_string(variant.parallaxSteps ? DETAILED_PARALLAX_STEPS : 1);
+            D3D_SHADER_MACRO defines[] =
+            {
+                { "MAX_SHADER_SPOTLIGHTS", spotlights.c_str() },
+                { "COLOUR_SHADOWS",        variant.colourShadows ? "1" : "0" },
+                { "PARALLAX_STEPS",        steps.c_str() },
+                { nullptr, nullptr }
+            };
+            std::string variantName = shaderName + "_L" + spotlights + (variant.colourShadows ? "_C" : "") +
+                                      (variant.parallaxSteps ? "_P" + steps : "");
+
+            permutations.variants[index] = LoadPixelShaderVariant(shaderName, variantName, defines);
+            if (permutations.variants[index] == nullptr)  success = false;
+        }
+    }
+
+    // Keep what was loaded even on failure so it is released
+    gPixelShaderPermutations.push_back(permutations);
+    return success;
+}
+
+
+// The variant of a pixel shader for the given settings, or the shader itself if it has no variants
+ID3D11PixelShader* GetPixelShaderPermutation(ID3D11PixelShader* shader, const ShaderPermutation& permutation)
+{
+    for (auto& permutations : gPixelShaderPermutations)
+    {
+        if (permutations.shader == shader)  return permutations.variants[PermutationIndex(permutation)];
+    }
+    return shader;
+}
+
+
+// Release all the variants
+void ReleasePixelShaderPermutations()
+{
+    for (auto& permutations : gPixelShaderPermutations)
+    {
+        for (int i = 0; i < NUM_SHADER_PERMUTATIONS; ++i)
+        {
+            // Shared variants are only released by the permutation that owns them (the first to use them)
+            ID3D11PixelShader* variant = permutations.variants[i];
+            bool owner = true;
+            for (int j = 0; j < i; ++j)
+            {
+                if (permutations.variants[j] == variant)  owner = false;
+            }
+            if (owner && variant != nullptr)  variant->Release();
+        }
+    }
+    gPixelShaderPermutations.clear();
+}
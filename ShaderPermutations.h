@@ -0,0 +1,74 @@
+//--------------------------------------------------------------------------------------
+// Shader permutations - variants of the lighting pixel shaders for the lights and features in use
+//--------------------------------------------------------------------------------------
+// The lighting pixel shaders are written for the worst case: up to 15 spotlights, shadows tinted
+// by transparent objects and so on, so every pixel pays for features the scene might not be
+// using. Each lighting pixel shader is also compiled into several variants (permutations) with
+// preprocessor settings that remove what isn't needed: a loop over fewer spotlights (in buckets,
+// so there aren't too many variants), with or without coloured shadows and, for parallax mapping,
+// a single offset or several refining steps. Each frame the smallest variant that covers the
+// scene is chosen.
+//
+// The variants are compiled from the .hlsl files the first time the app runs and saved as .cso
+// files next to the ones the project builds, so later runs only load them. A variant is compiled
+// again if its shader or Common.hlsli has changed since.
+
+#ifndef _SHADER_PERMUTATIONS_H_INCLUDED_
+#define _SHADER_PERMUTATIONS_H_INCLUDED_
+
+#include <string>
+
+// Declared in d3d11.h, only used by pointer here
+struct ID3D11PixelShader;
+
+// Numbers of spotlights there are variants for. The last must be the most spotlights the shaders support
+const int NUM_SPOTLIGHT_BUCKETS = 5;
+const int SPOTLIGHT_BUCKETS[NUM_SPOTLIGHT_BUCKETS] = { 1, 2, 4, 8, 15 };
+
+// Settings for one variant, the defaults are the most general
+struct ShaderPermutation
+{
+    int  spotlightBucket = NUM_SPOTLIGHT_BUCKETS - 1; // Index into SPOTLIGHT_BUCKETS, the most spotlights the shader will light with
+    bool colourShadows   = true;  // Shadows tinted by the transparent objects the light passes through (the colour atlas)
+    bool parallaxSteps   = false; // Parallax mapping refines its offset over several steps rather than one
+};
+
+const int NUM_SHADER_PERMUTATIONS = NUM_SPOTLIGHT_BUCKETS * 2 * 2;
+
+// Each permutation has an index from 0 to NUM_SHADER_PERMUTATIONS - 1, e.g. for arrays of pipelines
+int PermutationIndex(const ShaderPermutation& permutation);
+
+// The permutation with the given index, the reverse of the above
+ShaderPermutation PermutationFromIndex(int index);
+
+// The smallest variant that can light a frame with the given number of spotlights and features
+ShaderPermutation ChooseShaderPermutation(int numSpotlights, bool colourShadows, bool parallaxSteps);
+
+// Short description of a variant, e.g. for the window title
+std::string ShaderPermutationName(const ShaderPermutation& permutation);
+
+
+//--------------------------------------------------------------------------------------
+// Pixel shader variants
+//--------------------------------------------------------------------------------------
+
+// Settings a shader's variants differ by. A shader doesn't get separate variants for settings it doesn't use
+enum PermutationFeatures
+{
+    PermuteSpotlights    = 1, // MAX_SHADER_SPOTLIGHTS in Common.hlsli
+    PermuteColourShadows = 2, // COLOUR_SHADOWS in Common.hlsli
+    PermuteParallaxSteps = 4, // PARALLAX_STEPS in ParallaxMapping_ps.hlsl
+};
+
+// Load the variants of a pixel shader already loaded with LoadPixelShader, compiling any that are missing or out of date.
+// Pass the shader name without the .hlsl extension. Returns false on failure, with the compiler's message in gLastError
+bool LoadPixelShaderPermutations(ID3D11PixelShader* shader, const std::string& shaderName, int features);
+
+// The variant of a pixel shader for the given settings, or the shader itself if it has no variants
+ID3D11PixelShader* GetPixelShaderPermutation(ID3D11PixelShader* shader, const ShaderPermutation& permutation);
+
+// Release all the variants
+void ReleasePixelShaderPermutations();
+
+
+#endif //_SHADER_PERMUTATIONS_H_INCLUDED_
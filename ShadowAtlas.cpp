@@ -0,0 +1,301 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas - sharing one large shadow texture between many lights
+//--------------------------------------------------------------------------------------
+
+#include "ShadowAtlas.h"
+
+#include <algorithm>
+
+
+//--------------------------------------------------------------------------------------
+// Quadtree allocator
+//--------------------------------------------------------------------------------------
+
+// The atlas and smallest square must be powers of two
+AtlasAllocator::AtlasAllocator(uint32_t atlasSize, uint32_t minSize)
+{
+    mAtlasSize = atlasSize;
+    mNumLevels = 1;
+    for (uint32_t size = atlasSize; size > minSize; size /= 2)  ++mNumLevels;
+    Clear();
+}
+
+
+// Free everything
+void AtlasAllocator::Clear()
+{
+    mFree.assign(mNumLevels, std::vector<AtlasRect>());
+    mFree[0].push_back({ 0, 0, mAtlasSize });
+    mUsedArea = 0;
+}
+
+
+// Level 0 is the whole atlas, each level below has squares half the size
+int AtlasAllocator::Level(uint32_t size) const
+{
+    int level = 0;
+    for (uint32_t levelSize = mAtlasSize; levelSize > size && level < mNumLevels - 1; levelSize /= 2)  ++level;
+    return level;
+}
+
+
+// Find a free square of the given (power of two) size. Returns false if there is no space
+bool AtlasAllocator::Allocate(uint32_t size, AtlasRect& rect)
+{
+    // Use a free square of the right size if there is one, otherwise split the smallest larger one available
+    int level = Level(size);
+    int freeLevel = level;
+    while (freeLevel >= 0 && mFree[freeLevel].empty())  --freeLevel;
+    if (freeLevel < 0)  return false;
+
+    AtlasRect square = mFree[freeLevel].back();
+    mFree[freeLevel].pop_back();
+
+    // Split into quarters until it is small enough, keeping the top-left quarter and freeing the others
+    while (freeLevel < level)
+    {
+        uint32_t half = square.size / 2;
+        ++freeLevel;
+        mFree[freeLevel].push_back({ square.x + half, square.y + half, half });
+        mFree[freeLevel].push_back({ square.x,        square.y + half, half });
+        mFree[freeLevel].push_back({ square.x + half, square.y,        half });
+        square.size = half;
+    }
+
+    rect = square;
+    mUsedArea += static_cast<uint64_t>(square.size) * square.size;
+    return true;
+}
+
+
+// Allocate a particular square, e.g. to give back one that has just been freed. Returns false if any of it is in use
+bool AtlasAllocator::AllocateAt(const AtlasRect& rect)
+{
+    auto contains = [&](const AtlasRect& square)
+    {
+        return rect.x >= square.x && rect.y >= square.y && rect.x < square.x + square.size && rect.y < square.y + square.size;
+    };
+
+    // Find the free square holding this one, which is the same size or larger
+    int level = Level(rect.size);
+    int freeLevel = level;
+    std::vector<AtlasRect>::iterator found;
+    for (; freeLevel >= 0; --freeLevel)
+    {
+        found = std::find_if(mFree[freeLevel].begin(), mFree[freeLevel].end(), contains);
+        if (found != mFree[freeLevel].end())  break;
+    }
+    if (freeLevel < 0)  return false;
+
+    AtlasRect square = *found;
+    mFree[freeLevel].erase(found);
+
+    // Split into quarters until it is the right size, keeping the quarter holding the square and freeing the others
+    while (freeLevel < level)
+    {
+        uint32_t half = square.size / 2;
+        ++freeLevel;
+        AtlasRect quarters[4] = { { square.x + half, square.y + half, half }, { square.x, square.y + half, half },
+                                  { square.x + half, square.y, half },        { square.x, square.y, half } };
+        for (const AtlasRect& quarter : quarters)
+        {
+            if (contains(quarter))  square = quarter;
+            else                    mFree[freeLevel].push_back(quarter);
+        }
+    }
+
+    mUsedArea += static_cast<uint64_t>(square.size) * square.size;
+    return true;
+}
+
+
+// Return a square to the free space, joining it back up with its neighbours where possible
+void AtlasAllocator::Free(const AtlasRect& rect)
+{
+    if (rect.size == 0)  return;
+    mUsedArea -= static_cast<uint64_t>(rect.size) * rect.size;
+
+    AtlasRect square = rect;
+    int level = Level(square.size);
+    while (level > 0)
+    {
+        // If the other three quarters of the parent square are all free, remove them and free the parent instead
+        uint32_t parentX = square.x & ~(square.size * 2 - 1);
+        uint32_t parentY = square.y & ~(square.size * 2 - 1);
+        std::vector<AtlasRect>& freeList = mFree[level];
+        int numSiblings = 0;
+        for (const AtlasRect& free : freeList)
+        {
+            if ((free.x & ~(square.size * 2 - 1)) == parentX && (free.y & ~(square.size * 2 - 1)) == parentY)  ++numSiblings;
+        }
+        if (numSiblings < 3)  break;
+
+        freeList.erase(std::remove_if(freeList.begin(), freeList.end(), [&](const AtlasRect& free)
+        {
+            return (free.x & ~(square.size * 2 - 1)) == parentX && (free.y & ~(square.size * 2 - 1)) == parentY;
+        }), freeList.end());
+
+        square = { parentX, parentY, square.size * 2 };
+        --level;
+    }
+    mFree[level].push_back(square);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Shadow atlas
+//--------------------------------------------------------------------------------------
+
+// Lights get square regions between minSize and maxSize (powers of two) in an atlas of atlasSize
+// At most maxChangesPerFrame lights change size each frame
+ShadowAtlas::ShadowAtlas(uint32_t atlasSize, uint32_t minSize, uint32_t maxSize, uint32_t maxChangesPerFrame)
+    : mAllocator(atlasSize, minSize)
+{
+    mMinSize = minSize;
+    mMaxSize = std::min(maxSize, atlasSize);
+    mMaxChangesPerFrame = maxChangesPerFrame;
+}
+
+
+// Size the light should have given its importance and current size. Only changes when the importance has moved well
+// past the point where the size would change, so lights near the boundary don't keep switching
+uint32_t ShadowAtlas::TargetSize(float importance, uint32_t currentSize) const
+{
+    // Grow once the ideal size is half way to the next size up, shrink once it is a quarter of the way below the next size down
+    // Lights without a region yet start from the smallest size so only grow, which picks the nearest size
+    float idealSize = importance * mMaxSize;
+    uint32_t size = (currentSize != 0) ? currentSize : mMinSize;
+    while (size < mMaxSize && idealSize >= size * 1.5f)  size *= 2;
+    while (size > mMinSize && idealSize <  size * 0.375f)  size /= 2;
+    return size;
+}
+
+
+// Update each light's region given its importance (0 to 1, the fraction of the largest resolution it should have)
+void ShadowAtlas::Update(const float* importances, uint32_t numLights)
+{
+    mNumChanged = 0;
+    mRepacked   = false;
+
+    bool newLights = (numLights != mRects.size());
+    if (newLights)  mRects.assign(numLights, { 0, 0, 0 });
+
+    //// Choose sizes ////
+
+    mTargetSizes.resize(numLights);
+    uint64_t totalArea = 0;
+    for (uint32_t i = 0; i < numLights; ++i)
+    {
+        mTargetSizes[i] = TargetSize(importances[i], mRects[i].size);
+        totalArea += static_cast<uint64_t>(mTargetSizes[i]) * mTargetSizes[i];
+    }
+
+    // If they don't all fit, halve the largest until they do (or everything is at the smallest size)
+    uint64_t atlasArea = static_cast<uint64_t>(AtlasSize()) * AtlasSize();
+    while (totalArea > atlasArea)
+    {
+        uint32_t largest = 0;
+        for (uint32_t i = 1; i < numLights; ++i)
+        {
+            if (mTargetSizes[i] > mTargetSizes[largest])  largest = i;
+        }
+        if (mTargetSizes[largest] <= mMinSize)  break;
+
+        uint64_t area = static_cast<uint64_t>(mTargetSizes[largest]) * mTargetSizes[largest];
+        mTargetSizes[largest] /= 2;
+        totalArea -= area - area / 4;
+    }
+
+    if (newLights)
+    {
+        Repack();
+        return;
+    }
+
+    //// Move a few lights ////
+
+    // Lights whose size should change, the biggest changes first
+    mOrder.clear();
+    for (uint32_t i = 0; i < numLights; ++i)
+    {
+        if (mTargetSizes[i] != mRects[i].size)  mOrder.push_back(i);
+    }
+    auto change = [&](uint32_t i)
+    {
+        if (mRects[i].size == 0)  return mTargetSizes[i]; // Light that didn't fit last time
+        return (mTargetSizes[i] > mRects[i].size) ? mTargetSizes[i] / mRects[i].size : mRects[i].size / mTargetSizes[i];
+    };
+    std::stable_sort(mOrder.begin(), mOrder.end(), [&](uint32_t a, uint32_t b) { return change(a) > change(b); });
+
+    // Shrinking always fits in the light's current space and makes room for the growing lights, so all shrinking is done
+    // straight away. Only a few lights grow each frame
+    uint32_t numGrown = 0;
+    bool blocked = false;
+    for (int shrinking = 1; shrinking >= 0; --shrinking)
+    {
+        for (uint32_t i : mOrder)
+        {
+            if (mTargetSizes[i] == mRects[i].size)  continue; // Shrunk in the first pass
+            bool shrink = mTargetSizes[i] < mRects[i].size;
+            if (shrink != (shrinking == 1))  continue;
+            if (!shrink && numGrown >= mMaxChangesPerFrame)  continue;
+
+            AtlasRect rect;
+            mAllocator.Free(mRects[i]);
+            if (mAllocator.Allocate(mTargetSizes[i], rect))
+            {
+                mRects[i] = rect;
+                ++mNumChanged;
+            }
+            else
+            {
+                // No space, give the light back the region it had so its shadow map stays where it is (this can't fail,
+                // that space was just freed)
+                if (mRects[i].size != 0)  mAllocator.AllocateAt(mRects[i]);
+                blocked = true;
+            }
+            if (!shrink)  ++numGrown;
+        }
+    }
+
+    // If lights have been unable to grow for a while the free space must be too fragmented (or the lights don't fit),
+    // so start again with everything at its target size. Not done straight away because lights shrinking over the
+    // next few frames might make enough space anyway
+    if (!blocked)
+    {
+        mBlockedFrames = 0;
+    }
+    else if (++mBlockedFrames >= REPACK_DELAY_FRAMES && totalArea <= atlasArea)
+    {
+        Repack();
+    }
+}
+
+
+// Allocate every light at its target size, largest first (which can't fail if the total area fits)
+void ShadowAtlas::Repack()
+{
+    mAllocator.Clear();
+
+    uint32_t numLights = static_cast<uint32_t>(mRects.size());
+    mOrder.resize(numLights);
+    for (uint32_t i = 0; i < numLights; ++i)  mOrder[i] = i;
+    std::stable_sort(mOrder.begin(), mOrder.end(), [&](uint32_t a, uint32_t b) { return mTargetSizes[a] > mTargetSizes[b]; });
+
+    for (uint32_t i : mOrder)
+    {
+        // Only fails if there are so many lights that even the smallest size doesn't fit, those lights get no shadows
+        if (!mAllocator.Allocate(mTargetSizes[i], mRects[i]))  mRects[i] = { 0, 0, 0 };
+    }
+
+    mNumChanged    = numLights;
+    mRepacked      = true;
+    mBlockedFrames = 0;
+}
+
+
+// Fraction of the atlas in use
+float ShadowAtlas::Occupancy() const
+{
+    return static_cast<float>(mAllocator.UsedArea()) / (static_cast<float>(AtlasSize()) * AtlasSize());
+}
@@ -0,0 +1,114 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas - sharing one large shadow texture between many lights
+//--------------------------------------------------------------------------------------
+// Rather than each light owning its own full size shadow map, all the lights render into
+// different square regions of one shared texture (the atlas). Each light is given a resolution
+// depending on how important its shadows are on screen, so distant lights use less memory and
+// more shadowed lights fit in the same space.
+//
+// Regions are power of two squares allocated from a quadtree: the atlas is split into four, each
+// quarter into four and so on, and a free square is split when a smaller one is needed. As lights
+// move their resolution changes, but only a few lights are moved each frame so the cost of
+// repacking is spread over several frames. Doesn't use any Direct3D so it can be tested on any
+// platform.
+
+#ifndef _SHADOW_ATLAS_H_INCLUDED_
+#define _SHADOW_ATLAS_H_INCLUDED_
+
+#include <vector>
+#include <cstdint>
+
+// A square region of the atlas, in texels
+struct AtlasRect
+{
+    uint32_t x, y;
+    uint32_t size; // Zero if nothing is allocated
+};
+
+
+//--------------------------------------------------------------------------------------
+// Quadtree allocator of power of two squares
+//--------------------------------------------------------------------------------------
+class AtlasAllocator
+{
+public:
+    // The atlas and smallest square must be powers of two
+    AtlasAllocator(uint32_t atlasSize, uint32_t minSize);
+
+    // Find a free square of the given (power of two) size. Returns false if there is no space
+    bool Allocate(uint32_t size, AtlasRect& rect);
+
+    // Allocate a particular square, e.g. to give back one that has just been freed. Returns false if any of it is in use
+    bool AllocateAt(const AtlasRect& rect);
+
+    // Return a square to the free space, joining it back up with its neighbours where possible
+    void Free(const AtlasRect& rect);
+
+    // Free everything
+    void Clear();
+
+    uint32_t AtlasSize() const  { return mAtlasSize; }
+    uint64_t UsedArea() const   { return mUsedArea; }
+
+private:
+    int Level(uint32_t size) const; // Level 0 is the whole atlas, each level below has squares half the size
+
+    uint32_t mAtlasSize;
+    int      mNumLevels;
+    uint64_t mUsedArea = 0;
+
+    std::vector<std::vector<AtlasRect>> mFree; // Free squares at each level
+};
+
+
+//--------------------------------------------------------------------------------------
+// Shadow atlas for a set of lights
+//--------------------------------------------------------------------------------------
+class ShadowAtlas
+{
+public:
+    // Lights get square regions between minSize and maxSize (powers of two) in an atlas of atlasSize
+    // At most maxChangesPerFrame lights change size each frame
+    ShadowAtlas(uint32_t atlasSize = 4096, uint32_t minSize = 256, uint32_t maxSize = 2048, uint32_t maxChangesPerFrame = 1);
+
+    // Update each light's region given its importance (0 to 1, the fraction of the largest resolution it should have)
+    void Update(const float* importances, uint32_t numLights);
+
+    // Region for each light after Update
+    const AtlasRect& Rect(uint32_t light) const  { return mRects[light]; }
+
+    uint32_t AtlasSize() const  { return mAllocator.AtlasSize(); }
+
+    // Fraction of the atlas in use
+    float Occupancy() const;
+
+    // Statistics for the last Update
+    uint32_t NumChanged() const  { return mNumChanged; }   // Lights given a new region
+    bool     Repacked() const    { return mRepacked; }     // Everything was reallocated because there was no space
+
+private:
+    // Size the light should have given its importance and current size. Only changes when the importance has moved well
+    // past the point where the size would change, so lights near the boundary don't keep switching
+    uint32_t TargetSize(float importance, uint32_t currentSize) const;
+
+    // Allocate every light at its target size, largest first (which can't fail if the total area fits)
+    void Repack();
+
+    AtlasAllocator mAllocator;
+    uint32_t mMinSize, mMaxSize;
+    uint32_t mMaxChangesPerFrame;
+
+    std::vector<AtlasRect> mRects;
+    std::vector<uint32_t>  mTargetSizes;
+    std::vector<uint32_t>  mOrder; // Temporary space for sorting lights
+
+    // Number of updates in a row where some light couldn't be given its target size, repack after REPACK_DELAY_FRAMES
+    static const uint32_t REPACK_DELAY_FRAMES = 30;
+    uint32_t mBlockedFrames = 0;
+
+    uint32_t mNumChanged = 0;
+    bool     mRepacked   = false;
+};
+
+
+#endif //_SHADOW_ATLAS_H_INCLUDED_
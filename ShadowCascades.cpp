@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+// Shadow cascades - shadow maps for a directional light fitted to the camera's view
+//--------------------------------------------------------------------------------------
+
+#include "ShadowCascades.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+// numCascades cover the camera's view from its near clip to shadowDistance. splitBlend chooses between evenly spaced
+// splits (0) and logarithmic splits (1), which give the near cascades more detail. Models up to casterDistance beyond
+// each cascade towards the light are included as casters
+ShadowCascades::ShadowCascades(int numCascades, float shadowDistance, float splitBlend, float casterDistance)
+{
+    mNumCascades    = std::min(std::max(numCascades, 1), MAX_SHADOW_CASCADES);
+    mShadowDistance = shadowDistance;
+    mSplitBlend     = splitBlend;
+    mCasterDistance = casterDistance;
+
+    for (int i = 0; i < MAX_SHADOW_CASCADES; ++i)
+    {
+        mSplitDepths[i] = 0;
+        mCentres[i] = { 0, 0, 0 };
+        mRadii[i] = 0;
+        mViewMatrices[i] = MatrixIdentity();
+        mProjectionMatrices[i] = MatrixIdentity();
+    }
+    mLightX = { 1, 0, 0 };
+    mLightY = { 0, 1, 0 };
+    mLightZ = { 0, 0, 1 };
+}
+
+
+// Fit the cascades to the camera. lightDirection is the direction the light travels. resolutions gives the size in texels of
+// each cascade's shadow map, used to snap the cascades to whole texels (a size of 0 means the cascade has no shadow map)
+void ShadowCascades::Update(const CMatrix4x4& cameraViewMatrix, const CMatrix4x4& cameraProjectionMatrix, float nearClip,
+                            const CVector3& lightDirection, const uint32_t* resolutions)
+{
+    //// Light space ////
+
+    // Any axes at right angles to the light will do, but they must not change from frame to frame or the snapping won't work
+    mLightZ = Normalise(lightDirection);
+    CVector3 up = (std::abs(mLightZ.y) < 0.99f) ? CVector3{ 0, 1, 0 } : CVector3{ 1, 0, 0 };
+    mLightX = Normalise(Cross(up, mLightZ));
+    mLightY = Cross(mLightZ, mLightX);
+
+    //// Camera ////
+
+    CMatrix4x4 cameraMatrix = InverseAffine(cameraViewMatrix);
+    CVector3 cameraPosition = cameraMatrix.GetPosition();
+    CVector3 cameraX = cameraMatrix.GetXAxis();
+    CVector3 cameraY = cameraMatrix.GetYAxis();
+    CVector3 cameraZ = cameraMatrix.GetZAxis();
+    float tanHalfFOVx = 1.0f / cameraProjectionMatrix.e00;
+    float tanHalfFOVy = 1.0f / cameraProjectionMatrix.e11;
+
+    float splitNear = nearClip;
+    for (int i = 0; i < mNumCascades; ++i)
+    {
+        //// Split ////
+
+        // Blend of logarithmic splits (the same ratio between each) and evenly spaced splits
+        float fraction = static_cast<float>(i + 1) / mNumCascades;
+        float logSplit  = nearClip * std::pow(mShadowDistance / nearClip, fraction);
+        float evenSplit = nearClip + (mShadowDistance - nearClip) * fraction;
+        float splitFar  = mSplitBlend * logSplit + (1 - mSplitBlend) * evenSplit;
+        mSplitDepths[i] = splitFar;
+
+        //// Bounding sphere ////
+
+        // Sphere around the eight corners of this slice of the view frustum. A sphere doesn't change size as the camera
+        // turns so the shadow map's texels stay the same size in the world
+        CVector3 corners[8];
+        CVector3 centre = { 0, 0, 0 };
+        int corner = 0;
+        for (float depth : { splitNear, splitFar })
+        {
+            for (float sx : { -1.0f, 1.0f })
+            {
+                for (float sy : { -1.0f, 1.0f })
+                {
+                    corners[corner] = cameraPosition + cameraZ * depth + cameraX * (sx * depth * tanHalfFOVx) +
+                                                                         cameraY * (sy * depth * tanHalfFOVy);
+                    centre = centre + corners[corner];
+                    ++corner;
+                }
+            }
+        }
+        centre = centre * (1.0f / 8);
+
+        float radius = 0;
+        for (const CVector3& point : corners)  radius = std::max(radius, Length(point - centre));
+        radius = std::ceil(radius * 16.0f) / 16.0f; // Tiny changes in radius from rounding errors would also cause shimmering
+
+        //// Snapping ////
+
+        // Move the centre across the light's view to a whole number of texels, so as the camera moves the shadow map
+        // moves in whole texels and shadow edges stay still
+        CVector3 lightCentre = { Dot(centre, mLightX), Dot(centre, mLightY), Dot(centre, mLightZ) };
+        if (resolutions[i] > 0)
+        {
+            float texelSize = 2 * radius / resolutions[i];
+            lightCentre.x = std::floor(lightCentre.x / texelSize) * texelSize;
+            lightCentre.y = std::floor(lightCentre.y / texelSize) * texelSize;
+        }
+        mCentres[i] = lightCentre;
+        mRadii[i]   = radius;
+
+        //// Matrices ////
+
+        // The "camera" for the cascade sits back towards the light far enough to see casters outside the sphere
+        float backDistance = radius + mCasterDistance;
+        CVector3 position = mLightX * lightCentre.x + mLightY * lightCentre.y + mLightZ * (lightCentre.z - backDistance);
+        CMatrix4x4 lightMatrix = MatrixIdentity();
+        lightMatrix.SetRow(0, mLightX);
+        lightMatrix.SetRow(1, mLightY);
+        lightMatrix.SetRow(2, mLightZ);
+        lightMatrix.SetRow(3, position);
+        mViewMatrices[i] = InverseAffine(lightMatrix);
+
+        // Orthographic projection - the light's rays are parallel. Covers the sphere across and from the camera to the far side
+        float depthRange = backDistance + radius;
+        mProjectionMatrices[i] = CMatrix4x4{ 1.0f / radius,          0.0f,              0.0f, 0.0f,
+                                                      0.0f, 1.0f / radius,              0.0f, 0.0f,
+                                                      0.0f,          0.0f, 1.0f / depthRange, 0.0f,
+                                                      0.0f,          0.0f,              0.0f, 1.0f };
+
+        splitNear = splitFar;
+    }
+}
+
+
+// True if a model with the given world bounding sphere might cast a shadow into the cascade
+bool ShadowCascades::IsCaster(int cascade, const CVector3& centre, float radius) const
+{
+    // Compare in light space: must overlap the cascade across the light's view, and must not be entirely beyond the far side
+    // of the cascade or further towards the light than the caster distance
+    CVector3 lightCentre = { Dot(centre, mLightX), Dot(centre, mLightY), Dot(centre, mLightZ) };
+    const CVector3& cascadeCentre = mCentres[cascade];
+    float reach = mRadii[cascade] + radius;
+    if (std::abs(lightCentre.x - cascadeCentre.x) > reach)  return false;
+    if (std::abs(lightCentre.y - cascadeCentre.y) > reach)  return false;
+    if (lightCentre.z - radius > cascadeCentre.z + mRadii[cascade])  return false;
+    if (lightCentre.z + radius < cascadeCentre.z - mRadii[cascade] - mCasterDistance)  return false;
+    return true;
+}
@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// Shadow cascades - shadow maps for a directional light fitted to the camera's view
+//--------------------------------------------------------------------------------------
+// A directional light (like the sun) lights the whole scene, so one shadow map covering
+// everything would need a huge resolution for sharp shadows near the camera. Instead the
+// camera's view is split into a few depth ranges (cascades), each with its own shadow map
+// covering just that part of the view. Near cascades cover a small area so get sharp shadows,
+// far cascades cover a large area where the lower detail isn't noticed.
+//
+// Each cascade's shadow map covers a sphere around its part of the view, so its size doesn't
+// change as the camera turns, and its position is snapped to whole shadow map texels so shadow
+// edges don't shimmer as the camera moves. Doesn't use any Direct3D so it can be tested on any
+// platform.
+
+#ifndef _SHADOW_CASCADES_H_INCLUDED_
+#define _SHADOW_CASCADES_H_INCLUDED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <cstdint>
+
+// Must match the size of the cascade arrays in the per-frame constants
+const int MAX_SHADOW_CASCADES = 4;
+
+class ShadowCascades
+{
+public:
+    // numCascades cover the camera's view from its near clip to shadowDistance. splitBlend chooses between evenly spaced
+    // splits (0) and logarithmic splits (1), which give the near cascades more detail. Models up to casterDistance beyond
+    // each cascade towards the light are included as casters
+    ShadowCascades(int numCascades = MAX_SHADOW_CASCADES, float shadowDistance = 400.0f, float splitBlend = 0.75f,
+                   float casterDistance = 500.0f);
+
+    // Fit the cascades to the camera. lightDirection is the direction the light travels. resolutions gives the size in texels of
+    // each cascade's shadow map, used to snap the cascades to whole texels (a size of 0 means the cascade has no shadow map)
+    void Update(const CMatrix4x4& cameraViewMatrix, const CMatrix4x4& cameraProjectionMatrix, float nearClip,
+                const CVector3& lightDirection, const uint32_t* resolutions);
+
+    int NumCascades() const  { return mNumCascades; }
+
+    // Camera view depth at the far end of each cascade
+    float SplitDepth(int cascade) const  { return mSplitDepths[cascade]; }
+
+    // Camera-like matrices for rendering each cascade's shadow map (orthographic projection)
+    const CMatrix4x4& ViewMatrix(int cascade) const        { return mViewMatrices[cascade]; }
+    const CMatrix4x4& ProjectionMatrix(int cascade) const  { return mProjectionMatrices[cascade]; }
+
+    // True if a model with the given world bounding sphere might cast a shadow into the cascade
+    bool IsCaster(int cascade, const CVector3& centre, float radius) const;
+
+private:
+    int   mNumCascades;
+    float mShadowDistance;
+    float mSplitBlend;
+    float mCasterDistance;
+
+    // Light space axes, z is the direction the light travels
+    CVector3 mLightX, mLightY, mLightZ;
+
+    float      mSplitDepths[MAX_SHADOW_CASCADES];
+    CVector3   mCentres[MAX_SHADOW_CASCADES]; // Centre of each cascade's sphere in light space (after snapping)
+    float      mRadii[MAX_SHADOW_CASCADES];
+    CMatrix4x4 mViewMatrices[MAX_SHADOW_CASCADES];
+    CMatrix4x4 mProjectionMatrices[MAX_SHADOW_CASCADES];
+};
+
+
+#endif //_SHADOW_CASCADES_H_INCLUDED_
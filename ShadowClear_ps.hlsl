@@ -0,0 +1,17 @@
+//--------------------------------------------------------------------------------------
+// Shadow Clear Pixel Shader
+//--------------------------------------------------------------------------------------
+// Used with the shadow clear vertex shader to clear one light's region of the colour atlas
+// to white (no tint on the light) at the same time as the depth is cleared
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main() : SV_Target
+{
+    return float4(1, 1, 1, 1);
+}
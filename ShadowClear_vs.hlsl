@@ -0,0 +1,22 @@
+//--------------------------------------------------------------------------------------
+// Shadow Clear Vertex Shader
+//--------------------------------------------------------------------------------------
+// Draws a single triangle covering the whole viewport at the far distance. Used to clear one
+// light's region of a shadow atlas, since Direct3D 11 can only clear whole depth buffers.
+// No vertex data is needed, the three corners are made from the vertex number
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(uint vertexID : SV_VertexID) : SV_Position
+{
+    // Vertices 0, 1, 2 give UVs (0,0), (2,0), (0,2) - a triangle twice the size of the viewport so it covers all of it
+    float2 uv = float2((vertexID << 1) & 2, vertexID & 2);
+
+    // Depth of 1 is the far distance, the same value a depth buffer is normally cleared to
+    return float4(uv.x * 2 - 1, 1 - uv.y * 2, 1, 1);
+}
@@ -22,6 +22,7 @@ ID3D11SamplerState* gPointSampler         = nullptr;
 ID3D11SamplerState* gTrilinearSampler     = nullptr;
 ID3D11SamplerState* gAnisotropic4xSampler = nullptr;
 ID3D11SamplerState* gCubeMapSampler       = nullptr;
+ID3D11SamplerState* gShadowComparisonSampler = nullptr;
 
 // Blend states allow us to switch between blending modes (none, additive, multiplicative etc.)
 ID3D11BlendState* gNoBlendingState             = nullptr;
@@ -38,6 +39,8 @@ ID3D11RasterizerState* gCullNoneState  = nullptr;
 ID3D11DepthStencilState* gUseDepthBufferState = nullptr;
 ID3D11DepthStencilState* gDepthReadOnlyState  = nullptr;
 ID3D11DepthStencilState* gNoDepthBufferState  = nullptr;
+ID3D11DepthStencilState* gDepthEqualState     = nullptr;
+ID3D11DepthStencilState* gDepthAlwaysState    = nullptr;
 
 
 //--------------------------------------------------------------------------------------
@@ -123,6 +126,25 @@ bool CreateStates()
         return false;
     }
 
+    ////-------- Shadow map comparison --------////
+    // Used with SampleCmp in the shaders: the hardware compares the pixel's depth from the light with the four nearest shadow
+    // map texels and blends the results bilinearly, which filters shadow edges far more cheaply than comparing samples by hand
+    samplerDesc.Filter = D3D11_FILTER_COMPARISON_MIN_MAG_LINEAR_MIP_POINT;
+    samplerDesc.AddressU = D3D11_TEXTURE_ADDRESS_CLAMP;   // Clamp addressing mode for texture coordinates outside 0->1
+    samplerDesc.AddressV = D3D11_TEXTURE_ADDRESS_CLAMP;   // --"--
+    samplerDesc.AddressW = D3D11_TEXTURE_ADDRESS_CLAMP;   // --"--
+    samplerDesc.ComparisonFunc = D3D11_COMPARISON_LESS;   // Lit if the pixel is nearer the light than the depth in the shadow map
+    samplerDesc.MaxAnisotropy = 1;
+
+    samplerDesc.MaxLOD = 0; // Shadow maps have no mip-maps
+    samplerDesc.MinLOD = 0;
+
+    if (FAILED(gD3DDevice->CreateSamplerState(&samplerDesc, &gShadowComparisonSampler)))
+    {
+        gLastError = "Error creating shadow comparison sampler";
+        return false;
+    }
+
     //--------------------------------------------------------------------------------------
 	// Rasterizer States
 	//--------------------------------------------------------------------------------------
@@ -310,6 +332,37 @@ bool CreateStates()
         return false;
     }
 
+
+    ////-------- Depth equal --------////
+    // Only draws pixels exactly at the depth already in the buffer, without writing. Used after a depth pre-pass
+    // so the expensive pixel shaders only run once for the visible pixel
+    depthStencilDesc.DepthEnable      = TRUE;
+    depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ZERO;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_EQUAL;
+    depthStencilDesc.StencilEnable    = FALSE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gDepthEqualState)))
+    {
+        gLastError = "Error creating depth-equal state";
+        return false;
+    }
+
+
+    ////-------- Depth always --------////
+    // Always draws and writes depth whatever is already in the buffer. Used to clear part of a depth buffer by drawing over it
+    depthStencilDesc.DepthEnable      = TRUE;
+    depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ALL;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_ALWAYS;
+    depthStencilDesc.StencilEnable    = FALSE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gDepthAlwaysState)))
+    {
+        gLastError = "Error creating depth-always state";
+        return false;
+    }
+
     return true;
 }
 
@@ -320,11 +373,14 @@ void ReleaseStates()
     if (gUseDepthBufferState)    gUseDepthBufferState->Release();
     if (gDepthReadOnlyState)     gDepthReadOnlyState->Release();
     if (gNoDepthBufferState)     gNoDepthBufferState->Release();
+    if (gDepthEqualState)        gDepthEqualState->Release();
+    if (gDepthAlwaysState)       gDepthAlwaysState->Release();
     if (gCullBackState)          gCullBackState->Release();
     if (gCullFrontState)         gCullFrontState->Release();
     if (gCullNoneState)          gCullNoneState->Release();
     if (gNoBlendingState)        gNoBlendingState->Release();
     if (gAdditiveBlendingState)  gAdditiveBlendingState->Release();
+    if (gShadowComparisonSampler) gShadowComparisonSampler->Release();
     if (gAnisotropic4xSampler)   gAnisotropic4xSampler->Release();
     if (gTrilinearSampler)       gTrilinearSampler->Release();
     if (gPointSampler)           gPointSampler->Release();
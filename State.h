@@ -22,6 +22,7 @@ extern ID3D11SamplerState* gPointSampler;
 extern ID3D11SamplerState* gTrilinearSampler;
 extern ID3D11SamplerState* gAnisotropic4xSampler;
 extern ID3D11SamplerState* gCubeMapSampler;
+extern ID3D11SamplerState* gShadowComparisonSampler;
 
 extern ID3D11BlendState* gNoBlendingState;
 extern ID3D11BlendState* gAdditiveBlendingState;
@@ -35,6 +36,8 @@ extern ID3D11RasterizerState*   gCullNoneState;
 extern ID3D11DepthStencilState* gUseDepthBufferState;
 extern ID3D11DepthStencilState* gDepthReadOnlyState;
 extern ID3D11DepthStencilState* gNoDepthBufferState;
+extern ID3D11DepthStencilState* gDepthEqualState;
+extern ID3D11DepthStencilState* gDepthAlwaysState;
 
 //--------------------------------------------------------------------------------------
 // State creation / destruction
@@ -0,0 +1,85 @@
+//--------------------------------------------------------------------------------------
+// Structured buffer - an array of structures that shaders can read
+//--------------------------------------------------------------------------------------
+
+#include "StructuredBuffer.h"
+
+#include <stdexcept>
+#include <cstring>
+
+
+// Create a buffer with space for the given number of elements, each elementSize bytes (must match the HLSL structure)
+// Will throw a std::runtime_error exception on failure (since constructors can't return errors)
+StructuredBuffer::StructuredBuffer(uint32_t elementSize, uint32_t capacity) : mElementSize(elementSize)
+{
+    if (!Create(capacity))
+    {
+        throw std::runtime_error("Error creating structured buffer");
+    }
+}
+
+StructuredBuffer::~StructuredBuffer()
+{
+    Release();
+}
+
+
+// Copy elements to the GPU using the immediate context. If there are more than fit, the buffer is recreated larger,
+// which changes the SRV, so call before recording anything that binds it. Returns false on failure
+bool StructuredBuffer::Update(const void* elements, uint32_t numElements)
+{
+    if (numElements > mCapacity)
+    {
+        // Grow to at least double the size so it doesn't happen every frame as the number of elements creeps up
+        uint32_t newCapacity = mCapacity * 2;
+        if (newCapacity < numElements)  newCapacity = numElements;
+
+        Release();
+        if (!Create(newCapacity))  return false;
+    }
+    if (numElements == 0)  return true;
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    if (FAILED(gD3DContext->Map(mBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))  return false;
+    std::memcpy(mapped.pData, elements, numElements * mElementSize);
+    gD3DContext->Unmap(mBuffer, 0);
+    return true;
+}
+
+
+bool StructuredBuffer::Create(uint32_t capacity)
+{
+    if (capacity == 0)  capacity = 1; // Empty buffers aren't allowed
+
+    D3D11_BUFFER_DESC bufferDesc = {};
+    bufferDesc.ByteWidth           = capacity * mElementSize;
+    bufferDesc.Usage               = D3D11_USAGE_DYNAMIC;                    // Updated by the CPU every frame
+    bufferDesc.BindFlags           = D3D11_BIND_SHADER_RESOURCE;             // Read by shaders
+    bufferDesc.CPUAccessFlags      = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags           = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bufferDesc.StructureByteStride = mElementSize;
+    if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mBuffer)))  return false;
+
+    D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Format              = DXGI_FORMAT_UNKNOWN; // Structured buffers have no format, the stride above is used
+    srvDesc.ViewDimension       = D3D11_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    srvDesc.Buffer.NumElements  = capacity;
+    if (FAILED(gD3DDevice->CreateShaderResourceView(mBuffer, &srvDesc, &mSRV)))
+    {
+        Release();
+        return false;
+    }
+
+    mCapacity = capacity;
+    return true;
+}
+
+void StructuredBuffer::Release()
+{
+    if (mSRV)     mSRV->Release();
+    if (mBuffer)  mBuffer->Release();
+    mSRV    = nullptr;
+    mBuffer = nullptr;
+    mCapacity = 0;
+}
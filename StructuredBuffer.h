@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------------
+// Structured buffer - an array of structures that shaders can read
+//--------------------------------------------------------------------------------------
+// Constant buffers have a fixed size (and a 64KB limit), so large or variable amounts of data
+// such as the clustered light lists are sent in structured buffers instead. The shaders declare
+// them as StructuredBuffer<T> with a t register and read them like an array. The buffer is
+// dynamic, its whole content is replaced each time it is updated (usually once per frame).
+
+#ifndef _STRUCTURED_BUFFER_H_INCLUDED_
+#define _STRUCTURED_BUFFER_H_INCLUDED_
+
+#include "Common.h"
+
+#include <cstdint>
+
+class StructuredBuffer
+{
+public:
+    // Create a buffer with space for the given number of elements, each elementSize bytes (must match the HLSL structure)
+    // Will throw a std::runtime_error exception on failure (since constructors can't return errors)
+    StructuredBuffer(uint32_t elementSize, uint32_t capacity);
+    ~StructuredBuffer();
+
+    // Prevent copying, the buffer owns its DirectX objects
+    StructuredBuffer(const StructuredBuffer&) = delete;
+    StructuredBuffer& operator=(const StructuredBuffer&) = delete;
+
+    // Copy elements to the GPU using the immediate context. If there are more than fit, the buffer is recreated larger,
+    // which changes the SRV, so call before recording anything that binds it. Returns false on failure
+    bool Update(const void* elements, uint32_t numElements);
+
+    ID3D11ShaderResourceView* SRV()  { return mSRV; }
+    uint32_t Capacity()              { return mCapacity; }
+
+private:
+    bool Create(uint32_t capacity);
+    void Release();
+
+    uint32_t                  mElementSize;
+    uint32_t                  mCapacity = 0;
+    ID3D11Buffer*             mBuffer   = nullptr;
+    ID3D11ShaderResourceView* mSRV      = nullptr;
+};
+
+
+#endif //_STRUCTURED_BUFFER_H_INCLUDED_
@@ -0,0 +1,132 @@
+//--------------------------------------------------------------------------------------
+// Command stream tests - writes commands, reads them back and replays them through NullBackend
+//--------------------------------------------------------------------------------------
+
+#include "TestHelpers.h"
+
+#include "CommandStream.h"
+#include "NullBackend.h"
+#include "PipelineState.h"
+
+#include <cstring>
+
+// Constant buffer contents are copied into the stream, they must be a multiple of 16 bytes
+struct TestConstants
+{
+    float values[8];
+};
+
+
+int main()
+{
+    PipelineDesc desc;
+    desc.vertexShader = FakeObject<ID3D11VertexShader>(1);
+    desc.sampler      = FakeObject<ID3D11SamplerState>(2);
+    const PipelineState* pipeline = GetPipelineState(desc);
+
+    auto renderTarget = FakeObject<ID3D11RenderTargetView>(3);
+    auto depthStencil = FakeObject<ID3D11DepthStencilView>(4);
+    auto constants    = FakeObject<ID3D11Buffer>(5);
+    ID3D11ShaderResourceView* textures[2] = { FakeObject<ID3D11ShaderResourceView>(6), FakeObject<ID3D11ShaderResourceView>(7) };
+    GeometryCommand geometry = { FakeObject<ID3D11InputLayout>(8), FakeObject<ID3D11Buffer>(9), 44, FakeObject<ID3D11Buffer>(10), 4 };
+    const float clearColour[4] = { 0.2f, 0.2f, 0.3f, 1.0f };
+    TestConstants data = { { 1, 2, 3, 4, 5, 6, 7, 8 } };
+
+    // A typical pass, with a few commands the D3D11 backend would skip as they don't change anything
+    CommandStream commands;
+    commands.SetRenderTargets(renderTarget, depthStencil);
+    commands.SetViewport(1280, 720);
+    commands.ClearRenderTarget(renderTarget, clearColour);
+    commands.ClearDepth(depthStencil);
+    commands.SetPipeline(pipeline);
+    commands.BindConstantBuffer(0, constants);
+    commands.UpdateConstants(constants, data);
+    commands.BindTextures(0, 2, textures);
+    commands.SetGeometry(geometry);
+    commands.DrawIndexed(36, 12, -4);
+    commands.SetPipeline(pipeline);           // Redundant
+    commands.BindTextures(0, 2, textures);    // Redundant
+    commands.BindSampler(0, desc.sampler);    // Redundant, the pipeline set the sampler
+    commands.SetGeometry(geometry);           // Redundant
+    commands.DrawIndexed(3);
+    commands.DrawGenerated(3);
+    commands.CopyTexture(FakeObject<ID3D11Resource>(11), FakeObject<ID3D11Resource>(12));
+    commands.Timestamp(FakeObject<ID3D11Query>(13));
+    CHECK(commands.NumCommands() == 18);
+    CHECK(commands.SizeInBytes() % 8 == 0);
+
+    // Read back a few commands with their extra data
+    int numRead = 0;
+    CommandStream::Reader reader(commands);
+    while (reader.Next())
+    {
+        ++numRead;
+        if (numRead == 7)
+        {
+            CHECK(reader.Type() == RenderCommand::UpdateConstants);
+            CHECK(reader.Get<UpdateConstantsCommand>().buffer == constants);
+            CHECK(reader.Get<UpdateConstantsCommand>().size == sizeof(data));
+            CHECK(std::memcmp(reader.Extra<UpdateConstantsCommand>(), &data, sizeof(data)) == 0);
+        }
+        else if (numRead == 8)
+        {
+            CHECK(reader.Type() == RenderCommand::BindTextures);
+            CHECK(reader.Get<TexturesCommand>().count == 2);
+            CHECK(std::memcmp(reader.Extra<TexturesCommand>(), textures, sizeof(textures)) == 0);
+        }
+        else if (numRead == 10)
+        {
+            CHECK(reader.Type() == RenderCommand::DrawIndexed);
+            CHECK(reader.Get<DrawCommand>().indexCount == 36);
+            CHECK(reader.Get<DrawCommand>().startIndex == 12);
+            CHECK(reader.Get<DrawCommand>().baseVertex == -4);
+        }
+    }
+    CHECK(numRead == 18);
+
+    // Replay the stream and check what the backend counted
+    NullBackend backend;
+    backend.Execute(commands);
+    const NullBackend::Stats& stats = backend.GetStats();
+    CHECK(backend.Errors().empty());
+    CHECK(stats.numDraws == 3);
+    CHECK(stats.numTriangles == 14);
+    CHECK(stats.numCommands[static_cast<size_t>(RenderCommand::SetPipeline)] == 2);
+    CHECK(stats.numCommands[static_cast<size_t>(RenderCommand::DrawIndexed)] == 2);
+    CHECK(stats.numCommands[static_cast<size_t>(RenderCommand::Timestamp)] == 1);
+    CHECK(stats.constantBytesUploaded == sizeof(data));
+    CHECK(stats.redundantStateChanges == 4);
+    CHECK(stats.streamBytes == commands.SizeInBytes());
+
+    // The generated draw removed the input layout, so an indexed draw must set the geometry again
+    commands.DrawIndexed(3);
+    backend.ResetStats();
+    backend.Execute(commands);
+    CHECK(backend.Errors().size() == 1);
+    CHECK(!backend.Errors().empty() && backend.Errors()[0] == "command 18: draw without geometry");
+
+    // Invalid commands are all reported. Clear keeps the memory but removes the commands
+    commands.Clear();
+    CHECK(commands.NumCommands() == 0 && commands.SizeInBytes() == 0);
+    commands.SetViewport(0, 720);
+    commands.BindTextures(127, 2, textures);
+    commands.UpdateConstants(constants, &data, 12);
+    commands.CopyTexture(FakeObject<ID3D11Resource>(11), FakeObject<ID3D11Resource>(11));
+    commands.DrawIndexed(0);
+    backend.ResetStats();
+    backend.Execute(commands);
+    const auto& errors = backend.Errors();
+    CHECK(errors.size() == 8);
+    if (errors.size() == 8)
+    {
+        CHECK(errors[0] == "command 0: empty viewport");
+        CHECK(errors[1] == "command 1: texture slots out of range");
+        CHECK(errors[2] == "command 2: constant data size is not a multiple of 16 bytes");
+        CHECK(errors[3] == "command 3: copying texture to itself");
+        CHECK(errors[4] == "command 4: draw without a pipeline");
+        CHECK(errors[7] == "command 4: draw with no indices");
+    }
+
+    ReleasePipelineStates();
+    return TestResult();
+}
@@ -0,0 +1,61 @@
+//--------------------------------------------------------------------------------------
+// Light animation benchmark - updating 1k to 10k animated lights
+//--------------------------------------------------------------------------------------
+// Times LightAnimation::Update against updating each light on its own as the scene used to
+// (see TestLights.h), for lights that all flicker and cycle colour, the most work per light.
+// Also counts the lights listed as changed when only a tenth of them are animated, which is how
+// many the scene copies back.
+
+#include "TestHelpers.h"
+#include "TestLights.h"
+
+#include "LightAnimation.h"
+
+#include <vector>
+#include <random>
+
+int main()
+{
+    const float FRAME_TIME = 1.0f / 60;
+
+    std::printf("%8s %12s %15s %10s %16s\n", "lights", "update (us)", "one by one (us)", "speed-up", "changed (10%)");
+    for (uint32_t numLights : { 1000u, 2000u, 5000u, 10000u })
+    {
+        std::mt19937 random(numLights);
+        std::uniform_real_distribution<float> unit(0, 1), flickerTimes(0.2f, 3), colourSpeeds(0.1f, 2);
+
+        // Every light flickering and changing colour
+        LightAnimation animation;
+        std::vector<ScalarLight> lights;
+        for (uint32_t i = 0; i < numLights; ++i)
+        {
+            CVector3 colour = { unit(random), unit(random), unit(random) };
+            float strength = 1 + unit(random) * 10, flickerTime = flickerTimes(random), colourSpeed = colourSpeeds(random);
+            int firstColour = random() % NUM_RAINBOW_COLOURS;
+
+            animation.AddLight(colour, strength);
+            animation.MakeFlicker(i, flickerTime);
+            animation.MakeRainbow(i, colourSpeed, firstColour);
+            lights.push_back(ScalarLight(colour, strength));
+            lights.back().MakeFlicker(flickerTime);
+            lights.back().MakeRainbow(colourSpeed, firstColour);
+        }
+
+        float updateTime = TimeFastest(50, [&] { animation.Update(FRAME_TIME); });
+        float scalarTime = TimeFastest(50, [&] { for (auto& light : lights)  light.Update(FRAME_TIME); });
+
+        // Only one light in ten animated, the rest are skipped by the scene after the first update
+        LightAnimation fewAnimated;
+        for (uint32_t i = 0; i < numLights; ++i)
+        {
+            fewAnimated.AddLight({ 1, 1, 1 }, 1);
+            if (i % 10 == 0)  fewAnimated.MakeFlicker(i, flickerTimes(random));
+        }
+        fewAnimated.Update(FRAME_TIME);
+        fewAnimated.Update(FRAME_TIME);
+
+        std::printf("%8u %12.1f %15.1f %9.1fx %16zu\n", numLights, updateTime * 1e6f, scalarTime * 1e6f, scalarTime / updateTime,
+                    fewAnimated.ChangedLights().size());
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+//--------------------------------------------------------------------------------------
+// Light animation tests - same results as animating each light on its own
+//--------------------------------------------------------------------------------------
+// Animates a mix of flickering, rainbow, flickering rainbow and still lights with LightAnimation
+// and with the per-light update it replaced (see TestLights.h), over many frames of varying
+// length, and checks the strengths and colours match. The number of lights isn't a multiple of
+// four so the lights after the last SSE group are checked too. Then checks which lights are
+// listed as changed: animated lights every update, still lights only after being added or
+// changed, and never otherwise.
+
+#include "TestHelpers.h"
+#include "TestLights.h"
+
+#include "LightAnimation.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+int main()
+{
+    //// Same as the per-light update ////
+
+    const uint32_t NUM_LIGHTS = 1003;
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> unit(0, 1), strengths(1, 20), flickerTimes(0.2f, 3), colourSpeeds(0.1f, 2);
+
+    // A quarter each of still, flickering, rainbow and both, mixed up so every SSE group has different kinds
+    LightAnimation animation;
+    std::vector<ScalarLight> lights;
+    for (uint32_t i = 0; i < NUM_LIGHTS; ++i)
+    {
+        CVector3 colour = { unit(random), unit(random), unit(random) };
+        float strength = strengths(random);
+        CHECK(animation.AddLight(colour, strength) == i);
+        lights.push_back(ScalarLight(colour, strength));
+
+        int kind = random() % 4;
+        if (kind & 1)
+        {
+            float flickerTime = flickerTimes(random);
+            animation.MakeFlicker(i, flickerTime);
+            lights[i].MakeFlicker(flickerTime);
+        }
+        if (kind & 2)
+        {
+            float colourSpeed = colourSpeeds(random);
+            int firstColour = random() % NUM_RAINBOW_COLOURS;
+            animation.MakeRainbow(i, colourSpeed, firstColour);
+            lights[i].MakeRainbow(colourSpeed, firstColour);
+        }
+    }
+    CHECK(animation.NumLights() == NUM_LIGHTS);
+
+    // Frames of uneven length, long enough for every light to flicker and change colour several times
+    std::uniform_real_distribution<float> frameTimes(0.002f, 0.03f);
+    float worstStrength = 0, worstColour = 0;
+    for (int frame = 0; frame < 1000; ++frame)
+    {
+        float frameTime = frameTimes(random);
+        animation.Update(frameTime);
+        for (uint32_t i = 0; i < NUM_LIGHTS; ++i)
+        {
+            lights[i].Update(frameTime);
+            worstStrength = std::max(worstStrength, std::fabs(animation.Strength(i) - lights[i].strength) / lights[i].strengthMax);
+            CVector3 colourError = animation.Colour(i) - lights[i].colour;
+            worstColour = std::max({ worstColour, std::fabs(colourError.x), std::fabs(colourError.y), std::fabs(colourError.z) });
+        }
+    }
+    CHECK(worstStrength < 1e-4f);
+    CHECK(worstColour < 1e-4f);
+
+    //// Changed lights ////
+
+    // Animated lights are listed every update, still lights never are once the update after they were added has passed
+    uint32_t numAnimated = 0;
+    for (uint32_t i = 0; i < NUM_LIGHTS; ++i)
+    {
+        bool animated = lights[i].flicker || lights[i].colourChange;
+        CHECK(animation.Changed(i) == animated);
+        if (animated)  ++numAnimated;
+    }
+    CHECK(animation.ChangedLights().size() == numAnimated);
+    CHECK(std::is_sorted(animation.ChangedLights().begin(), animation.ChangedLights().end()));
+    for (uint32_t light : animation.ChangedLights())  CHECK(animation.Changed(light));
+
+    // All listed in the first update, then only the animated ones
+    LightAnimation stillLights;
+    for (uint32_t i = 0; i < 10; ++i)  stillLights.AddLight({ 1, 1, 1 }, 5);
+    stillLights.MakeFlicker(3, 1.0f);
+    stillLights.MakeRainbow(9, 1.0f); // In the scalar remainder after the first SSE groups
+    stillLights.Update(0.01f);
+    CHECK(stillLights.ChangedLights().size() == 10);
+    stillLights.Update(0.01f);
+    CHECK((stillLights.ChangedLights() == std::vector<uint32_t>{ 3, 9 }));
+    for (uint32_t i = 0; i < 10; ++i)  CHECK(stillLights.Changed(i) == (i == 3 || i == 9));
+
+    // A still light is listed once more after being added or changed, the rest stay unchanged with their colour untouched
+    stillLights.AddLight({ 0, 1, 0 }, 2);
+    stillLights.MakeRainbow(5, 0); // Changes the colour once but never moves on
+    stillLights.Update(0.01f);
+    CHECK((stillLights.ChangedLights() == std::vector<uint32_t>{ 3, 5, 9, 10 }));
+    CHECK(stillLights.Colour(5).x == RAINBOW_COLOURS[0].x && stillLights.Colour(5).y == RAINBOW_COLOURS[0].y);
+    stillLights.Update(0.01f);
+    CHECK((stillLights.ChangedLights() == std::vector<uint32_t>{ 3, 9 }));
+    CHECK(stillLights.Colour(0).x == 1 && stillLights.Strength(0) == 5);
+    CHECK(stillLights.Colour(10).y == 1 && stillLights.Strength(10) == 2);
+
+    return TestResult();
+}
@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// Light cluster benchmark - time to assign lights to clusters each frame
+//--------------------------------------------------------------------------------------
+// Before clustering every pixel looped over every light. The benchmark gives the CPU time to
+// build the cluster lists and the number of lights a pixel loops over now, on average over
+// the non-empty clusters and at most.
+
+#include "TestHelpers.h"
+
+#include "LightClusters.h"
+
+#include <vector>
+#include <random>
+#include <thread>
+#include <cmath>
+
+int main()
+{
+    CMatrix4x4 viewMatrix = MatrixIdentity();
+    CMatrix4x4 projectionMatrix = MatrixIdentity();
+    projectionMatrix.e00 = 1.0f / std::tan(0.5236f);
+    projectionMatrix.e11 = projectionMatrix.e00 * 16.0f / 9.0f;
+
+    std::printf("%8s %8s %12s %12s %12s %12s\n", "lights", "threads", "assign (ms)", "per light", "avg/cluster", "max/cluster");
+    std::vector<unsigned int> threadCounts = { 1 };
+    if (std::thread::hardware_concurrency() > 1)  threadCounts.push_back(std::thread::hardware_concurrency());
+    for (uint32_t numLights : { 256u, 1024u, 4096u, 16384u })
+    {
+        // Small lights scattered through the view, like the scene's point lights
+        std::mt19937 random(numLights);
+        std::uniform_real_distribution<float> across(-400, 400), depth(1, 800), size(2, 20);
+        std::vector<CVector3> positions;
+        std::vector<float>    radii;
+        for (uint32_t i = 0; i < numLights; ++i)
+        {
+            positions.push_back({ across(random), across(random) * 0.6f, depth(random) });
+            radii.push_back(size(random));
+        }
+
+        for (unsigned int numThreads : threadCounts)
+        {
+            LightClusters clusters(16, 9, 24, 1.0f, 1000.0f, numThreads);
+            clusters.SetProjection(projectionMatrix, 0.1f, 1000.0f);
+            float time = TimeFastest(20, [&] { clusters.AssignLights(positions.data(), radii.data(), numLights, viewMatrix); });
+
+            uint32_t numUsed = 0;
+            for (auto& cluster : clusters.Clusters())  numUsed += (cluster.count > 0) ? 1 : 0;
+            float average = numUsed ? static_cast<float>(clusters.LightIndices().size()) / numUsed : 0;
+            std::printf("%8u %8u %12.3f %10.1fns %12.1f %12u\n", numLights, numThreads, time * 1000, time * 1e9f / numLights,
+                        average, clusters.MaxLightsPerCluster());
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+//--------------------------------------------------------------------------------------
+// Light cluster tests - checks every light reaching a point is in the point's cluster
+//--------------------------------------------------------------------------------------
+
+#include "TestHelpers.h"
+
+#include "LightClusters.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+const float NEAR_CLIP = 0.1f;
+const float FAR_CLIP  = 2000.0f;
+
+// Point transformed by a matrix (row vector times matrix, as in the shaders)
+static CVector3 TransformPoint(const CVector3& p, const CMatrix4x4& m)
+{
+    return { p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30,
+             p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31,
+             p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32 };
+}
+
+
+int main()
+{
+    // A camera like Camera::UpdateMatrices makes, 60 degree horizontal field of view and 16:9
+    CMatrix4x4 cameraWorld = MatrixRotationX(0.2f) * MatrixRotationY(0.7f) * MatrixTranslation({ 10, 20, -30 });
+    CMatrix4x4 viewMatrix  = InverseAffine(cameraWorld);
+    CMatrix4x4 projectionMatrix = MatrixIdentity();
+    projectionMatrix.e00 = 1.0f / std::tan(0.5236f);
+    projectionMatrix.e11 = projectionMatrix.e00 * 16.0f / 9.0f;
+
+    // Lights of many sizes around and in front of the camera. Not a multiple of four, so the lights after the last SSE
+    // group are tested too
+    const uint32_t NUM_LIGHTS = 1003;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> across(-300, 300), depth(-50, 1200), size(0.5f, 80);
+    std::vector<CVector3> positions;
+    std::vector<float>    radii;
+    for (uint32_t i = 0; i < NUM_LIGHTS; ++i)
+    {
+        positions.push_back(TransformPoint({ across(random), across(random), depth(random) }, cameraWorld));
+        radii.push_back(size(random));
+    }
+
+    // The results don't depend on the number of threads
+    LightClusters clusters(16, 9, 24, 1.0f, 1000.0f, 4);
+    LightClusters singleThread(16, 9, 24, 1.0f, 1000.0f, 1);
+    clusters.SetProjection(projectionMatrix, NEAR_CLIP, FAR_CLIP);
+    singleThread.SetProjection(projectionMatrix, NEAR_CLIP, FAR_CLIP);
+    clusters.AssignLights(positions.data(), radii.data(), NUM_LIGHTS, viewMatrix);
+    singleThread.AssignLights(positions.data(), radii.data(), NUM_LIGHTS, viewMatrix);
+    CHECK(clusters.LightIndices() == singleThread.LightIndices());
+    bool sameClusters = clusters.Clusters().size() == singleThread.Clusters().size();
+    for (size_t c = 0; sameClusters && c < clusters.Clusters().size(); ++c)
+    {
+        sameClusters = clusters.Clusters()[c].offset == singleThread.Clusters()[c].offset &&
+                       clusters.Clusters()[c].count  == singleThread.Clusters()[c].count;
+    }
+    CHECK(sameClusters);
+
+    // Each list is in light order without repeats, and the lists fill the index list
+    const auto& lists   = clusters.Clusters();
+    const auto& indices = clusters.LightIndices();
+    uint32_t maxCount = 0, total = 0;
+    bool listsValid = true;
+    for (auto& list : lists)
+    {
+        listsValid = listsValid && list.offset == total && list.offset + list.count <= indices.size();
+        for (uint32_t i = 1; listsValid && i < list.count; ++i)  listsValid = indices[list.offset + i - 1] < indices[list.offset + i];
+        total += list.count;
+        maxCount = std::max(maxCount, list.count);
+    }
+    CHECK(listsValid);
+    CHECK(total == indices.size());
+    CHECK(maxCount == clusters.MaxLightsPerCluster());
+    CHECK(maxCount < NUM_LIGHTS); // The clustering did something
+
+    // Points on screen, found the same way as the shaders find their cluster. Every light that reaches a point must be
+    // in its cluster's list
+    int numMissing = 0, numTested = 0;
+    std::uniform_real_distribution<float> screen(-0.999f, 0.999f), logDepth(std::log(0.2f), std::log(1500.0f));
+    for (int p = 0; p < 50000; ++p)
+    {
+        float sx = screen(random), sy = screen(random), z = std::exp(logDepth(random));
+        CVector3 world = TransformPoint({ sx * z / projectionMatrix.e00, sy * z / projectionMatrix.e11, z }, cameraWorld);
+
+        uint32_t tileX = static_cast<uint32_t>((sx + 1) * 0.5f * clusters.TilesX());
+        uint32_t tileY = static_cast<uint32_t>((1 - sy) * 0.5f * clusters.TilesY());
+        float    slice = std::floor(std::log(z) * clusters.DepthScale() + clusters.DepthBias());
+        slice = std::min(std::max(slice, 0.0f), clusters.Slices() - 1.0f);
+        const LightCluster& list = lists[tileX + (tileY + static_cast<uint32_t>(slice) * clusters.TilesY()) * clusters.TilesX()];
+
+        for (uint32_t light = 0; light < NUM_LIGHTS; ++light)
+        {
+            if (Length(world - positions[light]) >= radii[light] * 0.999f)  continue;
+            ++numTested;
+            auto begin = indices.begin() + list.offset;
+            if (!std::binary_search(begin, begin + list.count, light))  ++numMissing;
+        }
+    }
+    std::printf("%d light and point pairs checked\n", numTested);
+    CHECK(numTested > 1000);
+    CHECK(numMissing == 0);
+
+    // Without lights every cluster is empty
+    clusters.AssignLights(nullptr, nullptr, 0, viewMatrix);
+    CHECK(clusters.LightIndices().empty());
+    CHECK(clusters.MaxLightsPerCluster() == 0);
+
+    return TestResult();
+}
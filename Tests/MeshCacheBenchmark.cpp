@@ -0,0 +1,48 @@
+//--------------------------------------------------------------------------------------
+// Mesh cache benchmark - loading a cooked mesh against cooking it again
+//--------------------------------------------------------------------------------------
+// Times the work a cooked file saves: cooking a test mesh (optimising, simplifying, clustering)
+// and saving it, against mapping the saved file and reading its data once as the copy to the GPU
+// would. MeshImportBenchmark does the same for the app's mesh files including the assimp import.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshCache.h"
+#include "MeshCook.h"
+
+#include <cstdio>
+
+int main()
+{
+    const std::string cookedFile = "MeshCacheBenchmark.cmesh";
+
+    std::printf("%10s %12s %12s %10s\n", "triangles", "cook (ms)", "load (ms)", "speed-up");
+    for (uint32_t rings : { 32u, 96u, 256u })
+    {
+        uint32_t segments = rings * 2;
+        uint32_t numTriangles = rings * segments * 2;
+
+        float cookTime = TimeFastest(3, [&]
+        {
+            auto data = MakeTestMesh(rings, segments);
+            CookMesh(*data);
+            WriteCookedMesh(cookedFile, 0, 0, data->description);
+        });
+
+        uint64_t checksum = 0;
+        float loadTime = TimeFastest(10, [&]
+        {
+            MappedFile file;
+            CookedMesh mesh;
+            if (!LoadCookedMesh(cookedFile, 0, 0, file, mesh))  return;
+            checksum += HashBytes(mesh.vertices, mesh.numVertices * mesh.vertexSize) + HashBytes(mesh.indices, mesh.numIndices * mesh.indexSize);
+        });
+        if (checksum == 0)  std::printf("Cooked file didn't load\n");
+
+        std::printf("%10u %12.2f %12.2f %9.0fx\n", numTriangles, cookTime * 1000, loadTime * 1000, cookTime / loadTime);
+    }
+
+    std::remove(cookedFile.c_str());
+    return 0;
+}
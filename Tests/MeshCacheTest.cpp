@@ -0,0 +1,138 @@
+//--------------------------------------------------------------------------------------
+// Mesh cache test - cooked files load back exactly as they were saved
+//--------------------------------------------------------------------------------------
+// Cooks a test mesh, saves it, maps it back with LoadCookedMesh and checks every part matches.
+// Then checks that damaged files and files from another source, other settings or another
+// version of the format are rejected rather than drawn.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshCache.h"
+#include "MeshCook.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+
+const uint64_t SOURCE_HASH  = 0x0123456789ABCDEFull;
+const uint32_t IMPORT_FLAGS = 0x1234;
+
+// Whole contents of a file
+std::vector<char> ReadFile(const std::string& fileName)
+{
+    std::ifstream file(fileName, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const std::string& fileName, const std::vector<char>& contents)
+{
+    std::ofstream file(fileName, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+}
+
+// True if a cooked file loads with the settings it was saved with
+bool Loads(const std::string& fileName)
+{
+    MappedFile file;
+    CookedMesh mesh;
+    return LoadCookedMesh(fileName, SOURCE_HASH, IMPORT_FLAGS, file, mesh);
+}
+
+
+int main()
+{
+    const std::string cookedFile  = "MeshCacheTest.cmesh";
+    const std::string damagedFile = "MeshCacheTest.damaged.cmesh";
+
+    // Large enough to have levels of detail and clusters, small enough for 16-bit indices
+    auto data = MakeTestMesh(96, 128);
+    CookMesh(*data);
+    const CookedMesh& cooked = data->description;
+    CHECK(cooked.numLods > 1);
+    CHECK(cooked.numClusters > 0);
+    CHECK(cooked.indexSize == 2);
+    CHECK(cooked.statsAfter.acmr > 0 && cooked.statsAfter.acmr < cooked.statsBefore.acmr);
+
+    //// Round trip ////
+
+    CHECK(WriteCookedMesh(cookedFile, SOURCE_HASH, IMPORT_FLAGS, cooked));
+    {
+        MappedFile file;
+        CookedMesh loaded;
+        CHECK(LoadCookedMesh(cookedFile, SOURCE_HASH, IMPORT_FLAGS, file, loaded));
+
+        CHECK(loaded.numElements == cooked.numElements);
+        for (uint32_t i = 0; i < cooked.numElements && i < loaded.numElements; ++i)
+        {
+            CHECK(loaded.elements[i].semantic   == cooked.elements[i].semantic);
+            CHECK(loaded.elements[i].format     == cooked.elements[i].format);
+            CHECK(loaded.elements[i].components == cooked.elements[i].components);
+            CHECK(loaded.elements[i].offset     == cooked.elements[i].offset);
+        }
+        CHECK(loaded.vertexSize   == cooked.vertexSize);
+        CHECK(loaded.numVertices  == cooked.numVertices);
+        CHECK(loaded.indexSize    == cooked.indexSize);
+        CHECK(loaded.numIndices   == cooked.numIndices);
+        CHECK(loaded.numSubMeshes == cooked.numSubMeshes);
+        CHECK(loaded.numLods      == cooked.numLods);
+        CHECK(loaded.numClusters  == cooked.numClusters);
+        CHECK(loaded.boundsRadius == cooked.boundsRadius);
+        CHECK(loaded.statsBefore.acmr == cooked.statsBefore.acmr && loaded.statsAfter.overdraw == cooked.statsAfter.overdraw);
+
+        // The data is used straight from the mapping, not copied
+        const uint8_t* vertices = static_cast<const uint8_t*>(loaded.vertices);
+        CHECK(vertices >= file.Data() && vertices < file.Data() + file.Size());
+
+        if (loaded.numVertices == cooked.numVertices && loaded.numIndices == cooked.numIndices &&
+            loaded.numSubMeshes == cooked.numSubMeshes && loaded.numLods == cooked.numLods && loaded.numClusters == cooked.numClusters)
+        {
+            CHECK(std::memcmp(loaded.vertices, cooked.vertices, cooked.numVertices * cooked.vertexSize) == 0);
+            CHECK(std::memcmp(loaded.indices, cooked.indices, cooked.numIndices * cooked.indexSize) == 0);
+            CHECK(std::memcmp(loaded.subMeshes, cooked.subMeshes, cooked.numSubMeshes * cooked.numLods * sizeof(SubMesh)) == 0);
+            CHECK(std::memcmp(loaded.clusters, cooked.clusters, cooked.numClusters * sizeof(MeshCluster)) == 0);
+        }
+    }
+
+    //// Files that must be rejected ////
+
+    // Cooked from another version of the source file or with other import settings
+    {
+        MappedFile file;
+        CookedMesh mesh;
+        CHECK(!LoadCookedMesh(cookedFile, SOURCE_HASH + 1, IMPORT_FLAGS, file, mesh));
+        CHECK(!LoadCookedMesh(cookedFile, SOURCE_HASH, IMPORT_FLAGS ^ 1, file, mesh));
+        CHECK(file.Data() == nullptr); // Not left mapped
+    }
+    CHECK(!Loads("MeshCacheTest.missing.cmesh"));
+
+    // Truncated anywhere: in the header, the vertices, the clusters at the end, or by a single byte
+    std::vector<char> contents = ReadFile(cookedFile);
+    CHECK(contents.size() > 1000);
+    for (size_t size : { size_t(0), size_t(16), size_t(100), contents.size() / 2, contents.size() - 64, contents.size() - 1 })
+    {
+        WriteFile(damagedFile, std::vector<char>(contents.begin(), contents.begin() + size));
+        CHECK(!Loads(damagedFile));
+    }
+
+    // Another version of the format (the version follows the 4 byte magic number) or not a cooked file at all
+    std::vector<char> otherVersion = contents;
+    ++reinterpret_cast<uint32_t&>(otherVersion[4]);
+    WriteFile(damagedFile, otherVersion);
+    CHECK(!Loads(damagedFile));
+
+    std::vector<char> otherMagic = contents;
+    otherMagic[0] = 'X';
+    WriteFile(damagedFile, otherMagic);
+    CHECK(!Loads(damagedFile));
+
+    // The unchanged copy still loads, so the rejections above are down to the damage
+    WriteFile(damagedFile, contents);
+    CHECK(Loads(damagedFile));
+
+    std::remove(cookedFile.c_str());
+    std::remove(damagedFile.c_str());
+    return TestResult();
+}
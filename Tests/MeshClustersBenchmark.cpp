@@ -0,0 +1,83 @@
+//--------------------------------------------------------------------------------------
+// Mesh clusters benchmark - building clusters and culling them
+//--------------------------------------------------------------------------------------
+// Times splitting test meshes of increasing size into clusters, as done when they are cooked,
+// and culling the clusters from a set of cameras around the mesh, as done each time a model is
+// drawn. Culling is timed four clusters at a time with SSE and one at a time, and the share of
+// clusters and triangles culled shows what the drawing saves.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshClusters.h"
+#include "MeshOptimiser.h"
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+int main()
+{
+    const int NUM_VIEWS = 64;
+
+    std::printf("%10s %9s %11s %11s %13s %10s %12s\n", "triangles", "clusters", "build (ms)", "cull (us)", "1 at a time", "culled", "tris culled");
+    for (uint32_t rings : { 128u, 256u, 512u })
+    {
+        auto data = MakeTestMesh(rings, rings * 2);
+        CookedMesh& mesh = data->description;
+        uint32_t* indices = reinterpret_cast<uint32_t*>(data->indices.get());
+        OptimiseMesh(mesh, data->vertices.get(), indices); // Clusters are built from the optimised order
+
+        std::vector<MeshCluster> clusters;
+        float buildTime = TimeFastest(3, [&]
+        {
+            clusters.clear();
+            BuildClusters(mesh, data->vertices.get(), indices, clusters);
+        });
+        uint32_t numClusters = static_cast<uint32_t>(clusters.size());
+
+        // Cameras all round the mesh at a few times its size, looking near its centre with a 60 degree view
+        std::mt19937 random(rings);
+        std::uniform_real_distribution<float> unit(-1, 1), distance(2, 6);
+        std::vector<ClusterView> views;
+        for (int v = 0; v < NUM_VIEWS; ++v)
+        {
+            CMatrix4x4 camera = MatrixTranslation(Normalise({ unit(random), unit(random), unit(random) }) * distance(random));
+            camera.FaceTarget(CVector3{ unit(random), unit(random), unit(random) } * 0.5f);
+            CMatrix4x4 projection = {};
+            projection.e00 = 1.3f;
+            projection.e11 = 1.73f;
+            projection.e22 = 1.0001f;
+            projection.e23 = 1;
+            projection.e32 = -0.10001f;
+            views.push_back(MakeClusterView(InverseAffine(camera) * projection, camera.GetPosition(), true));
+        }
+
+        std::vector<uint8_t> visible(numClusters);
+        uint64_t numVisible = 0, trianglesVisible = 0;
+        float cullTime = TimeFastest(5, [&]
+        {
+            numVisible = 0;
+            for (auto& view : views)  numVisible += CullClusters(clusters.data(), numClusters, view, visible.data());
+        });
+        for (auto& view : views)
+        {
+            CullClusters(clusters.data(), numClusters, view, visible.data());
+            for (uint32_t c = 0; c < numClusters; ++c)  trianglesVisible += visible[c] ? clusters[c].numIndices / 3 : 0;
+        }
+        float scalarTime = TimeFastest(5, [&]
+        {
+            for (auto& view : views)
+            {
+                for (uint32_t c = 0; c < numClusters; ++c)  CullClusters(&clusters[c], 1, view, &visible[c]);
+            }
+        });
+
+        uint32_t numTriangles = mesh.numIndices / 3;
+        float culled = 1 - static_cast<float>(numVisible) / (static_cast<float>(numClusters) * NUM_VIEWS);
+        float trianglesCulled = 1 - static_cast<float>(trianglesVisible) / (static_cast<float>(numTriangles) * NUM_VIEWS);
+        std::printf("%10u %9u %11.2f %11.1f %13.1f %9.0f%% %11.0f%%\n", numTriangles, numClusters, buildTime * 1000,
+                    cullTime * 1e6f / NUM_VIEWS, scalarTime * 1e6f / NUM_VIEWS, culled * 100, trianglesCulled * 100);
+    }
+    return 0;
+}
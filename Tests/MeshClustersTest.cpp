@@ -0,0 +1,175 @@
+//--------------------------------------------------------------------------------------
+// Mesh clusters test - cluster limits and bounds, and culling never hides a visible triangle
+//--------------------------------------------------------------------------------------
+// Cooks a test mesh and checks each cluster keeps to the vertex and triangle limits, covers its
+// sub-mesh in order and bounds its triangles. Then culls the clusters from many random cameras
+// and model transforms and checks that no cluster holding a triangle the camera can see (front
+// facing with a corner inside the frustum) is culled, that the SSE path agrees with the scalar
+// one, and that culling does remove a good share of the clusters.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshClusters.h"
+#include "MeshCook.h"
+
+#include <vector>
+#include <set>
+#include <random>
+#include <cmath>
+
+// Index i of a cooked mesh
+uint32_t ReadIndex(const CookedMesh& mesh, uint32_t i)
+{
+    return (mesh.indexSize == 2) ? static_cast<const uint16_t*>(mesh.indices)[i] : static_cast<const uint32_t*>(mesh.indices)[i];
+}
+
+// Model space position of corner i of a sub-mesh's triangles
+CVector3 ReadPosition(const CookedMesh& mesh, const SubMesh& subMesh, uint32_t i)
+{
+    const uint8_t* vertex = static_cast<const uint8_t*>(mesh.vertices) + (subMesh.baseVertex + ReadIndex(mesh, i)) * mesh.vertexSize;
+    CVector3 position;
+    std::memcpy(&position, vertex, sizeof(position));
+    return position;
+}
+
+// Left-handed perspective projection with depth from 0 to 1, row vectors
+CMatrix4x4 PerspectiveMatrix(float fov, float aspect, float nearClip, float farClip)
+{
+    float yScale = 1 / std::tan(fov / 2);
+    CMatrix4x4 m = {};
+    m.e00 = yScale / aspect;
+    m.e11 = yScale;
+    m.e22 = farClip / (farClip - nearClip);
+    m.e23 = 1;
+    m.e32 = -nearClip * farClip / (farClip - nearClip);
+    return m;
+}
+
+// True if a world space point is inside the view of a view-projection matrix
+bool InsideView(const CMatrix4x4& viewProjection, const CVector3& p)
+{
+    const CMatrix4x4& m = viewProjection;
+    float x = p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30;
+    float y = p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31;
+    float z = p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32;
+    float w = p.x * m.e03 + p.y * m.e13 + p.z * m.e23 + m.e33;
+    return w > 0 && std::fabs(x) < w && std::fabs(y) < w && z > 0 && z < w;
+}
+
+// World space position of a model space point
+CVector3 Transform(const CMatrix4x4& m, const CVector3& p)
+{
+    return { p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30,
+             p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31,
+             p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32 };
+}
+
+
+int main()
+{
+    auto data = MakeTestMesh(128, 256);
+    CookMesh(*data);
+    const CookedMesh& mesh = data->description;
+    CHECK(mesh.numClusters > 0);
+
+    //// Building ////
+
+    // Clusters cover each clustered sub-mesh's full detail indices in order, within the limits, bounding their triangles
+    uint32_t cluster = 0;
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)
+    {
+        const SubMesh& subMesh = mesh.subMeshes[s];
+        if (subMesh.numIndices / 3 < MIN_CLUSTERED_TRIANGLES)  continue;
+
+        uint32_t nextIndex = subMesh.startIndex;
+        while (cluster < mesh.numClusters && mesh.clusters[cluster].subMesh == s)
+        {
+            const MeshCluster& c = mesh.clusters[cluster];
+            CHECK(c.startIndex == nextIndex);
+            CHECK(c.numIndices > 0 && c.numIndices % 3 == 0 && c.numIndices / 3 <= MAX_CLUSTER_TRIANGLES);
+
+            std::set<uint32_t> vertices;
+            for (uint32_t i = c.startIndex; i < c.startIndex + c.numIndices; i += 3)
+            {
+                CVector3 p0 = ReadPosition(mesh, subMesh, i);
+                CVector3 p1 = ReadPosition(mesh, subMesh, i + 1);
+                CVector3 p2 = ReadPosition(mesh, subMesh, i + 2);
+                for (uint32_t corner = 0; corner < 3; ++corner)  vertices.insert(ReadIndex(mesh, i + corner));
+                CHECK(Length(p0 - c.centre) <= c.radius && Length(p1 - c.centre) <= c.radius && Length(p2 - c.centre) <= c.radius);
+
+                // Every triangle's direction is inside the cone, unless the cone can't be culled
+                CVector3 normal = Cross(p1 - p0, p2 - p0);
+                if (c.coneCutoff < 1 && Length(normal) > 0)
+                {
+                    // Normalise treats small vectors as zero, these triangles are tiny
+                    float cosAngle = Dot(normal * (1 / Length(normal)), c.coneAxis);
+                    CHECK(cosAngle > 0 && std::sqrt(1 - cosAngle * cosAngle) <= c.coneCutoff + 1e-4f);
+                }
+            }
+            CHECK(vertices.size() <= MAX_CLUSTER_VERTICES);
+
+            nextIndex = c.startIndex + c.numIndices;
+            ++cluster;
+        }
+        CHECK(nextIndex == subMesh.startIndex + subMesh.numIndices);
+    }
+    CHECK(cluster == mesh.numClusters);
+
+    //// Culling ////
+
+    std::mt19937 random(2);
+    std::uniform_real_distribution<float> unit(-1, 1), angle(0, 6.2831853f), distance(1.5f, 6), scale(0.5f, 3);
+    std::vector<uint8_t> visible(mesh.numClusters), scalarVisible(mesh.numClusters);
+    uint64_t numTested = 0, numCulled = 0, numMissed = 0, numDisagree = 0;
+    for (int view = 0; view < 200; ++view)
+    {
+        // A model somewhere near the origin, turned and scaled the same on each axis, seen from a camera a few sizes away
+        // looking somewhere near it
+        float modelScale = scale(random);
+        CMatrix4x4 world = MatrixScaling(modelScale) * MatrixRotationY(angle(random)) * MatrixRotationX(angle(random)) *
+                           MatrixTranslation({ unit(random), unit(random), unit(random) });
+        CVector3 direction = Normalise({ unit(random), unit(random), unit(random) });
+        CMatrix4x4 camera = MatrixTranslation(direction * distance(random) * modelScale);
+        camera.FaceTarget(CVector3{ unit(random), unit(random), unit(random) } * modelScale);
+        CMatrix4x4 viewProjection = InverseAffine(camera) * PerspectiveMatrix(1.0f, 1.5f, 0.1f, 1000.0f);
+
+        ClusterView worldView = MakeClusterView(viewProjection, camera.GetPosition(), true);
+        ClusterView modelView = ModelClusterView(worldView, world);
+        CullClusters(mesh.clusters, mesh.numClusters, modelView, visible.data());
+
+        // One at a time uses the scalar test
+        for (uint32_t c = 0; c < mesh.numClusters; ++c)  CullClusters(&mesh.clusters[c], 1, modelView, &scalarVisible[c]);
+
+        for (uint32_t c = 0; c < mesh.numClusters; ++c)
+        {
+            const MeshCluster& clusterToTest = mesh.clusters[c];
+            const SubMesh& subMesh = mesh.subMeshes[clusterToTest.subMesh];
+            if (visible[c] != scalarVisible[c])  ++numDisagree;
+            ++numTested;
+            if (visible[c])  continue;
+            ++numCulled;
+
+            // A culled cluster must have no triangle facing the camera with a corner on screen
+            for (uint32_t i = clusterToTest.startIndex; i < clusterToTest.startIndex + clusterToTest.numIndices; i += 3)
+            {
+                CVector3 p0 = Transform(world, ReadPosition(mesh, subMesh, i));
+                CVector3 p1 = Transform(world, ReadPosition(mesh, subMesh, i + 1));
+                CVector3 p2 = Transform(world, ReadPosition(mesh, subMesh, i + 2));
+                bool frontFacing = Dot(Cross(p1 - p0, p2 - p0), camera.GetPosition() - p0) > 0;
+                bool onScreen = InsideView(viewProjection, p0) || InsideView(viewProjection, p1) || InsideView(viewProjection, p2);
+                if (frontFacing && onScreen)
+                {
+                    ++numMissed;
+                    break;
+                }
+            }
+        }
+    }
+    std::printf("%llu of %llu clusters culled\n", static_cast<unsigned long long>(numCulled), static_cast<unsigned long long>(numTested));
+    CHECK(numMissed == 0);
+    CHECK(numDisagree == 0);
+    CHECK(numCulled > numTested / 3); // Half of a closed mesh faces away, more is off screen
+
+    return TestResult();
+}
@@ -0,0 +1,83 @@
+//--------------------------------------------------------------------------------------
+// Mesh cook test - cooking a mesh without a device and reporting what it did
+//--------------------------------------------------------------------------------------
+// Cooks test meshes the way imported meshes are cooked and prints the same optimisation and
+// level of detail report the app writes to the debugger. Checks the optimisation improved the
+// vertex cache and fetch measures without adding overdraw, that each level of detail is simpler
+// than the one before, and that the mesh still draws every triangle afterwards.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshCook.h"
+#include "MeshOptimiser.h"
+#include "MeshSimplifier.h"
+
+#include <vector>
+#include <algorithm>
+#include <string>
+
+// The corner positions of each full detail triangle of a sub-mesh, sorted so meshes can be compared whatever order their
+// triangles and vertices are in. Each triangle starts at its smallest corner, so the winding is compared too
+std::vector<std::vector<float>> SortedTriangles(const CookedMesh& mesh, uint32_t subMesh)
+{
+    std::vector<std::vector<float>> triangles;
+    const SubMesh& range = mesh.subMeshes[subMesh];
+    const uint8_t* vertices = static_cast<const uint8_t*>(mesh.vertices);
+    for (uint32_t i = range.startIndex; i < range.startIndex + range.numIndices; i += 3)
+    {
+        std::vector<std::vector<float>> corners;
+        for (uint32_t c = 0; c < 3; ++c)
+        {
+            uint32_t index = (mesh.indexSize == 2) ? static_cast<const uint16_t*>(mesh.indices)[i + c]
+                                                   : static_cast<const uint32_t*>(mesh.indices)[i + c];
+            const float* position = reinterpret_cast<const float*>(vertices + (range.baseVertex + index) * mesh.vertexSize);
+            corners.push_back({ position[0], position[1], position[2] });
+        }
+
+        // Rotate the corners so the smallest is first, keeping the winding
+        auto first = std::min_element(corners.begin(), corners.end()) - corners.begin();
+        std::vector<float> triangle;
+        for (uint32_t c = 0; c < 3; ++c)  triangle.insert(triangle.end(), corners[(first + c) % 3].begin(), corners[(first + c) % 3].end());
+        triangles.push_back(triangle);
+    }
+    std::sort(triangles.begin(), triangles.end());
+    return triangles;
+}
+
+
+int main()
+{
+    for (uint32_t rings : { 64u, 128u })
+    {
+        auto data = MakeTestMesh(rings, rings * 2);
+        auto original = MakeTestMesh(rings, rings * 2);
+        CookMesh(*data);
+        const CookedMesh& mesh = data->description;
+
+        std::string name = "Test sphere " + std::to_string(rings) + "x" + std::to_string(rings * 2);
+        std::printf("%s\n%s\n", MeshOrderReport(name, mesh).c_str(), MeshLodReport(name, mesh).c_str());
+
+        // The generated rows are poor for the vertex cache, the optimised order must be much better
+        CHECK(mesh.statsBefore.acmr > 0 && mesh.statsAfter.acmr < mesh.statsBefore.acmr * 0.9f);
+        CHECK(mesh.statsAfter.atvr < mesh.statsBefore.atvr);
+        CHECK(mesh.statsAfter.overdraw <= mesh.statsBefore.overdraw * 1.05f);
+
+        // Each level has fewer triangles than the one before
+        CHECK(mesh.numLods > 1);
+        for (uint32_t lod = 1; lod < mesh.numLods; ++lod)
+        {
+            for (uint32_t i = 0; i < mesh.numSubMeshes; ++i)
+            {
+                CHECK(mesh.subMeshes[lod * mesh.numSubMeshes + i].numIndices < mesh.subMeshes[(lod - 1) * mesh.numSubMeshes + i].numIndices);
+            }
+        }
+
+        // Reordering mustn't change what is drawn
+        for (uint32_t i = 0; i < mesh.numSubMeshes; ++i)
+        {
+            CHECK(SortedTriangles(mesh, i) == SortedTriangles(original->description, i));
+        }
+    }
+    return TestResult();
+}
@@ -0,0 +1,41 @@
+//--------------------------------------------------------------------------------------
+// Mesh cook tool - cook mesh files from the command line without a device
+//--------------------------------------------------------------------------------------
+// Imports and cooks each mesh file given, saving the cooked file next to it as the app does, and
+// prints the optimisation and level of detail report for each. Meshes that are already cooked
+// are reported from their cooked file. Only built when assimp is installed.
+//     MeshCookTool Teapot.x Hills.x
+
+#include "MeshImport.h"
+#include "MeshOptimiser.h"
+#include "MeshSimplifier.h"
+
+#include <cstdio>
+#include <string>
+#include <stdexcept>
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::printf("Usage: MeshCookTool <mesh file>...\n");
+        return 1;
+    }
+
+    int numFailed = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        try
+        {
+            auto data = ImportMesh(argv[i], true);
+            std::printf("%s\n", MeshOrderReport(argv[i], data->description).c_str());
+            std::printf("%s\n", MeshLodReport(argv[i], data->description).c_str());
+        }
+        catch (std::runtime_error e)
+        {
+            std::printf("%s\n", e.what());
+            ++numFailed;
+        }
+    }
+    return numFailed == 0 ? 0 : 1;
+}
@@ -0,0 +1,59 @@
+//--------------------------------------------------------------------------------------
+// Mesh import benchmark - loading the app's meshes from cooked files against assimp
+//--------------------------------------------------------------------------------------
+// Times importing each mesh file with assimp, calculating its tangents and cooking it, as the
+// first run of the app does, against loading the cooked file later runs use. Only built when
+// assimp is installed. Pass mesh files to time, the default is the app's own meshes.
+
+#include "TestHelpers.h"
+
+#include "MeshImport.h"
+#include "MeshCache.h"
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+
+int main(int argc, char* argv[])
+{
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i)  files.push_back(argv[i]);
+    if (files.empty())
+    {
+        for (auto file : { "Teapot.x", "Sphere.x", "Cube.x", "Building03.x", "Hills.x", "CargoContainer.x", "Ground.x" })
+        {
+            files.push_back(std::string(MEDIA_DIR) + "/" + file);
+        }
+    }
+
+    std::printf("%-20s %10s %14s %14s %10s\n", "file", "triangles", "assimp (ms)", "cooked (ms)", "speed-up");
+    for (auto& file : files)
+    {
+        try
+        {
+            // The first import with the cooked file allowed makes sure it is up to date
+            auto data = ImportMesh(file, true);
+            uint32_t numTriangles = data->description.numSubMeshes > 0 ? data->description.subMeshes[0].numIndices / 3 : 0;
+            for (uint32_t i = 1; i < data->description.numSubMeshes; ++i)  numTriangles += data->description.subMeshes[i].numIndices / 3;
+
+            float importTime = TimeFastest(3, [&] { ImportMesh(file, true, false); });
+
+            uint64_t checksum = 0;
+            float cookedTime = TimeFastest(10, [&]
+            {
+                auto cooked = ImportMesh(file, true);
+                const CookedMesh& mesh = cooked->description;
+                checksum += HashBytes(mesh.vertices, mesh.numVertices * mesh.vertexSize) + HashBytes(mesh.indices, mesh.numIndices * mesh.indexSize);
+            });
+
+            std::string name = file.substr(file.find_last_of("/\\") + 1);
+            std::printf("%-20s %10u %14.2f %14.2f %9.0fx\n", name.c_str(), numTriangles, importTime * 1000, cookedTime * 1000,
+                        importTime / cookedTime);
+        }
+        catch (std::runtime_error e)
+        {
+            std::printf("%s\n", e.what());
+        }
+    }
+    return 0;
+}
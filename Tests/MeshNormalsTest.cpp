@@ -0,0 +1,232 @@
+//--------------------------------------------------------------------------------------
+// Mesh normals test - smooth normals that keep hard edges, and joining vertices
+//--------------------------------------------------------------------------------------
+// Calculates the normals of a cube with its own vertices for each triangle, as imported before
+// joining. Within the smoothing angle the cube's edges stay hard and the vertices join back to
+// four per side, beyond it each corner is smoothed into one vertex. Calculates the normals of the
+// bumpy test sphere and compares them with the exact normals, then checks joining its vertices
+// gives back the sphere as it was made, with each sub-mesh's triangles using the same vertices as
+// before. Checks the results are the same whatever the number of threads.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshTangents.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+const uint32_t CUBE_VERTEX_SIZE = 24;
+
+CVector3 ReadVertexVector(const MeshData& data, uint32_t vertex, uint32_t offset)
+{
+    CVector3 v;
+    std::memcpy(&v, data.vertices.get() + vertex * data.description.vertexSize + offset, sizeof(v));
+    return v;
+}
+
+// Angle in degrees between two unit vectors
+float AngleBetween(const CVector3& a, const CVector3& b)
+{
+    float cosAngle = Dot(a, b);
+    cosAngle = (cosAngle < -1) ? -1 : (cosAngle > 1) ? 1 : cosAngle;
+    return std::acos(cosAngle) * 180.0f / 3.14159265f;
+}
+
+// A cube from -1 to 1 with positions and zero normals, three vertices for each of its 12 triangles, clockwise seen from outside
+std::unique_ptr<MeshData> MakeUnjoinedCube()
+{
+    auto data = std::make_unique<MeshData>();
+    CookedMesh& mesh = data->description;
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Position, VertexFormat::Float, 3, 0 };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Normal,   VertexFormat::Float, 3, 12 };
+    mesh.vertexSize   = CUBE_VERTEX_SIZE;
+    mesh.numVertices  = 36;
+    mesh.numIndices   = 36;
+    mesh.numSubMeshes = 1;
+    data->vertices  = std::make_unique<unsigned char[]>(36 * CUBE_VERTEX_SIZE);
+    data->indices   = std::make_unique<unsigned char[]>(36 * 4);
+    data->subMeshes = std::make_unique<SubMesh[]>(1);
+
+    float* vertex = reinterpret_cast<float*>(data->vertices.get());
+    uint32_t* index = reinterpret_cast<uint32_t*>(data->indices.get());
+    for (uint32_t side = 0; side < 6; ++side)
+    {
+        // Two axes across the side, corners in order around it
+        CVector3 normal = { 0, 0, 0 }, across = { 0, 0, 0 }, up = { 0, 0, 0 };
+        float sign = (side & 1) ? -1.0f : 1.0f;
+        (&normal.x)[side / 2]           = sign;
+        (&across.x)[(side / 2 + 1) % 3] = 1;
+        (&up.x)[(side / 2 + 2) % 3]     = 1;
+        CVector3 corners[4] = { normal - across - up, normal + across - up, normal + across + up, normal - across + up };
+        uint32_t triangles[2][3] = { { 0, 1, 2 }, { 0, 2, 3 } };
+        for (auto& triangle : triangles)
+        {
+            // Facing out when clockwise in a left-handed space
+            CVector3 p[3] = { corners[triangle[0]], corners[triangle[1]], corners[triangle[2]] };
+            if (Dot(Cross(p[1] - p[0], p[2] - p[0]), normal) < 0)  std::swap(p[1], p[2]);
+            for (const CVector3& position : p)
+            {
+                float values[6] = { position.x, position.y, position.z, 0, 0, 0 };
+                std::memcpy(vertex, values, sizeof(values));
+                vertex += 6;
+                *index = static_cast<uint32_t>(index - reinterpret_cast<uint32_t*>(data->indices.get()));
+                ++index;
+            }
+        }
+    }
+    data->subMeshes[0] = { 0, 36, 0, 0 };
+
+    mesh.vertices  = data->vertices.get();
+    mesh.indices   = data->indices.get();
+    mesh.subMeshes = data->subMeshes.get();
+    return data;
+}
+
+
+int main()
+{
+    //// Hard edges ////
+
+    // Sides of the cube are 90 degrees apart, more than the smoothing angle, so every vertex keeps its side's normal
+    auto cube = MakeUnjoinedCube();
+    uint32_t* cubeIndices = reinterpret_cast<uint32_t*>(cube->indices.get());
+    GenerateNormals(cube->description, 0, cube->vertices.get(), cubeIndices);
+    int numWrongNormals = 0;
+    for (uint32_t v = 0; v < 36; ++v)
+    {
+        // Each side has two triangles, made one side after another
+        CVector3 position = ReadVertexVector(*cube, v, 0);
+        CVector3 normal   = ReadVertexVector(*cube, v, 12);
+        uint32_t triangle = v / 3;
+        uint32_t side = triangle / 2;
+        CVector3 sideNormal = { 0, 0, 0 };
+        (&sideNormal.x)[side / 2] = (side & 1) ? -1.0f : 1.0f;
+        if (normal.x != sideNormal.x || normal.y != sideNormal.y || normal.z != sideNormal.z)  ++numWrongNormals;
+        if (Dot(position, sideNormal) != 1)  ++numWrongNormals;
+    }
+    CHECK(numWrongNormals == 0);
+
+    // The corners of each side are joined, but not with the corners of the other sides
+    CookedMesh& cubeMesh = cube->description;
+    cubeMesh.numVertices = JoinIdenticalVertices(cubeMesh, cube->vertices.get(), cubeIndices, cube->subMeshes.get());
+    CHECK(cubeMesh.numVertices == 24);
+    CHECK(*std::max_element(cubeIndices, cubeIndices + 36) == 23);
+
+    // Smoothing beyond 90 degrees gives each corner one normal pointing out from the cube, so only the 8 corners are left
+    cube = MakeUnjoinedCube();
+    cubeIndices = reinterpret_cast<uint32_t*>(cube->indices.get());
+    GenerateNormals(cube->description, 0, cube->vertices.get(), cubeIndices, 100.0f);
+    int numNotOutwards = 0;
+    for (uint32_t v = 0; v < 36; ++v)
+    {
+        CVector3 position = ReadVertexVector(*cube, v, 0);
+        CVector3 normal   = ReadVertexVector(*cube, v, 12);
+        if (normal.x * position.x <= 0 || normal.y * position.y <= 0 || normal.z * position.z <= 0)  ++numNotOutwards;
+        if (Dot(normal, Normalise(position)) < 0.9f)  ++numNotOutwards;
+    }
+    CHECK(numNotOutwards == 0);
+    CHECK(JoinIdenticalVertices(cube->description, cube->vertices.get(), cubeIndices, cube->subMeshes.get()) == 8);
+
+    //// Smooth surfaces ////
+
+    // Normals of the bumpy sphere against the exact ones it was made with. Not near the poles, where the triangles are too
+    // thin to give an accurate normal, or at the seam or where the two halves meet, where a vertex only has triangles on one
+    // side of it
+    const uint32_t RINGS = 128, SEGMENTS = 256, HALF_RINGS = RINGS / 2;
+    auto sphere = MakeTestMesh(RINGS, SEGMENTS);
+    auto unjoined = UnjoinTestMesh(*sphere, false);
+    uint32_t* unjoinedIndices = reinterpret_cast<uint32_t*>(unjoined->indices.get());
+    for (uint32_t s = 0; s < 2; ++s)  GenerateNormals(unjoined->description, s, unjoined->vertices.get(), unjoinedIndices);
+
+    const uint32_t* sphereIndices = reinterpret_cast<const uint32_t*>(sphere->indices.get());
+    std::vector<float> errors;
+    for (uint32_t s = 0; s < 2; ++s)
+    {
+        const SubMesh& subMesh = sphere->description.subMeshes[s];
+        for (uint32_t i = 0; i < subMesh.numIndices; ++i)
+        {
+            uint32_t vertex = subMesh.baseVertex + sphereIndices[subMesh.startIndex + i];
+            uint32_t ring = (vertex % ((HALF_RINGS + 1) * (SEGMENTS + 1))) / (SEGMENTS + 1) + s * HALF_RINGS;
+            uint32_t segment = vertex % (SEGMENTS + 1);
+            if (ring < 8 || ring > RINGS - 8 || ring == HALF_RINGS || segment == 0 || segment == SEGMENTS)  continue;
+
+            CVector3 exact = ReadVertexVector(*sphere, vertex, TEST_MESH_NORMAL_OFFSET);
+            CVector3 normal = ReadVertexVector(*unjoined, subMesh.startIndex + i, TEST_MESH_NORMAL_OFFSET);
+            errors.push_back(AngleBetween(exact, normal));
+        }
+    }
+    std::sort(errors.begin(), errors.end());
+    CHECK(errors.size() > 150000);
+    CHECK(errors[errors.size() / 2] < 0.5f);
+    CHECK(errors[errors.size() * 99 / 100] < 2.0f);
+    CHECK(errors.back() < 3.0f);
+
+    //// Joining ////
+
+    // Joining a sphere with its normals kept gives back the vertices it was made with, each sub-mesh straight after the last
+    unjoined = UnjoinTestMesh(*sphere, true);
+    unjoinedIndices = reinterpret_cast<uint32_t*>(unjoined->indices.get());
+    CookedMesh& unjoinedMesh = unjoined->description;
+    unjoinedMesh.numVertices = JoinIdenticalVertices(unjoinedMesh, unjoined->vertices.get(), unjoinedIndices,
+                                                     unjoined->subMeshes.get());
+    CHECK(unjoinedMesh.numVertices == sphere->description.numVertices);
+    CHECK(unjoinedMesh.subMeshes[0].baseVertex == 0);
+    CHECK(unjoinedMesh.subMeshes[1].baseVertex == sphere->description.subMeshes[1].baseVertex);
+
+    // Every triangle corner has the same vertex as before, only its number may have changed
+    int numChangedCorners = 0;
+    for (uint32_t s = 0; s < 2; ++s)
+    {
+        const SubMesh& before = sphere->description.subMeshes[s];
+        const SubMesh& after  = unjoinedMesh.subMeshes[s];
+        CHECK(after.startIndex == before.startIndex && after.numIndices == before.numIndices);
+        for (uint32_t i = 0; i < before.numIndices; ++i)
+        {
+            uint32_t beforeVertex = before.baseVertex + sphereIndices[before.startIndex + i];
+            uint32_t afterVertex  = after.baseVertex + unjoinedIndices[after.startIndex + i];
+            if (afterVertex >= unjoinedMesh.numVertices ||
+                std::memcmp(sphere->vertices.get() + beforeVertex * TEST_MESH_VERTEX_SIZE,
+                            unjoined->vertices.get() + afterVertex * TEST_MESH_VERTEX_SIZE, TEST_MESH_VERTEX_SIZE) != 0)
+            {
+                ++numChangedCorners;
+            }
+        }
+    }
+    CHECK(numChangedCorners == 0);
+
+    // Calculated normals are the same at every corner of a smooth surface, so those vertices join back up too
+    unjoined = UnjoinTestMesh(*sphere, false);
+    unjoinedIndices = reinterpret_cast<uint32_t*>(unjoined->indices.get());
+    for (uint32_t s = 0; s < 2; ++s)  GenerateNormals(unjoined->description, s, unjoined->vertices.get(), unjoinedIndices);
+    uint32_t numJoined = JoinIdenticalVertices(unjoined->description, unjoined->vertices.get(), unjoinedIndices,
+                                               unjoined->subMeshes.get());
+    CHECK(numJoined == sphere->description.numVertices);
+
+    //// Threads ////
+
+    // A mesh large enough to be split between threads gives exactly the same normals and joined vertices on one thread or four
+    auto large = MakeTestMesh(128, 256);
+    auto oneThread   = UnjoinTestMesh(*large, false);
+    auto fourThreads = UnjoinTestMesh(*large, false);
+    uint32_t numVertices[2];
+    int numThreadCounts = 0;
+    for (auto* data : { oneThread.get(), fourThreads.get() })
+    {
+        unsigned int numThreads = (data == oneThread.get()) ? 1 : 4;
+        uint32_t* indices = reinterpret_cast<uint32_t*>(data->indices.get());
+        for (uint32_t s = 0; s < 2; ++s)
+        {
+            GenerateNormals(data->description, s, data->vertices.get(), indices, NORMAL_SMOOTHING_ANGLE, numThreads);
+        }
+        numVertices[numThreadCounts++] = JoinIdenticalVertices(data->description, data->vertices.get(), indices,
+                                                               data->subMeshes.get(), numThreads);
+    }
+    CHECK(oneThread->description.subMeshes[0].numIndices >= MIN_ITEMS_PER_THREAD * 4); // Vertices in each sub-mesh
+    CHECK(numVertices[0] == numVertices[1] && numVertices[0] == large->description.numVertices);
+    CHECK(std::memcmp(oneThread->vertices.get(), fourThreads->vertices.get(), numVertices[0] * TEST_MESH_VERTEX_SIZE) == 0);
+    CHECK(std::memcmp(oneThread->indices.get(), fourThreads->indices.get(), large->description.numIndices * 4) == 0);
+
+    return TestResult();
+}
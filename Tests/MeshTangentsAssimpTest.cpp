@@ -0,0 +1,325 @@
+//--------------------------------------------------------------------------------------
+// Mesh tangents assimp test - normals and tangents agree with the ones assimp used to calculate
+//--------------------------------------------------------------------------------------
+// Imports the app's meshes and a test mesh of a million triangles with assimp, calculates their
+// tangents with GenerateTangents and with assimp's aiProcess_CalcTangentSpace, and checks the two
+// agree. They aren't expected to be identical: assimp averages the triangles around a vertex
+// without weights and also smooths across vertices at the same place with different texture
+// coordinates, so the check is on the typical and near-worst angle between them. Then imports the
+// same meshes without their normals and calculates normals at each triangle corner with
+// GenerateNormals and with assimp's aiProcess_GenSmoothNormals, both before joining vertices, and
+// checks those agree the same way and that joining leaves about as many vertices as assimp's.
+// assimp treats positions a tiny distance apart as the same place, GenerateNormals only exactly
+// equal ones. Prints the time each takes for the large mesh. Only built when assimp is installed.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshTangents.h"
+
+#include <assimp/Importer.hpp>
+#include <assimp/postprocess.h>
+#include <assimp/scene.h>
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+
+// Sub-mesh 0 of a test mesh layout holding an assimp mesh, with zero tangents for GenerateTangents
+std::unique_ptr<MeshData> CopyAssimpMesh(const aiMesh& assimpMesh)
+{
+    auto data = std::make_unique<MeshData>();
+    CookedMesh& mesh = data->description;
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Position, VertexFormat::Float, 3, 0 };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Normal,   VertexFormat::Float, 3, TEST_MESH_NORMAL_OFFSET };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Tangent,  VertexFormat::Float, 3, TEST_MESH_TANGENT_OFFSET };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::UV,       VertexFormat::Float, 2, TEST_MESH_UV_OFFSET };
+    mesh.vertexSize   = TEST_MESH_VERTEX_SIZE;
+    mesh.numVertices  = assimpMesh.mNumVertices;
+    mesh.numIndices   = assimpMesh.mNumFaces * 3;
+    mesh.numSubMeshes = 1;
+    data->vertices  = std::make_unique<unsigned char[]>(mesh.numVertices * mesh.vertexSize);
+    data->indices   = std::make_unique<unsigned char[]>(mesh.numIndices * 4);
+    data->subMeshes = std::make_unique<SubMesh[]>(1);
+
+    float* vertex = reinterpret_cast<float*>(data->vertices.get());
+    for (unsigned int v = 0; v < assimpMesh.mNumVertices; ++v)
+    {
+        const aiVector3D& p  = assimpMesh.mVertices[v];
+        const aiVector3D& n  = assimpMesh.mNormals[v];
+        const aiVector3D& uv = assimpMesh.mTextureCoords[0][v];
+        float values[11] = { p.x, p.y, p.z, n.x, n.y, n.z, 0, 0, 0, uv.x, uv.y };
+        std::memcpy(vertex, values, sizeof(values));
+        vertex += 11;
+    }
+    uint32_t* index = reinterpret_cast<uint32_t*>(data->indices.get());
+    for (unsigned int f = 0; f < assimpMesh.mNumFaces; ++f)
+    {
+        for (unsigned int c = 0; c < 3; ++c)  *index++ = assimpMesh.mFaces[f].mIndices[c];
+    }
+    data->subMeshes[0] = { 0, mesh.numIndices, 0, 0 };
+
+    mesh.vertices  = data->vertices.get();
+    mesh.indices   = data->indices.get();
+    mesh.subMeshes = data->subMeshes.get();
+    return data;
+}
+
+// Test mesh layout holding an assimp mesh imported without joining vertices, with its own three vertices for each triangle
+// in face order, zero normals and no tangents, as ImportMesh copies a mesh without normals
+std::unique_ptr<MeshData> CopyAssimpCorners(const aiMesh& assimpMesh)
+{
+    auto data = std::make_unique<MeshData>();
+    CookedMesh& mesh = data->description;
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Position, VertexFormat::Float, 3, 0 };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Normal,   VertexFormat::Float, 3, TEST_MESH_NORMAL_OFFSET };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::UV,       VertexFormat::Float, 2, TEST_MESH_UV_OFFSET };
+    mesh.vertexSize   = TEST_MESH_VERTEX_SIZE;
+    mesh.numVertices  = assimpMesh.mNumFaces * 3;
+    mesh.numIndices   = assimpMesh.mNumFaces * 3;
+    mesh.numSubMeshes = 1;
+    data->vertices  = std::make_unique<unsigned char[]>(mesh.numVertices * mesh.vertexSize);
+    data->indices   = std::make_unique<unsigned char[]>(mesh.numIndices * 4);
+    data->subMeshes = std::make_unique<SubMesh[]>(1);
+
+    // The unused tangent space is zeroed so identical vertices compare the same
+    std::memset(data->vertices.get(), 0, mesh.numVertices * mesh.vertexSize);
+    float* vertex = reinterpret_cast<float*>(data->vertices.get());
+    uint32_t* index = reinterpret_cast<uint32_t*>(data->indices.get());
+    for (unsigned int f = 0; f < assimpMesh.mNumFaces; ++f)
+    {
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            unsigned int v = assimpMesh.mFaces[f].mIndices[c];
+            const aiVector3D& p  = assimpMesh.mVertices[v];
+            aiVector3D uv = assimpMesh.HasTextureCoords(0) ? assimpMesh.mTextureCoords[0][v] : aiVector3D(0, 0, 0);
+            float values[11] = { p.x, p.y, p.z, 0, 0, 0, 0, 0, 0, uv.x, uv.y };
+            std::memcpy(vertex, values, sizeof(values));
+            vertex += 11;
+            *index = f * 3 + c;
+            ++index;
+        }
+    }
+    data->subMeshes[0] = { 0, mesh.numIndices, 0, 0 };
+
+    mesh.vertices  = data->vertices.get();
+    mesh.indices   = data->indices.get();
+    mesh.subMeshes = data->subMeshes.get();
+    return data;
+}
+
+// Angle in degrees between the tangents of each vertex, sorted. Vertices assimp couldn't give a tangent are left out
+std::vector<float> TangentDifferences(const aiMesh& assimpMesh, const MeshData& data)
+{
+    std::vector<float> differences;
+    for (unsigned int v = 0; v < assimpMesh.mNumVertices; ++v)
+    {
+        const aiVector3D& t = assimpMesh.mTangents[v];
+        CVector3 assimpTangent = { t.x, t.y, t.z };
+        if (!std::isfinite(t.x) || !std::isfinite(t.y) || !std::isfinite(t.z) || Length(assimpTangent) < 1e-6f)  continue;
+
+        CVector3 tangent;
+        std::memcpy(&tangent, data.vertices.get() + v * TEST_MESH_VERTEX_SIZE + TEST_MESH_TANGENT_OFFSET, sizeof(tangent));
+        float cosAngle = Dot(tangent, assimpTangent * (1 / Length(assimpTangent)));
+        cosAngle = (cosAngle < -1) ? -1 : (cosAngle > 1) ? 1 : cosAngle;
+        differences.push_back(std::acos(cosAngle) * 180 / PI);
+    }
+    std::sort(differences.begin(), differences.end());
+    return differences;
+}
+
+// Calculate the tangents of every mesh in a scene both ways and check they agree, giving the time each way took
+void CompareTangents(const std::string& name, Assimp::Importer& importer, float& ownTime, float& assimpTime)
+{
+    const aiScene* scene = importer.GetScene();
+    std::vector<std::unique_ptr<MeshData>> meshes;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        const aiMesh& assimpMesh = *scene->mMeshes[m];
+        meshes.push_back(assimpMesh.HasNormals() && assimpMesh.HasTextureCoords(0) ? CopyAssimpMesh(assimpMesh) : nullptr);
+    }
+
+    ownTime = TimeFastest(1, [&]
+    {
+        for (auto& data : meshes)
+        {
+            if (data)  GenerateTangents(data->description, 0, data->vertices.get(), reinterpret_cast<const uint32_t*>(data->indices.get()));
+        }
+    });
+    assimpTime = TimeFastest(1, [&] { scene = importer.ApplyPostProcessing(aiProcess_CalcTangentSpace); });
+    CHECK(scene != nullptr);
+    if (scene == nullptr)  return;
+
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        if (!meshes[m])  continue;
+        CHECK(scene->mMeshes[m]->HasTangentsAndBitangents());
+        if (!scene->mMeshes[m]->HasTangentsAndBitangents())  continue;
+
+        std::vector<float> differences = TangentDifferences(*scene->mMeshes[m], *meshes[m]);
+        CHECK(!differences.empty());
+        if (differences.empty())  continue;
+
+        float median = differences[differences.size() / 2];
+        float worst100th = differences[differences.size() - differences.size() / 100 - 1];
+        std::printf("%-26s %2u %9u %10.3f %10.3f %10.3f\n", name.c_str(), m, scene->mMeshes[m]->mNumVertices, median, worst100th,
+                    differences.back());
+        CHECK(median < 2.0f);
+        CHECK(worst100th < 20.0f);
+    }
+}
+
+// Calculate the normals of every mesh in a scene imported without normals or joining both ways and check they agree at each
+// triangle corner, giving the time each way took including joining the vertices
+void CompareNormals(const std::string& name, Assimp::Importer& importer, float& ownTime, float& assimpTime)
+{
+    const aiScene* scene = importer.GetScene();
+    std::vector<std::unique_ptr<MeshData>> meshes;
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        CHECK(!scene->mMeshes[m]->HasNormals());
+        meshes.push_back(CopyAssimpCorners(*scene->mMeshes[m]));
+    }
+
+    ownTime = TimeFastest(1, [&]
+    {
+        for (auto& data : meshes)
+        {
+            uint32_t* indices = reinterpret_cast<uint32_t*>(data->indices.get());
+            GenerateNormals(data->description, 0, data->vertices.get(), indices);
+            data->description.numVertices = JoinIdenticalVertices(data->description, data->vertices.get(), indices,
+                                                                  data->subMeshes.get());
+        }
+    });
+    assimpTime = TimeFastest(1, [&]
+    {
+        scene = importer.ApplyPostProcessing(aiProcess_GenSmoothNormals | aiProcess_JoinIdenticalVertices);
+    });
+    CHECK(scene != nullptr);
+    if (scene == nullptr)  return;
+
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
+    {
+        const aiMesh& assimpMesh = *scene->mMeshes[m];
+        const MeshData& data = *meshes[m];
+        CHECK(assimpMesh.HasNormals() && assimpMesh.mNumFaces * 3 == data.description.numIndices);
+        if (!assimpMesh.HasNormals() || assimpMesh.mNumFaces * 3 != data.description.numIndices)  continue;
+
+        // Faces are in the same order both ways, joining doesn't move them
+        std::vector<float> differences;
+        const uint32_t* indices = reinterpret_cast<const uint32_t*>(data.indices.get());
+        for (unsigned int i = 0; i < assimpMesh.mNumFaces * 3; ++i)
+        {
+            const aiVector3D& n = assimpMesh.mNormals[assimpMesh.mFaces[i / 3].mIndices[i % 3]];
+            CVector3 assimpNormal = { n.x, n.y, n.z };
+            if (!std::isfinite(n.x) || !std::isfinite(n.y) || !std::isfinite(n.z) || Length(assimpNormal) < 1e-6f)  continue;
+
+            CVector3 normal;
+            const unsigned char* vertex = data.vertices.get() + indices[i] * TEST_MESH_VERTEX_SIZE;
+            std::memcpy(&normal, vertex + TEST_MESH_NORMAL_OFFSET, sizeof(normal));
+            float cosAngle = Dot(normal, assimpNormal * (1 / Length(assimpNormal)));
+            cosAngle = (cosAngle < -1) ? -1 : (cosAngle > 1) ? 1 : cosAngle;
+            differences.push_back(std::acos(cosAngle) * 180 / PI);
+        }
+        std::sort(differences.begin(), differences.end());
+        CHECK(!differences.empty());
+        if (differences.empty())  continue;
+
+        float median = differences[differences.size() / 2];
+        float worst100th = differences[differences.size() - differences.size() / 100 - 1];
+        std::printf("%-26s %2u %9u %10.3f %10.3f %10.3f %9u\n", name.c_str(), m, data.description.numVertices, median, worst100th,
+                    differences.back(), assimpMesh.mNumVertices);
+        CHECK(median < 2.0f);
+        CHECK(worst100th < 20.0f);
+        CHECK(data.description.numVertices <= assimpMesh.mNumVertices * 11 / 10 + 8);
+    }
+}
+
+
+int main()
+{
+    std::printf("%-26s %2s %9s %10s %10s %10s %9s\n", "mesh", "", "vertices", "median", "99%", "worst", "assimp's");
+
+    //// The app's meshes ////
+
+    // Imported as ImportMesh used to, up to where assimp calculated the tangents, then again without normals or joining
+    const unsigned int IMPORT_FLAGS = aiProcess_MakeLeftHanded | aiProcess_FlipUVs | aiProcess_FlipWindingOrder |
+                                      aiProcess_Triangulate | aiProcess_PreTransformVertices | aiProcess_SortByPType |
+                                      aiProcess_FindDegenerates;
+    for (auto file : { "Teapot.x", "Sphere.x", "Cube.x", "Building03.x", "Hills.x", "CargoContainer.x", "Ground.x" })
+    {
+        Assimp::Importer importer;
+        importer.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, NORMAL_SMOOTHING_ANGLE);
+        importer.SetPropertyInteger(AI_CONFIG_PP_SBP_REMOVE, aiPrimitiveType_POINT | aiPrimitiveType_LINE);
+        importer.SetPropertyBool(AI_CONFIG_PP_FD_REMOVE, true);
+        importer.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, aiComponent_NORMALS);
+        std::string fileName = std::string(MEDIA_DIR) + "/" + file;
+        unsigned int oldFlags = IMPORT_FLAGS | aiProcess_GenSmoothNormals | aiProcess_JoinIdenticalVertices;
+        CHECK(importer.ReadFile(fileName, oldFlags) != nullptr);
+        if (importer.GetScene() == nullptr)  continue;
+
+        float ownTime, assimpTime;
+        CompareTangents(file, importer, ownTime, assimpTime);
+
+        CHECK(importer.ReadFile(fileName, IMPORT_FLAGS | aiProcess_RemoveComponent) != nullptr);
+        if (importer.GetScene() == nullptr)  continue;
+        CompareNormals(std::string(file) + " normals", importer, ownTime, assimpTime);
+    }
+
+    //// A large mesh ////
+
+    // The test mesh written out as an OBJ file, its two halves become one mesh
+    auto data = MakeTestMesh(512, 1024);
+    const CookedMesh& mesh = data->description;
+    const float* vertex = reinterpret_cast<const float*>(data->vertices.get());
+    std::ostringstream obj;
+    obj.precision(9);
+    for (uint32_t v = 0; v < mesh.numVertices; ++v, vertex += 11)
+    {
+        obj << "v "  << vertex[0] << ' ' << vertex[1] << ' ' << vertex[2] << '\n';
+        obj << "vn " << vertex[3] << ' ' << vertex[4] << ' ' << vertex[5] << '\n';
+        obj << "vt " << vertex[9] << ' ' << vertex[10] << '\n';
+    }
+    const uint32_t* index = reinterpret_cast<const uint32_t*>(data->indices.get());
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)
+    {
+        const SubMesh& subMesh = mesh.subMeshes[s];
+        for (uint32_t i = subMesh.startIndex; i < subMesh.startIndex + subMesh.numIndices; i += 3)
+        {
+            obj << 'f';
+            for (uint32_t c = 0; c < 3; ++c)
+            {
+                uint32_t v = subMesh.baseVertex + index[i + c] + 1;
+                obj << ' ' << v << '/' << v << '/' << v;
+            }
+            obj << '\n';
+        }
+    }
+    std::string objText = obj.str();
+
+    Assimp::Importer importer;
+    CHECK(importer.ReadFileFromMemory(objText.data(), objText.size(), aiProcess_JoinIdenticalVertices, "obj") != nullptr);
+    if (importer.GetScene() != nullptr)
+    {
+        float ownTime, assimpTime;
+        CompareTangents("Test mesh", importer, ownTime, assimpTime);
+        std::printf("%u triangles: GenerateTangents %.1fms, assimp %.1fms\n", mesh.numIndices / 3, ownTime * 1000, assimpTime * 1000);
+    }
+
+    // Again without its normals or joining
+    Assimp::Importer normalsImporter;
+    normalsImporter.SetPropertyFloat(AI_CONFIG_PP_GSN_MAX_SMOOTHING_ANGLE, NORMAL_SMOOTHING_ANGLE);
+    normalsImporter.SetPropertyInteger(AI_CONFIG_PP_RVC_FLAGS, aiComponent_NORMALS);
+    CHECK(normalsImporter.ReadFileFromMemory(objText.data(), objText.size(), aiProcess_RemoveComponent, "obj") != nullptr);
+    if (normalsImporter.GetScene() != nullptr)
+    {
+        float ownTime, assimpTime;
+        CompareNormals("Test mesh normals", normalsImporter, ownTime, assimpTime);
+        std::printf("%u triangles: GenerateNormals and JoinIdenticalVertices %.1fms, assimp %.1fms\n", mesh.numIndices / 3,
+                    ownTime * 1000, assimpTime * 1000);
+    }
+
+    return TestResult();
+}
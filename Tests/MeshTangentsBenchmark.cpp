@@ -0,0 +1,53 @@
+//--------------------------------------------------------------------------------------
+// Mesh tangents benchmark - calculating normals and tangents for large meshes
+//--------------------------------------------------------------------------------------
+// Times the steps MeshImport.h takes after assimp for test meshes of increasing size, up to a
+// few million triangles: smooth normals for a mesh with three vertices per triangle, joining
+// the vertices that are the same, then tangents for the joined mesh. Sub-meshes of more than
+// MIN_ITEMS_PER_THREAD triangles or vertices are split over the CPU's threads, so the rate should
+// rise with the thread count. MeshTangentsAssimpTest compares with assimp where it is installed.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshTangents.h"
+
+#include <thread>
+
+int main()
+{
+    std::printf("%u hardware threads\n", std::thread::hardware_concurrency());
+    std::printf("%10s %10s %12s %10s %14s %16s\n", "triangles", "vertices", "normals (ms)", "join (ms)", "tangents (ms)",
+                "M triangles/s");
+    for (uint32_t rings : { 128u, 256u, 512u, 768u })
+    {
+        auto joined = MakeTestMesh(rings, rings * 2);
+        auto data = UnjoinTestMesh(*joined, false);
+        joined.reset();
+        CookedMesh& mesh = data->description;
+        uint32_t* indices = reinterpret_cast<uint32_t*>(data->indices.get());
+
+        // Each run overwrites the normals of the last
+        float normalsTime = TimeFastest(3, [&]
+        {
+            for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)  GenerateNormals(mesh, s, data->vertices.get(), indices);
+        });
+
+        // Joining changes the mesh so can only be timed once
+        float joinTime = TimeFastest(1, [&]
+        {
+            mesh.numVertices = JoinIdenticalVertices(mesh, data->vertices.get(), indices, data->subMeshes.get());
+        });
+
+        float tangentsTime = TimeFastest(3, [&]
+        {
+            for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)  GenerateTangents(mesh, s, data->vertices.get(), indices);
+        });
+
+        uint32_t numTriangles = mesh.numIndices / 3;
+        float time = normalsTime + joinTime + tangentsTime;
+        std::printf("%10u %10u %12.1f %10.1f %14.1f %16.1f\n", numTriangles, mesh.numVertices, normalsTime * 1000,
+                    joinTime * 1000, tangentsTime * 1000, numTriangles / time / 1e6f);
+    }
+    return 0;
+}
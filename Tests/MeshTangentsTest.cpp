@@ -0,0 +1,136 @@
+//--------------------------------------------------------------------------------------
+// Mesh tangents test - tangents follow the texture coordinates across the surface
+//--------------------------------------------------------------------------------------
+// Calculates the tangents of test meshes and compares them with the exact direction of
+// increasing U on the bumpy sphere, made perpendicular to the vertex normal. Checks the rest of
+// each vertex is left alone, that both sides of the UV seam agree, that a large mesh split
+// between threads is as accurate as a small one, and that sub-meshes without usable texture
+// coordinates still get a unit tangent along the surface. MeshTangentsAssimpTest compares with
+// assimp's tangents where assimp is installed.
+
+#include "TestHelpers.h"
+#include "TestMeshes.h"
+
+#include "MeshTangents.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+CVector3 ReadVertexVector(const MeshData& data, uint32_t vertex, uint32_t offset)
+{
+    CVector3 v;
+    std::memcpy(&v, data.vertices.get() + vertex * TEST_MESH_VERTEX_SIZE + offset, sizeof(v));
+    return v;
+}
+
+// Angle in degrees between two unit vectors
+float AngleBetween(const CVector3& a, const CVector3& b)
+{
+    float cosAngle = Dot(a, b);
+    cosAngle = (cosAngle < -1) ? -1 : (cosAngle > 1) ? 1 : cosAngle;
+    return std::acos(cosAngle) * 180 / PI;
+}
+
+// Calculate the tangents of all the sub-meshes of a test mesh
+void CalculateTangents(MeshData& data)
+{
+    for (uint32_t s = 0; s < data.description.numSubMeshes; ++s)
+    {
+        GenerateTangents(data.description, s, data.vertices.get(), reinterpret_cast<const uint32_t*>(data.indices.get()));
+    }
+}
+
+// Angle in degrees between each vertex's tangent and the exact direction of increasing U, sorted. Checks the tangents are
+// unit length and perpendicular to the normal on the way. The rings nearest the poles are left out, the direction of U turns
+// right round in the space of a triangle there so no one direction is right
+std::vector<float> TangentErrors(const MeshData& data)
+{
+    std::vector<float> errors;
+    for (uint32_t v = 0; v < data.description.numVertices; ++v)
+    {
+        float uv[2];
+        std::memcpy(uv, data.vertices.get() + v * TEST_MESH_VERTEX_SIZE + TEST_MESH_UV_OFFSET, sizeof(uv));
+        float around = uv[0] * 2 * PI;
+        float down   = uv[1] * PI;
+
+        CVector3 normal  = ReadVertexVector(data, v, TEST_MESH_NORMAL_OFFSET);
+        CVector3 tangent = ReadVertexVector(data, v, TEST_MESH_TANGENT_OFFSET);
+        CHECK(std::fabs(Length(tangent) - 1) < 1e-4f);
+        CHECK(std::fabs(Dot(tangent, normal)) < 1e-4f);
+        if (uv[1] < 0.01f || uv[1] > 0.99f)  continue;
+
+        CVector3 alongU = TestMeshPosition(around + 0.0001f, down) - TestMeshPosition(around - 0.0001f, down);
+        alongU = alongU - normal * Dot(normal, alongU);
+        errors.push_back(AngleBetween(tangent, alongU * (1 / Length(alongU))));
+    }
+    std::sort(errors.begin(), errors.end());
+    return errors;
+}
+
+
+int main()
+{
+    //// Accuracy ////
+
+    // A small mesh done on one thread and a large one split between threads where there are several. The tangents come from
+    // flat triangles so are only as close to the curved surface's as the triangles are: the limits are in degrees
+    struct Accuracy
+    {
+        uint32_t rings;
+        float    median, worst, seam;
+    };
+    for (const Accuracy& accuracy : { Accuracy{ 64, 1.0f, 10.0f, 10.0f }, Accuracy{ 512, 0.1f, 1.5f, 1.5f } })
+    {
+        auto data = MakeTestMesh(accuracy.rings, accuracy.rings * 2);
+        const CookedMesh& mesh = data->description;
+        std::vector<unsigned char> before(data->vertices.get(), data->vertices.get() + mesh.numVertices * mesh.vertexSize);
+        CalculateTangents(*data);
+
+        // Only the tangents change
+        uint32_t numChanged = 0;
+        for (uint32_t v = 0; v < mesh.numVertices; ++v)
+        {
+            const unsigned char* oldVertex = before.data() + v * TEST_MESH_VERTEX_SIZE;
+            const unsigned char* newVertex = data->vertices.get() + v * TEST_MESH_VERTEX_SIZE;
+            if (std::memcmp(oldVertex, newVertex, TEST_MESH_TANGENT_OFFSET) != 0 ||
+                std::memcmp(oldVertex + TEST_MESH_UV_OFFSET, newVertex + TEST_MESH_UV_OFFSET, 8) != 0)  ++numChanged;
+        }
+        CHECK(numChanged == 0);
+
+        std::vector<float> errors = TangentErrors(*data);
+        float median = errors[errors.size() / 2];
+        std::printf("%u triangles: median error %.3f, worst %.3f degrees\n", mesh.numIndices / 3, median, errors.back());
+        CHECK(median < accuracy.median);
+        CHECK(errors.back() < accuracy.worst);
+
+        // The vertices either side of the UV seam are at the same place, but each only has the triangles on its own side
+        uint32_t segments = accuracy.rings * 2;
+        float worstSeam = 0;
+        for (uint32_t v = 0; v < mesh.numVertices; v += segments + 1)
+        {
+            float seam = AngleBetween(ReadVertexVector(*data, v, TEST_MESH_TANGENT_OFFSET),
+                                      ReadVertexVector(*data, v + segments, TEST_MESH_TANGENT_OFFSET));
+            worstSeam = std::max(worstSeam, seam);
+        }
+        CHECK(worstSeam < accuracy.seam);
+    }
+
+    //// No texture coordinates ////
+
+    // With every UV the same there is no U direction, any unit tangent along the surface will do
+    auto flat = MakeTestMesh(16, 32);
+    for (uint32_t v = 0; v < flat->description.numVertices; ++v)
+    {
+        std::memset(flat->vertices.get() + v * TEST_MESH_VERTEX_SIZE + TEST_MESH_UV_OFFSET, 0, 8);
+    }
+    CalculateTangents(*flat);
+    for (uint32_t v = 0; v < flat->description.numVertices; ++v)
+    {
+        CVector3 tangent = ReadVertexVector(*flat, v, TEST_MESH_TANGENT_OFFSET);
+        CHECK(std::fabs(Length(tangent) - 1) < 1e-4f);
+        CHECK(std::fabs(Dot(tangent, ReadVertexVector(*flat, v, TEST_MESH_NORMAL_OFFSET))) < 1e-4f);
+    }
+
+    return TestResult();
+}
@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------------
+// Object light benchmark - choosing each object's lights with the grid and without
+//--------------------------------------------------------------------------------------
+// Times SetLights and AssignObjects together, as done each frame, against checking every
+// light for every object.
+
+#include "TestHelpers.h"
+
+#include "ObjectLights.h"
+
+#include <vector>
+#include <random>
+#include <cmath>
+
+int main()
+{
+    const uint32_t NUM_OBJECTS = 1000;
+
+    std::printf("%8s %8s %12s %16s %12s\n", "lights", "objects", "grid (ms)", "all lights (ms)", "avg lights");
+    for (uint32_t numLights : { 64u, 256u, 1024u, 4096u })
+    {
+        // Small lights and objects spread over a scene 1000 units across
+        std::mt19937 random(numLights);
+        std::uniform_real_distribution<float> place(-500, 500), lightSize(5, 40), brightness(0.1f, 10), objectSize(1, 20);
+        std::vector<CVector3> positions, centres;
+        std::vector<float>    radii, luminances, objectRadii;
+        for (uint32_t i = 0; i < numLights; ++i)
+        {
+            positions.push_back({ place(random), place(random) * 0.1f, place(random) });
+            radii.push_back(lightSize(random));
+            luminances.push_back(brightness(random));
+        }
+        for (uint32_t i = 0; i < NUM_OBJECTS; ++i)
+        {
+            centres.push_back({ place(random), 0, place(random) });
+            objectRadii.push_back(objectSize(random));
+        }
+
+        ObjectLights objectLights;
+        float gridTime = TimeFastest(20, [&]
+        {
+            objectLights.SetLights(positions.data(), radii.data(), luminances.data(), numLights);
+            objectLights.AssignObjects(centres.data(), objectRadii.data(), NUM_OBJECTS);
+        });
+        uint32_t totalLights = 0;
+        for (uint32_t object = 0; object < NUM_OBJECTS; ++object)  totalLights += objectLights.Lights(object).count;
+
+        // Every light against every object, only counting the ones in reach, for comparison
+        volatile uint32_t inReach = 0;
+        float allTime = TimeFastest(5, [&]
+        {
+            uint32_t count = 0;
+            for (uint32_t object = 0; object < NUM_OBJECTS; ++object)
+            {
+                for (uint32_t light = 0; light < numLights; ++light)
+                {
+                    CVector3 toLight = positions[light] - centres[object];
+                    float reach = radii[light] + objectRadii[object];
+                    if (Dot(toLight, toLight) < reach * reach)  ++count;
+                }
+            }
+            inReach = count;
+        });
+
+        std::printf("%8u %8u %12.3f %16.3f %12.2f\n", numLights, NUM_OBJECTS, gridTime * 1000, allTime * 1000,
+                    static_cast<float>(totalLights) / NUM_OBJECTS);
+    }
+    return 0;
+}
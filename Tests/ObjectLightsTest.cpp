@@ -0,0 +1,89 @@
+//--------------------------------------------------------------------------------------
+// Object light tests - compares the grid search with checking every light
+//--------------------------------------------------------------------------------------
+
+#include "TestHelpers.h"
+
+#include "ObjectLights.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+// The lights ObjectLights should choose for a sphere, found by ranking every light
+static ObjectLightList ChooseLights(const CVector3& centre, float radius, const std::vector<CVector3>& positions,
+                                    const std::vector<float>& radii, const std::vector<float>& luminances)
+{
+    std::vector<std::pair<float, uint32_t>> ranked;
+    for (uint32_t light = 0; light < positions.size(); ++light)
+    {
+        float distance = Length(positions[light] - centre);
+        if (distance >= radii[light] + radius)  continue;
+        float surfaceDistance = std::max(distance - radius, 1.0f);
+        ranked.push_back({ luminances[light] / (surfaceDistance * surfaceDistance), light });
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [](const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b)
+    {
+        return a.first > b.first;
+    });
+
+    ObjectLightList list = {};
+    list.count = std::min(static_cast<uint32_t>(ranked.size()), MAX_OBJECT_LIGHTS);
+    for (uint32_t i = 0; i < list.count; ++i)  list.lights[i] = ranked[i].second;
+    return list;
+}
+
+
+int main()
+{
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> place(-200, 200), lightSize(2, 40), brightness(0.1f, 10), objectSize(0.5f, 30);
+
+    // A few very large lights among many small ones, so some lights cover much of the grid
+    const uint32_t NUM_LIGHTS = 500;
+    std::vector<CVector3> positions;
+    std::vector<float>    radii, luminances;
+    for (uint32_t i = 0; i < NUM_LIGHTS; ++i)
+    {
+        positions.push_back({ place(random), place(random) * 0.2f, place(random) });
+        radii.push_back(i % 50 == 0 ? 300.0f : lightSize(random));
+        luminances.push_back(brightness(random));
+    }
+
+    // Objects inside and outside the lights' grid
+    const uint32_t NUM_OBJECTS = 2000;
+    std::vector<CVector3> centres;
+    std::vector<float>    objectRadii;
+    for (uint32_t i = 0; i < NUM_OBJECTS; ++i)
+    {
+        centres.push_back({ place(random) * 2, place(random) * 0.5f, place(random) * 2 });
+        objectRadii.push_back(objectSize(random));
+    }
+
+    ObjectLights objectLights;
+    objectLights.SetLights(positions.data(), radii.data(), luminances.data(), NUM_LIGHTS);
+    objectLights.AssignObjects(centres.data(), objectRadii.data(), NUM_OBJECTS);
+
+    int numDifferent = 0, numFull = 0, numEmpty = 0;
+    for (uint32_t object = 0; object < NUM_OBJECTS; ++object)
+    {
+        ObjectLightList expected = ChooseLights(centres[object], objectRadii[object], positions, radii, luminances);
+        const ObjectLightList& list = objectLights.Lights(object);
+        bool same = list.count == expected.count && std::equal(list.lights, list.lights + list.count, expected.lights);
+        if (!same)  ++numDifferent;
+        if (list.count == MAX_OBJECT_LIGHTS)  ++numFull;
+        if (list.count == 0)  ++numEmpty;
+    }
+    CHECK(numDifferent == 0);
+    CHECK(numFull > 0 && numEmpty > 0); // Both limits were tested
+
+    // No lights leaves every object with an empty list
+    objectLights.SetLights(nullptr, nullptr, nullptr, 0);
+    objectLights.AssignObjects(centres.data(), objectRadii.data(), NUM_OBJECTS);
+    bool allEmpty = true;
+    for (uint32_t object = 0; object < NUM_OBJECTS; ++object)  allEmpty = allEmpty && objectLights.Lights(object).count == 0;
+    CHECK(allEmpty);
+
+    return TestResult();
+}
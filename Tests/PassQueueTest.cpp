@@ -0,0 +1,107 @@
+//--------------------------------------------------------------------------------------
+// Pass queue tests - passes recorded on several workers are submitted in the order added
+//--------------------------------------------------------------------------------------
+// Adds passes that take longer the earlier they were added, so the workers finish them out of
+// order, and checks Submit still hands every pass back once, in the order it was added, with
+// its own commands and finished result. Runs several frames of different sizes so the command
+// streams are reused, and checks a queue with unsubmitted passes shuts down cleanly.
+
+#include "TestHelpers.h"
+
+#include "PassQueue.h"
+
+#include <vector>
+#include <string>
+#include <set>
+#include <mutex>
+#include <chrono>
+
+// The draw recorded by each test pass identifies it
+static uint32_t ReadPassNumber(const CommandStream& commands)
+{
+    uint32_t number = ~0u;
+    CommandStream::Reader reader(commands);
+    while (reader.Next())
+    {
+        if (reader.Type() == RenderCommand::DrawIndexed)  number = reader.Get<DrawCommand>().startIndex;
+    }
+    return number;
+}
+
+
+int main()
+{
+    const unsigned int NUM_THREADS = 4;
+
+    // Every pass finished, in the order the workers finished them
+    std::mutex finishedMutex;
+    std::vector<uint32_t> finishOrder;
+    std::set<unsigned int> workersUsed;
+    PassQueue queue(NUM_THREADS, [&](unsigned int worker, const std::string&, const CommandStream& commands)
+    {
+        uint32_t number = ReadPassNumber(commands);
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finishOrder.push_back(number);
+        workersUsed.insert(worker);
+        return reinterpret_cast<void*>(static_cast<uintptr_t>(number + 1000));
+    });
+    CHECK(queue.NumThreads() == NUM_THREADS);
+
+    for (uint32_t numPasses : { 16u, 5u, 40u, 0u })
+    {
+        finishOrder.clear();
+        for (uint32_t p = 0; p < numPasses; ++p)
+        {
+            queue.Add("Pass " + std::to_string(p), [p, numPasses](CommandStream& commands)
+            {
+                // Earlier passes take longer. Each pass records a different number of commands into its stream
+                std::this_thread::sleep_for(std::chrono::milliseconds(numPasses - p));
+                for (uint32_t i = 0; i < p % 3; ++i)  commands.SetViewport(256, 256);
+                commands.DrawIndexed(3, p);
+            });
+        }
+
+        std::vector<uint32_t> submitOrder;
+        uint32_t numMismatched = 0;
+        queue.Submit([&](const std::string& name, const CommandStream& commands, void* finished)
+        {
+            uint32_t number = ReadPassNumber(commands);
+            if (name != "Pass " + std::to_string(number))                         ++numMismatched;
+            if (finished != reinterpret_cast<void*>(static_cast<uintptr_t>(number + 1000)))  ++numMismatched;
+            submitOrder.push_back(number);
+        });
+
+        std::vector<uint32_t> addOrder;
+        for (uint32_t p = 0; p < numPasses; ++p)  addOrder.push_back(p);
+        CHECK(submitOrder == addOrder);
+        CHECK(numMismatched == 0);
+        CHECK(finishOrder.size() == numPasses);
+        if (numPasses >= NUM_THREADS * 2)  CHECK(finishOrder != addOrder); // The test is only worth anything if this happens
+    }
+    CHECK(workersUsed.size() > 1);
+    for (unsigned int worker : workersUsed)  CHECK(worker < NUM_THREADS);
+
+    // Submitting again with nothing added submits nothing
+    int numSubmitted = 0;
+    queue.Submit([&](const std::string&, const CommandStream&, void*) { ++numSubmitted; });
+    CHECK(numSubmitted == 0);
+
+    // A queue destroyed with passes still recording waits for them rather than leaving them running
+    int numRecorded = 0;
+    {
+        PassQueue unsubmitted(2);
+        for (int p = 0; p < 6; ++p)
+        {
+            unsubmitted.Add("Unsubmitted", [&numRecorded, &finishedMutex](CommandStream& commands)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+                commands.DrawIndexed(3);
+                std::lock_guard<std::mutex> lock(finishedMutex);
+                ++numRecorded;
+            });
+        }
+    }
+    CHECK(numRecorded == 6);
+
+    return TestResult();
+}
@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// Pass recorder tests - records passes headless through NullPassRecorder on several threads
+//--------------------------------------------------------------------------------------
+
+#include "TestHelpers.h"
+
+#include "NullBackend.h"
+#include "PipelineState.h"
+
+#include <string>
+
+// A depth-only pass like a shadow map, with the given number of draws of 100 triangles each. Leave out the pipeline
+// to make a pass the backend should reject
+static void RecordShadowPass(CommandStream& commands, const PipelineState* pipeline, int numDraws)
+{
+    commands.SetRenderTargets(nullptr, FakeObject<ID3D11DepthStencilView>(1));
+    commands.SetViewport(1024, 1024);
+    commands.ClearDepth(FakeObject<ID3D11DepthStencilView>(1));
+    if (pipeline)  commands.SetPipeline(pipeline);
+
+    GeometryCommand geometry = { FakeObject<ID3D11InputLayout>(2), FakeObject<ID3D11Buffer>(3), 32,
+                                 FakeObject<ID3D11Buffer>(4), 2 };
+    commands.SetGeometry(geometry);
+    for (int i = 0; i < numDraws; ++i)  commands.DrawIndexed(300, i * 300);
+}
+
+
+int main()
+{
+    PipelineDesc desc;
+    desc.vertexShader = FakeObject<ID3D11VertexShader>(5);
+    const PipelineState* pipeline = GetPipelineState(desc);
+    CHECK(GetPipelineState(desc) == pipeline); // Pipelines are shared
+
+    // Passes are recorded on the workers and replayed in the order they are added, each from default state
+    NullPassRecorder recorder(4);
+    recorder.AddPass("Shadow map 0", [&](CommandStream& commands) { RecordShadowPass(commands, pipeline, 3); });
+    recorder.AddPass("Shadow map 1", [&](CommandStream& commands) { RecordShadowPass(commands, pipeline, 2); });
+    recorder.Submit();
+
+    const NullBackend::Stats& stats = recorder.Backend().GetStats();
+    CHECK(recorder.NumPasses() == 2);
+    CHECK(stats.numDraws == 5);
+    CHECK(stats.numTriangles == 500);
+    CHECK(stats.numCommands[static_cast<size_t>(RenderCommand::SetPipeline)] == 2);
+    CHECK(stats.numCommands[static_cast<size_t>(RenderCommand::ClearDepth)] == 2);
+    CHECK(stats.redundantStateChanges == 0);
+    CHECK(recorder.Backend().Errors().empty());
+
+    // State doesn't carry over from the passes before, so a pass without its own pipeline is reported with its name
+    recorder.Backend().ResetStats();
+    recorder.AddPass("Main scene", [&](CommandStream& commands) { RecordShadowPass(commands, nullptr, 1); });
+    recorder.Submit();
+
+    const auto& errors = recorder.Backend().Errors();
+    CHECK(recorder.NumPasses() == 3);
+    CHECK(recorder.Backend().GetStats().numDraws == 1);
+    CHECK(errors.size() == 1);
+    CHECK(!errors.empty() && errors[0] == "Main scene, command 4: draw without a pipeline");
+
+    recorder.Backend().ResetStats();
+    CHECK(recorder.Backend().Errors().empty());
+    CHECK(recorder.Backend().GetStats().numDraws == 0);
+
+    ReleasePipelineStates();
+    return TestResult();
+}
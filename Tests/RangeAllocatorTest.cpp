@@ -0,0 +1,194 @@
+//--------------------------------------------------------------------------------------
+// Range allocator tests - best fit, joining free ranges and fragmentation
+//--------------------------------------------------------------------------------------
+// Checks the smallest free range that fits is used, freed ranges join the free ranges before
+// and after them, allocations fail when no single free range is large enough even if enough is
+// free in total, and Reset and Grow leave the expected free space. Then runs a long mixed
+// sequence of allocations and frees against a simple map of which units are in use, checking
+// ranges never overlap and the used space, free range count and largest free range all match.
+
+#include "TestHelpers.h"
+
+#include "RangeAllocator.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+struct Range
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+
+int main()
+{
+    //// Best fit ////
+
+    // Free ranges of 30, 10 and 20 with used ranges between them
+    RangeAllocator allocator(100);
+    uint32_t a, b, c, d, e, f;
+    CHECK(allocator.Allocate(30, a) && a == 0);
+    CHECK(allocator.Allocate(5, b) && b == 30);
+    CHECK(allocator.Allocate(10, c) && c == 35);
+    CHECK(allocator.Allocate(5, d) && d == 45);
+    CHECK(allocator.Allocate(20, e) && e == 50);
+    CHECK(allocator.Allocate(5, f) && f == 70);
+    allocator.Free(a, 30);
+    allocator.Free(c, 10);
+    allocator.Free(e, 20);
+    CHECK(allocator.NumFreeRanges() == 4); // And the 25 at the end
+    CHECK(allocator.Used() == 15);
+
+    // Each allocation takes the smallest range it fits in, not the first
+    uint32_t offset;
+    CHECK(allocator.Allocate(8, offset) && offset == 35);  // The 10
+    CHECK(allocator.Allocate(15, offset) && offset == 50); // The 20, not the 25 or 30
+    CHECK(allocator.Allocate(26, offset) && offset == 0);  // Only the 30 is large enough
+    CHECK(allocator.Allocate(25, offset) && offset == 75); // Exactly fits the range at the end
+    CHECK(allocator.NumFreeRanges() == 3);                 // 2, 5 and 4 left over
+    CHECK(allocator.LargestFreeRange() == 5);
+
+    //// Joining free ranges ////
+
+    // Three neighbouring ranges with used space either side, freed so each new free range joins the one before, the one
+    // after, and then both
+    allocator.Reset(100, 0);
+    uint32_t left, middle, right, wall;
+    CHECK(allocator.Allocate(10, wall) && allocator.Allocate(10, left) && allocator.Allocate(10, middle) &&
+          allocator.Allocate(10, right) && allocator.Allocate(60, wall));
+    CHECK(allocator.NumFreeRanges() == 0 && allocator.Used() == 100);
+
+    allocator.Free(left, 10);
+    CHECK(allocator.NumFreeRanges() == 1);
+    allocator.Free(middle, 10); // Joins the previous range
+    CHECK(allocator.NumFreeRanges() == 1 && allocator.LargestFreeRange() == 20);
+    CHECK(allocator.Allocate(20, offset) && offset == left);
+    allocator.Free(left, 20);
+
+    allocator.Reset(100, 0);
+    CHECK(allocator.Allocate(10, wall) && allocator.Allocate(10, left) && allocator.Allocate(10, middle) &&
+          allocator.Allocate(10, right) && allocator.Allocate(60, wall));
+    allocator.Free(right, 10);
+    allocator.Free(middle, 10); // Joins the next range
+    CHECK(allocator.NumFreeRanges() == 1 && allocator.LargestFreeRange() == 20);
+    allocator.Free(left, 10);   // Joins the range now after it
+    CHECK(allocator.NumFreeRanges() == 1 && allocator.LargestFreeRange() == 30);
+
+    allocator.Reset(100, 0);
+    CHECK(allocator.Allocate(10, wall) && allocator.Allocate(10, left) && allocator.Allocate(10, middle) &&
+          allocator.Allocate(10, right) && allocator.Allocate(60, wall));
+    allocator.Free(left, 10);
+    allocator.Free(right, 10);
+    CHECK(allocator.NumFreeRanges() == 2);
+    allocator.Free(middle, 10); // Joins both
+    CHECK(allocator.NumFreeRanges() == 1 && allocator.LargestFreeRange() == 30);
+    CHECK(allocator.Used() == 70);
+
+    //// Failing ////
+
+    // 30 free in total but in three pieces, so 15 doesn't fit anywhere until two of them are joined
+    allocator.Reset(60, 0);
+    uint32_t pieces[6];
+    for (auto& piece : pieces)  CHECK(allocator.Allocate(10, piece));
+    CHECK(!allocator.Allocate(1, offset));
+    allocator.Free(pieces[0], 10);
+    allocator.Free(pieces[2], 10);
+    allocator.Free(pieces[4], 10);
+    CHECK(allocator.Size() - allocator.Used() == 30 && allocator.LargestFreeRange() == 10);
+    offset = 12345;
+    CHECK(!allocator.Allocate(15, offset));
+    CHECK(offset == 12345 && allocator.Used() == 30 && allocator.NumFreeRanges() == 3); // A failure changes nothing
+    allocator.Free(pieces[1], 10);
+    CHECK(allocator.Allocate(15, offset) && offset == pieces[0]);
+    CHECK(!allocator.Allocate(0, offset));
+
+    //// Reset and grow ////
+
+    // Everything below the used size is allocated and the rest is one free range
+    allocator.Reset(1000, 400);
+    CHECK(allocator.Size() == 1000 && allocator.Used() == 400);
+    CHECK(allocator.NumFreeRanges() == 1 && allocator.LargestFreeRange() == 600);
+    CHECK(allocator.Allocate(600, offset) && offset == 400);
+    allocator.Reset(1000, 1000);
+    CHECK(allocator.NumFreeRanges() == 0 && !allocator.Allocate(1, offset));
+
+    // Growing adds free space at the end, joined to any free range already there
+    allocator.Reset(100, 0);
+    CHECK(allocator.Allocate(60, offset));
+    allocator.Grow(150);
+    CHECK(allocator.Size() == 150 && allocator.Used() == 60);
+    CHECK(allocator.NumFreeRanges() == 1 && allocator.LargestFreeRange() == 90);
+    allocator.Grow(120); // Never shrinks
+    CHECK(allocator.Size() == 150);
+
+    //// Mixed sequence ////
+
+    // Random allocations and frees compared against a map of the units in use
+    const uint32_t SIZE = 5000;
+    allocator.Reset(SIZE, 0);
+    std::vector<bool> inUse(SIZE, false);
+    std::vector<Range> allocated;
+    std::mt19937 random(6);
+    std::uniform_int_distribution<uint32_t> rangeSize(1, 200);
+    uint32_t numOverlaps = 0, numMismatches = 0, numFailed = 0;
+    for (int step = 0; step < 5000; ++step)
+    {
+        if (allocated.empty() || random() % 5 < 3)
+        {
+            Range range = { 0, rangeSize(random) };
+            if (!allocator.Allocate(range.size, range.offset))
+            {
+                // Must really be no free range large enough
+                if (allocator.LargestFreeRange() >= range.size)  ++numMismatches;
+                ++numFailed;
+                continue;
+            }
+            for (uint32_t i = range.offset; i < range.offset + range.size; ++i)
+            {
+                if (i >= SIZE || inUse[i])  ++numOverlaps;
+                else                        inUse[i] = true;
+            }
+            allocated.push_back(range);
+        }
+        else
+        {
+            size_t index = random() % allocated.size();
+            Range range = allocated[index];
+            allocated[index] = allocated.back();
+            allocated.pop_back();
+            allocator.Free(range.offset, range.size);
+            for (uint32_t i = range.offset; i < range.offset + range.size; ++i)  inUse[i] = false;
+        }
+
+        // Count the used units, the free runs and the longest free run in the map
+        uint32_t used = 0, numRuns = 0, run = 0, longestRun = 0;
+        for (uint32_t i = 0; i < SIZE; ++i)
+        {
+            if (inUse[i])
+            {
+                ++used;
+                run = 0;
+            }
+            else
+            {
+                if (run == 0)  ++numRuns;
+                longestRun = std::max(longestRun, ++run);
+            }
+        }
+        if (allocator.Used() != used || allocator.NumFreeRanges() != numRuns || allocator.LargestFreeRange() != longestRun)
+        {
+            ++numMismatches;
+        }
+    }
+    CHECK(numOverlaps == 0);
+    CHECK(numMismatches == 0);
+    CHECK(numFailed > 0); // The space filled up at times, so failures were tested too
+
+    // Freeing everything joins it all back into one range
+    for (const Range& range : allocated)  allocator.Free(range.offset, range.size);
+    CHECK(allocator.Used() == 0 && allocator.NumFreeRanges() == 1 && allocator.LargestFreeRange() == SIZE);
+
+    return TestResult();
+}
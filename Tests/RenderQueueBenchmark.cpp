@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------------
+// Render queue benchmark - filling and sorting queues of up to 100k items
+//--------------------------------------------------------------------------------------
+// Times adding items at random positions and sorting them front to back, as the scene does for
+// its opaque models each frame, for queues of increasing size. The SSE depths and radix sort are
+// compared with a scalar depth loop and std::sort on the same items, which should fall behind
+// as the queue grows.
+
+#include "TestHelpers.h"
+
+#include "RenderQueue.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+
+int main()
+{
+    CMatrix4x4 view = InverseAffine(MatrixRotationY(0.7f) * MatrixTranslation({ 10, 5, -30 }));
+
+    std::printf("%10s %12s %12s %12s %12s %10s\n", "items", "add (us)", "depths (us)", "sort (us)", "std (us)", "speed-up");
+    for (size_t numItems : { 1000, 10000, 100000, 1000000 })
+    {
+        std::mt19937 random(static_cast<unsigned int>(numItems));
+        std::uniform_real_distribution<float> coordinate(-500, 500);
+        std::vector<CVector3> positions(numItems);
+        std::vector<uint16_t> buckets(numItems);
+        for (size_t i = 0; i < numItems; ++i)
+        {
+            positions[i] = { coordinate(random), coordinate(random), coordinate(random) };
+            buckets[i] = static_cast<uint16_t>(random() % 8);
+        }
+
+        // The queue as the scene uses it: cleared, filled and sorted each frame
+        RenderQueue queue;
+        float addTime = TimeFastest(5, [&]
+        {
+            queue.Clear();
+            for (size_t i = 0; i < numItems; ++i)  queue.Add(static_cast<uint32_t>(i), positions[i], buckets[i]);
+        });
+        float sortTime = TimeFastest(5, [&] { queue.Sort(view, RenderQueue::FrontToBack); });
+
+        // Just the depths, to show how much of the sort time they are
+        std::vector<float> x(numItems), y(numItems), z(numItems), depths(numItems);
+        for (size_t i = 0; i < numItems; ++i)
+        {
+            x[i] = positions[i].x;
+            y[i] = positions[i].y;
+            z[i] = positions[i].z;
+        }
+        float depthTime = TimeFastest(5, [&] { CalculateViewDepths(x.data(), y.data(), z.data(), numItems, view, depths.data()); });
+
+        // The same sort done simply: a depth per item from the position then std::sort on bucket and depth
+        std::vector<RenderItem> items(numItems);
+        float stdTime = TimeFastest(5, [&]
+        {
+            for (size_t i = 0; i < numItems; ++i)
+            {
+                const CVector3& p = positions[i];
+                float depth = p.x * view.e02 + p.y * view.e12 + p.z * view.e22 + view.e32;
+                items[i] = { buckets[i], static_cast<uint32_t>(i), depth };
+            }
+            std::sort(items.begin(), items.end(), [](const RenderItem& a, const RenderItem& b)
+            {
+                return (a.sortKey != b.sortKey) ? a.sortKey < b.sortKey : a.depth < b.depth;
+            });
+        });
+
+        std::printf("%10zu %12.1f %12.1f %12.1f %12.1f %9.1fx\n", numItems, addTime * 1e6f, depthTime * 1e6f, sortTime * 1e6f,
+                    stdTime * 1e6f, stdTime / sortTime);
+    }
+    return 0;
+}
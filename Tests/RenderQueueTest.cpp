@@ -0,0 +1,146 @@
+//--------------------------------------------------------------------------------------
+// Render queue tests - depths, sortable keys and the radix sort
+//--------------------------------------------------------------------------------------
+// Checks the radix sort gives exactly the order std::stable_sort does, for keys that use every
+// byte, keys with many equal values and keys where most bytes are the same in every key (the
+// passes that are skipped). Checks the SSE depths match the scalar sum for counts that leave
+// a remainder, that floats convert to keys in the same order, and that the queue sorts opaque
+// items by bucket then front to back and blended items back to front.
+
+#include "TestHelpers.h"
+
+#include "RenderQueue.h"
+
+#include <vector>
+#include <algorithm>
+#include <random>
+#include <cmath>
+
+// True if the radix sort puts the items in the same order as std::stable_sort
+bool MatchesStableSort(std::vector<RenderItem> items)
+{
+    std::vector<RenderItem> expected = items;
+    std::stable_sort(expected.begin(), expected.end(), [](const RenderItem& a, const RenderItem& b) { return a.sortKey < b.sortKey; });
+
+    std::vector<RenderItem> scratch;
+    RadixSort(items, scratch);
+    if (items.size() != expected.size())  return false;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        if (items[i].sortKey != expected[i].sortKey || items[i].index != expected[i].index)  return false;
+    }
+    return true;
+}
+
+// Random items with keys made by the given function, numbered in their original order to check stability
+template <typename KeyFunction>
+std::vector<RenderItem> MakeItems(size_t count, KeyFunction key)
+{
+    std::vector<RenderItem> items(count);
+    for (size_t i = 0; i < count; ++i)  items[i] = { key(), static_cast<uint32_t>(i), 0.0f };
+    return items;
+}
+
+
+int main()
+{
+    std::mt19937_64 random(3);
+
+    //// Radix sort ////
+
+    for (size_t count : { 0, 1, 2, 3, 100, 5000 })
+    {
+        // Every byte differs
+        CHECK(MatchesStableSort(MakeItems(count, [&] { return random(); })));
+
+        // Only a few values, so most keys are equal to others
+        CHECK(MatchesStableSort(MakeItems(count, [&] { return random() % 4; })));
+
+        // Only the bucket and lowest byte vary, the six bytes between are the same in every key and skipped
+        CHECK(MatchesStableSort(MakeItems(count, [&] { return ((random() % 3) << 32) | 0x12345600u | (random() & 0xff); })));
+
+        // Real depth keys with negative depths, both orders
+        std::uniform_real_distribution<float> depth(-50, 500);
+        CHECK(MatchesStableSort(MakeItems(count, [&] { return static_cast<uint64_t>(FloatToSortableInt(depth(random))); })));
+        CHECK(MatchesStableSort(MakeItems(count, [&] { return static_cast<uint64_t>(~FloatToSortableInt(depth(random))); })));
+    }
+
+    // Every key the same, all passes are skipped and the order is unchanged
+    std::vector<RenderItem> same = MakeItems(50, [] { return 7ull; });
+    std::vector<RenderItem> scratch;
+    RadixSort(same, scratch);
+    for (size_t i = 0; i < same.size(); ++i)  CHECK(same[i].index == i);
+
+    //// Sortable floats ////
+
+    std::vector<float> values = { -1e30f, -1000, -1.5f, -1, -1e-30f, -0.0f, 0.0f, 1e-30f, 0.25f, 1, 1000, 1e30f };
+    for (size_t i = 1; i < values.size(); ++i)
+    {
+        CHECK(FloatToSortableInt(values[i - 1]) <= FloatToSortableInt(values[i]));
+        if (values[i - 1] < values[i])  CHECK(FloatToSortableInt(values[i - 1]) < FloatToSortableInt(values[i]));
+    }
+
+    //// View depths ////
+
+    // A camera turned and moved away from the origin, depth is z after the view transform
+    CMatrix4x4 camera = MatrixRotationY(0.7f) * MatrixRotationX(-0.3f) * MatrixTranslation({ 10, 5, -30 });
+    CMatrix4x4 view = InverseAffine(camera);
+    std::uniform_real_distribution<float> coordinate(-100, 100);
+    for (size_t count : { 0, 1, 3, 4, 5, 7, 8, 13, 1001 })
+    {
+        std::vector<float> x(count), y(count), z(count), depths(count + 1, -12345.0f);
+        for (size_t i = 0; i < count; ++i)
+        {
+            x[i] = coordinate(random);
+            y[i] = coordinate(random);
+            z[i] = coordinate(random);
+        }
+        CalculateViewDepths(x.data(), y.data(), z.data(), count, view, depths.data());
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            float expected = x[i] * view.e02 + y[i] * view.e12 + z[i] * view.e22 + view.e32;
+            CHECK(std::fabs(depths[i] - expected) <= 1e-4f * (1 + std::fabs(expected)));
+        }
+        CHECK(depths[count] == -12345.0f); // Nothing written past the end
+    }
+
+    //// Queue order ////
+
+    // Items in front of and behind the camera, in three buckets
+    RenderQueue opaque, blended;
+    for (int pass = 0; pass < 2; ++pass) // The second pass checks the queues work again after Clear
+    {
+        opaque.Clear();
+        blended.Clear();
+        for (uint32_t i = 0; i < 1000; ++i)
+        {
+            CVector3 position = { coordinate(random), coordinate(random), coordinate(random) };
+            opaque.Add(i, position, static_cast<uint16_t>(i % 3));
+            blended.Add(i, position);
+        }
+        opaque.Sort(view, RenderQueue::FrontToBack);
+        blended.Sort(view, RenderQueue::BackToFront);
+        CHECK(opaque.Size() == 1000 && blended.Size() == 1000);
+
+        const auto& opaqueItems = opaque.Items();
+        const auto& blendedItems = blended.Items();
+        bool sawNegative = false;
+        for (size_t i = 1; i < opaqueItems.size(); ++i)
+        {
+            uint32_t bucket = opaqueItems[i].index % 3, previousBucket = opaqueItems[i - 1].index % 3;
+            CHECK(previousBucket <= bucket);
+            if (previousBucket == bucket)  CHECK(opaqueItems[i - 1].depth <= opaqueItems[i].depth);
+            CHECK(blendedItems[i - 1].depth >= blendedItems[i].depth);
+            if (opaqueItems[i].depth < 0)  sawNegative = true;
+        }
+        CHECK(sawNegative);
+
+        // Each item keeps its own depth
+        std::vector<float> depthOf(1000);
+        for (auto& item : opaqueItems)  depthOf[item.index] = item.depth;
+        for (auto& item : blendedItems)  CHECK(depthOf[item.index] == item.depth);
+    }
+
+    return TestResult();
+}
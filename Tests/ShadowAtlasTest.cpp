@@ -0,0 +1,200 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas tests - quadtree allocation and the rules for moving lights
+//--------------------------------------------------------------------------------------
+// Checks the allocator fills the atlas exactly, joins freed squares back into their parents and
+// gives back a particular square. Then checks the atlas shrinks lights before growing them,
+// grows at most the allowed number each frame, repacks after lights have been blocked for 30
+// frames, and over many frames of random importances never overlaps two lights or moves a light
+// without counting it.
+
+#include "TestHelpers.h"
+
+#include "ShadowAtlas.h"
+
+#include <vector>
+#include <random>
+#include <algorithm>
+
+bool Overlap(const AtlasRect& a, const AtlasRect& b)
+{
+    return a.size > 0 && b.size > 0 && a.x < b.x + b.size && b.x < a.x + a.size && a.y < b.y + b.size && b.y < a.y + a.size;
+}
+
+// True if no two regions overlap and all are inside the atlas
+bool ValidRects(const std::vector<AtlasRect>& rects, uint32_t atlasSize)
+{
+    for (size_t i = 0; i < rects.size(); ++i)
+    {
+        if (rects[i].x + rects[i].size > atlasSize || rects[i].y + rects[i].size > atlasSize)  return false;
+        for (size_t j = i + 1; j < rects.size(); ++j)
+        {
+            if (Overlap(rects[i], rects[j]))  return false;
+        }
+    }
+    return true;
+}
+
+std::vector<AtlasRect> LightRects(const ShadowAtlas& atlas, uint32_t numLights)
+{
+    std::vector<AtlasRect> rects;
+    for (uint32_t i = 0; i < numLights; ++i)  rects.push_back(atlas.Rect(i));
+    return rects;
+}
+
+bool SameRect(const AtlasRect& a, const AtlasRect& b)
+{
+    return a.x == b.x && a.y == b.y && a.size == b.size;
+}
+
+
+int main()
+{
+    std::mt19937 random(4);
+
+    //// Allocator ////
+
+    // 64 of the smallest squares fill the atlas exactly, with no space for one more
+    AtlasAllocator allocator(1024, 128);
+    std::vector<AtlasRect> squares(64);
+    for (auto& square : squares)  CHECK(allocator.Allocate(128, square) && square.size == 128);
+    CHECK(ValidRects(squares, 1024));
+    CHECK(allocator.UsedArea() == 1024u * 1024u);
+    AtlasRect rect;
+    CHECK(!allocator.Allocate(128, rect));
+
+    // Freed in any order they join all the way back up to the whole atlas, which can then be allocated in one go
+    std::shuffle(squares.begin(), squares.end(), random);
+    for (auto& square : squares)  allocator.Free(square);
+    CHECK(allocator.UsedArea() == 0);
+    CHECK(allocator.Allocate(1024, rect) && rect.x == 0 && rect.y == 0 && rect.size == 1024);
+    allocator.Free(rect);
+
+    // A parent is only whole again once all four quarters are free
+    AtlasRect quarters[4];
+    for (auto& quarter : quarters)  CHECK(allocator.Allocate(512, quarter));
+    for (int i = 0; i < 3; ++i)  allocator.Free(quarters[i]);
+    CHECK(!allocator.Allocate(1024, rect));
+    allocator.Free(quarters[3]);
+    CHECK(allocator.Allocate(1024, rect));
+    allocator.Clear();
+    CHECK(allocator.UsedArea() == 0);
+
+    // A particular square can be taken back after it is freed and joined up, but not while any of it is in use
+    AtlasRect small, other;
+    CHECK(allocator.Allocate(128, small));
+    CHECK(allocator.Allocate(256, other));
+    allocator.Free(small);
+    CHECK(allocator.AllocateAt(small));
+    CHECK(!allocator.AllocateAt(small));
+    CHECK(!allocator.AllocateAt({ other.x, other.y, 128 }));
+    CHECK(allocator.UsedArea() == 128u * 128u + 256u * 256u);
+    CHECK(allocator.Allocate(128, rect) && !Overlap(rect, small) && !Overlap(rect, other));
+
+    //// Shrink first, then grow a few ////
+
+    // Four lights at 256. Two shrink and two grow, but only one may grow each frame
+    {
+        ShadowAtlas atlas(1024, 128, 1024, 1);
+        float importances[4] = { 0.25f, 0.25f, 0.25f, 0.25f };
+        atlas.Update(importances, 4);
+        CHECK(atlas.Repacked());
+        for (uint32_t i = 0; i < 4; ++i)  CHECK(atlas.Rect(i).size == 256);
+
+        // Importance near a boundary doesn't change the size
+        importances[0] = 0.2f;
+        importances[1] = 0.3f;
+        atlas.Update(importances, 4);
+        CHECK(atlas.NumChanged() == 0);
+
+        importances[0] = importances[1] = 0.05f;
+        importances[2] = importances[3] = 0.5f;
+        atlas.Update(importances, 4);
+        CHECK(!atlas.Repacked());
+        CHECK(atlas.Rect(0).size == 128 && atlas.Rect(1).size == 128);
+        CHECK((atlas.Rect(2).size == 512) + (atlas.Rect(3).size == 512) == 1);
+        CHECK(atlas.NumChanged() == 3);
+        CHECK(ValidRects(LightRects(atlas, 4), 1024));
+
+        atlas.Update(importances, 4);
+        CHECK(atlas.Rect(2).size == 512 && atlas.Rect(3).size == 512);
+        CHECK(atlas.NumChanged() == 1);
+        CHECK(ValidRects(LightRects(atlas, 4), 1024));
+    }
+
+    //// Repacking ////
+
+    // Sixteen lights fill the atlas at 256. Twelve shrink, freeing plenty of area, but each keeps a corner of its old square
+    // so no 512 square is free for the light that grows. It stays where it is until the atlas repacks 30 frames later
+    {
+        const uint32_t NUM_LIGHTS = 16;
+        ShadowAtlas atlas(1024, 128, 1024, 1);
+        std::vector<float> importances(NUM_LIGHTS, 0.25f);
+        atlas.Update(importances.data(), NUM_LIGHTS);
+        CHECK(atlas.Occupancy() == 1.0f);
+
+        for (uint32_t i = 0; i < 12; ++i)  importances[i] = 0.05f;
+        importances[15] = 0.5f;
+        atlas.Update(importances.data(), NUM_LIGHTS);
+        CHECK(!atlas.Repacked() && atlas.NumChanged() == 12);
+        AtlasRect blockedRect = atlas.Rect(15);
+        CHECK(blockedRect.size == 256);
+
+        int frame = 2;
+        for (; frame <= 40 && !atlas.Repacked(); ++frame)
+        {
+            atlas.Update(importances.data(), NUM_LIGHTS);
+            if (atlas.Repacked())  break;
+            CHECK(atlas.NumChanged() == 0);
+            CHECK(SameRect(atlas.Rect(15), blockedRect)); // Given back the same region, not just the same size
+        }
+        CHECK(frame == 30);
+        CHECK(atlas.Repacked() && atlas.NumChanged() == NUM_LIGHTS);
+        CHECK(atlas.Rect(15).size == 512);
+        CHECK(ValidRects(LightRects(atlas, NUM_LIGHTS), 1024));
+    }
+
+    //// Random importances ////
+
+    // Lights drifting in importance over many frames are never overlapped, never grow more than allowed each frame and are
+    // never moved without being counted
+    {
+        const uint32_t NUM_LIGHTS = 40;
+        ShadowAtlas atlas(2048, 128, 1024, 2);
+        std::vector<float> importances(NUM_LIGHTS);
+        std::uniform_real_distribution<float> unit(0, 1), drift(-0.3f, 0.3f);
+        for (auto& importance : importances)  importance = unit(random) * unit(random);
+        atlas.Update(importances.data(), NUM_LIGHTS);
+
+        uint32_t numRepacks = 0, numMisses = 0, numMovesNotCounted = 0, numTooManyGrown = 0, numInvalid = 0;
+        for (int frame = 0; frame < 2000; ++frame)
+        {
+            std::vector<AtlasRect> before = LightRects(atlas, NUM_LIGHTS);
+            for (auto& importance : importances)  importance = std::min(1.0f, std::max(0.0f, importance + drift(random)));
+            atlas.Update(importances.data(), NUM_LIGHTS);
+            std::vector<AtlasRect> after = LightRects(atlas, NUM_LIGHTS);
+
+            if (!ValidRects(after, 2048))  ++numInvalid;
+            if (atlas.Repacked())
+            {
+                ++numRepacks;
+                continue;
+            }
+            uint32_t numMoved = 0, numGrown = 0;
+            for (uint32_t i = 0; i < NUM_LIGHTS; ++i)
+            {
+                if (!SameRect(before[i], after[i]))  ++numMoved;
+                if (after[i].size > before[i].size)  ++numGrown;
+                if (after[i].size == 0)  ++numMisses;
+            }
+            if (numMoved != atlas.NumChanged())  ++numMovesNotCounted;
+            if (numGrown > 2)  ++numTooManyGrown;
+        }
+        std::printf("%u repacks in 2000 frames, occupancy %.0f%%\n", numRepacks, atlas.Occupancy() * 100);
+        CHECK(numInvalid == 0);
+        CHECK(numMovesNotCounted == 0);
+        CHECK(numTooManyGrown == 0);
+        CHECK(numMisses == 0); // 40 lights of at least 128 always fit in 2048
+    }
+
+    return TestResult();
+}
@@ -0,0 +1,164 @@
+//--------------------------------------------------------------------------------------
+// Shadow cascade tests - splits, coverage of the view and texel snapping
+//--------------------------------------------------------------------------------------
+// Checks the splits run from the camera's near clip to the shadow distance, evenly or with the
+// same ratio between each at the two ends of the blend. Checks every point in each slice of the
+// camera's view lands inside its cascade's shadow map, from any direction the camera faces.
+// Checks that as the camera moves a little the cascades move across the light's view by whole
+// shadow map texels only, and keep the same size as the camera turns.
+
+#include "TestHelpers.h"
+
+#include "ShadowCascades.h"
+
+#include <random>
+#include <cmath>
+
+const float NEAR_CLIP = 0.5f;
+
+// Point transformed by a matrix (row vector times matrix, as in the shaders)
+static CVector3 TransformPoint(const CVector3& p, const CMatrix4x4& m)
+{
+    return { p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30,
+             p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31,
+             p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32 };
+}
+
+// Position of a cascade's shadow map "camera" across the light's view, in the light's own axes
+static void CascadeOrigin(const ShadowCascades& cascades, int cascade, float& x, float& y)
+{
+    CMatrix4x4 lightMatrix = InverseAffine(cascades.ViewMatrix(cascade));
+    x = Dot(lightMatrix.GetPosition(), lightMatrix.GetXAxis());
+    y = Dot(lightMatrix.GetPosition(), lightMatrix.GetYAxis());
+}
+
+
+int main()
+{
+    // A camera like Camera::UpdateMatrices makes, 60 degree horizontal field of view and 16:9
+    CMatrix4x4 projectionMatrix = MatrixIdentity();
+    projectionMatrix.e00 = 1.0f / std::tan(0.5236f);
+    projectionMatrix.e11 = projectionMatrix.e00 * 16.0f / 9.0f;
+
+    const CVector3 LIGHT_DIRECTION = { 0.3f, -1.0f, 0.5f };
+    const uint32_t RESOLUTIONS[MAX_SHADOW_CASCADES] = { 2048, 1024, 1024, 512 };
+
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> unit(0, 1), angle(-3.14f, 3.14f);
+
+    //// Splits ////
+
+    CMatrix4x4 viewMatrix = InverseAffine(MatrixRotationY(0.7f) * MatrixTranslation({ 10, 5, -30 }));
+    for (float splitBlend : { 0.0f, 0.75f, 1.0f })
+    {
+        ShadowCascades cascades(4, 400.0f, splitBlend);
+        cascades.Update(viewMatrix, projectionMatrix, NEAR_CLIP, LIGHT_DIRECTION, RESOLUTIONS);
+        CHECK(cascades.NumCascades() == 4);
+
+        // Each split is further than the last, starting beyond the near clip and ending at the shadow distance
+        float previous = NEAR_CLIP;
+        for (int i = 0; i < 4; ++i)
+        {
+            CHECK(cascades.SplitDepth(i) > previous);
+            previous = cascades.SplitDepth(i);
+        }
+        CHECK(std::fabs(cascades.SplitDepth(3) - 400.0f) < 0.01f);
+
+        // Evenly spaced or the same ratio between each at the two ends of the blend
+        for (int i = 0; i < 4; ++i)
+        {
+            float nearSplit = (i == 0) ? NEAR_CLIP : cascades.SplitDepth(i - 1);
+            if (splitBlend == 0)  CHECK(std::fabs((cascades.SplitDepth(i) - nearSplit) - (400.0f - NEAR_CLIP) / 4) < 0.01f);
+            if (splitBlend == 1)  CHECK(std::fabs(cascades.SplitDepth(i) / nearSplit - std::pow(400.0f / NEAR_CLIP, 0.25f)) < 0.01f);
+        }
+    }
+
+    // The number of cascades is limited to what the constants have room for
+    CHECK(ShadowCascades(0).NumCascades() == 1);
+    CHECK(ShadowCascades(MAX_SHADOW_CASCADES + 3).NumCascades() == MAX_SHADOW_CASCADES);
+
+    //// Coverage ////
+
+    // For cameras facing all over, points anywhere in each slice of the view are inside that cascade's shadow map: across
+    // the map and between its near and far depth
+    ShadowCascades cascades;
+    int numOutside = 0, numPoints = 0;
+    for (int camera = 0; camera < 20; ++camera)
+    {
+        CMatrix4x4 cameraWorld = MatrixRotationX(angle(random) * 0.5f) * MatrixRotationY(angle(random)) *
+                                 MatrixTranslation({ angle(random) * 100, angle(random) * 10, angle(random) * 100 });
+        cascades.Update(InverseAffine(cameraWorld), projectionMatrix, NEAR_CLIP, LIGHT_DIRECTION, RESOLUTIONS);
+
+        for (int i = 0; i < cascades.NumCascades(); ++i)
+        {
+            CMatrix4x4 shadowViewProj = cascades.ViewMatrix(i) * cascades.ProjectionMatrix(i);
+            float nearSplit = (i == 0) ? NEAR_CLIP : cascades.SplitDepth(i - 1);
+            for (int p = 0; p < 200; ++p)
+            {
+                // The first eight are the corners of the slice, the rest are random points inside it
+                float farSplit = cascades.SplitDepth(i);
+                float z  = (p < 8) ? ((p & 4) ? farSplit : nearSplit) : nearSplit + unit(random) * (farSplit - nearSplit);
+                float sx = (p < 8) ? ((p & 1) ? 1.0f : -1.0f) : unit(random) * 2 - 1;
+                float sy = (p < 8) ? ((p & 2) ? 1.0f : -1.0f) : unit(random) * 2 - 1;
+                CVector3 world = TransformPoint({ sx * z / projectionMatrix.e00, sy * z / projectionMatrix.e11, z }, cameraWorld);
+
+                CVector3 shadow = TransformPoint(world, shadowViewProj);
+                const float e = 1e-4f;
+                if (std::fabs(shadow.x) > 1 + e || std::fabs(shadow.y) > 1 + e || shadow.z < -e || shadow.z > 1 + e)  ++numOutside;
+                if (!cascades.IsCaster(i, world, 0))  ++numOutside;
+                ++numPoints;
+            }
+        }
+    }
+    CHECK(numOutside == 0);
+    CHECK(numPoints == 20 * 4 * 200);
+
+    //// Texel snapping ////
+
+    // Small camera moves shift each cascade across the light's view by a whole number of texels. Checks moves happen too,
+    // or the test would pass with cascades that never move
+    CMatrix4x4 cameraWorld = MatrixRotationX(0.2f) * MatrixRotationY(0.7f) * MatrixTranslation({ 10, 5, -30 });
+    cascades.Update(InverseAffine(cameraWorld), projectionMatrix, NEAR_CLIP, LIGHT_DIRECTION, RESOLUTIONS);
+    int numNotWhole = 0, numShifted = 0;
+    std::uniform_real_distribution<float> step(-0.5f, 0.5f);
+    for (int move = 0; move < 200; ++move)
+    {
+        float oldX[MAX_SHADOW_CASCADES], oldY[MAX_SHADOW_CASCADES], oldRadius[MAX_SHADOW_CASCADES];
+        for (int i = 0; i < cascades.NumCascades(); ++i)
+        {
+            CascadeOrigin(cascades, i, oldX[i], oldY[i]);
+            oldRadius[i] = 1.0f / cascades.ProjectionMatrix(i).e00;
+        }
+
+        cameraWorld = cameraWorld * MatrixTranslation({ step(random), step(random), step(random) });
+        cascades.Update(InverseAffine(cameraWorld), projectionMatrix, NEAR_CLIP, LIGHT_DIRECTION, RESOLUTIONS);
+
+        for (int i = 0; i < cascades.NumCascades(); ++i)
+        {
+            float x, y;
+            CascadeOrigin(cascades, i, x, y);
+            float radius = 1.0f / cascades.ProjectionMatrix(i).e00;
+            CHECK(radius == oldRadius[i]); // Only turning or a new projection changes the size
+
+            float texelSize = 2 * radius / RESOLUTIONS[i];
+            float texelsX = (x - oldX[i]) / texelSize, texelsY = (y - oldY[i]) / texelSize;
+            if (std::fabs(texelsX - std::round(texelsX)) > 0.01f)  ++numNotWhole;
+            if (std::fabs(texelsY - std::round(texelsY)) > 0.01f)  ++numNotWhole;
+            if (std::round(texelsX) != 0 || std::round(texelsY) != 0)  ++numShifted;
+        }
+    }
+    CHECK(numNotWhole == 0);
+    CHECK(numShifted > 100);
+
+    // Turning the camera on the spot keeps the cascades the same size, so their texels stay the same size in the world
+    float radii[MAX_SHADOW_CASCADES];
+    for (int i = 0; i < cascades.NumCascades(); ++i)  radii[i] = 1.0f / cascades.ProjectionMatrix(i).e00;
+    cameraWorld = MatrixRotationY(1.3f) * cameraWorld;
+    cascades.Update(InverseAffine(cameraWorld), projectionMatrix, NEAR_CLIP, LIGHT_DIRECTION, RESOLUTIONS);
+    for (int i = 0; i < cascades.NumCascades(); ++i)
+    {
+        CHECK(std::fabs(1.0f / cascades.ProjectionMatrix(i).e00 - radii[i]) <= radii[i] * 1e-3f);
+    }
+
+    return TestResult();
+}
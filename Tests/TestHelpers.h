@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Test helpers
+//--------------------------------------------------------------------------------------
+// Each test is a small program that checks things with CHECK and returns TestResult() from
+// main, so ctest sees it fail if any check failed. Checks carry on after a failure so one run
+// reports every problem.
+
+#ifndef _TEST_HELPERS_H_INCLUDED_
+#define _TEST_HELPERS_H_INCLUDED_
+
+#include <cstdio>
+#include <cstdint>
+#include <chrono>
+
+// Number of checks that have failed in this test program
+inline int& NumFailedChecks()
+{
+    static int numFailed = 0;
+    return numFailed;
+}
+
+// Report the condition with its file and line if it is false
+#define CHECK(condition) \
+    do { if (!(condition)) { std::printf("%s(%d): check failed: %s\n", __FILE__, __LINE__, #condition); ++NumFailedChecks(); } } while (false)
+
+// Return from main, prints a summary
+inline int TestResult()
+{
+    if (NumFailedChecks() == 0)  std::printf("All checks passed\n");
+    else                         std::printf("%d checks failed\n", NumFailedChecks());
+    return NumFailedChecks() == 0 ? 0 : 1;
+}
+
+
+// The null backend never looks inside GPU objects, so any distinct non-null pointers can stand in for them
+template <class T>
+T* FakeObject(uintptr_t id)  { return reinterpret_cast<T*>(id * 64); }
+
+
+// Seconds taken by the fastest of several runs of a function, for the benchmarks
+template <typename Function>
+float TimeFastest(int numRuns, Function function)
+{
+    float fastest = 0;
+    for (int run = 0; run < numRuns; ++run)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        function();
+        float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+        if (run == 0 || time < fastest)  fastest = time;
+    }
+    return fastest;
+}
+
+
+#endif //_TEST_HELPERS_H_INCLUDED_
@@ -0,0 +1,88 @@
+//--------------------------------------------------------------------------------------
+// Test lights - lights animated one at a time, as each Light did before LightAnimation
+//--------------------------------------------------------------------------------------
+// The light animation tests and benchmark compare LightAnimation with the per-light update it
+// replaced: each light object flickers and cycles colour on its own, with a branch for each kind
+// of animation. Only the animation is kept here, not the rest of Light.
+
+#ifndef _TEST_LIGHTS_H_INCLUDED_
+#define _TEST_LIGHTS_H_INCLUDED_
+
+#include "LightAnimation.h"
+
+struct ScalarLight
+{
+    CVector3 colour;
+    float    strength;
+
+    // Flickering
+    bool  flicker = false;
+    float flickerTime = 1.2f;
+    float strengthMax = 0;
+    bool  flickerDown = true;
+
+    // Colour change
+    bool  colourChange = false;
+    float colourSpeed = 1;
+    int   currentColour = 0;
+    int   nextColour = 1;
+    float colourProgress = 0;
+
+    ScalarLight(const CVector3& lightColour, float lightStrength) : colour(lightColour), strength(lightStrength) {}
+
+    void MakeFlicker(float time)
+    {
+        flicker = true;
+        flickerTime = time;
+        strengthMax = strength;
+    }
+
+    void MakeRainbow(float speed, int firstColour)
+    {
+        colourChange = true;
+        colourSpeed = speed;
+        currentColour = firstColour;
+        nextColour = (firstColour + 1) % NUM_RAINBOW_COLOURS;
+        colour = RAINBOW_COLOURS[currentColour];
+    }
+
+    void Update(float frameTime)
+    {
+        if (flicker)
+        {
+            if (flickerDown)
+            {
+                strength -= frameTime * strengthMax / flickerTime;
+                if (strength < 0)
+                {
+                    strength = 0;
+                    flickerDown = false;
+                }
+            }
+            else
+            {
+                strength += frameTime * strengthMax / flickerTime;
+                if (strength > strengthMax)
+                {
+                    strength = strengthMax;
+                    flickerDown = true;
+                }
+            }
+        }
+
+        if (colourChange)
+        {
+            colourProgress += colourSpeed * frameTime;
+            if (colourProgress > 1)
+            {
+                colourProgress -= 1.0f;
+                currentColour = nextColour;
+                nextColour = (nextColour + 1) % NUM_RAINBOW_COLOURS;
+            }
+            colour = colourProgress * RAINBOW_COLOURS[nextColour] + (1 - colourProgress) * RAINBOW_COLOURS[currentColour];
+        }
+    }
+};
+
+
+#endif //_TEST_LIGHTS_H_INCLUDED_
@@ -0,0 +1,151 @@
+//--------------------------------------------------------------------------------------
+// Test meshes - meshes made in code, laid out as if just imported
+//--------------------------------------------------------------------------------------
+// The mesh tests and benchmarks can't rely on assimp being installed, so they use a bumpy sphere
+// made here instead. It is laid out the way MeshImport.h leaves an imported mesh before it is
+// cooked: float positions, normals, tangents (zero, for GenerateTangents to fill in) and UVs,
+// 32-bit indices and one level of detail. The top and bottom halves are separate sub-meshes and
+// there is a UV seam where the sphere wraps around, like a real model. UnjoinTestMesh gives each
+// triangle its own vertices, as meshes are imported before their normals are calculated.
+
+#ifndef _TEST_MESHES_H_INCLUDED_
+#define _TEST_MESHES_H_INCLUDED_
+
+#include "MeshCook.h"
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+
+// Vertex layout of the test meshes
+const uint32_t TEST_MESH_VERTEX_SIZE    = 44;
+const uint32_t TEST_MESH_NORMAL_OFFSET  = 12;
+const uint32_t TEST_MESH_TANGENT_OFFSET = 24;
+const uint32_t TEST_MESH_UV_OFFSET      = 36;
+
+// Position on the bumpy sphere at the given angles. The bumps give the simplifier and optimiser something to work with
+inline CVector3 TestMeshPosition(float around, float down)
+{
+    float radius = 1 + 0.1f * std::sin(around * 7) * std::sin(down * 5);
+    return { radius * std::sin(down) * std::cos(around), radius * std::cos(down), radius * std::sin(down) * std::sin(around) };
+}
+
+// A bumpy sphere with the given number of rings (even) and segments, 2 * rings * segments triangles. Normals are calculated
+// from the neighbouring positions
+inline std::unique_ptr<MeshData> MakeTestMesh(uint32_t rings, uint32_t segments)
+{
+    const float PI = 3.14159265f;
+
+    auto data = std::make_unique<MeshData>();
+    CookedMesh& mesh = data->description;
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Position, VertexFormat::Float, 3, 0 };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Normal,   VertexFormat::Float, 3, TEST_MESH_NORMAL_OFFSET };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::Tangent,  VertexFormat::Float, 3, TEST_MESH_TANGENT_OFFSET };
+    mesh.elements[mesh.numElements++] = { VertexSemantic::UV,       VertexFormat::Float, 2, TEST_MESH_UV_OFFSET };
+    mesh.vertexSize = TEST_MESH_VERTEX_SIZE;
+
+    // Each half has its own vertices, the ring where they meet is in both
+    uint32_t halfRings    = rings / 2;
+    uint32_t halfVertices = (halfRings + 1) * (segments + 1);
+    uint32_t halfIndices  = halfRings * segments * 6;
+    mesh.numVertices  = halfVertices * 2;
+    mesh.numIndices   = halfIndices * 2;
+    mesh.numSubMeshes = 2;
+    data->vertices  = std::make_unique<unsigned char[]>(mesh.numVertices * mesh.vertexSize);
+    data->indices   = std::make_unique<unsigned char[]>(mesh.numIndices * 4);
+    data->subMeshes = std::make_unique<SubMesh[]>(2);
+
+    float* vertex = reinterpret_cast<float*>(data->vertices.get());
+    uint32_t* index = reinterpret_cast<uint32_t*>(data->indices.get());
+    for (uint32_t half = 0; half < 2; ++half)
+    {
+        for (uint32_t ring = 0; ring <= halfRings; ++ring)
+        {
+            for (uint32_t segment = 0; segment <= segments; ++segment)
+            {
+                // Poles are nudged off the axis so their normals are well defined
+                float around = 2 * PI * segment / segments;
+                float down   = PI * (half * halfRings + ring) / rings;
+                if (down < 0.001f)    down = 0.001f;
+                if (down > PI - 0.001f)  down = PI - 0.001f;
+
+                CVector3 position = TestMeshPosition(around, down);
+                // Rates of change rather than the tiny steps themselves, which Normalise would treat as zero
+                CVector3 alongU   = (TestMeshPosition(around + 0.001f, down) - position) * 1000.0f;
+                CVector3 alongV   = (TestMeshPosition(around, down + 0.001f) - position) * 1000.0f;
+                CVector3 normal   = Normalise(Cross(alongU, alongV));
+                if (Dot(normal, position) < 0)  normal = -normal;
+
+                float values[11] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, 0, 0, 0,
+                                     static_cast<float>(segment) / segments, (down / PI) };
+                std::memcpy(vertex, values, sizeof(values));
+                vertex += 11;
+            }
+        }
+
+        // Indices are relative to the sub-mesh's first vertex, clockwise seen from outside
+        for (uint32_t ring = 0; ring < halfRings; ++ring)
+        {
+            for (uint32_t segment = 0; segment < segments; ++segment)
+            {
+                uint32_t v0 = ring * (segments + 1) + segment;
+                uint32_t v1 = v0 + 1;
+                uint32_t v2 = v0 + segments + 1;
+                uint32_t v3 = v2 + 1;
+                uint32_t quad[6] = { v0, v1, v2, v1, v3, v2 };
+                for (uint32_t i : quad)  *index++ = i;
+            }
+        }
+        data->subMeshes[half] = { half * halfIndices, halfIndices, static_cast<int32_t>(half * halfVertices), half };
+    }
+
+    mesh.vertices     = data->vertices.get();
+    mesh.indices      = data->indices.get();
+    mesh.subMeshes    = data->subMeshes.get();
+    mesh.boundsCentre = { 0, 0, 0 };
+    mesh.boundsRadius = 1.1f;
+    return data;
+}
+
+
+// Copy of a test mesh with three vertices of its own for each triangle, as MeshImport.h copies a mesh from assimp before
+// calculating normals and joining identical vertices. Pass false for keepNormals to zero the normals, as for a file without them
+inline std::unique_ptr<MeshData> UnjoinTestMesh(const MeshData& joined, bool keepNormals)
+{
+    const CookedMesh& from = joined.description;
+    const uint32_t* fromIndices = reinterpret_cast<const uint32_t*>(joined.indices.get());
+
+    auto data = std::make_unique<MeshData>();
+    CookedMesh& mesh = data->description;
+    mesh = from;
+    mesh.numVertices = from.numIndices;
+    data->vertices  = std::make_unique<unsigned char[]>(mesh.numVertices * mesh.vertexSize);
+    data->indices   = std::make_unique<unsigned char[]>(mesh.numIndices * 4);
+    data->subMeshes = std::make_unique<SubMesh[]>(mesh.numSubMeshes);
+
+    // The sub-meshes' vertices are in the same order as their indices, so each corner's vertex number is its index number
+    uint32_t* index = reinterpret_cast<uint32_t*>(data->indices.get());
+    const float zero[3] = { 0, 0, 0 };
+    for (uint32_t s = 0; s < mesh.numSubMeshes; ++s)
+    {
+        SubMesh subMesh = from.subMeshes[s];
+        for (uint32_t i = 0; i < subMesh.numIndices; ++i)
+        {
+            uint32_t fromVertex = subMesh.baseVertex + fromIndices[subMesh.startIndex + i];
+            unsigned char* vertex = data->vertices.get() + (subMesh.startIndex + i) * mesh.vertexSize;
+            std::memcpy(vertex, joined.vertices.get() + fromVertex * mesh.vertexSize, mesh.vertexSize);
+            if (!keepNormals)  std::memcpy(vertex + TEST_MESH_NORMAL_OFFSET, zero, sizeof(zero));
+            index[subMesh.startIndex + i] = i;
+        }
+        subMesh.baseVertex = static_cast<int32_t>(subMesh.startIndex);
+        data->subMeshes[s] = subMesh;
+    }
+
+    mesh.vertices  = data->vertices.get();
+    mesh.indices   = data->indices.get();
+    mesh.subMeshes = data->subMeshes.get();
+    return data;
+}
+
+
+#endif //_TEST_MESHES_H_INCLUDED_
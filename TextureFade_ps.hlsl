@@ -6,11 +6,12 @@
 Texture2D DiffuseSpecularMap : register(t0);
 Texture2D DiffuseSpecularMap2 : register(t4);
 
-Texture2D ShadowMap[15] : register(t10);
-Texture2D ColourMap[15]      : register(t30);
+Texture2D ShadowAtlas   : register(t10);
+Texture2D ColourAtlas        : register(t30);
 
 SamplerState TexSampler      : register(s0);
 SamplerState PointClamp   : register(s1);
+SamplerComparisonState ShadowSampler : register(s2);
 
 //--------------------------------------------------------------------------------------
 // Shader code
@@ -23,7 +24,7 @@ float4 main(LightingPixelShaderInput input) : SV_Target
 	// Calculate lighting
 	float3 diffuseLight;
 	float3 specularLight;
-	CalculateLighting(ShadowMap, input.worldPosition, input.worldNormal, PointClamp, diffuseLight, specularLight, ColourMap, true);
+	CalculateLighting(ShadowAtlas, input.worldPosition, input.worldNormal, input.lightProjections, PointClamp, ShadowSampler, diffuseLight, specularLight, ColourAtlas, true);
 
 	////////////////////
 	// Combine lighting and textures
@@ -20,13 +20,14 @@
 // Template function to update a constant buffer. Pass the DirectX constant buffer object and the C++ data structure
 // you want to update it with. The structure will be copied in full over to the GPU constant buffer, where it will
 // be available to shaders. This is used to update model and camera positions, lighting data etc.
+// Optionally pass the context to use, this must be given when recording on a deferred context (see PassRecorder.h)
 template <class T>
-void UpdateConstantBuffer(ID3D11Buffer* buffer, const T& bufferData)
+void UpdateConstantBuffer(ID3D11Buffer* buffer, const T& bufferData, ID3D11DeviceContext* context = gD3DContext)
 {
     D3D11_MAPPED_SUBRESOURCE cb;
-    gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
+    context->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
     memcpy(cb.pData, &bufferData, sizeof(T));
-    gD3DContext->Unmap(buffer, 0);
+    context->Unmap(buffer, 0);
 }
 
 
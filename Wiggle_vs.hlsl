@@ -8,10 +8,10 @@ LightingPixelShaderInput main(BasicVertex modelVertex)
 {
     LightingPixelShaderInput output;
 
-    float4 modelPosition = float4(modelVertex.position, 1);
+    float4 modelPosition = float4(ModelPosition(modelVertex.position), 1);
     float4 worldPosition = mul(gWorldMatrix, modelPosition);
 
-    float4 modelNormal = float4(modelVertex.normal, 0);
+    float4 modelNormal = float4(ModelNormal(modelVertex.normal), 0);
     float4 worldNormal = mul(gWorldMatrix, modelNormal);
 
     // Distortion
@@ -28,6 +28,7 @@ LightingPixelShaderInput main(BasicVertex modelVertex)
 
     output.worldNormal = worldNormal.xyz;
     output.worldPosition = worldPosition.xyz;
+    CalculateLightProjections(worldPosition, output.lightProjections);
 
     output.uv = modelVertex.uv;
 